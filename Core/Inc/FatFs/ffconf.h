@@ -275,7 +275,11 @@
 /      lock control is independent of re-entrancy. */
 
 
+#ifdef USE_FREERTOS
+#define FF_FS_REENTRANT	1
+#else
 #define FF_FS_REENTRANT	0
+#endif
 #define FF_FS_TIMEOUT	1000
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
@@ -0,0 +1,72 @@
+/*
+ * FreeRTOS configuration, only used in builds with USE_FREERTOS defined.
+ *
+ * The kernel is not part of the tree. To build the RTOS variant, add the
+ * FreeRTOS kernel (V10.4 or later, task notification arrays are used) as
+ * Middlewares/Third_Party/FreeRTOS with Source, Source/include,
+ * Source/portable/GCC/ARM_CM4F and Source/portable/MemMang/heap_4.c, and
+ * define USE_FREERTOS. The scheduler tasks then run as kernel threads,
+ * FatFs becomes reentrant and the console and SD drivers take locks.
+ *
+ * SysTick stays the HAL time base, SysTick_Handler calls into the kernel.
+ */
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <stdint.h>
+
+extern uint32_t SystemCoreClock;
+
+#define configUSE_PREEMPTION					1
+#define configUSE_TIME_SLICING					1
+#define configSUPPORT_STATIC_ALLOCATION			1
+#define configSUPPORT_DYNAMIC_ALLOCATION		1
+#define configUSE_IDLE_HOOK						1
+#define configUSE_TICK_HOOK						0
+#define configCPU_CLOCK_HZ						(SystemCoreClock)
+#define configTICK_RATE_HZ						((TickType_t)1000)
+#define configMAX_PRIORITIES					4
+#define configMINIMAL_STACK_SIZE				((uint16_t)128)
+#define configTOTAL_HEAP_SIZE					((size_t)20 * 1024)
+#define configMAX_TASK_NAME_LEN					12
+#define configUSE_16_BIT_TICKS					0
+#define configUSE_MUTEXES						1
+#define configQUEUE_REGISTRY_SIZE				0
+#define configUSE_NEWLIB_REENTRANT				1
+#define configUSE_TASK_NOTIFICATIONS			1
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES	2	// see OS_NOTIFY_* in os.h
+#define configCHECK_FOR_STACK_OVERFLOW			2
+#define configUSE_MALLOC_FAILED_HOOK			1
+#define configUSE_TIMERS						0
+#define configUSE_CO_ROUTINES					0
+
+#define INCLUDE_vTaskDelay						1
+#define INCLUDE_vTaskDelete						0
+#define INCLUDE_vTaskSuspend					1
+#define INCLUDE_xTaskGetSchedulerState			1
+#define INCLUDE_xTaskGetCurrentTaskHandle		1
+#define INCLUDE_uxTaskGetStackHighWaterMark		1
+
+/* Cortex-M interrupt priorities, the STM32F4 implements 4 bits */
+#ifdef __NVIC_PRIO_BITS
+#define configPRIO_BITS							__NVIC_PRIO_BITS
+#else
+#define configPRIO_BITS							4
+#endif
+
+#define configLIBRARY_LOWEST_INTERRUPT_PRIORITY			15
+// interrupts that post to tasks must not be more urgent than this
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY	5
+
+#define configKERNEL_INTERRUPT_PRIORITY \
+	(configLIBRARY_LOWEST_INTERRUPT_PRIORITY << (8 - configPRIO_BITS))
+#define configMAX_SYSCALL_INTERRUPT_PRIORITY \
+	(configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY << (8 - configPRIO_BITS))
+
+#define configASSERT(x) if((x) == 0) { taskDISABLE_INTERRUPTS(); for(;;); }
+
+/* The port provides the SVC and PendSV handlers, stm32f4xx_it.c leaves them out */
+#define vPortSVCHandler		SVC_Handler
+#define xPortPendSVHandler	PendSV_Handler
+
+#endif /* FREERTOS_CONFIG_H */
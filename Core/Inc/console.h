@@ -0,0 +1,51 @@
+#ifndef INC_CONSOLE_H_
+#define INC_CONSOLE_H_
+
+#include "stm32f4xx_hal.h"
+#include <stdint.h>
+
+/* Must be powers of two */
+#define CONSOLE_TX_BUFFER_SIZE 2048
+#define CONSOLE_RX_BUFFER_SIZE 512
+
+/* Longest line console_read_line assembles, including the terminator */
+#define CONSOLE_LINE_MAX 128
+
+/* Baud rate after reset, and how long the host gets to confirm a new one */
+#define CONSOLE_DEFAULT_BAUD 115200
+#define CONSOLE_BAUD_CONFIRM_MS 2000
+#define CONSOLE_BAUD_CONFIRM "baud ok"
+
+typedef enum {
+	CONSOLE_OVERFLOW_DROP = 0,	// new data is discarded
+	CONSOLE_OVERFLOW_BLOCK,		// caller waits for the DMA, drops if interrupts are masked
+	CONSOLE_OVERFLOW_OVERWRITE,	// queued data that is not in flight is discarded
+} console_overflow_policy;
+
+typedef struct {
+	uint32_t written;
+	uint32_t dropped;
+	uint32_t overwritten;
+	uint32_t transfers;
+	uint32_t tx_peak;
+	uint32_t received;
+	uint32_t rx_lost;		// bytes overwritten by the DMA before they were read
+	uint32_t rx_errors;		// framing, noise and overrun errors reported by the UART
+	uint32_t line_truncated;
+} console_stats;
+
+void console_init(UART_HandleTypeDef *huart);
+int console_write(const char *data, int len);
+void console_flush(void);
+uint32_t console_tx_free(void);
+int console_getchar(void);
+uint32_t console_rx_available(void);
+int console_read_line(char *line, int len);
+void console_set_echo(uint8_t enable);
+void console_poll(void);
+int console_change_baud(uint32_t baud);
+uint32_t console_get_baud(void);
+void console_set_overflow_policy(console_overflow_policy policy);
+const console_stats *console_get_stats(void);
+
+#endif /* INC_CONSOLE_H_ */
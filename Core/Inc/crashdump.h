@@ -0,0 +1,50 @@
+#ifndef INC_CRASHDUMP_H_
+#define INC_CRASHDUMP_H_
+
+#include <stdint.h>
+
+/*
+ * Crash dumps kept across a reset.
+ *
+ * HardFault_Handler and the other fault vectors are aliases of
+ * crashdump_fault_entry(), which is assembly only and moves to a stack of
+ * its own, since a MemManage fault from the stack guard of memstat.h leaves
+ * SP inside the guard. It saves the registers the core stacked, the fault
+ * status registers and the words at the faulting SP into the .noinit
+ * section, which the startup code does not clear, and resets.
+ * Error_Handler() does the same through crashdump_error().
+ *
+ * After the reset crashdump_init() checks the dump and crashdump_report()
+ * prints it once on the console, the shell's crash command prints it again.
+ */
+
+#define CRASHDUMP_STACK_WORDS 32
+#define CRASHDUMP_ERROR 0				// reason of Error_Handler, otherwise the exception number
+
+typedef struct {
+	uint32_t magic;
+	uint32_t reason;
+	uint32_t count;						// crashes since power on
+	uint32_t reported;
+	uint32_t uptime_ms;
+	uint32_t exc_return;
+	uint32_t stacked;					// r0 to xpsr were read from the exception frame
+	uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr;
+	uint32_t sp;						// before the exception
+	uint32_t cfsr, hfsr, mmfar, bfar;
+	uint32_t stack_words;
+	uint32_t stack[CRASHDUMP_STACK_WORDS];
+	uint32_t check;
+} crashdump;
+
+void crashdump_init(void);
+void crashdump_report(void);
+const crashdump *crashdump_get(void);
+void crashdump_print(const crashdump *dump);
+void crashdump_clear(void);
+
+// The fault vectors, see above
+void crashdump_fault_entry(void);
+void crashdump_error(uint32_t caller) __attribute__((noreturn));
+
+#endif /* INC_CRASHDUMP_H_ */
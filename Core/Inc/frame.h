@@ -0,0 +1,21 @@
+#ifndef INC_FRAME_H_
+#define INC_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * COBS framing and CRC shared by the firmware and the host tools. An
+ * encoded block never contains 0x00, which is used as the frame delimiter.
+ */
+
+/* Worst case size of len bytes after COBS encoding */
+#define FRAME_COBS_MAX(len) ((len) + (len) / 254 + 1)
+
+#define FRAME_CRC16_INIT 0xffff
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, size_t len);
+size_t frame_cobs_encode(const uint8_t *src, size_t len, uint8_t *dest);
+int frame_cobs_decode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_len);
+
+#endif /* INC_FRAME_H_ */
@@ -0,0 +1,74 @@
+#ifndef INC_LOG_H_
+#define INC_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Deferred logging. LOG() only stores the address of its format string and
+ * the raw argument words in a ring, the text is produced later by
+ * log_print() at idle time or by the host decoder from the ELF file.
+ *
+ * Arguments are stored as machine words: integers, characters and pointers
+ * work, %s must point at a string that outlives the record (in practice a
+ * constant in flash). Floating point and 64-bit values are not supported.
+ * Safe to call from interrupts.
+ */
+
+/* Ring size in words, must be a power of two */
+#define LOG_RING_WORDS 512
+#define LOG_MAX_ARGS 7
+
+typedef struct {
+	const char *fmt;
+	uint32_t tick;
+	uint8_t nargs;
+	uintptr_t args[LOG_MAX_ARGS];
+} log_record;
+
+typedef struct {
+	uint32_t written;
+	uint32_t dropped;
+	uint32_t peak;	// highest ring fill in words
+} log_stats;
+
+/*
+ * Format strings are 8 byte aligned so the argument count fits in the low
+ * bits of their address, and collected in .rodata.logstr for the decoder.
+ */
+#define LOG_STR_ATTR __attribute__((section(".rodata.logstr"), aligned(8)))
+
+#define LOG_WORD(x) ((uintptr_t)(x))
+
+#define LOG_NARGS(...) LOG_NARGS_(0, ##__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, n, ...) n
+
+#define LOG_MAP(...) LOG_MAP_(LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define LOG_MAP_(n, ...) LOG_MAP__(n, ##__VA_ARGS__)
+#define LOG_MAP__(n, ...) LOG_MAP_##n(__VA_ARGS__)
+#define LOG_MAP_0()
+#define LOG_MAP_1(a) LOG_WORD(a)
+#define LOG_MAP_2(a, ...) LOG_WORD(a), LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...) LOG_WORD(a), LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...) LOG_WORD(a), LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...) LOG_WORD(a), LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...) LOG_WORD(a), LOG_MAP_5(__VA_ARGS__)
+#define LOG_MAP_7(a, ...) LOG_WORD(a), LOG_MAP_6(__VA_ARGS__)
+
+#define LOG(fmt, ...) do { \
+		static const char log_fmt_[] LOG_STR_ATTR = fmt; \
+		const uintptr_t log_args_[LOG_NARGS(__VA_ARGS__) + 1] = { LOG_MAP(__VA_ARGS__) }; \
+		if(0) \
+			printf(fmt, ##__VA_ARGS__); \
+		log_write(log_fmt_, log_args_, LOG_NARGS(__VA_ARGS__)); \
+	} while(0)
+
+void log_init(void);
+void log_write(const char *fmt, const uintptr_t *args, uint32_t nargs);
+uint8_t log_peek(log_record *rec);
+void log_discard(void);
+void log_print(const log_record *rec);
+uint32_t log_process(uint32_t max_records);
+const log_stats *log_get_stats(void);
+
+#endif /* INC_LOG_H_ */
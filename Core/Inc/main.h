@@ -36,12 +36,20 @@ extern "C" {
 
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
-
+// Scheduler task ids
+typedef enum {
+	TASK_USB = 0,
+	TASK_CONSOLE,
+	TASK_SENSORS,
+	TASK_BUTTON,
+} app_task;
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
-
+// Task events, the scheduler adds SCHED_EVENT_TIMER for periodic runs
+#define TASK_EVENT_IRQ 0x01		// posted by an interrupt handler
+#define TASK_EVENT_AGAIN 0x02	// more work is waiting, run again
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
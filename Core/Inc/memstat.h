@@ -0,0 +1,36 @@
+#ifndef INC_MEMSTAT_H_
+#define INC_MEMSTAT_H_
+
+#include <stdint.h>
+
+/*
+ * Stack and heap use of the main stack and the newlib heap.
+ *
+ * The main stack is the top _Min_Stack_Size bytes of RAM. memstat_init()
+ * fills its unused part with a pattern, the high-water mark is where the
+ * pattern ends. Below it an MPU region of _Stack_Guard_Size bytes allows no
+ * access, so an overflow raises a MemManage fault instead of running into
+ * the heap and .bss. The heap grows from the end of .bss up to the guard,
+ * _sbrk in sysmem.c keeps its peak.
+ *
+ * With USE_FREERTOS the main stack is what interrupts run on once the
+ * kernel started, tasks have their own stacks and overflow checks.
+ */
+
+typedef struct {
+	uint32_t stack_size;
+	uint32_t stack_peak;		// bytes ever used, from the paint
+	uint32_t heap_size;			// room between .bss and the guard
+	uint32_t heap_used;
+	uint32_t heap_peak;
+	uint32_t heap_failures;		// _sbrk calls refused
+	uint8_t guarded;			// the MPU guard is armed
+} memstat_info;
+
+void memstat_init(void);
+void memstat_get(memstat_info *info);
+
+// Implemented by _sbrk in sysmem.c
+void sysmem_heap_stats(uint32_t *used, uint32_t *peak, uint32_t *failures);
+
+#endif /* INC_MEMSTAT_H_ */
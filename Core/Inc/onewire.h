@@ -5,9 +5,32 @@
 #include <stdint.h>
 #include <assert.h>
 
-#define ONEWIRE_LOW() (ONEWIRE_OUT_GPIO_Port->BSRR = ONEWIRE_OUT_Pin << 16)
-#define ONEWIRE_RELEASE() (ONEWIRE_OUT_GPIO_Port->BSRR = ONEWIRE_OUT_Pin)
-#define ONEWIRE_READ() ((ONEWIRE_IN_GPIO_Port->IDR & ONEWIRE_IN_Pin) != 0)
+#ifndef ONEWIRE_LOW
+#define ONEWIRE_LOW(bus) ((bus)->out_port->BSRR = (uint32_t)(bus)->out_pin << 16)
+#define ONEWIRE_RELEASE(bus) ((bus)->out_port->BSRR = (bus)->out_pin)
+#define ONEWIRE_READ(bus) (((bus)->in_port->IDR & (bus)->in_pin) != 0)
+#endif
+
+/* Parallel mode touches a whole port with a single access per slot edge */
+#ifndef ONEWIRE_PORT_WRITE
+#define ONEWIRE_PORT_WRITE(port, bsrr) ((port)->BSRR = (bsrr))
+#define ONEWIRE_PORT_READ(port) ((uint16_t)(port)->IDR)
+#endif
+
+#ifndef ONEWIRE_TIMER_COUNT
+#define ONEWIRE_TIMER_COUNT(htim) ((uint16_t)(htim)->Instance->CNT)
+#endif
+
+/* Timer passed to onewire_init must count at this rate (TIM6 prescaler) */
+#define ONEWIRE_TICKS_PER_US 4
+/* Number of devices per bus that can be tracked at overdrive speed */
+#define ONEWIRE_MAX_DEVICES 8
+/* Longest formatted temperature, "-2048.0625" and the terminator */
+#define ONEWIRE_TEMPERATURE_MAX_LEN 11
+/* One GPIO port has 16 pins */
+#define ONEWIRE_PARALLEL_MAX_BUSES 16
+
+#define ONEWIRE_FAMILY_DS18B20 0x28
 
 typedef enum {
 	ONEWIRE_RESOLUTION_9BIT = 0x1f,
@@ -16,12 +39,68 @@ typedef enum {
 	ONEWIRE_RESOLUTION_12BIT = 0x7f,
 } onewire_resolution;
 
+typedef enum {
+	ONEWIRE_SPEED_STANDARD = 0,
+	ONEWIRE_SPEED_OVERDRIVE = 1,
+} onewire_speed;
+
+typedef struct {
+	uint64_t rom;
+	onewire_speed speed;
+} onewire_device_speed;
+
+typedef struct {
+	GPIO_TypeDef *out_port;
+	GPIO_TypeDef *in_port;
+	uint16_t out_pin;
+	uint16_t in_pin;
+	onewire_speed speed;
+	uint8_t all_overdrive;		// OVERDRIVE SKIP ROM succeeded, until the next standard speed reset
+	onewire_device_speed devices[ONEWIRE_MAX_DEVICES];
+} onewire_bus;
+
+/*
+ * Up to 16 standard speed buses sharing one output port and one input port.
+ * Bus n drives out_pins[n] and samples in_pins[n], which may be the same pin
+ * when it is configured as open drain.
+ */
+typedef struct {
+	GPIO_TypeDef *out_port;
+	GPIO_TypeDef *in_port;
+	uint8_t count;
+	uint16_t out_pins[ONEWIRE_PARALLEL_MAX_BUSES];
+	uint16_t in_pins[ONEWIRE_PARALLEL_MAX_BUSES];
+	uint16_t out_mask;
+} onewire_parallel;
+
 void onewire_init(TIM_HandleTypeDef *htim_);
-uint64_t onewire_get_single_address(void);
-void onewire_request_conversion(uint64_t rom);
-uint8_t onewire_get_request_status();
-int16_t onewire_read_temperature(uint64_t rom);
-void onewire_format_temperature(int16_t temp, char *dest, size_t len);
-uint8_t onewire_set_resolution(uint64_t rom, onewire_resolution resolution);
+void onewire_bus_init(onewire_bus *bus, GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin);
+uint64_t onewire_get_single_address(onewire_bus *bus);
+uint8_t onewire_search(onewire_bus *bus, uint64_t *roms, uint8_t max_count);
+void onewire_request_conversion(onewire_bus *bus, uint64_t rom);
+uint8_t onewire_get_request_status(onewire_bus *bus);
+int16_t onewire_read_temperature(onewire_bus *bus, uint64_t rom);
+uint8_t onewire_read_temperature_checked(onewire_bus *bus, uint64_t rom, int16_t *temp);
+size_t onewire_format_temperature(int16_t temp, char *dest, size_t len);
+size_t onewire_format_temperatures(const int16_t *temps, size_t count, char sep,
+		char *dest, size_t len);
+uint8_t onewire_get_resolution(onewire_bus *bus, uint64_t rom, onewire_resolution *resolution);
+uint8_t onewire_set_resolution(onewire_bus *bus, uint64_t rom, onewire_resolution resolution);
+uint16_t onewire_conversion_time_ms(onewire_resolution resolution);
+onewire_speed onewire_get_speed(onewire_bus *bus, uint64_t rom);
+onewire_speed onewire_set_speed(onewire_bus *bus, uint64_t rom, onewire_speed speed);
+uint8_t onewire_overdrive_skip_rom(onewire_bus *bus);
+
+uint8_t onewire_parallel_init(onewire_parallel *group, GPIO_TypeDef *out_port,
+		const uint16_t *out_pins, GPIO_TypeDef *in_port, const uint16_t *in_pins,
+		uint8_t count);
+uint16_t onewire_parallel_reset(onewire_parallel *group);
+void onewire_parallel_write_byte(onewire_parallel *group, uint8_t byte);
+void onewire_parallel_write_bytes(onewire_parallel *group, const uint8_t *bytes);
+void onewire_parallel_read_bytes(onewire_parallel *group, uint8_t *bytes);
+uint16_t onewire_parallel_request_conversion(onewire_parallel *group, const uint64_t *roms);
+uint16_t onewire_parallel_read_temperature(onewire_parallel *group, const uint64_t *roms,
+		int16_t *temps);
 
 #endif /* INC_ONEWIRE_H_ */
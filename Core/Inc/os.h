@@ -0,0 +1,47 @@
+#ifndef INC_OS_H_
+#define INC_OS_H_
+
+#include <stdint.h>
+
+/*
+ * Locking and interrupt to task signalling for the drivers. Without
+ * USE_FREERTOS, or before the kernel runs, locks do nothing and waits return
+ * at once, so callers keep polling their condition as before.
+ */
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#endif
+
+// Task notification slots, the scheduler's events and driver completions
+#define OS_NOTIFY_SCHED 0
+#define OS_NOTIFY_DRIVER 1
+
+typedef struct {
+#ifdef USE_FREERTOS
+	SemaphoreHandle_t handle;	// created on first use
+	StaticSemaphore_t buffer;
+#else
+	uint8_t unused;
+#endif
+} os_mutex;
+
+// A single task waiting for an interrupt
+typedef struct {
+#ifdef USE_FREERTOS
+	TaskHandle_t volatile waiter;
+#else
+	uint8_t unused;
+#endif
+} os_event;
+
+uint8_t os_running(void);
+uint8_t os_in_isr(void);
+void os_mutex_lock(os_mutex *mutex);
+void os_mutex_unlock(os_mutex *mutex);
+void os_event_wait(os_event *event, uint32_t timeout_ms);
+void os_event_signal(os_event *event);
+
+#endif /* INC_OS_H_ */
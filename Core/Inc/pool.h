@@ -0,0 +1,64 @@
+#ifndef INC_POOL_H_
+#define INC_POOL_H_
+
+#include <stdint.h>
+
+/*
+ * Fixed block pools in static storage, instead of the newlib heap.
+ *
+ *	FIL *fil = pool_alloc(&pool_fil);
+ *	...
+ *	pool_free(&pool_fil, fil);
+ *
+ * Allocating and freeing take constant time and are safe from interrupts: a
+ * block comes off the free list or, until every block has been in use once,
+ * from the part of the storage never handed out, so a pool needs no setup.
+ * Nothing fragments and the worst case is fixed at link time. Pools are
+ * registered for pool_first() the first time they hand out a block.
+ */
+
+#define POOL_ALIGN 8
+#define POOL_BLOCK_SIZE(size) (((size) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN)
+
+/* Pools of the application, defined in pool.c */
+#define POOL_FIL_COUNT 2
+#define POOL_DIR_COUNT 2
+#define POOL_SECTOR_COUNT 2
+#define POOL_FRAME_COUNT 2
+#define POOL_SECTOR_SIZE 512
+
+typedef struct pool_block {
+	struct pool_block *next;
+} pool_block;
+
+typedef struct pool {
+	const char *name;
+	uint8_t *storage;
+	uint16_t block_size;
+	uint16_t count;
+	uint16_t fresh;			// blocks from here on were never handed out
+	pool_block *free;
+	struct pool *next;
+	uint8_t registered;
+	uint16_t used;
+	uint16_t peak;
+	uint32_t allocs;
+	uint32_t failures;		// pool was empty
+} pool;
+
+// Storage and descriptor of a pool of n blocks of size bytes
+#define POOL_DEFINE(id, size, n) \
+	static uint8_t id##_storage[(n) * POOL_BLOCK_SIZE(size)] __attribute__((aligned(POOL_ALIGN))); \
+	pool id = { .name = #id, .storage = id##_storage, .block_size = POOL_BLOCK_SIZE(size), .count = (n) }
+
+extern pool pool_fil;
+extern pool pool_dir;
+extern pool pool_sector;
+extern pool pool_frame;
+
+void *pool_alloc(pool *p);
+void pool_free(pool *p, void *block);
+const pool *pool_first(void);
+void pool_reset(void);
+
+#endif /* INC_POOL_H_ */
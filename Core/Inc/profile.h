@@ -0,0 +1,71 @@
+#ifndef INC_PROFILE_H_
+#define INC_PROFILE_H_
+
+#include <stdint.h>
+
+/*
+ * Cycle counting profiler on the DWT cycle counter.
+ *
+ *	PROFILE_BEGIN(sd_read);
+ *	...
+ *	PROFILE_END(sd_read);
+ *
+ * Each name gets a static scope, registered the first time it completes, so
+ * the registry only holds scopes that actually ran. BEGIN and END must be in
+ * the same block and names should be unique in the program. Scopes may nest
+ * and are safe to use from interrupts. A scope can measure up to 2^32 cycles,
+ * about 25 s at 168 MHz.
+ *
+ * Build with -DPROFILE_ENABLE=0 to compile all scopes out.
+ */
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1
+#endif
+
+/*
+ * log2 histogram: bucket 0 counts durations below 2^PROFILE_HIST_SHIFT
+ * cycles, bucket n those in [2^(n + SHIFT - 1), 2^(n + SHIFT)), the last one
+ * everything longer.
+ */
+#define PROFILE_HIST_BUCKETS 16
+#define PROFILE_HIST_SHIFT 7
+
+typedef struct profile_scope {
+	const char *name;
+	struct profile_scope *next;
+	uint8_t registered;
+	uint32_t count;
+	uint32_t min;	// cycles
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[PROFILE_HIST_BUCKETS];
+} profile_scope;
+
+#if PROFILE_ENABLE
+
+#include "stm32f4xx.h"
+
+#define PROFILE_BEGIN(id) \
+	static profile_scope profile_scope_##id = { .name = #id, .min = UINT32_MAX }; \
+	const uint32_t profile_start_##id = DWT->CYCCNT
+
+#define PROFILE_END(id) \
+	profile_record(&profile_scope_##id, DWT->CYCCNT - profile_start_##id)
+
+#else
+
+#define PROFILE_BEGIN(id) do { } while(0)
+#define PROFILE_END(id) do { } while(0)
+
+#endif
+
+void profile_init(void);
+void profile_record(profile_scope *scope, uint32_t cycles);
+void profile_reset(void);
+const profile_scope *profile_first(void);
+const profile_scope *profile_find(const char *name);
+uint32_t profile_overhead(void);
+uint32_t profile_cycles_to_us(uint32_t cycles);
+
+#endif /* INC_PROFILE_H_ */
@@ -0,0 +1,27 @@
+#ifndef INC_RAMFUNC_H_
+#define INC_RAMFUNC_H_
+
+/*
+ * RAMFUNC puts a function in .RamFunc, the section the linker scripts
+ * already keep in .data, so the startup code copies it from flash to SRAM
+ * with the initialized variables. Code there runs without flash wait states
+ * and ART misses, so tight loops keep a steady pace, but it shares the S-bus
+ * with data accesses, and a function can just as well get slower.
+ *
+ * Nothing is marked yet. Mark a function only after the prof command shows
+ * it faster from SRAM on the board, the sd_crc16 and ow_read scopes are the
+ * candidates. SRAM is out of reach of a BL from flash, calls go through a
+ * register. Build with -DRAMFUNC_ENABLE=0 to leave everything in flash.
+ */
+
+#ifndef RAMFUNC_ENABLE
+#define RAMFUNC_ENABLE 1
+#endif
+
+#if RAMFUNC_ENABLE && defined(__arm__)
+#define RAMFUNC __attribute__((section(".RamFunc"), long_call, noinline))
+#else
+#define RAMFUNC
+#endif
+
+#endif /* INC_RAMFUNC_H_ */
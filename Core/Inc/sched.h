@@ -0,0 +1,68 @@
+#ifndef INC_SCHED_H_
+#define INC_SCHED_H_
+
+#include <stdint.h>
+
+/*
+ * Cooperative run-to-completion scheduler.
+ *
+ * A task is a handler that runs when its period elapsed or when events were
+ * posted to it, and returns without blocking. Ready tasks run round robin,
+ * so the worst case latency of any task is bounded by the longest handler
+ * runtime of the others. With nothing ready the idle hooks run and the core
+ * sleeps in WFI until the next interrupt, SysTick wakes it every tick.
+ *
+ * Events are bits ORed into the task's pending mask, sched_post is safe to
+ * call from interrupts. Events posted while a task is pending are merged,
+ * so a handler must drain whatever the event stands for, not count events.
+ *
+ * With USE_FREERTOS every task becomes a kernel thread of equal priority
+ * that sleeps on a task notification, the idle hooks get a thread of their
+ * own at idle priority. Handlers are then preemptible and may block, shared
+ * drivers lock themselves (see os.h). Runtimes are wall clock and include
+ * time spent preempted.
+ */
+
+#define SCHED_MAX_TASKS 8
+#define SCHED_MAX_IDLE_HOOKS 4
+#define SCHED_STACK_WORDS 768	// per kernel thread
+
+// passed to the handler when the period elapsed, the other bits are free
+#define SCHED_EVENT_TIMER 0x80000000u
+
+typedef void (*sched_handler)(uint32_t events);
+typedef void (*sched_idle_hook)(void);
+
+typedef struct {
+	const char *name;
+	sched_handler handler;
+	uint32_t period_ms;		// 0 for tasks that only run on events
+	uint32_t next_run;
+	volatile uint32_t events;
+	uint32_t posted_at;		// cycle counter when the first pending event arrived
+	void *os_task;			// kernel thread with USE_FREERTOS
+
+	// runtime accounting
+	uint32_t runs;
+	uint64_t cycles;
+	uint32_t max_cycles;
+	uint32_t max_wait;		// cycles from the first posted event to the run
+	uint32_t max_late_ms;	// timer runs started this long after their due time
+} sched_task;
+
+typedef struct {
+	uint64_t elapsed;		// cycles since sched_reset_stats
+	uint64_t idle;			// of which in idle hooks and WFI, or in no task with the kernel
+	uint32_t sleeps;
+} sched_stats;
+
+void sched_init(void);
+void sched_add(uint8_t id, const char *name, sched_handler handler, uint32_t period_ms);
+void sched_add_idle(sched_idle_hook hook);
+void sched_post(uint8_t id, uint32_t events);
+void sched_run(void) __attribute__((noreturn));
+const sched_task *sched_get_task(uint8_t id);
+const sched_stats *sched_get_stats(void);
+void sched_reset_stats(void);
+
+#endif /* INC_SCHED_H_ */
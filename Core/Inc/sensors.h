@@ -0,0 +1,43 @@
+#ifndef INC_SENSORS_H_
+#define INC_SENSORS_H_
+
+#include <stdint.h>
+#include "onewire.h"
+
+#define SENSORS_MAX_DEVICES 16
+
+typedef enum {
+	SENSORS_IDLE = 0,
+	SENSORS_CONVERTING,
+} sensors_state;
+
+typedef struct {
+	onewire_bus *bus;
+	uint64_t rom;
+	onewire_resolution resolution;
+	onewire_resolution requested_resolution;
+	uint32_t period_ms;
+	sensors_state state;
+	uint8_t pollable; // no other traffic on the bus since Convert T
+	uint8_t fresh;
+	uint32_t next_conversion;
+	uint32_t conversion_start;
+	uint32_t conversion_deadline;
+	int16_t temperature;
+	uint32_t timestamp;
+	uint32_t conversion_ms; // measured time of the last conversion
+	uint32_t samples;
+	uint32_t errors;
+} sensors_device;
+
+void sensors_init(void);
+int sensors_add(onewire_bus *bus, uint64_t rom, uint32_t period_ms);
+uint8_t sensors_scan(onewire_bus *bus, uint32_t period_ms);
+uint8_t sensors_count(void);
+sensors_device *sensors_get(uint8_t index);
+uint8_t sensors_set_resolution(uint8_t index, onewire_resolution resolution);
+uint8_t sensors_set_period(uint8_t index, uint32_t period_ms);
+uint8_t sensors_read(uint8_t index, int16_t *temperature, uint32_t *timestamp);
+uint8_t sensors_poll(void);
+
+#endif /* INC_SENSORS_H_ */
@@ -0,0 +1,29 @@
+#ifndef INC_SHELL_H_
+#define INC_SHELL_H_
+
+#include <stdint.h>
+#include "onewire.h"
+
+#define SHELL_MAX_ARGS 6
+
+/* Jobs only print while the console TX ring has this much room */
+#define SHELL_TX_RESERVE 256
+
+/*
+ * A command either finishes in its handler or installs a job that the
+ * main loop advances one small step per shell_poll() call.
+ */
+typedef uint8_t (*shell_job)(void);
+
+typedef struct {
+	const char *name;
+	const char *usage;
+	void (*handler)(int argc, char **argv);
+} shell_command;
+
+void shell_init(onewire_bus *bus, uint32_t sensor_period_ms);
+void shell_poll(void);
+uint8_t shell_execute(const char *line);
+uint8_t shell_busy(void);
+
+#endif /* INC_SHELL_H_ */
@@ -0,0 +1,44 @@
+#ifndef INC_STREAM_PROTO_H_
+#define INC_STREAM_PROTO_H_
+
+#include <stdint.h>
+#include "telemetry_proto.h"
+
+/*
+ * Wire format of the vendor bulk stream, shared with the host reader.
+ *
+ * The bulk IN endpoint carries back to back records, each a header and
+ * length bytes of payload. USB already checks every packet, so there is no
+ * CRC or escaping; the magic only lets a reader resynchronize inside a
+ * capture file. All fields are little endian.
+ */
+
+#define STREAM_MAGIC 0x5357	// "WS"
+#define STREAM_VERSION 1
+#define STREAM_MAX_PAYLOAD 1024
+
+typedef enum {
+	STREAM_RECORD_SAMPLES = 0x01,	// payload is an array of telemetry_sample
+} stream_record_type;
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t type;
+	uint8_t version;
+	uint16_t length;	// payload bytes following the header
+	uint16_t seq;		// incremented per record, gaps mean records dropped on the device
+} stream_header;
+
+/* Vendor requests to the streaming interface */
+#define STREAM_REQ_START 0x01	// OUT, no data: records are queued from now on
+#define STREAM_REQ_STOP 0x02	// OUT, no data
+#define STREAM_REQ_STATS 0x03	// IN, stream_stats_msg
+
+typedef struct __attribute__((packed)) {
+	uint32_t records;
+	uint32_t dropped;
+	uint32_t bytes;
+	uint32_t peak;		// highest ring fill in bytes
+} stream_stats_msg;
+
+#endif /* INC_STREAM_PROTO_H_ */
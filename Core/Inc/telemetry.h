@@ -0,0 +1,36 @@
+#ifndef INC_TELEMETRY_H_
+#define INC_TELEMETRY_H_
+
+#include <stdint.h>
+#include "telemetry_proto.h"
+#include "frame.h"
+#include "sensors.h"
+#include "ff.h"
+#include "log.h"
+#include "profile.h"
+
+/* A frame before and after COBS encoding with its delimiters, one pool_frame block */
+#define TELEMETRY_RAW_MAX (sizeof(telemetry_header) + TELEMETRY_MAX_PAYLOAD + 2)
+#define TELEMETRY_FRAME_MAX (FRAME_COBS_MAX(TELEMETRY_RAW_MAX) + 2)
+#define TELEMETRY_BUFFER_SIZE (TELEMETRY_RAW_MAX + TELEMETRY_FRAME_MAX)
+
+typedef struct {
+	uint32_t sent;
+	uint32_t dropped;	// frames that did not fit in the console TX ring or had no buffer
+	uint32_t bytes;
+} telemetry_stats;
+
+void telemetry_init(void);
+void telemetry_enable(uint8_t enable);
+uint8_t telemetry_enabled(void);
+int telemetry_send(telemetry_msg_type type, const void *payload, uint16_t len);
+int telemetry_send_hello(void);
+int telemetry_send_sensor(uint8_t index, const sensors_device *dev);
+int telemetry_send_samples(const telemetry_sample *samples, uint8_t count);
+int telemetry_send_dir_entry(const FILINFO *finfo);
+int telemetry_send_stats(void);
+int telemetry_send_log(const log_record *rec);
+int telemetry_send_profile(const profile_scope *scope);
+const telemetry_stats *telemetry_get_stats(void);
+
+#endif /* INC_TELEMETRY_H_ */
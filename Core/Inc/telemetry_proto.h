@@ -0,0 +1,103 @@
+#ifndef INC_TELEMETRY_PROTO_H_
+#define INC_TELEMETRY_PROTO_H_
+
+#include <stdint.h>
+
+/*
+ * Wire format of the binary telemetry, shared with the host decoder.
+ *
+ * Every frame is 0x00, COBS(header, payload, CRC-16 of header and payload,
+ * little endian), 0x00. Text console output never contains 0x00, so frames
+ * and text can be mixed on the same UART. All fields are little endian.
+ */
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_PAYLOAD 128
+#define TELEMETRY_MAX_SAMPLES 16
+#define TELEMETRY_PROFILE_BUCKETS 16
+#define TELEMETRY_PROFILE_SHIFT 7
+
+typedef enum {
+	TELEMETRY_MSG_HELLO = 0x01,
+	TELEMETRY_MSG_SENSOR = 0x02,
+	TELEMETRY_MSG_TEMPERATURE = 0x03,
+	TELEMETRY_MSG_DIR_ENTRY = 0x04,
+	TELEMETRY_MSG_STATS = 0x05,
+	TELEMETRY_MSG_LOG = 0x06,
+	TELEMETRY_MSG_PROFILE = 0x07,
+} telemetry_msg_type;
+
+typedef struct __attribute__((packed)) {
+	uint8_t type;
+	uint8_t seq;	// incremented per frame, gaps mean lost frames
+} telemetry_header;
+
+typedef struct __attribute__((packed)) {
+	uint8_t version;
+	uint32_t tick;
+} telemetry_hello;
+
+// Describes a sensor index used by the temperature samples
+typedef struct __attribute__((packed)) {
+	uint8_t index;
+	uint64_t rom;
+	uint8_t resolution;
+	uint32_t period_ms;
+} telemetry_sensor;
+
+typedef struct __attribute__((packed)) {
+	uint8_t index;
+	int16_t temperature;	// 1/16 degree Celsius
+	uint32_t timestamp;		// HAL_GetTick at the end of the conversion
+} telemetry_sample;
+
+typedef struct __attribute__((packed)) {
+	uint8_t count;
+	telemetry_sample samples[TELEMETRY_MAX_SAMPLES];
+} telemetry_temperature;
+
+typedef struct __attribute__((packed)) {
+	uint32_t size;
+	uint16_t date;	// FAT date and time
+	uint16_t time;
+	uint8_t attrib;
+	char name[13];	// 8.3 name, zero terminated
+} telemetry_dir_entry;
+
+typedef struct __attribute__((packed)) {
+	uint32_t tick;
+	uint32_t console_written;
+	uint32_t console_dropped;
+	uint32_t console_rx_lost;
+	uint32_t console_rx_errors;
+	uint32_t frames_sent;
+	uint32_t frames_dropped;
+	uint32_t sensor_samples;
+	uint32_t sensor_errors;
+} telemetry_stats_msg;
+
+/*
+ * Deferred log record, the format string is looked up in the ELF file at
+ * address fmt. The number of arguments follows from the payload length.
+ */
+typedef struct __attribute__((packed)) {
+	uint32_t tick;
+	uint32_t fmt;
+	uint32_t args[7];
+} telemetry_log;
+
+// One profiler scope, durations in CPU cycles at clock_hz
+typedef struct __attribute__((packed)) {
+	char name[16];	// zero terminated, truncated if longer
+	uint32_t clock_hz;
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[TELEMETRY_PROFILE_BUCKETS];	// log2 buckets, the first ends at 2^SHIFT cycles
+} telemetry_profile;
+
+_Static_assert(sizeof(telemetry_temperature) <= TELEMETRY_MAX_PAYLOAD, "temperature frame too large");
+_Static_assert(sizeof(telemetry_profile) <= TELEMETRY_MAX_PAYLOAD, "profile frame too large");
+
+#endif /* INC_TELEMETRY_PROTO_H_ */
@@ -0,0 +1,30 @@
+#ifndef INC_USB_CDC_H_
+#define INC_USB_CDC_H_
+
+#include <stdint.h>
+#include "usb_device.h"
+
+/* Must be powers of two */
+#define USB_CDC_TX_BUFFER_SIZE 4096
+#define USB_CDC_RX_BUFFER_SIZE 1024
+
+/* Largest bulk IN transfer, a multiple of the packet size */
+#define USB_CDC_MAX_TRANSFER 1024
+
+typedef struct {
+	uint32_t written;
+	uint32_t transfers;
+	uint32_t received;
+	uint32_t rx_paused;	// times OUT was NAKed because the RX ring was full
+} usb_cdc_stats;
+
+extern const usb_class usb_cdc_class;
+
+uint8_t usb_cdc_connected(void);
+uint32_t usb_cdc_tx_free(void);
+int usb_cdc_write(const char *data, int len);
+void usb_cdc_wait_tx(uint32_t timeout_ms);
+int usb_cdc_getchar(void);
+const usb_cdc_stats *usb_cdc_get_stats(void);
+
+#endif /* INC_USB_CDC_H_ */
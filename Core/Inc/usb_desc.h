@@ -0,0 +1,85 @@
+#ifndef INC_USB_DESC_H_
+#define INC_USB_DESC_H_
+
+#include <stdint.h>
+#include "usb_device.h"
+
+/*
+ * Function set the device enumerates with. The composite device carries
+ * the CDC-ACM console, the SD card as mass storage and the vendor sample
+ * stream at once; the others exist for hosts that want a single function.
+ */
+#define USB_CONFIG_COMPOSITE 0
+#define USB_CONFIG_CDC 1
+#define USB_CONFIG_MSC 2
+
+#ifndef USB_CONFIG
+#define USB_CONFIG USB_CONFIG_COMPOSITE
+#endif
+
+#if USB_CONFIG == USB_CONFIG_COMPOSITE
+#define USB_WITH_CDC 1
+#define USB_WITH_MSC 1
+#define USB_WITH_STREAM 1
+#elif USB_CONFIG == USB_CONFIG_CDC
+#define USB_WITH_CDC 1
+#define USB_WITH_MSC 0
+#define USB_WITH_STREAM 1
+#elif USB_CONFIG == USB_CONFIG_MSC
+#define USB_WITH_CDC 0
+#define USB_WITH_MSC 1
+#define USB_WITH_STREAM 0
+#else
+#error "Unknown USB_CONFIG"
+#endif
+
+#define USB_VID 0x0483
+#define USB_PID_COMPOSITE 0x5741
+#define USB_PID_CDC 0x5740
+#define USB_PID_MSC 0x5720
+
+#define USB_STRING_MANUFACTURER 1
+#define USB_STRING_PRODUCT 2
+#define USB_STRING_SERIAL 3
+
+/*
+ * The OTG_FS FIFO RAM is 1.25 KB (320 words), shared by the RX FIFO and
+ * one TX FIFO per IN endpoint. Sizes are in 32-bit words, the TX FIFOs
+ * are listed in usb_desc.c.
+ */
+#if USB_CONFIG == USB_CONFIG_COMPOSITE
+#define USB_RX_FIFO_WORDS 80
+#else
+#define USB_RX_FIFO_WORDS 128
+#endif
+
+#define USB_TX_FIFO_COUNT 5
+
+/*
+ * Interface and endpoint numbers. Endpoints are fixed per function so every
+ * class driver builds whichever function set is selected, functions left
+ * out of the set keep numbers that are never enumerated.
+ */
+#define USB_CDC_COMM_INTERFACE 0
+#define USB_CDC_DATA_INTERFACE 1
+#define USB_CDC_DATA_IN_EP USB_EP_IN(1)
+#define USB_CDC_DATA_OUT_EP USB_EP_OUT(1)
+#define USB_CDC_NOTIFY_EP USB_EP_IN(2)
+#define USB_CDC_NOTIFY_SIZE 16
+
+#define USB_MSC_INTERFACE (USB_WITH_CDC ? 2 : 0)
+#define USB_MSC_IN_EP USB_EP_IN(3)
+#define USB_MSC_OUT_EP USB_EP_OUT(3)
+
+#define USB_STREAM_INTERFACE (USB_MSC_INTERFACE + USB_WITH_MSC)
+#define USB_STREAM_IN_EP USB_EP_IN(4)
+
+extern const uint8_t usb_device_descriptor[];
+extern const uint8_t usb_config_descriptor[];
+extern const char *const usb_strings[];
+extern const uint8_t usb_string_count;
+extern const usb_class *const usb_classes[];
+extern const uint8_t usb_class_count;
+extern const uint16_t usb_tx_fifo_words[USB_TX_FIFO_COUNT];
+
+#endif /* INC_USB_DESC_H_ */
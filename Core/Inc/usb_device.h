@@ -0,0 +1,78 @@
+#ifndef INC_USB_DEVICE_H_
+#define INC_USB_DEVICE_H_
+
+#include "stm32f4xx_hal.h"
+#include <stdint.h>
+
+/*
+ * Minimal USB device core on top of the HAL PCD driver. It answers the
+ * standard requests on EP0 and hands class requests and endpoint events to
+ * the class drivers listed in usb_desc.c.
+ */
+
+#define USB_EP0_SIZE 64
+#define USB_FS_BULK_SIZE 64
+
+#define USB_DESC_DEVICE 0x01
+#define USB_DESC_CONFIGURATION 0x02
+#define USB_DESC_STRING 0x03
+#define USB_DESC_INTERFACE 0x04
+#define USB_DESC_ENDPOINT 0x05
+#define USB_DESC_DEVICE_QUALIFIER 0x06
+#define USB_DESC_IAD 0x0b
+#define USB_DESC_CS_INTERFACE 0x24
+
+#define USB_REQ_TYPE_MASK 0x60
+#define USB_REQ_TYPE_STANDARD 0x00
+#define USB_REQ_TYPE_CLASS 0x20
+#define USB_REQ_TYPE_VENDOR 0x40
+#define USB_REQ_RECIPIENT_MASK 0x1f
+#define USB_REQ_RECIPIENT_DEVICE 0x00
+#define USB_REQ_RECIPIENT_INTERFACE 0x01
+#define USB_REQ_RECIPIENT_ENDPOINT 0x02
+#define USB_REQ_DIR_IN 0x80
+
+#define USB_EP_IN(n) (0x80 | (n))
+#define USB_EP_OUT(n) (n)
+
+// bit in usb_class.endpoints for an endpoint address
+#define USB_EP_BIT(ep) (((ep) & 0x80) ? (1u << ((ep) & 0x0f)) : (0x10000u << ((ep) & 0x0f)))
+
+typedef struct __attribute__((packed)) {
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} usb_setup;
+
+typedef enum {
+	USB_STATE_DEFAULT = 0,
+	USB_STATE_ADDRESSED,
+	USB_STATE_CONFIGURED,
+	USB_STATE_SUSPENDED,
+} usb_state;
+
+typedef struct {
+	uint8_t first_interface;
+	uint8_t num_interfaces;
+	uint32_t endpoints;	// USB_EP_BIT of every endpoint the class uses
+	void (*configure)(PCD_HandleTypeDef *hpcd);
+	void (*reset)(void);
+	/*
+	 * Class or vendor request for one of the interfaces. For IN requests
+	 * point *data at the reply, OUT data arrives through ep0_out.
+	 * Returning 0 stalls the request.
+	 */
+	uint8_t (*setup)(const usb_setup *req, const uint8_t **data, uint16_t *len);
+	void (*ep0_out)(const usb_setup *req, const uint8_t *data, uint16_t len);
+	void (*data_in)(uint8_t ep);
+	void (*data_out)(uint8_t ep, uint32_t len);
+	void (*clear_halt)(uint8_t ep);
+} usb_class;
+
+void usb_device_init(PCD_HandleTypeDef *hpcd);
+usb_state usb_device_state(void);
+PCD_HandleTypeDef *usb_device_pcd(void);
+
+#endif /* INC_USB_DEVICE_H_ */
@@ -0,0 +1,30 @@
+#ifndef INC_USB_MSC_H_
+#define INC_USB_MSC_H_
+
+#include <stdint.h>
+#include "usb_device.h"
+
+/*
+ * Sectors per transfer buffer. READ(10) and WRITE(10) alternate between two
+ * of them, so the card works on one while USB moves the other.
+ */
+#define USB_MSC_BUFFER_SECTORS 8
+
+typedef struct {
+	uint32_t commands;
+	uint32_t failed;		// commands answered with a sense code
+	uint32_t sectors_read;
+	uint32_t sectors_written;
+	uint32_t resets;		// Bulk-Only Mass Storage Resets from the host
+} usb_msc_stats;
+
+extern const usb_class usb_msc_class;
+
+void usb_msc_poll(void);
+uint8_t usb_msc_attached(void);
+uint8_t usb_msc_eject(void);
+void usb_msc_attach(void);
+uint32_t usb_msc_sector_count(void);
+const usb_msc_stats *usb_msc_get_stats(void);
+
+#endif /* INC_USB_MSC_H_ */
@@ -0,0 +1,27 @@
+#ifndef INC_USB_STREAM_H_
+#define INC_USB_STREAM_H_
+
+#include <stdint.h>
+#include "usb_device.h"
+
+/* Must be a power of two */
+#define USB_STREAM_BUFFER_SIZE 8192
+
+/* Largest bulk IN transfer, a multiple of the packet size */
+#define USB_STREAM_MAX_TRANSFER 4096
+
+typedef struct {
+	uint32_t records;
+	uint32_t dropped;	// records that did not fit in the ring
+	uint32_t bytes;
+	uint32_t transfers;
+	uint32_t peak;
+} usb_stream_stats;
+
+extern const usb_class usb_stream_class;
+
+uint8_t usb_stream_active(void);
+uint8_t usb_stream_write(uint8_t type, const void *payload, uint16_t len);
+const usb_stream_stats *usb_stream_get_stats(void);
+
+#endif /* INC_USB_STREAM_H_ */
@@ -14,6 +14,8 @@
 #include "diskio.h"		/* Declarations of disk functions */
 #include "stm32f4xx.h"
 #include "main.h"
+#include "os.h"
+#include "profile.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -25,6 +27,9 @@ extern SPI_HandleTypeDef hspi1;
 static volatile uint8_t sd_initialized = 0;
 static volatile uint8_t sd_ccs;
 
+// FatFs and the USB mass storage class both drive the card, one command sequence at a time
+static os_mutex sd_lock;
+
 #define SPI_HANDLE hspi1
 
 #if FF_MIN_SS != FF_MAX_SS
@@ -38,6 +43,10 @@ static volatile uint8_t sd_ccs;
 #define R3_LEN 5
 #define R7_LEN 5
 
+/* Response timeouts: R1 is due within 8 bytes, ACMD41 within 1 s, section 4.2.3 */
+#define SD_COMMAND_TIMEOUT_MS 10
+#define SD_INIT_TIMEOUT_MS 1000
+
 #define ASSERT_CS_LOW()		{ spi_send_single_byte(0xff); CS_LOW(); spi_send_single_byte(0xff); }
 #define ASSERT_CS_HIGH()	{ spi_send_single_byte(0xff); CS_HIGH(); spi_send_single_byte(0xff); }
 
@@ -58,22 +67,17 @@ static uint8_t crc7(uint64_t in) {
 	return (crc << 1) | 1;
 }
 
-// Based on Figure 4-21
-static uint16_t crc16(uint8_t *data) {
+// CRC-16/XMODEM of Figure 4-21, a nibble at a time
+static uint16_t crc16(const uint8_t *data, uint32_t len) {
+	static const uint16_t table[16] = {
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+	};
 	uint16_t crc = 0;
 
-	for(int i = 0; i < 512; i++) {
-		uint8_t in = data[i];
-		for(int j = 0; j < 8; j++) {
-			uint8_t bit = (crc & 0x8000) != 0;
-			crc <<= 1;
-
-			uint8_t xor_flag = bit ^ ((in & 0x80) != 0);
-			if(xor_flag) {
-				crc ^= 0b1000000100001;
-			}
-			in <<= 1;
-		}
+	for(uint32_t i = 0; i < len; i++) {
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0f)];
 	}
 
 	return crc;
@@ -96,10 +100,16 @@ static void spi_send_sd_command(uint8_t command, uint32_t arg, uint8_t *response
 	ASSERT_CS_LOW();
 	HAL_SPI_Transmit(&hspi1, data, sizeof(data), 0xffff);
 
+	// R1 comes within 8 bytes, a missing card leaves DO high and the response at 0xff
+	uint32_t start = HAL_GetTick();
 	memset(response, 0xff, response_length);
 	do {
 		HAL_SPI_Receive(&hspi1, response, 1, 0xffff);
-	} while(response[0] == 0xff);
+	} while(response[0] == 0xff && HAL_GetTick() - start < SD_COMMAND_TIMEOUT_MS);
+	if(response[0] == 0xff) {
+		ASSERT_CS_HIGH();
+		return;
+	}
 
 	if(response_length > 1) {
 		HAL_SPI_Receive(&hspi1, response + 1, response_length - 1, 0xffff);
@@ -120,39 +130,186 @@ static uint8_t spi_send_sd_command_r1(uint8_t command, uint32_t arg) {
 #define SD_READ_BAD_R1					0x10
 #define SD_READ_BAD_CRC					0x20
 #define SD_READ_UNKNOWN					0x40
-static uint8_t spi_sd_read_block(uint32_t block_index, uint8_t *data) {
-	uint8_t ret = 0;
+#define SD_READ_TIMEOUT					0x80
 
-	uint32_t address = (sd_ccs ? block_index : block_index * SECTOR_SIZE);
-	if(spi_send_sd_command_r1(17, address) != 0x00)
-		return SD_READ_BAD_R1;
+#define SD_WRITE_REJECTED				0x01
+#define SD_WRITE_BAD_R1					0x10
+#define SD_WRITE_TIMEOUT				0x80
 
-	ASSERT_CS_LOW();
+/* Data tokens, section 7.3.3 */
+#define TOKEN_START_BLOCK				0xfe
+#define TOKEN_START_MULTI_WRITE			0xfc
+#define TOKEN_STOP_MULTI_WRITE			0xfd
+#define DATA_RESPONSE_MASK				0x1f
+#define DATA_RESPONSE_ACCEPTED			0x05
+
+/* Worst case timeouts of section 4.6.2 */
+#define SD_READ_TIMEOUT_MS				100
+#define SD_BUSY_TIMEOUT_MS				500
+
+// 84 MHz APB2 / 4, the card allows up to 25 MHz once it left identification mode
+#define SD_SPI_FAST_PRESCALER			SPI_BAUDRATEPRESCALER_4
+
+static uint8_t sd_csd[16];
+
+static void spi_set_prescaler(uint32_t prescaler) {
+	__HAL_SPI_DISABLE(&hspi1);
+	MODIFY_REG(hspi1.Instance->CR1, SPI_CR1_BR, prescaler);
+	hspi1.Init.BaudRatePrescaler = prescaler;
+}
+
+// Waits for the card to release DO after programming, CS must be low
+static uint8_t spi_sd_wait_ready(uint32_t timeout_ms) {
+	uint32_t start = HAL_GetTick();
+	uint8_t received;
+	do {
+		HAL_SPI_Receive(&hspi1, &received, 1, 0xffff);
+		if(received == 0xff) {
+			return 0;
+		}
+	} while(HAL_GetTick() - start < timeout_ms);
+	return 1;
+}
+
+// Receives one data block after its start token, CS must be low
+static uint8_t spi_sd_receive_data(uint8_t *data, uint32_t len) {
+	uint32_t start = HAL_GetTick();
 	uint8_t received = 0xff;
 	do {
 		HAL_SPI_Receive(&hspi1, &received, 1, 0xffff);
-	} while(received == 0xff);
+	} while(received == 0xff && HAL_GetTick() - start < SD_READ_TIMEOUT_MS);
 
+	if(received == 0xff) {
+		return SD_READ_TIMEOUT;
+	}
 	if((received & 0xf0) == 0) {
-		ret = received;
-	} else if(received != 0xfe) {
-		ret = SD_READ_UNKNOWN;
+		return received;
+	}
+	if(received != TOKEN_START_BLOCK) {
+		return SD_READ_UNKNOWN;
+	}
+
+	uint8_t crc[2];
+	HAL_SPI_Receive(&hspi1, data, len, 0xffff);
+	HAL_SPI_Receive(&hspi1, crc, 2, 0xffff);
+	PROFILE_BEGIN(sd_crc16);
+	uint16_t expected = crc16(data, len);
+	PROFILE_END(sd_crc16);
+	if((crc[0] << 8 | crc[1]) != expected) {
+		return SD_READ_BAD_CRC;
+	}
+	return 0;
+}
+
+// Sends one data block with the given start token and checks the data response, CS must be low
+static uint8_t spi_sd_send_data(uint8_t token, const uint8_t *data) {
+	uint16_t crc = crc16(data, SECTOR_SIZE);
+	uint8_t trailer[2] = { crc >> 8, crc & 0xff };
+
+	spi_send_single_byte(token);
+	HAL_SPI_Transmit(&hspi1, (uint8_t *)data, SECTOR_SIZE, 0xffff);
+	HAL_SPI_Transmit(&hspi1, trailer, 2, 0xffff);
+
+	uint8_t response;
+	HAL_SPI_Receive(&hspi1, &response, 1, 0xffff);
+	if((response & DATA_RESPONSE_MASK) != DATA_RESPONSE_ACCEPTED) {
+		spi_sd_wait_ready(SD_BUSY_TIMEOUT_MS);
+		return SD_WRITE_REJECTED;
+	}
+	return spi_sd_wait_ready(SD_BUSY_TIMEOUT_MS) ? SD_WRITE_TIMEOUT : 0;
+}
+
+// CMD12 answers after a stuff byte and then holds DO low while busy, CS must be low
+static void spi_sd_stop_transmission(void) {
+	uint8_t data[6];
+	data[0] = 12 | 0x40;
+	data[1] = data[2] = data[3] = data[4] = 0;
+	data[5] = crc7((uint64_t)data[0] << 32);
+	HAL_SPI_Transmit(&hspi1, data, sizeof(data), 0xffff);
+
+	uint8_t received;
+	HAL_SPI_Receive(&hspi1, &received, 1, 0xffff);
+	uint8_t tries = 16;
+	do {
+		HAL_SPI_Receive(&hspi1, &received, 1, 0xffff);
+	} while((received & 0x80) && --tries);
+	spi_sd_wait_ready(SD_BUSY_TIMEOUT_MS);
+}
+
+static uint8_t spi_sd_read_blocks(uint32_t block_index, uint8_t *data, uint32_t count) {
+	uint8_t ret = 0;
+
+	uint32_t address = (sd_ccs ? block_index : block_index * SECTOR_SIZE);
+	uint8_t r1 = spi_send_sd_command_r1(count == 1 ? 17 : 18, address);
+	if(r1 != 0x00)
+		return r1 == 0xff ? SD_READ_TIMEOUT : SD_READ_BAD_R1;
+
+	ASSERT_CS_LOW();
+	for(uint32_t i = 0; i < count && ret == 0; i++) {
+		ret = spi_sd_receive_data(data + i * SECTOR_SIZE, SECTOR_SIZE);
+	}
+	if(count != 1) {
+		spi_sd_stop_transmission();
+	}
+	ASSERT_CS_HIGH();
+	return ret;
+}
+
+static uint8_t spi_sd_write_blocks(uint32_t block_index, const uint8_t *data, uint32_t count) {
+	uint8_t ret = 0;
+
+	if(count != 1) {
+		// pre-erase hint, lets the card program the whole run at once
+		spi_send_sd_command_r1(55, 0);
+		spi_send_sd_command_r1(23, count);
+	}
+
+	uint32_t address = (sd_ccs ? block_index : block_index * SECTOR_SIZE);
+	uint8_t r1 = spi_send_sd_command_r1(count == 1 ? 24 : 25, address);
+	if(r1 != 0x00)
+		return r1 == 0xff ? SD_WRITE_TIMEOUT : SD_WRITE_BAD_R1;
+
+	ASSERT_CS_LOW();
+	if(count == 1) {
+		ret = spi_sd_send_data(TOKEN_START_BLOCK, data);
 	} else {
-		memset(data, 0xff, SECTOR_SIZE);
-		uint16_t crc = 0xffff;
-		HAL_SPI_Receive(&hspi1, data, SECTOR_SIZE, 0xffff);
-		HAL_SPI_Receive(&hspi1, (uint8_t*)&crc, 2, 0xffff);
-		uint16_t crc_swapped = crc << 8 | crc >> 8;
-
-		if(crc_swapped != crc16(data)) {
-			ret = SD_READ_BAD_CRC;
+		for(uint32_t i = 0; i < count && ret == 0; i++) {
+			ret = spi_sd_send_data(TOKEN_START_MULTI_WRITE, data + i * SECTOR_SIZE);
+		}
+		spi_send_single_byte(TOKEN_STOP_MULTI_WRITE);
+		spi_send_single_byte(0xff);
+		if(spi_sd_wait_ready(SD_BUSY_TIMEOUT_MS) && ret == 0) {
+			ret = SD_WRITE_TIMEOUT;
 		}
 	}
+	ASSERT_CS_HIGH();
+	return ret;
+}
+
+static uint8_t spi_sd_read_csd(uint8_t *csd) {
+	if(spi_send_sd_command_r1(9, 0) != 0x00)
+		return SD_READ_BAD_R1;
 
+	ASSERT_CS_LOW();
+	uint8_t ret = spi_sd_receive_data(csd, 16);
 	ASSERT_CS_HIGH();
 	return ret;
 }
 
+// Card capacity in sectors from the CSD, section 5.3
+static uint32_t sd_csd_sector_count(const uint8_t *csd) {
+	if((csd[0] >> 6) == 1) {
+		// CSD version 2.0: (C_SIZE + 1) * 512 KiB
+		uint32_t c_size = ((uint32_t)(csd[7] & 0x3f) << 16) | (csd[8] << 8) | csd[9];
+		return (c_size + 1) << 10;
+	}
+	// CSD version 1.0: (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) blocks of 2^READ_BL_LEN bytes
+	uint32_t read_bl_len = csd[5] & 0x0f;
+	uint32_t c_size = ((uint32_t)(csd[6] & 0x03) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+	uint32_t c_size_mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+	return (c_size + 1) << (c_size_mult + 2 + read_bl_len - 9);
+}
+
 // initialization based on Figure 7-2: SPI Mode Initialization Flow
 static uint8_t spi_init_sd(void) {
 	uint8_t buffer[16];
@@ -168,10 +325,11 @@ static uint8_t spi_init_sd(void) {
 		spi_send_sd_command(58, 0, buffer, R3_LEN); // read OCR
 		if(buffer[0] != 0x01) return 1; // according to spec, this should not happen
 
+		uint32_t start = HAL_GetTick();
 		do {
 			spi_send_sd_command_r1(55, 0); // next command is ACMD
 			buffer[0] = spi_send_sd_command_r1(41, 0x40000000); // initialize
-		} while(buffer[0] == 0x01);
+		} while(buffer[0] == 0x01 && HAL_GetTick() - start < SD_INIT_TIMEOUT_MS);
 
 		if(buffer[0] != 0x00) return 1; // init failed
 		
@@ -183,10 +341,11 @@ static uint8_t spi_init_sd(void) {
 		spi_send_sd_command(58, 0, buffer, R3_LEN); // read OCR
 		if(buffer[0] != 0x01) return 1; // according to spec, this should not happen
 
+		uint32_t start = HAL_GetTick();
 		do {
 			spi_send_sd_command_r1(55, 0); // next command is ACMD
 			buffer[0] = spi_send_sd_command_r1(41, 0); // initialize
-		} while(buffer[0] == 0x01);
+		} while(buffer[0] == 0x01 && HAL_GetTick() - start < SD_INIT_TIMEOUT_MS);
 		if(buffer[0] != 0x00) return 1; // init failed
 
 		sd_ccs = 0;
@@ -216,18 +375,24 @@ DSTATUS disk_status (
 /* Inidialize a Drive                                                    */
 /*-----------------------------------------------------------------------*/
 
-//TODO: Handle timeouts
 DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
+	DSTATUS status = STA_NOINIT;
+
+	os_mutex_lock(&sd_lock);
+	sd_initialized = 0;
+	spi_set_prescaler(SPI_BAUDRATEPRESCALER_256);
 	if(spi_init_sd() == 0) {
-		sd_initialized = 1;
-		return 0;
-	} else {
-		sd_initialized = 0;
-		return STA_NOINIT;
+		spi_set_prescaler(SD_SPI_FAST_PRESCALER);
+		if(spi_sd_read_csd(sd_csd) == 0) {
+			sd_initialized = 1;
+			status = 0;
+		}
 	}
+	os_mutex_unlock(&sd_lock);
+	return status;
 }
 
 
@@ -244,10 +409,17 @@ DRESULT disk_read (
 )
 {
 	if(sd_initialized == 0) return RES_NOTRDY;
-	for(int i = 0; i < count; i++) {
-		if(spi_sd_read_block(sector, buff + i) != 0) { return RES_ERROR; }
+	if(count == 0) return RES_PARERR;
+	os_mutex_lock(&sd_lock);
+	PROFILE_BEGIN(sd_read);
+	uint8_t err = spi_sd_read_blocks(sector, buff, count);
+	PROFILE_END(sd_read);
+	if(err & SD_READ_TIMEOUT) {
+		// pulled or hung, disk_status reports it gone until disk_initialize finds it again
+		sd_initialized = 0;
 	}
-	return RES_OK;
+	os_mutex_unlock(&sd_lock);
+	return err != 0 ? RES_ERROR : RES_OK;
 }
 
 
@@ -256,7 +428,7 @@ DRESULT disk_read (
 /* Write Sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
 
-#if FF_FS_READONLY == 0
+// also built with FF_FS_READONLY, the USB mass storage class writes through it
 
 DRESULT disk_write (
 	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
@@ -265,11 +437,19 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	return RES_PARERR;
+	if(sd_initialized == 0) return RES_NOTRDY;
+	if(count == 0) return RES_PARERR;
+	os_mutex_lock(&sd_lock);
+	PROFILE_BEGIN(sd_write);
+	uint8_t err = spi_sd_write_blocks(sector, buff, count);
+	PROFILE_END(sd_write);
+	if(err & SD_WRITE_TIMEOUT) {
+		sd_initialized = 0;
+	}
+	os_mutex_unlock(&sd_lock);
+	return err != 0 ? RES_ERROR : RES_OK;
 }
 
-#endif
-
 
 /*-----------------------------------------------------------------------*/
 /* Miscellaneous Functions                                               */
@@ -281,6 +461,34 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-	return RES_PARERR;
-}
+	if(sd_initialized == 0) return RES_NOTRDY;
 
+	switch(cmd) {
+	case CTRL_SYNC: {
+		os_mutex_lock(&sd_lock);
+		ASSERT_CS_LOW();
+		uint8_t busy = spi_sd_wait_ready(SD_BUSY_TIMEOUT_MS);
+		ASSERT_CS_HIGH();
+		if(busy) {
+			sd_initialized = 0;
+		}
+		os_mutex_unlock(&sd_lock);
+		return busy ? RES_ERROR : RES_OK;
+	}
+	case GET_SECTOR_COUNT:
+		*(LBA_t *)buff = sd_csd_sector_count(sd_csd);
+		return RES_OK;
+	case GET_SECTOR_SIZE:
+		*(WORD *)buff = SECTOR_SIZE;
+		return RES_OK;
+	case GET_BLOCK_SIZE:
+		// erase block size unknown
+		*(DWORD *)buff = 1;
+		return RES_OK;
+	case MMC_GET_CSD:
+		memcpy(buff, sd_csd, sizeof(sd_csd));
+		return RES_OK;
+	default:
+		return RES_PARERR;
+	}
+}
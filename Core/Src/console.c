@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <string.h>
+#include "console.h"
+#include "main.h"
+#include "os.h"
+#include "profile.h"
+#include "usb_cdc.h"
+
+#define TX_MASK (CONSOLE_TX_BUFFER_SIZE - 1)
+#define RX_MASK (CONSOLE_RX_BUFFER_SIZE - 1)
+
+#if (CONSOLE_TX_BUFFER_SIZE & TX_MASK) != 0
+#error "CONSOLE_TX_BUFFER_SIZE must be a power of two"
+#endif
+
+#if (CONSOLE_RX_BUFFER_SIZE & RX_MASK) != 0
+#error "CONSOLE_RX_BUFFER_SIZE must be a power of two"
+#endif
+
+/*
+ * Private function prototypes
+ */
+static void console_tx_kick(void);
+static uint8_t console_can_block(void);
+static int console_usb_write(const char *data, int len);
+static int console_uart_write(const char *data, int len);
+static void console_rx_start(void);
+static uint32_t console_oversampling(uint32_t baud);
+static uint32_t console_actual_baud(uint32_t baud, uint32_t oversampling);
+static void console_apply_baud(uint32_t baud);
+
+/*
+ * Private variables
+ */
+static UART_HandleTypeDef *console_huart = NULL;
+static console_overflow_policy console_policy = CONSOLE_OVERFLOW_DROP;
+static console_stats stats;
+
+// serialises writers with USE_FREERTOS, BLOCK writers sleep on tx_done
+static os_mutex console_lock;
+static os_event console_tx_done;
+
+/*
+ * head is only moved by console_write, with interrupts masked from reading
+ * it to publishing all of the data that fits, wrapped or not, so a write
+ * from an interrupt handler lands before or after a task's write and only
+ * splits one that has to wait for room or overwrite. tail and
+ * tx_in_flight are only moved by console_tx_kick, which runs with
+ * interrupts masked or from the DMA completion interrupt.
+ */
+static uint8_t tx_buffer[CONSOLE_TX_BUFFER_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile uint32_t tx_in_flight = 0;
+
+/*
+ * The RX DMA runs in circular mode straight into rx_buffer, so the buffer
+ * is the ring. rx_head counts every byte the DMA has stored and is moved by
+ * the idle line, half and full transfer events, rx_tail only by the reader.
+ */
+static uint8_t rx_buffer[CONSOLE_RX_BUFFER_SIZE];
+static volatile uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+static uint32_t rx_dma_pos = 0;
+
+static char line_buffer[CONSOLE_LINE_MAX];
+static int line_len = 0;
+static uint8_t line_overlong = 0;
+static uint8_t line_last_cr = 0;
+static uint8_t console_echo = 1;
+
+/*
+ * A baud rate change is only kept once the host sends CONSOLE_BAUD_CONFIRM
+ * at the new rate, otherwise console_poll goes back to baud_previous.
+ */
+static uint32_t baud_previous = 0;
+static uint32_t baud_deadline = 0;
+static uint8_t baud_pending = 0;
+
+/*
+ * Private functions
+ */
+static void console_tx_kick(void) {
+	if(tx_in_flight != 0) {
+		return;
+	}
+
+	uint32_t pending = tx_head - tx_tail;
+	if(pending == 0) {
+		return;
+	}
+
+	// DMA needs a contiguous block, the wrapped part goes in the next transfer
+	uint32_t start = tx_tail & TX_MASK;
+	uint32_t chunk = CONSOLE_TX_BUFFER_SIZE - start;
+	if(chunk > pending) {
+		chunk = pending;
+	}
+	if(chunk > UINT16_MAX) {
+		chunk = UINT16_MAX;
+	}
+
+	tx_in_flight = chunk;
+	if(HAL_UART_Transmit_DMA(console_huart, tx_buffer + start, chunk) != HAL_OK) {
+		tx_in_flight = 0;
+		return;
+	}
+	stats.transfers++;
+}
+
+static void console_rx_start(void) {
+	rx_dma_pos = 0;
+	if(HAL_UARTEx_ReceiveToIdle_DMA(console_huart, rx_buffer, CONSOLE_RX_BUFFER_SIZE) != HAL_OK) {
+		stats.rx_errors++;
+	}
+}
+
+// 8x reaches the fast rates, 16x samples slow ones better and divides further down
+static uint32_t console_oversampling(uint32_t baud) {
+	return baud > CONSOLE_DEFAULT_BAUD ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+}
+
+// Baud rate the UART really produces with the given oversampling, 0 if out of range
+static uint32_t console_actual_baud(uint32_t baud, uint32_t oversampling) {
+	uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+	uint32_t brr, div;
+
+	if(oversampling == UART_OVERSAMPLING_8) {
+		if(baud == 0 || baud > pclk / 8) {
+			return 0;
+		}
+		brr = UART_BRR_SAMPLING8(pclk, baud);
+		div = (brr >> 4) * 8 + (brr & 0x7);
+	} else {
+		if(baud == 0 || baud > pclk / 16) {
+			return 0;
+		}
+		brr = UART_BRR_SAMPLING16(pclk, baud);
+		div = brr;
+	}
+	// the mantissa has 12 bits
+	if(brr > 0xffff || div == 0) {
+		return 0;
+	}
+	return pclk / div;
+}
+
+// Switches USART3 with nothing in flight, the RX DMA is restarted from scratch
+static void console_apply_baud(uint32_t baud) {
+	fflush(stdout);
+	console_flush();
+	HAL_UART_AbortReceive(console_huart);
+
+	console_huart->Init.BaudRate = baud;
+	console_huart->Init.OverSampling = console_oversampling(baud);
+	if(HAL_UART_Init(console_huart) != HAL_OK) {
+		Error_Handler();
+	}
+
+	// whatever arrived during the switch is garbage
+	rx_head = rx_tail = 0;
+	line_len = 0;
+	line_overlong = line_last_cr = 0;
+	console_rx_start();
+}
+
+// waiting for the DMA only makes sense if its interrupt can still run
+static uint8_t console_can_block(void) {
+	return __get_PRIMASK() == 0 && (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) == 0;
+}
+
+// the CDC ring cannot be rewound under a transfer, so OVERWRITE drops like DROP
+static int console_usb_write(const char *data, int len) {
+	int written = 0;
+	while(written < len) {
+		int n = usb_cdc_write(data + written, len - written);
+		written += n;
+		if(n == 0) {
+			if(console_policy == CONSOLE_OVERFLOW_BLOCK && console_can_block() && usb_cdc_connected()) {
+				usb_cdc_wait_tx(1);
+				continue;
+			}
+			stats.dropped += len - written;
+			break;
+		}
+	}
+	stats.written += written;
+	return written;
+}
+
+static int console_uart_write(const char *data, int len) {
+	if(console_huart == NULL) {
+		return 0;
+	}
+
+	PROFILE_BEGIN(uart_write);
+	int written = 0;
+	while(written < len) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		uint32_t free = CONSOLE_TX_BUFFER_SIZE - (tx_head - tx_tail);
+		// up to the wrap and from the start, both under the same mask
+		while(free != 0 && written < len) {
+			uint32_t start = tx_head & TX_MASK;
+			uint32_t chunk = CONSOLE_TX_BUFFER_SIZE - start;
+			if(chunk > free) {
+				chunk = free;
+			}
+			if(chunk > (uint32_t)(len - written)) {
+				chunk = len - written;
+			}
+
+			memcpy(tx_buffer + start, data + written, chunk);
+			__DMB();
+			tx_head += chunk;
+			written += chunk;
+			free -= chunk;
+		}
+		if(tx_head - tx_tail > stats.tx_peak) {
+			stats.tx_peak = tx_head - tx_tail;
+		}
+		console_tx_kick();
+		__set_PRIMASK(primask);
+
+		// the ring is full, interrupts run again before waiting or overwriting
+		if(written < len) {
+			if(console_policy == CONSOLE_OVERFLOW_BLOCK && console_can_block()) {
+				os_event_wait(&console_tx_done, 1);
+				continue;
+			}
+			if(console_policy == CONSOLE_OVERFLOW_OVERWRITE) {
+				primask = __get_PRIMASK();
+				__disable_irq();
+				uint32_t discard = tx_head - tx_tail - tx_in_flight;
+				tx_head = tx_tail + tx_in_flight;
+				__set_PRIMASK(primask);
+				stats.overwritten += discard;
+				if(discard != 0) {
+					continue;
+				}
+			}
+			stats.dropped += len - written;
+			break;
+		}
+	}
+
+	stats.written += written;
+	PROFILE_END(uart_write);
+	return written;
+}
+
+/*
+ * Public functions
+ */
+void console_init(UART_HandleTypeDef *huart) {
+	tx_head = tx_tail = tx_in_flight = 0;
+	rx_head = rx_tail = 0;
+	line_len = 0;
+	line_overlong = line_last_cr = 0;
+	memset(&stats, 0, sizeof(stats));
+	console_huart = huart;
+	console_rx_start();
+}
+
+// Queues data for DMA transmission, returns the number of bytes accepted.
+// Interrupt handlers skip the lock, the rings take their writes whole.
+int console_write(const char *data, int len) {
+	os_mutex_lock(&console_lock);
+	// output follows the USB terminal while it holds DTR
+	int written = usb_cdc_connected() ? console_usb_write(data, len) : console_uart_write(data, len);
+	os_mutex_unlock(&console_lock);
+	return written;
+}
+
+// Waits until everything queued so far is on the wire
+void console_flush(void) {
+	if(console_huart == NULL || !console_can_block()) {
+		return;
+	}
+	while(tx_head != tx_tail) {
+		os_event_wait(&console_tx_done, 1);
+	}
+	while(__HAL_UART_GET_FLAG(console_huart, UART_FLAG_TC) == RESET)
+		;
+}
+
+uint32_t console_tx_free(void) {
+	if(usb_cdc_connected()) {
+		return usb_cdc_tx_free();
+	}
+	return CONSOLE_TX_BUFFER_SIZE - (tx_head - tx_tail);
+}
+
+// Returns the next received byte, or -1 if there is none
+int console_getchar(void) {
+	if(console_huart == NULL) {
+		return usb_cdc_getchar();
+	}
+
+	uint32_t head = rx_head;
+	if(head - rx_tail > CONSOLE_RX_BUFFER_SIZE) {
+		// the DMA lapped the reader, whatever is left is a mix of old and new data
+		stats.rx_lost += head - rx_tail;
+		rx_tail = head;
+	}
+	if(head == rx_tail) {
+		return usb_cdc_getchar();
+	}
+	return rx_buffer[rx_tail++ & RX_MASK];
+}
+
+uint32_t console_rx_available(void) {
+	uint32_t pending = rx_head - rx_tail;
+	return pending > CONSOLE_RX_BUFFER_SIZE ? CONSOLE_RX_BUFFER_SIZE : pending;
+}
+
+/*
+ * Assembles a line from whatever has been received so far without waiting.
+ * Returns the line length once CR, LF or CRLF arrives (the terminator is
+ * replaced by '\0'), or -1 while the line is still incomplete. Characters
+ * past len - 1 are dropped and counted in line_truncated.
+ */
+int console_read_line(char *line, int len) {
+	int ch;
+	while((ch = console_getchar()) >= 0) {
+		if(ch == '\n' && line_last_cr) {
+			line_last_cr = 0;
+			continue;
+		}
+		line_last_cr = (ch == '\r');
+
+		if(ch == '\r' || ch == '\n') {
+			if(console_echo) {
+				console_write("\n", 1);
+			}
+			if(baud_pending && line_len == sizeof(CONSOLE_BAUD_CONFIRM) - 1
+					&& memcmp(line_buffer, CONSOLE_BAUD_CONFIRM, line_len) == 0) {
+				baud_pending = 0;
+				line_len = 0;
+				printf("baud: %lu confirmed\n", (unsigned long)console_huart->Init.BaudRate);
+				continue;
+			}
+
+			int n = line_len < len - 1 ? line_len : len - 1;
+			if(n < 0) {
+				n = 0;
+			}
+			if(len > 0) {
+				memcpy(line, line_buffer, n);
+				line[n] = '\0';
+			}
+			if(line_overlong || n < line_len) {
+				stats.line_truncated++;
+			}
+			line_len = 0;
+			line_overlong = 0;
+			return n;
+		}
+
+		if(ch == '\b' || ch == 0x7f) {
+			if(line_len > 0) {
+				line_len--;
+				if(console_echo) {
+					console_write("\b \b", 3);
+				}
+			}
+			continue;
+		}
+
+		if(line_len >= CONSOLE_LINE_MAX - 1) {
+			line_overlong = 1;
+			continue;
+		}
+		line_buffer[line_len++] = ch;
+		if(console_echo) {
+			char c = ch;
+			console_write(&c, 1);
+		}
+	}
+	return -1;
+}
+
+void console_set_echo(uint8_t enable) {
+	console_echo = enable;
+}
+
+// Reverts an unconfirmed baud rate change once its deadline passes
+void console_poll(void) {
+	if(baud_pending && (int32_t)(HAL_GetTick() - baud_deadline) >= 0) {
+		baud_pending = 0;
+		console_apply_baud(baud_previous);
+		printf("baud: not confirmed, back to %lu\n", (unsigned long)baud_previous);
+	}
+}
+
+/*
+ * Announces the new rate, switches once the announcement is on the wire and
+ * waits for the host to confirm. Rates above CONSOLE_DEFAULT_BAUD use 8x
+ * oversampling, which allows up to PCLK1 / 8 (5.25 Mbaud at 42 MHz), the
+ * others 16x, which goes down to PCLK1 / 65536 (641 baud).
+ * Returns 0 on success or -1 if the rate is off by more than 2%.
+ */
+int console_change_baud(uint32_t baud) {
+	if(console_huart == NULL || baud_pending) {
+		return -1;
+	}
+
+	uint32_t actual = console_actual_baud(baud, console_oversampling(baud));
+	uint32_t error = actual > baud ? actual - baud : baud - actual;
+	if(actual == 0 || error > baud / 50) {
+		return -1;
+	}
+
+	printf("baud: switching to %lu (actual %lu), send \"%s\" within %d ms\n",
+			(unsigned long)baud, (unsigned long)actual, CONSOLE_BAUD_CONFIRM, CONSOLE_BAUD_CONFIRM_MS);
+
+	baud_previous = console_huart->Init.BaudRate;
+	console_apply_baud(baud);
+	baud_deadline = HAL_GetTick() + CONSOLE_BAUD_CONFIRM_MS;
+	baud_pending = 1;
+	return 0;
+}
+
+uint32_t console_get_baud(void) {
+	return console_huart != NULL ? console_huart->Init.BaudRate : 0;
+}
+
+void console_set_overflow_policy(console_overflow_policy policy) {
+	console_policy = policy;
+}
+
+const console_stats *console_get_stats(void) {
+	return &stats;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+	if(huart != console_huart) {
+		return;
+	}
+	PROFILE_BEGIN(uart_tx_isr);
+	tx_tail += tx_in_flight;
+	tx_in_flight = 0;
+	console_tx_kick();
+	os_event_signal(&console_tx_done);
+	PROFILE_END(uart_tx_isr);
+}
+
+/*
+ * Called on idle line as well as half and full transfer, size is the DMA
+ * position. The half transfer event guarantees less than a lap between calls.
+ */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size) {
+	if(huart != console_huart) {
+		return;
+	}
+	PROFILE_BEGIN(uart_rx_isr);
+	uint32_t pos = size & RX_MASK;
+	uint32_t received = (pos - rx_dma_pos) & RX_MASK;
+	rx_dma_pos = pos;
+	rx_head += received;
+	stats.received += received;
+	PROFILE_END(uart_rx_isr);
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+	if(huart != console_huart) {
+		return;
+	}
+	stats.rx_errors++;
+
+	// overrun and DMA errors abort the reception, pick up the bytes already stored and restart
+	if(huart->RxState == HAL_UART_STATE_READY) {
+		uint32_t pos = (CONSOLE_RX_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(huart->hdmarx)) & RX_MASK;
+		rx_head += (pos - rx_dma_pos) & RX_MASK;
+		console_rx_start();
+	}
+	// a failed TX transfer would otherwise stall the ring forever
+	if(huart->gState == HAL_UART_STATE_READY && tx_in_flight != 0) {
+		tx_in_flight = 0;
+		console_tx_kick();
+	}
+}
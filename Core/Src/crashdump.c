@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "crashdump.h"
+#include "main.h"
+
+#define CRASHDUMP_MAGIC 0x43525348U		// "CRSH"
+#define CRASHDUMP_HANDLER_STACK 256		// bytes, for crashdump_fault and what it calls
+#define CRASHDUMP_STR(x) #x
+#define CRASHDUMP_XSTR(x) CRASHDUMP_STR(x)
+
+#define EXC_RETURN_STD_FRAME (1U << 4)	// no floating point state stacked
+#define XPSR_STACK_ALIGNED (1U << 9)	// the core inserted a word to align the frame
+
+/* Linker script symbols, only their addresses are meaningful */
+extern uint8_t _estack;
+extern uint8_t _Min_Stack_Size;
+extern uint8_t _Stack_Guard_Size;
+
+static crashdump dump __attribute__((section(".noinit")));
+static uint8_t crashdump_valid = 0;
+// SP may point into the stack guard when a fault is taken, the handler runs on this instead
+static uint32_t crashdump_stack[CRASHDUMP_HANDLER_STACK / 4] __attribute__((used));
+
+static const char *const cfsr_names[32] = {
+	[0] = "IACCVIOL", [1] = "DACCVIOL", [3] = "MUNSTKERR", [4] = "MSTKERR", [5] = "MLSPERR",
+	[7] = "MMARVALID", [8] = "IBUSERR", [9] = "PRECISERR", [10] = "IMPRECISERR", [11] = "UNSTKERR",
+	[12] = "STKERR", [13] = "LSPERR", [15] = "BFARVALID", [16] = "UNDEFINSTR", [17] = "INVSTATE",
+	[18] = "INVPC", [19] = "NOCP", [24] = "UNALIGNED", [25] = "DIVBYZERO",
+};
+
+/*
+ * Private function prototypes
+ */
+static uint32_t crashdump_checksum(void);
+static uint8_t crashdump_intact(void);
+static uint8_t crashdump_in_ram(uint32_t addr, uint32_t len);
+static void crashdump_begin(uint32_t reason);
+static void crashdump_snapshot(uint32_t sp);
+static void crashdump_reset(void) __attribute__((noreturn));
+static void crashdump_fault(uint32_t *frame, uint32_t exc_return) __attribute__((used, noreturn));
+static const char *crashdump_reason_name(uint32_t reason);
+
+/*
+ * Private functions
+ */
+
+// Tells a dump apart from what RAM holds after power on
+static uint32_t crashdump_checksum(void) {
+	const uint32_t *words = (const uint32_t *)&dump;
+	uint32_t sum = CRASHDUMP_MAGIC;
+
+	for(size_t i = 0; i < offsetof(crashdump, check) / sizeof(uint32_t); i++) {
+		sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+	}
+	return sum;
+}
+
+static uint8_t crashdump_intact(void) {
+	return dump.magic == CRASHDUMP_MAGIC && dump.check == crashdump_checksum();
+}
+
+static uint8_t crashdump_in_ram(uint32_t addr, uint32_t len) {
+	return (addr & 3) == 0 && addr >= SRAM1_BASE && addr + len <= (uintptr_t)&_estack;
+}
+
+static void crashdump_begin(uint32_t reason) {
+	uint32_t count = crashdump_intact() ? dump.count : 0;
+
+	memset(&dump, 0, sizeof(dump));
+	dump.magic = CRASHDUMP_MAGIC;
+	dump.reason = reason;
+	dump.count = count + 1;
+	dump.uptime_ms = HAL_GetTick();
+	dump.cfsr = SCB->CFSR;
+	dump.hfsr = SCB->HFSR;
+	dump.mmfar = SCB->MMFAR;
+	dump.bfar = SCB->BFAR;
+}
+
+static void crashdump_snapshot(uint32_t sp) {
+	const uint32_t *words = (const uint32_t *)(uintptr_t)sp;
+
+	while(dump.stack_words < CRASHDUMP_STACK_WORDS
+			&& crashdump_in_ram(sp, (dump.stack_words + 1) * sizeof(uint32_t))) {
+		dump.stack[dump.stack_words] = words[dump.stack_words];
+		dump.stack_words++;
+	}
+}
+
+static void crashdump_reset(void) {
+	dump.check = crashdump_checksum();
+	__DSB();
+	// stop where it happened when a debugger is attached
+	if(CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk) {
+		__BKPT(0);
+	}
+	NVIC_SystemReset();
+}
+
+// Runs on crashdump_stack, frame is the stack pointer the exception was taken on
+static void crashdump_fault(uint32_t *frame, uint32_t exc_return) {
+	uint32_t sp = (uintptr_t)frame;
+
+	// the guard of memstat.h must not fault the reads below
+	HAL_MPU_Disable();
+	crashdump_begin(__get_IPSR() & 0x1ff);
+	dump.exc_return = exc_return;
+
+	// a fault while stacking leaves no frame behind
+	if(!(dump.cfsr & (SCB_CFSR_MSTKERR_Msk | SCB_CFSR_STKERR_Msk)) && crashdump_in_ram(sp, 8 * sizeof(uint32_t))) {
+		dump.stacked = 1;
+		dump.r0 = frame[0];
+		dump.r1 = frame[1];
+		dump.r2 = frame[2];
+		dump.r3 = frame[3];
+		dump.r12 = frame[4];
+		dump.lr = frame[5];
+		dump.pc = frame[6];
+		dump.xpsr = frame[7];
+		sp += (exc_return & EXC_RETURN_STD_FRAME) ? 8 * sizeof(uint32_t) : 26 * sizeof(uint32_t);
+		if(dump.xpsr & XPSR_STACK_ALIGNED) {
+			sp += sizeof(uint32_t);
+		}
+	}
+	dump.sp = sp;
+	crashdump_snapshot(sp);
+	crashdump_reset();
+}
+
+static const char *crashdump_reason_name(uint32_t reason) {
+	switch(reason) {
+	case CRASHDUMP_ERROR:
+		return "Error_Handler";
+	case 2:
+		return "NMI";
+	case 3:
+		return "HardFault";
+	case 4:
+		return "MemManage";
+	case 5:
+		return "BusFault";
+	case 6:
+		return "UsageFault";
+	default:
+		return "exception";
+	}
+}
+
+/*
+ * Public functions
+ */
+
+// Before anything else in main(), nothing may write .noinit before the check
+void crashdump_init(void) {
+	crashdump_valid = crashdump_intact();
+}
+
+// Once per crash, on the first boot after it
+void crashdump_report(void) {
+	if(!crashdump_valid || dump.reported) {
+		return;
+	}
+	printf("Reset after a crash:\n");
+	crashdump_print(&dump);
+	printf("\n");
+	dump.reported = 1;
+	dump.check = crashdump_checksum();
+}
+
+const crashdump *crashdump_get(void) {
+	return crashdump_valid ? &dump : NULL;
+}
+
+void crashdump_print(const crashdump *d) {
+	uint32_t guard_top = (uintptr_t)&_estack - (uintptr_t)&_Min_Stack_Size;
+
+	printf("crash     %s (%lu), at %lu ms, %lu since power on\n", crashdump_reason_name(d->reason),
+			(unsigned long)d->reason, (unsigned long)d->uptime_ms, (unsigned long)d->count);
+	if(d->reason == CRASHDUMP_ERROR) {
+		printf("called    from %08lx, sp %08lx\n", (unsigned long)d->pc, (unsigned long)d->sp);
+	} else if(d->stacked) {
+		printf("pc %08lx  lr %08lx  xpsr %08lx  sp %08lx\n", (unsigned long)d->pc, (unsigned long)d->lr,
+				(unsigned long)d->xpsr, (unsigned long)d->sp);
+		printf("r0 %08lx  r1 %08lx  r2 %08lx  r3 %08lx  r12 %08lx\n", (unsigned long)d->r0,
+				(unsigned long)d->r1, (unsigned long)d->r2, (unsigned long)d->r3, (unsigned long)d->r12);
+	} else {
+		printf("no exception frame, sp %08lx, exc_return %08lx\n", (unsigned long)d->sp,
+				(unsigned long)d->exc_return);
+	}
+
+	printf("cfsr %08lx", (unsigned long)d->cfsr);
+	for(uint32_t bit = 0; bit < 32; bit++) {
+		if((d->cfsr & (1UL << bit)) && cfsr_names[bit] != NULL) {
+			printf(" %s", cfsr_names[bit]);
+		}
+	}
+	printf("  hfsr %08lx%s%s\n", (unsigned long)d->hfsr, (d->hfsr & SCB_HFSR_FORCED_Msk) ? " FORCED" : "",
+			(d->hfsr & SCB_HFSR_VECTTBL_Msk) ? " VECTTBL" : "");
+	if(d->cfsr & (SCB_CFSR_MMARVALID_Msk | SCB_CFSR_BFARVALID_Msk)) {
+		printf("mmfar %08lx  bfar %08lx\n", (unsigned long)d->mmfar, (unsigned long)d->bfar);
+	}
+	if((d->cfsr & SCB_CFSR_MSTKERR_Msk) || ((d->cfsr & SCB_CFSR_MMARVALID_Msk) && d->mmfar < guard_top
+			&& d->mmfar >= guard_top - (uintptr_t)&_Stack_Guard_Size)) {
+		printf("stack overflow into the guard\n");
+	}
+
+	for(uint32_t i = 0; i < d->stack_words; i++) {
+		if(i % 8 == 0) {
+			printf("%08lx:", (unsigned long)(d->sp + i * sizeof(uint32_t)));
+		}
+		printf(" %08lx", (unsigned long)d->stack[i]);
+		if(i % 8 == 7 || i + 1 == d->stack_words) {
+			printf("\n");
+		}
+	}
+}
+
+void crashdump_clear(void) {
+	dump.magic = 0;
+	crashdump_valid = 0;
+}
+
+/*
+ * Takes the stack pointer the core stacked the frame on, from EXC_RETURN in
+ * LR, and moves off it before any C code runs.
+ */
+__attribute__((naked)) void crashdump_fault_entry(void) {
+	__asm volatile(
+		"cpsid i\n"
+		"tst lr, #4\n"
+		"ite eq\n"
+		"mrseq r0, msp\n"
+		"mrsne r0, psp\n"
+		"mov r1, lr\n"
+		"movw r2, #:lower16:(crashdump_stack + " CRASHDUMP_XSTR(CRASHDUMP_HANDLER_STACK) ")\n"
+		"movt r2, #:upper16:(crashdump_stack + " CRASHDUMP_XSTR(CRASHDUMP_HANDLER_STACK) ")\n"
+		"mov sp, r2\n"
+		"b crashdump_fault\n"
+	);
+}
+
+// The vector table entries, CubeMX is set not to generate these in stm32f4xx_it.c
+void HardFault_Handler(void) __attribute__((alias("crashdump_fault_entry")));
+void MemManage_Handler(void) __attribute__((alias("crashdump_fault_entry")));
+void BusFault_Handler(void) __attribute__((alias("crashdump_fault_entry")));
+void UsageFault_Handler(void) __attribute__((alias("crashdump_fault_entry")));
+
+// caller is the return address of Error_Handler, where the HAL call failed
+void crashdump_error(uint32_t caller) {
+	__disable_irq();
+	crashdump_begin(CRASHDUMP_ERROR);
+	dump.pc = caller;
+	dump.sp = (__get_CONTROL() & CONTROL_SPSEL_Msk) ? __get_PSP() : __get_MSP();
+	crashdump_snapshot(dump.sp);
+	crashdump_reset();
+}
@@ -0,0 +1,71 @@
+#include "frame.h"
+
+/*
+ * Private variables
+ */
+
+// CRC-16/CCITT-FALSE (poly 0x1021), one nibble at a time
+static const uint16_t crc16_table[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+/*
+ * Public functions
+ */
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, size_t len) {
+	while(len--) {
+		uint8_t b = *data++;
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (b >> 4)];
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (b & 0x0f)];
+	}
+	return crc;
+}
+
+// dest must hold FRAME_COBS_MAX(len) bytes, returns the encoded length
+size_t frame_cobs_encode(const uint8_t *src, size_t len, uint8_t *dest) {
+	size_t out = 1;
+	size_t code_pos = 0;
+	uint8_t code = 1;
+
+	for(size_t i = 0; i < len; i++) {
+		if(src[i] != 0) {
+			dest[out++] = src[i];
+			code++;
+		}
+		if(src[i] == 0 || code == 0xff) {
+			dest[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		}
+	}
+	dest[code_pos] = code;
+	return out;
+}
+
+// Returns the decoded length or -1 if the block is malformed or does not fit
+int frame_cobs_decode(const uint8_t *src, size_t len, uint8_t *dest, size_t dest_len) {
+	size_t in = 0;
+	size_t out = 0;
+
+	while(in < len) {
+		uint8_t code = src[in++];
+		if(code == 0 || in + code - 1 > len) {
+			return -1;
+		}
+		for(uint8_t i = 1; i < code; i++) {
+			if(out >= dest_len || src[in] == 0) {
+				return -1;
+			}
+			dest[out++] = src[in++];
+		}
+		// a short block stands for a zero, except at the very end
+		if(code != 0xff && in < len) {
+			if(out >= dest_len) {
+				return -1;
+			}
+			dest[out++] = 0;
+		}
+	}
+	return out;
+}
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "log.h"
+#include "main.h"
+
+#define RING_MASK (LOG_RING_WORDS - 1)
+#define NARGS_MASK 0x7
+
+#if (LOG_RING_WORDS & RING_MASK) != 0
+#error "LOG_RING_WORDS must be a power of two"
+#endif
+
+/*
+ * Private variables
+ */
+
+/*
+ * A record is the format address with the argument count in its low bits,
+ * the tick and the arguments. Producers reserve and fill a record with
+ * interrupts masked, the single consumer runs from the main loop.
+ */
+static uintptr_t ring[LOG_RING_WORDS];
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+static log_stats stats;
+
+/*
+ * Public functions
+ */
+void log_init(void) {
+	ring_head = ring_tail = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+// Called through LOG(), records are dropped whole when the ring is full
+void log_write(const char *fmt, const uintptr_t *args, uint32_t nargs) {
+	uint32_t words = 2 + nargs;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t head = ring_head;
+	uint32_t used = head - ring_tail;
+	if(used + words > LOG_RING_WORDS) {
+		stats.dropped++;
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	ring[head++ & RING_MASK] = (uintptr_t)fmt | nargs;
+	ring[head++ & RING_MASK] = HAL_GetTick();
+	for(uint32_t i = 0; i < nargs; i++) {
+		ring[head++ & RING_MASK] = args[i];
+	}
+	ring_head = head;
+
+	stats.written++;
+	if(used + words > stats.peak) {
+		stats.peak = used + words;
+	}
+	__set_PRIMASK(primask);
+}
+
+// Copies the oldest record without removing it, returns 0 if there is none
+uint8_t log_peek(log_record *rec) {
+	uint32_t tail = ring_tail;
+	if(tail == ring_head) {
+		return 0;
+	}
+
+	uintptr_t word = ring[tail++ & RING_MASK];
+	rec->fmt = (const char *)(word & ~(uintptr_t)NARGS_MASK);
+	rec->nargs = word & NARGS_MASK;
+	rec->tick = ring[tail++ & RING_MASK];
+	for(uint8_t i = 0; i < LOG_MAX_ARGS; i++) {
+		rec->args[i] = i < rec->nargs ? ring[tail++ & RING_MASK] : 0;
+	}
+	return 1;
+}
+
+void log_discard(void) {
+	if(ring_tail == ring_head) {
+		return;
+	}
+	uint32_t nargs = ring[ring_tail & RING_MASK] & NARGS_MASK;
+	ring_tail += 2 + nargs;
+}
+
+/*
+ * Unused argument slots are zero and passing surplus variadic arguments is
+ * harmless, so a single call covers every argument count.
+ */
+void log_print(const log_record *rec) {
+	const uintptr_t *a = rec->args;
+	printf("[%8lu] ", (unsigned long)rec->tick);
+	printf(rec->fmt, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+}
+
+// Formats up to max_records at idle time, returns the number printed
+uint32_t log_process(uint32_t max_records) {
+	log_record rec;
+	uint32_t n = 0;
+	while(n < max_records && log_peek(&rec)) {
+		log_print(&rec);
+		log_discard();
+		n++;
+	}
+	return n;
+}
+
+const log_stats *log_get_stats(void) {
+	return &stats;
+}
@@ -26,7 +26,21 @@
 #include <string.h>
 #include "diskio.h"
 #include "ff.h"
+#include "console.h"
+#include "crashdump.h"
+#include "log.h"
+#include "memstat.h"
 #include "onewire.h"
+#include "os.h"
+#include "profile.h"
+#include "sched.h"
+#include "sensors.h"
+#include "shell.h"
+#include "telemetry.h"
+#include "usb_device.h"
+#include "usb_msc.h"
+#include "usb_stream.h"
+#include "stream_proto.h"
 #include "stm32f4xx_hal_gpio.h"
 /* USER CODE END Includes */
 
@@ -37,6 +51,16 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#define SENSORS_DEFAULT_PERIOD_MS 1000
+// console space kept free when formatting deferred log records
+#define LOG_TX_RESERVE 128
+// records formatted per idle pass, bounds the time spent in the idle hook
+#define LOG_IDLE_RECORDS 4
+#define BUTTON_HOLDOFF_MS 1000
+
+#define TASK_PERIOD_USB_MS 1
+#define TASK_PERIOD_CONSOLE_MS 5
+#define TASK_PERIOD_SENSORS_MS 10
 
 /* USER CODE END PD */
 
@@ -51,36 +75,120 @@ SPI_HandleTypeDef hspi1;
 TIM_HandleTypeDef htim6;
 
 UART_HandleTypeDef huart3;
+DMA_HandleTypeDef hdma_usart3_rx;
+DMA_HandleTypeDef hdma_usart3_tx;
 
 PCD_HandleTypeDef hpcd_USB_OTG_FS;
 
 /* USER CODE BEGIN PV */
 static char stdinbuffer[256];
+static onewire_bus onewire_bus1;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART3_UART_Init(void);
 static void MX_USB_OTG_FS_PCD_Init(void);
 static void MX_TIM6_Init(void);
 static void MX_SPI1_Init(void);
 /* USER CODE BEGIN PFP */
-
+static void task_usb(uint32_t events);
+static void task_console(uint32_t events);
+static void task_sensors(uint32_t events);
+static void task_button(uint32_t events);
+static void idle_log(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 int __io_putchar(int ch) {
-	uint8_t c = ch;
-	HAL_UART_Transmit(&huart3, &c, 1, 0xffff);
+	char c = ch;
+	console_write(&c, 1);
 	return 1;
 }
 
 int __io_getchar(void) {
-	uint8_t data;
-	HAL_UART_Receive(&huart3, &data, 1, HAL_MAX_DELAY);
-	return data;
+	int ch;
+	while((ch = console_getchar()) < 0)
+		;
+	return ch;
+}
+
+// Mass storage commands, woken by the USB interrupt, the period keeps the SD pipeline going
+static void task_usb(uint32_t events) {
+	usb_msc_poll();
+}
+
+static void task_console(uint32_t events) {
+	console_poll();
+	shell_poll();
+	// a running job goes on as long as the console has room for its output
+	if(shell_busy() && console_tx_free() >= SHELL_TX_RESERVE) {
+		sched_post(TASK_CONSOLE, TASK_EVENT_AGAIN);
+	}
+}
+
+static void task_sensors(uint32_t events) {
+	telemetry_sample samples[TELEMETRY_MAX_SAMPLES];
+
+	if(!sensors_poll() || !(telemetry_enabled() || usb_stream_active())) {
+		return;
+	}
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < sensors_count() && count < TELEMETRY_MAX_SAMPLES; i++) {
+		int16_t temperature;
+		uint32_t timestamp;
+		if(sensors_read(i, &temperature, &timestamp)) {
+			samples[count].index = i;
+			samples[count].temperature = temperature;
+			samples[count++].timestamp = timestamp;
+		}
+	}
+	if(count != 0 && usb_stream_active()) {
+		// raw records, the host does all the formatting
+		usb_stream_write(STREAM_RECORD_SAMPLES, samples, count * sizeof(samples[0]));
+	}
+	if(count != 0 && telemetry_enabled()) {
+		telemetry_send_samples(samples, count);
+	}
+}
+
+// the button is a shortcut for listing the root directory
+static void task_button(uint32_t events) {
+	static uint32_t last_press = 0;
+	uint32_t now = HAL_GetTick();
+
+	if(now - last_press < BUTTON_HOLDOFF_MS) {
+		return;
+	}
+	last_press = now;
+	if(!shell_busy()) {
+		printf("ls\n");
+		shell_execute("ls");
+		sched_post(TASK_CONSOLE, TASK_EVENT_AGAIN);
+	}
+}
+
+// drains deferred log records as text or as telemetry frames
+static void idle_log(void) {
+	log_record rec;
+	for(uint32_t n = 0; n < LOG_IDLE_RECORDS && console_tx_free() >= LOG_TX_RESERVE
+			&& log_peek(&rec); n++) {
+		if(telemetry_enabled()) {
+			telemetry_send_log(&rec);
+		} else {
+			log_print(&rec);
+		}
+		log_discard();
+	}
+}
+
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+	if(GPIO_Pin == USER_Btn_Pin) {
+		sched_post(TASK_BUTTON, TASK_EVENT_IRQ);
+	}
 }
 /* USER CODE END 0 */
 
@@ -90,6 +198,8 @@ int __io_getchar(void) {
  */
 int main(void) {
 	/* USER CODE BEGIN 1 */
+	crashdump_init();
+	memstat_init();
 	setvbuf(stdin, stdinbuffer, _IOLBF, sizeof(stdinbuffer));
 
 	/* USER CODE END 1 */
@@ -112,53 +222,51 @@ int main(void) {
 
 	/* Initialize all configured peripherals */
 	MX_GPIO_Init();
+	MX_DMA_Init();
 	MX_USART3_UART_Init();
 	MX_USB_OTG_FS_PCD_Init();
 	MX_TIM6_Init();
 	MX_SPI1_Init();
 	/* USER CODE BEGIN 2 */
+	profile_init();
+	console_init(&huart3);
+	log_init();
+	usb_device_init(&hpcd_USB_OTG_FS);
 	printf("---- PROGRAM START ----\n\n");
+	crashdump_report();
+
+	onewire_init(&htim6);
+	onewire_bus_init(&onewire_bus1, ONEWIRE_OUT_GPIO_Port, ONEWIRE_OUT_Pin,
+			ONEWIRE_IN_GPIO_Port, ONEWIRE_IN_Pin);
+	sensors_init();
+	printf("Found %d sensors\n", sensors_scan(&onewire_bus1, SENSORS_DEFAULT_PERIOD_MS));
+	telemetry_init();
+	shell_init(&onewire_bus1, SENSORS_DEFAULT_PERIOD_MS);
+
+#ifdef USE_FREERTOS
+	// interrupts that notify tasks must stay out of the kernel's critical sections
+	static const IRQn_Type task_irqs[] = {
+		DMA1_Stream1_IRQn, DMA1_Stream3_IRQn, USART3_IRQn, EXTI15_10_IRQn, OTG_FS_IRQn,
+	};
+	for(size_t i = 0; i < sizeof(task_irqs) / sizeof(task_irqs[0]); i++) {
+		HAL_NVIC_SetPriority(task_irqs[i], configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+	}
+#endif
+
+	sched_init();
+	sched_add(TASK_USB, "usb", task_usb, TASK_PERIOD_USB_MS);
+	sched_add(TASK_CONSOLE, "console", task_console, TASK_PERIOD_CONSOLE_MS);
+	sched_add(TASK_SENSORS, "sensors", task_sensors, TASK_PERIOD_SENSORS_MS);
+	sched_add(TASK_BUTTON, "button", task_button, 0);
+	sched_add_idle(idle_log);
 
 	/* USER CODE END 2 */
 
 	/* Infinite loop */
 	/* USER CODE BEGIN WHILE */
-	FATFS FatFs;
-	DIR dp;
-	FILINFO finfo;
-	FRESULT res;
-	uint32_t last_event = 0;
+	// tasks run from here on, sched_run does not return
+	sched_run();
 	while (1) {
-		if(HAL_GPIO_ReadPin(USER_Btn_GPIO_Port, USER_Btn_Pin) == GPIO_PIN_SET && last_event + 1000 < HAL_GetTick()) {
-			printf("\n");
-			last_event = HAL_GetTick();
-			
-			if((res = f_mount(&FatFs, "", 1) != FR_OK)) {
-				printf("Mount failed: %x\n", res);
-				continue;
-			}
-			if((res = f_opendir(&dp, "/") != FR_OK)) {
-				printf("Open dir failed: %x\n", res);
-				continue;
-			}
-
-			for(;;){
-				if((res = f_readdir(&dp, &finfo) != FR_OK)) {
-					printf("Read dir failed: %x\n", res);
-					Error_Handler();
-				}
-				if(finfo.fname[0] == 0) {
-					break;
-				}
-				printf("Name: %s\n", finfo.fname);
-				printf("Type: %s\n\n", (finfo.fattrib & AM_DIR) ? "Directory" : "File");
-			}
-
-			if(f_unmount("") != FR_OK) {
-				printf("Unmount failed\n");
-				Error_Handler();
-			}
-		}
 		/* USER CODE END WHILE */
 
 		/* USER CODE BEGIN 3 */
@@ -262,7 +370,7 @@ static void MX_TIM6_Init(void) {
 
 	/* USER CODE END TIM6_Init 1 */
 	htim6.Instance = TIM6;
-	htim6.Init.Prescaler = 83;
+	htim6.Init.Prescaler = 20;
 	htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
 	htim6.Init.Period = 65535;
 	htim6.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
@@ -345,6 +453,24 @@ static void MX_USB_OTG_FS_PCD_Init(void) {
 
 }
 
+/**
+ * Enable DMA controller clock
+ */
+static void MX_DMA_Init(void) {
+
+	/* DMA controller clock enable */
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	/* DMA interrupt init */
+	/* DMA1_Stream1_IRQn interrupt configuration */
+	HAL_NVIC_SetPriority(DMA1_Stream1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream1_IRQn);
+	/* DMA1_Stream3_IRQn interrupt configuration */
+	HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+
+}
+
 /**
  * @brief GPIO Initialization Function
  * @param None
@@ -422,6 +548,10 @@ static void MX_GPIO_Init(void) {
 	GPIO_InitStruct.Pull = GPIO_NOPULL;
 	HAL_GPIO_Init(ONEWIRE_IN_GPIO_Port, &GPIO_InitStruct);
 
+	/* EXTI interrupt init*/
+	HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+
 	/* USER CODE BEGIN MX_GPIO_Init_2 */
 	/* USER CODE END MX_GPIO_Init_2 */
 }
@@ -437,9 +567,7 @@ static void MX_GPIO_Init(void) {
 void Error_Handler(void) {
 	/* USER CODE BEGIN Error_Handler_Debug */
 	/* User can add his own implementation to report the HAL error return state */
-	__disable_irq();
-	while (1) {
-	}
+	crashdump_error((uintptr_t)__builtin_return_address(0));
 	/* USER CODE END Error_Handler_Debug */
 }
 
@@ -0,0 +1,89 @@
+#include "memstat.h"
+#include "main.h"
+
+#define MEMSTAT_PAINT 0xa5a5a5a5U
+// left unpainted under the stack pointer of memstat_init, for its own calls
+#define MEMSTAT_PAINT_MARGIN 64
+
+/* Linker script symbols, only their addresses are meaningful */
+extern uint8_t _end;
+extern uint8_t _estack;
+extern uint8_t _Min_Stack_Size;
+extern uint8_t _Stack_Guard_Size;
+
+static uint8_t memstat_guarded = 0;
+
+/*
+ * Private function prototypes
+ */
+static uint32_t *memstat_stack_bottom(void);
+static void memstat_paint(void);
+static void memstat_guard(void);
+
+/*
+ * Private functions
+ */
+static uint32_t *memstat_stack_bottom(void) {
+	return (uint32_t *)(&_estack - (uintptr_t)&_Min_Stack_Size);
+}
+
+static void memstat_paint(void) {
+	uint32_t *end = (uint32_t *)(uintptr_t)((__get_MSP() - MEMSTAT_PAINT_MARGIN) & ~3U);
+	for(uint32_t *p = memstat_stack_bottom(); p < end; p++) {
+		*p = MEMSTAT_PAINT;
+	}
+}
+
+// The region has to be a power of two of at least 32 bytes, aligned to its size
+static void memstat_guard(void) {
+	uint32_t size = (uintptr_t)&_Stack_Guard_Size;
+	uint32_t base = (uintptr_t)memstat_stack_bottom() - size;
+
+	if(size < 32 || (size & (size - 1)) != 0 || (base & (size - 1)) != 0) {
+		return;
+	}
+
+	MPU_Region_InitTypeDef region = { 0 };
+	region.Enable = MPU_REGION_ENABLE;
+	region.Number = MPU_REGION_NUMBER0;
+	region.BaseAddress = base;
+	region.Size = 30 - __builtin_clz(size);		// 2^(Size + 1) bytes
+	region.SubRegionDisable = 0;
+	region.TypeExtField = MPU_TEX_LEVEL0;
+	region.AccessPermission = MPU_REGION_NO_ACCESS;
+	region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+	region.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+	region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+	region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+
+	HAL_MPU_Disable();
+	HAL_MPU_ConfigRegion(&region);
+	// everything else keeps the default memory map, MemManage faults are enabled
+	HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+	memstat_guarded = 1;
+}
+
+/*
+ * Public functions
+ */
+
+// First thing in main(), while the stack holds little more than main's frame
+void memstat_init(void) {
+	memstat_paint();
+	memstat_guard();
+}
+
+void memstat_get(memstat_info *info) {
+	uint32_t *bottom = memstat_stack_bottom();
+	uint32_t *p = bottom;
+
+	// the paint is contiguous from the bottom up to the deepest point reached
+	while(p < (uint32_t *)&_estack && *p == MEMSTAT_PAINT) {
+		p++;
+	}
+	info->stack_size = (uintptr_t)&_Min_Stack_Size;
+	info->stack_peak = (uintptr_t)&_estack - (uintptr_t)p;
+	info->heap_size = (uintptr_t)bottom - (uintptr_t)&_Stack_Guard_Size - (uintptr_t)&_end;
+	sysmem_heap_stats(&info->heap_used, &info->heap_peak, &info->heap_failures);
+	info->guarded = memstat_guarded;
+}
@@ -1,20 +1,24 @@
 // https://www.analog.com/en/technical-articles/1wire-communication-through-software.html
-#include <stdio.h>
 #include <inttypes.h>
 #include <string.h>
 #include "onewire.h"
+#include "log.h"
 #include "main.h"
-
-#define DELAY_A 6
-#define DELAY_B 64
-#define DELAY_C 60
-#define DELAY_D 10
-#define DELAY_E 9
-#define DELAY_F 55
-#define DELAY_G 0
-#define DELAY_H 480
-#define DELAY_I 70
-#define DELAY_J 410
+#include "profile.h"
+
+/* TIM6 runs at ONEWIRE_TICKS_PER_US, so overdrive delays can be expressed */
+#define US(x) ((uint16_t)((x) * ONEWIRE_TICKS_PER_US))
+
+#define DELAY_A (onewire_timings[bus->speed].a)
+#define DELAY_B (onewire_timings[bus->speed].b)
+#define DELAY_C (onewire_timings[bus->speed].c)
+#define DELAY_D (onewire_timings[bus->speed].d)
+#define DELAY_E (onewire_timings[bus->speed].e)
+#define DELAY_F (onewire_timings[bus->speed].f)
+#define DELAY_G (onewire_timings[bus->speed].g)
+#define DELAY_H (onewire_timings[bus->speed].h)
+#define DELAY_I (onewire_timings[bus->speed].i)
+#define DELAY_J (onewire_timings[bus->speed].j)
 
 #define ONEWIRE_CMD_CONVERT_T 0x44
 #define ONEWIRE_CMD_READ_SCRATCHPAD 0xbe
@@ -22,6 +26,9 @@
 
 #define ONEWIRE_SEARCH 0xf0
 #define ONEWIRE_MATCH_ROM 0x55
+#define ONEWIRE_SKIP_ROM 0xcc
+#define ONEWIRE_OVERDRIVE_SKIP_ROM 0x3c
+#define ONEWIRE_OVERDRIVE_MATCH_ROM 0x69
 
 #ifndef ONEWIRE_LOW
 #error "ONEWIRE_LOW not defined"
@@ -35,143 +42,234 @@
 #error "ONEWIRE_READ not defined"
 #endif
 
+#ifndef ONEWIRE_TIMER_COUNT
+#error "ONEWIRE_TIMER_COUNT not defined"
+#endif
+
+#ifndef ONEWIRE_PORT_WRITE
+#error "ONEWIRE_PORT_WRITE not defined"
+#endif
+
+#ifndef ONEWIRE_PORT_READ
+#error "ONEWIRE_PORT_READ not defined"
+#endif
+
+typedef struct {
+	uint16_t a, b, c, d, e, f, g, h, i, j;
+} onewire_timing_t;
+
 /*
  * Private function prototypes
  */
-static void onewire_delay_us(const uint32_t us);
-static void onewire_write_1(void);
-static void onewire_write_0(void);
-static void onewire_write_bit(uint8_t bit);
-static uint8_t onewire_read_bit(void);
-static uint8_t onewire_reset(void);
-static void onewire_write_byte(uint8_t byte);
-static void onewire_match_rom(uint64_t rom);
+static void onewire_delay(const uint16_t ticks);
+static void onewire_write_1(onewire_bus *bus);
+static void onewire_write_0(onewire_bus *bus);
+static void onewire_write_bit(onewire_bus *bus, uint8_t bit);
+static uint8_t onewire_read_bit(onewire_bus *bus);
+static uint8_t onewire_reset(onewire_bus *bus);
+static void onewire_write_byte(onewire_bus *bus, uint8_t byte);
+static void onewire_write_rom(onewire_bus *bus, uint64_t rom);
+static uint8_t onewire_match_rom(onewire_bus *bus, uint64_t rom);
+static uint8_t onewire_crc_byte(uint8_t crc, uint8_t data);
 static uint8_t onewire_calculate_crc(void *src, uint8_t byte_cnt);
-static uint8_t onewire_read_scratchpad(uint64_t rom, uint8_t dest[8]);
+static uint8_t onewire_check_rom_crc(uint64_t rom);
+static uint8_t onewire_read_scratchpad(onewire_bus *bus, uint64_t rom, uint8_t dest[8]);
+static onewire_device_speed *onewire_find_device(onewire_bus *bus, uint64_t rom);
+static void onewire_parallel_write_slot(onewire_parallel *group, uint16_t ones);
+static uint16_t onewire_parallel_read_slot(onewire_parallel *group);
+static uint16_t onewire_parallel_match_rom(onewire_parallel *group, const uint64_t *roms);
 
 /*
  * Private variables
  */
-static volatile uint16_t onewire_delay_counter = 0;
+// Standard and overdrive values from the recommended timing table of the app note above
+static const onewire_timing_t onewire_timings[] = {
+	[ONEWIRE_SPEED_STANDARD] = {
+		US(6), US(64), US(60), US(10), US(9), US(55), US(0), US(480), US(70), US(410)
+	},
+	[ONEWIRE_SPEED_OVERDRIVE] = {
+		US(1), US(7.5), US(7.5), US(2.5), US(1), US(7), US(2.5), US(70), US(8.5), US(40)
+	},
+};
+
 static TIM_HandleTypeDef *htim = NULL;
 
 /* 
  * Private functions
  */
-static void onewire_delay_us(const uint32_t us) {
+static void onewire_delay(const uint16_t ticks) {
 #ifdef DEBUG
 	assert(htim != NULL);
 #endif
-	if (us == 0) {
-		return;
-	}
-
-	onewire_delay_counter = us;
-	htim->Instance->CNT = 0;
-	HAL_TIM_Base_Start(htim);
-
-	while (htim->Instance->CNT < us - 1)
+	const uint16_t start = ONEWIRE_TIMER_COUNT(htim);
+	while ((uint16_t)(ONEWIRE_TIMER_COUNT(htim) - start) < ticks)
 		;
-
-	HAL_TIM_Base_Stop(htim);
 }
 
-static void onewire_write_1(void) {
-	ONEWIRE_LOW();
-	onewire_delay_us(DELAY_A);
-	ONEWIRE_RELEASE();
-	onewire_delay_us(DELAY_B);
+// Slots are kept free of interrupts, an overdrive slot is only a few microseconds long
+static void onewire_write_1(onewire_bus *bus) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_LOW(bus);
+	onewire_delay(DELAY_A);
+	ONEWIRE_RELEASE(bus);
+	__set_PRIMASK(primask);
+	onewire_delay(DELAY_B);
 }
 
-static void onewire_write_0(void) {
-	ONEWIRE_LOW();
-	onewire_delay_us(DELAY_C);
-	ONEWIRE_RELEASE();
-	onewire_delay_us(DELAY_D);
+static void onewire_write_0(onewire_bus *bus) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_LOW(bus);
+	onewire_delay(DELAY_C);
+	ONEWIRE_RELEASE(bus);
+	__set_PRIMASK(primask);
+	onewire_delay(DELAY_D);
 }
 
-static void onewire_write_bit(uint8_t bit) {
+static void onewire_write_bit(onewire_bus *bus, uint8_t bit) {
 	if (bit) {
-		onewire_write_1();
+		onewire_write_1(bus);
 	} else {
-		onewire_write_0();
+		onewire_write_0(bus);
 	}
 }
 
-static uint8_t onewire_read_bit(void) {
-	ONEWIRE_LOW();
-	onewire_delay_us(DELAY_A);
-	ONEWIRE_RELEASE();
-	onewire_delay_us(DELAY_E);
-	uint8_t result = ONEWIRE_READ();
-	onewire_delay_us(DELAY_F);
+static uint8_t onewire_read_bit(onewire_bus *bus) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_LOW(bus);
+	onewire_delay(DELAY_A);
+	ONEWIRE_RELEASE(bus);
+	onewire_delay(DELAY_E);
+	uint8_t result = ONEWIRE_READ(bus);
+	__set_PRIMASK(primask);
+	onewire_delay(DELAY_F);
 	return result;
 }
 
-static uint8_t onewire_reset(void) {
-	onewire_delay_us(DELAY_G);
-	ONEWIRE_LOW();
-	onewire_delay_us(DELAY_H);
-	ONEWIRE_RELEASE();
-	onewire_delay_us(DELAY_I);
-	uint8_t result = ONEWIRE_READ();
-	onewire_delay_us(DELAY_J);
-	return result;
+// returns 1 if any device answered with a presence pulse
+static uint8_t onewire_reset(onewire_bus *bus) {
+	if(bus->speed == ONEWIRE_SPEED_STANDARD) {
+		// every device leaves overdrive on a standard speed reset
+		bus->all_overdrive = 0;
+	}
+	onewire_delay(DELAY_G);
+	// a stretched low pulse drops devices out of overdrive, a late sample misses presence
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_LOW(bus);
+	onewire_delay(DELAY_H);
+	ONEWIRE_RELEASE(bus);
+	onewire_delay(DELAY_I);
+	uint8_t result = ONEWIRE_READ(bus);
+	__set_PRIMASK(primask);
+	onewire_delay(DELAY_J);
+	return !result;
 }
 
-static void onewire_write_byte(uint8_t byte) {
+static void onewire_write_byte(onewire_bus *bus, uint8_t byte) {
 	for (uint8_t i = 0; i < 8; i++) {
 		if (byte & 1) {
-			onewire_write_1();
+			onewire_write_1(bus);
 		} else {
-			onewire_write_0();
+			onewire_write_0(bus);
 		}
 		byte >>= 1;
 	}
 }
 
+static void onewire_write_rom(onewire_bus *bus, uint64_t rom) {
+	for(int i = 0; i < 8; i++) {
+		onewire_write_byte(bus, ((uint8_t*)&rom)[i]);
+	}
+}
+
+// returns 0 if nobody answered the reset
+static uint8_t onewire_match_rom(onewire_bus *bus, uint64_t rom) {
+	const onewire_speed speed = onewire_get_speed(bus, rom);
+
+	// after OVERDRIVE SKIP ROM untracked devices are at overdrive too
+	if((speed == ONEWIRE_SPEED_OVERDRIVE || bus->all_overdrive) && bus->speed == ONEWIRE_SPEED_OVERDRIVE) {
+		if(onewire_reset(bus)) {
+			onewire_write_byte(bus, ONEWIRE_MATCH_ROM);
+			onewire_write_rom(bus, rom);
+			return 1;
+		}
+		// devices fell back to standard speed, e.g. after a power glitch
+	}
 
-static void onewire_match_rom(uint64_t rom) {
-	onewire_reset();
-	onewire_write_byte(ONEWIRE_MATCH_ROM);
+	// a standard speed reset also drops every device out of overdrive
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	if(!onewire_reset(bus)) {
+		return 0;
+	}
 
+	if(speed == ONEWIRE_SPEED_OVERDRIVE) {
+		onewire_write_byte(bus, ONEWIRE_OVERDRIVE_MATCH_ROM);
+		bus->speed = ONEWIRE_SPEED_OVERDRIVE;
+	} else {
+		onewire_write_byte(bus, ONEWIRE_MATCH_ROM);
+	}
+	onewire_write_rom(bus, rom);
+	return 1;
+}
+
+static uint8_t onewire_crc_byte(uint8_t crc, uint8_t data) {
 	for(int i = 0; i < 8; i++) {
-		onewire_write_byte(((uint8_t*)&rom)[i]);
+		uint8_t new_bit = (data & 1) ^ (crc & 1);
+		crc = crc >> 1;
+		if(new_bit) {
+			crc ^= 0b10001100;
+		}
+		data >>= 1;
 	}
+	return crc;
 }
 
+// src holds the bytes in reverse order of transmission
 static uint8_t onewire_calculate_crc(void *src, uint8_t byte_cnt) {
 	uint8_t crc = 0;
 	for(size_t byte = 0; byte < byte_cnt; byte++) {
-		uint8_t data = ((uint8_t*)src)[byte_cnt - 1 -byte];
-		for(int i = 0; i < 8; i++) {
-			uint8_t new_bit = (data & 1) ^ (crc & 1);
-			crc = crc >> 1;
-			if(new_bit) {
-				crc ^= 0b10001100;
-			}
-			data >>= 1;
-		}
+		crc = onewire_crc_byte(crc, ((uint8_t*)src)[byte_cnt - 1 - byte]);
 	}
 
 	return crc;
 }
 
-static uint8_t onewire_read_scratchpad(uint64_t rom, uint8_t dest[8]) {
-	onewire_match_rom(rom);
+// the ROM is stored in transmission order, family code in the lowest byte
+static uint8_t onewire_check_rom_crc(uint64_t rom) {
+	uint8_t crc = 0;
+	for(int i = 0; i < 7; i++) {
+		crc = onewire_crc_byte(crc, (rom >> (8 * i)) & 0xff);
+	}
+	return rom != 0 && crc == (rom >> 56);
+}
+
+static uint8_t onewire_read_scratchpad(onewire_bus *bus, uint64_t rom, uint8_t dest[8]) {
+	if(!onewire_match_rom(bus, rom)) {
+		return 0;
+	}
 
-	onewire_write_byte(ONEWIRE_CMD_READ_SCRATCHPAD);
+	onewire_write_byte(bus, ONEWIRE_CMD_READ_SCRATCHPAD);
 	uint8_t data[9];
 	for(int i = 8; i >= 0; i--) {
 		uint8_t *curr_byte = data + i;
 		for(int j = 0; j < 8; j++) {
-			*curr_byte = (*curr_byte >> 1) | (onewire_read_bit() << 7);
+			*curr_byte = (*curr_byte >> 1) | (onewire_read_bit(bus) << 7);
 		}
 	}
 
 	uint8_t crc = onewire_calculate_crc(data + 1, 8);
 
 	if(crc != data[0]) {
+		// overdrive is marginal on long lines, retry once at standard speed
+		if(bus->speed == ONEWIRE_SPEED_OVERDRIVE) {
+			LOG("onewire: scratchpad CRC error at overdrive, rom %08lx%08lx\n",
+					(unsigned long)(rom >> 32), (unsigned long)rom);
+			onewire_set_speed(bus, rom, ONEWIRE_SPEED_STANDARD);
+			return onewire_read_scratchpad(bus, rom, dest);
+		}
 		return 0;
 	}
 
@@ -183,87 +281,453 @@ static uint8_t onewire_read_scratchpad(uint64_t rom, uint8_t dest[8]) {
 	return 1;
 }
 
+static onewire_device_speed *onewire_find_device(onewire_bus *bus, uint64_t rom) {
+	for(int i = 0; i < ONEWIRE_MAX_DEVICES; i++) {
+		if(bus->devices[i].rom == rom) {
+			return &bus->devices[i];
+		}
+	}
+	return NULL;
+}
+
+static void onewire_parallel_write_slot(onewire_parallel *group, uint16_t ones) {
+	const onewire_timing_t *timing = &onewire_timings[ONEWIRE_SPEED_STANDARD];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_PORT_WRITE(group->out_port, (uint32_t)group->out_mask << 16);
+	onewire_delay(timing->a);
+	ONEWIRE_PORT_WRITE(group->out_port, ones);
+	onewire_delay(timing->c - timing->a);
+	ONEWIRE_PORT_WRITE(group->out_port, group->out_mask);
+	__set_PRIMASK(primask);
+	onewire_delay(timing->d);
+}
+
+static uint16_t onewire_parallel_read_slot(onewire_parallel *group) {
+	const onewire_timing_t *timing = &onewire_timings[ONEWIRE_SPEED_STANDARD];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_PORT_WRITE(group->out_port, (uint32_t)group->out_mask << 16);
+	onewire_delay(timing->a);
+	ONEWIRE_PORT_WRITE(group->out_port, group->out_mask);
+	onewire_delay(timing->e);
+	uint16_t result = ONEWIRE_PORT_READ(group->in_port);
+	__set_PRIMASK(primask);
+	onewire_delay(timing->f);
+	return result;
+}
+
+// roms == NULL addresses the only device of each bus with SKIP ROM
+static uint16_t onewire_parallel_match_rom(onewire_parallel *group, const uint64_t *roms) {
+	uint16_t presence = onewire_parallel_reset(group);
+	if(roms == NULL) {
+		onewire_parallel_write_byte(group, ONEWIRE_SKIP_ROM);
+		return presence;
+	}
+
+	onewire_parallel_write_byte(group, ONEWIRE_MATCH_ROM);
+	uint8_t bytes[ONEWIRE_PARALLEL_MAX_BUSES];
+	for(int i = 0; i < 8; i++) {
+		for(uint8_t bus = 0; bus < group->count; bus++) {
+			bytes[bus] = ((const uint8_t*)&roms[bus])[i];
+		}
+		onewire_parallel_write_bytes(group, bytes);
+	}
+	return presence;
+}
+
 /*
  * Public functions
  */
 void onewire_init(TIM_HandleTypeDef *htim_) {
 	htim = htim_;
+	HAL_TIM_Base_Start(htim);
+}
+
+void onewire_bus_init(onewire_bus *bus, GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin) {
+	memset(bus, 0, sizeof(*bus));
+	bus->out_port = out_port;
+	bus->out_pin = out_pin;
+	bus->in_port = in_port;
+	bus->in_pin = in_pin;
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	ONEWIRE_RELEASE(bus);
 }
 
-//TODO: check CRC
 //returns 0 if device cnt on bus != 1
-uint64_t onewire_get_single_address(void) {
-	onewire_reset();
-	onewire_write_byte(ONEWIRE_SEARCH);
+uint64_t onewire_get_single_address(onewire_bus *bus) {
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	onewire_reset(bus);
+	onewire_write_byte(bus, ONEWIRE_SEARCH);
 	uint64_t rom = 0;
 	for(uint8_t i = 0; i < 64; i++) {
-		uint8_t b1 = onewire_read_bit();
-		uint8_t b2 = onewire_read_bit();
+		uint8_t b1 = onewire_read_bit(bus);
+		uint8_t b2 = onewire_read_bit(bus);
 		if(b1 == b2) {
 			return 0;
 		}
 		rom = (rom >> 1) | ((uint64_t)b1 << 63);
-		onewire_write_bit(b1);
+		onewire_write_bit(bus, b1);
 	}
-	return rom;
+	return onewire_check_rom_crc(rom) ? rom : 0;
 }
 
-void onewire_request_conversion(uint64_t rom) {
-	onewire_match_rom(rom);
-	onewire_write_byte(ONEWIRE_CMD_CONVERT_T);
+// Search ROM as described in Maxim AN187, returns the number of devices stored in roms
+uint8_t onewire_search(onewire_bus *bus, uint64_t *roms, uint8_t max_count) {
+	uint8_t count = 0;
+	uint8_t last_discrepancy = 0;
+	uint64_t rom = 0;
+
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	while(count < max_count) {
+		if(!onewire_reset(bus)) {
+			break;
+		}
+		onewire_write_byte(bus, ONEWIRE_SEARCH);
+
+		uint8_t last_zero = 0;
+		for(uint8_t bit = 1; bit <= 64; bit++) {
+			uint8_t b1 = onewire_read_bit(bus);
+			uint8_t b2 = onewire_read_bit(bus);
+			uint8_t direction;
+
+			if(b1 && b2) {
+				return count; // nobody answered, bus glitch
+			} else if(b1 != b2) {
+				direction = b1;
+			} else if(bit < last_discrepancy) {
+				direction = (rom >> (bit - 1)) & 1;
+			} else {
+				direction = bit == last_discrepancy;
+			}
+
+			if(b1 == b2 && direction == 0) {
+				last_zero = bit;
+			}
+
+			if(direction) {
+				rom |= (uint64_t)1 << (bit - 1);
+			} else {
+				rom &= ~((uint64_t)1 << (bit - 1));
+			}
+			onewire_write_bit(bus, direction);
+		}
+
+		if(onewire_check_rom_crc(rom)) {
+			roms[count++] = rom;
+		}
+
+		last_discrepancy = last_zero;
+		if(last_discrepancy == 0) {
+			break;
+		}
+	}
+	return count;
 }
 
-uint8_t onewire_get_request_status() {
-	return onewire_read_bit();
+void onewire_request_conversion(onewire_bus *bus, uint64_t rom) {
+	PROFILE_BEGIN(ow_convert);
+	onewire_match_rom(bus, rom);
+	onewire_write_byte(bus, ONEWIRE_CMD_CONVERT_T);
+	PROFILE_END(ow_convert);
 }
 
-int16_t onewire_read_temperature(uint64_t rom) {
-	uint8_t scratchpad[8];
-	if(!onewire_read_scratchpad(rom, scratchpad)) {
+uint8_t onewire_get_request_status(onewire_bus *bus) {
+	return onewire_read_bit(bus);
+}
+
+int16_t onewire_read_temperature(onewire_bus *bus, uint64_t rom) {
+	int16_t temp;
+	if(!onewire_read_temperature_checked(bus, rom, &temp)) {
 		return 0;
 	}
 
-	return (scratchpad[6] << 8) | scratchpad[7];
+	return temp;
 }
 
-void onewire_format_temperature(int16_t temp, char *dest, size_t len) {
-	int16_t temp_whole = temp / 16;
-	int16_t temp_frac = temp & 0xf;
+// unlike onewire_read_temperature, a CRC error can be told apart from 0 degrees
+uint8_t onewire_read_temperature_checked(onewire_bus *bus, uint64_t rom, int16_t *temp) {
+	uint8_t scratchpad[8];
+	PROFILE_BEGIN(ow_read);
+	uint8_t ok = onewire_read_scratchpad(bus, rom, scratchpad);
+	PROFILE_END(ow_read);
+	if(!ok) {
+		return 0;
+	}
 
-	const uint16_t fractions[] = {10000 / 16, 10000 / 8, 10000 / 4, 10000 / 2};
-	uint16_t fractional_sum = 0;
-	for(int i = 0; i < 4; i++) {
-		fractional_sum += fractions[i] * ((temp_frac >> i) & 1);
+	*temp = (scratchpad[6] << 8) | scratchpad[7];
+	return 1;
+}
+
+// Integer only, writes the shortest form with at least one fractional digit ("-10.5", "25.0625").
+// Returns the length of the string without the terminator.
+size_t onewire_format_temperature(int16_t temp, char *dest, size_t len) {
+	static const char fractions[16][5] = {
+		"0", "0625", "125", "1875", "25", "3125", "375", "4375",
+		"5", "5625", "625", "6875", "75", "8125", "875", "9375",
+	};
+	char buf[ONEWIRE_TEMPERATURE_MAX_LEN];
+	char digits[4];
+	size_t n = 0;
+
+	if(len == 0) {
+		return 0;
 	}
 
+	uint16_t magnitude = temp < 0 ? -(int32_t)temp : temp;
+	uint16_t whole = magnitude >> 4;
 	if(temp < 0) {
-		if(fractional_sum)
-			fractional_sum = 10000 - fractional_sum;
+		buf[n++] = '-';
+	}
 
-		snprintf(dest, len, "-%d.%04d", -temp_whole, fractional_sum);
-	} else {
-		snprintf(dest, len, "%d.%04d", temp_whole, fractional_sum);
+	uint8_t digit_cnt = 0;
+	do {
+		digits[digit_cnt++] = '0' + whole % 10;
+		whole /= 10;
+	} while(whole);
+	while(digit_cnt) {
+		buf[n++] = digits[--digit_cnt];
 	}
 
-	for(size_t i = strlen(dest) - 1; i > 0; i--) {
-		if(dest[i] == '0' && dest[i - 1] != '.') {
-			dest[i] = '\0';
-		} else {
+	buf[n++] = '.';
+	for(const char *frac = fractions[magnitude & 0xf]; *frac; frac++) {
+		buf[n++] = *frac;
+	}
+
+	if(n > len - 1) {
+		n = len - 1;
+	}
+	memcpy(dest, buf, n);
+	dest[n] = '\0';
+	return n;
+}
+
+// Formats count readings separated by sep into one string, stops before a
+// reading that would not fit. Returns the length without the terminator.
+size_t onewire_format_temperatures(const int16_t *temps, size_t count, char sep,
+		char *dest, size_t len) {
+	size_t n = 0;
+
+	if(len == 0) {
+		return 0;
+	}
+	dest[0] = '\0';
+
+	for(size_t i = 0; i < count; i++) {
+		// worst case reading plus separator must fit before the terminator
+		if(len - n < ONEWIRE_TEMPERATURE_MAX_LEN + 1) {
 			break;
 		}
+		if(i != 0) {
+			dest[n++] = sep;
+		}
+		n += onewire_format_temperature(temps[i], dest + n, len - n);
 	}
+	return n;
 }
 
-uint8_t onewire_set_resolution(uint64_t rom, onewire_resolution resolution) {
+uint8_t onewire_get_resolution(onewire_bus *bus, uint64_t rom, onewire_resolution *resolution) {
 	uint8_t scratchpad[8];
-	if(!onewire_read_scratchpad(rom, scratchpad))
+	if(!onewire_read_scratchpad(bus, rom, scratchpad))
+		return 0;
+
+	*resolution = scratchpad[3] | 0x1f;
+	return 1;
+}
+
+// Worst case Tconv from the DS18B20 datasheet
+uint16_t onewire_conversion_time_ms(onewire_resolution resolution) {
+	const uint16_t times[] = {94, 188, 375, 750};
+	return times[(resolution >> 5) & 3];
+}
+
+uint8_t onewire_set_resolution(onewire_bus *bus, uint64_t rom, onewire_resolution resolution) {
+	uint8_t scratchpad[8];
+	if(!onewire_read_scratchpad(bus, rom, scratchpad))
 		return 0;
 
 	scratchpad[3] = resolution;
-	onewire_match_rom(rom);
-	onewire_write_byte(ONEWIRE_CMD_WRITE_SCRATCHPAD);
+	onewire_match_rom(bus, rom);
+	onewire_write_byte(bus, ONEWIRE_CMD_WRITE_SCRATCHPAD);
 	for(int i = 2; i >= 0; i--) {
-		onewire_write_byte(scratchpad[3 + i]);
+		onewire_write_byte(bus, scratchpad[3 + i]);
+	}
+	return 1;
+}
+
+onewire_speed onewire_get_speed(onewire_bus *bus, uint64_t rom) {
+	onewire_device_speed *dev = onewire_find_device(bus, rom);
+	return dev != NULL ? dev->speed : ONEWIRE_SPEED_STANDARD;
+}
+
+// Switches a single device to overdrive and checks that it still answers,
+// devices that do not are kept at standard speed. Returns the speed in use.
+onewire_speed onewire_set_speed(onewire_bus *bus, uint64_t rom, onewire_speed speed) {
+	onewire_device_speed *dev = onewire_find_device(bus, rom);
+
+	if(speed == ONEWIRE_SPEED_STANDARD) {
+		if(dev != NULL) {
+			dev->rom = 0;
+			dev->speed = ONEWIRE_SPEED_STANDARD;
+		}
+		if(bus->speed == ONEWIRE_SPEED_OVERDRIVE) {
+			bus->speed = ONEWIRE_SPEED_STANDARD;
+			onewire_reset(bus);
+		}
+		return ONEWIRE_SPEED_STANDARD;
+	}
+
+	if(dev == NULL) {
+		dev = onewire_find_device(bus, 0);
+		if(dev == NULL) {
+			return ONEWIRE_SPEED_STANDARD;
+		}
+	}
+	dev->rom = rom;
+	dev->speed = ONEWIRE_SPEED_OVERDRIVE;
+
+	// force OVERDRIVE MATCH ROM, then check presence at overdrive speed
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	if(onewire_match_rom(bus, rom) && onewire_reset(bus)) {
+		return ONEWIRE_SPEED_OVERDRIVE;
+	}
+
+	dev->rom = 0;
+	dev->speed = ONEWIRE_SPEED_STANDARD;
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	onewire_reset(bus);
+	return ONEWIRE_SPEED_STANDARD;
+}
+
+// Puts every overdrive capable device on the bus into overdrive at once,
+// returns 0 if none of them answered at the new speed. Devices are then
+// addressed at overdrive until a standard speed reset, a standard only part
+// is found through the CRC fallback of onewire_read_scratchpad.
+uint8_t onewire_overdrive_skip_rom(onewire_bus *bus) {
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	if(!onewire_reset(bus)) {
+		return 0;
+	}
+	onewire_write_byte(bus, ONEWIRE_OVERDRIVE_SKIP_ROM);
+	bus->speed = ONEWIRE_SPEED_OVERDRIVE;
+	if(onewire_reset(bus)) {
+		bus->all_overdrive = 1;
+		return 1;
+	}
+
+	bus->speed = ONEWIRE_SPEED_STANDARD;
+	onewire_reset(bus);
+	return 0;
+}
+
+uint8_t onewire_parallel_init(onewire_parallel *group, GPIO_TypeDef *out_port,
+		const uint16_t *out_pins, GPIO_TypeDef *in_port, const uint16_t *in_pins,
+		uint8_t count) {
+	if(count == 0 || count > ONEWIRE_PARALLEL_MAX_BUSES) {
+		return 0;
+	}
+
+	memset(group, 0, sizeof(*group));
+	group->out_port = out_port;
+	group->in_port = in_port;
+	group->count = count;
+	for(uint8_t bus = 0; bus < count; bus++) {
+		group->out_pins[bus] = out_pins[bus];
+		group->in_pins[bus] = in_pins[bus];
+		group->out_mask |= out_pins[bus];
 	}
+	ONEWIRE_PORT_WRITE(group->out_port, group->out_mask);
 	return 1;
 }
+
+// returns a mask with bit n set if bus n has at least one device
+uint16_t onewire_parallel_reset(onewire_parallel *group) {
+	const onewire_timing_t *timing = &onewire_timings[ONEWIRE_SPEED_STANDARD];
+	onewire_delay(timing->g);
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ONEWIRE_PORT_WRITE(group->out_port, (uint32_t)group->out_mask << 16);
+	onewire_delay(timing->h);
+	ONEWIRE_PORT_WRITE(group->out_port, group->out_mask);
+	onewire_delay(timing->i);
+	uint16_t in = ONEWIRE_PORT_READ(group->in_port);
+	__set_PRIMASK(primask);
+	onewire_delay(timing->j);
+
+	uint16_t presence = 0;
+	for(uint8_t bus = 0; bus < group->count; bus++) {
+		if((in & group->in_pins[bus]) == 0) {
+			presence |= 1 << bus;
+		}
+	}
+	return presence;
+}
+
+void onewire_parallel_write_byte(onewire_parallel *group, uint8_t byte) {
+	for(uint8_t i = 0; i < 8; i++) {
+		onewire_parallel_write_slot(group, (byte & 1) ? group->out_mask : 0);
+		byte >>= 1;
+	}
+}
+
+// bytes[n] is sent on bus n
+void onewire_parallel_write_bytes(onewire_parallel *group, const uint8_t *bytes) {
+	for(uint8_t i = 0; i < 8; i++) {
+		uint16_t ones = 0;
+		for(uint8_t bus = 0; bus < group->count; bus++) {
+			if((bytes[bus] >> i) & 1) {
+				ones |= group->out_pins[bus];
+			}
+		}
+		onewire_parallel_write_slot(group, ones);
+	}
+}
+
+// bytes[n] receives the byte read from bus n
+void onewire_parallel_read_bytes(onewire_parallel *group, uint8_t *bytes) {
+	memset(bytes, 0, group->count);
+	for(uint8_t i = 0; i < 8; i++) {
+		uint16_t in = onewire_parallel_read_slot(group);
+		for(uint8_t bus = 0; bus < group->count; bus++) {
+			if(in & group->in_pins[bus]) {
+				bytes[bus] |= 1 << i;
+			}
+		}
+	}
+}
+
+// roms[n] selects the device on bus n, roms == NULL uses SKIP ROM everywhere
+uint16_t onewire_parallel_request_conversion(onewire_parallel *group, const uint64_t *roms) {
+	uint16_t presence = onewire_parallel_match_rom(group, roms);
+	onewire_parallel_write_byte(group, ONEWIRE_CMD_CONVERT_T);
+	return presence;
+}
+
+// returns a mask with bit n set if temps[n] passed the CRC check
+uint16_t onewire_parallel_read_temperature(onewire_parallel *group, const uint64_t *roms,
+		int16_t *temps) {
+	uint8_t data[ONEWIRE_PARALLEL_MAX_BUSES][9];
+	uint8_t bytes[ONEWIRE_PARALLEL_MAX_BUSES];
+
+	onewire_parallel_match_rom(group, roms);
+	onewire_parallel_write_byte(group, ONEWIRE_CMD_READ_SCRATCHPAD);
+	// same reversed layout as onewire_read_scratchpad
+	for(int i = 8; i >= 0; i--) {
+		onewire_parallel_read_bytes(group, bytes);
+		for(uint8_t bus = 0; bus < group->count; bus++) {
+			data[bus][i] = bytes[bus];
+		}
+	}
+
+	uint16_t valid = 0;
+	for(uint8_t bus = 0; bus < group->count; bus++) {
+		if(onewire_calculate_crc(data[bus] + 1, 8) == data[bus][0]) {
+			temps[bus] = (data[bus][7] << 8) | data[bus][8];
+			valid |= 1 << bus;
+		} else {
+			temps[bus] = 0;
+		}
+	}
+	return valid;
+}
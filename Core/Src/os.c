@@ -0,0 +1,98 @@
+#include "os.h"
+#include "main.h"
+
+/*
+ * Public functions
+ */
+uint8_t os_running(void) {
+#ifdef USE_FREERTOS
+	return xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+#else
+	return 0;
+#endif
+}
+
+uint8_t os_in_isr(void) {
+	return (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
+}
+
+// Not for interrupts, which pass through unlocked
+void os_mutex_lock(os_mutex *mutex) {
+#ifdef USE_FREERTOS
+	if(!os_running() || os_in_isr()) {
+		return;
+	}
+	if(mutex->handle == NULL) {
+		taskENTER_CRITICAL();
+		if(mutex->handle == NULL) {
+			mutex->handle = xSemaphoreCreateMutexStatic(&mutex->buffer);
+		}
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreTake(mutex->handle, portMAX_DELAY);
+#endif
+}
+
+void os_mutex_unlock(os_mutex *mutex) {
+#ifdef USE_FREERTOS
+	if(!os_running() || os_in_isr()) {
+		return;
+	}
+	xSemaphoreGive(mutex->handle);
+#endif
+}
+
+/*
+ * Blocks the calling task until os_event_signal or the timeout. A signal
+ * may also be left over from an earlier wait, so callers recheck whatever
+ * they are waiting for.
+ */
+void os_event_wait(os_event *event, uint32_t timeout_ms) {
+#ifdef USE_FREERTOS
+	if(!os_running() || os_in_isr()) {
+		return;
+	}
+	event->waiter = xTaskGetCurrentTaskHandle();
+	ulTaskNotifyTakeIndexed(OS_NOTIFY_DRIVER, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+	event->waiter = NULL;
+#endif
+}
+
+// Safe from interrupts
+void os_event_signal(os_event *event) {
+#ifdef USE_FREERTOS
+	TaskHandle_t waiter = event->waiter;
+	if(waiter == NULL) {
+		return;
+	}
+	if(os_in_isr()) {
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveIndexedFromISR(waiter, OS_NOTIFY_DRIVER, &woken);
+		portYIELD_FROM_ISR(woken);
+	} else {
+		xTaskNotifyGiveIndexed(waiter, OS_NOTIFY_DRIVER);
+	}
+#endif
+}
+
+#ifdef USE_FREERTOS
+/*
+ * Kernel hooks
+ */
+void vApplicationStackOverflowHook(TaskHandle_t task, char *name) {
+	Error_Handler();
+}
+
+void vApplicationMallocFailedHook(void) {
+	Error_Handler();
+}
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *stack_size) {
+	static StaticTask_t idle_tcb;
+	static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+
+	*tcb = &idle_tcb;
+	*stack = idle_stack;
+	*stack_size = configMINIMAL_STACK_SIZE;
+}
+#endif
@@ -0,0 +1,79 @@
+#include "pool.h"
+#include "main.h"
+#include "ff.h"
+#include "telemetry.h"
+
+/*
+ * Private variables
+ */
+static pool *pools = NULL;
+
+/*
+ * Application pools
+ */
+POOL_DEFINE(pool_fil, sizeof(FIL), POOL_FIL_COUNT);
+POOL_DEFINE(pool_dir, sizeof(DIR), POOL_DIR_COUNT);
+POOL_DEFINE(pool_sector, POOL_SECTOR_SIZE, POOL_SECTOR_COUNT);
+POOL_DEFINE(pool_frame, TELEMETRY_BUFFER_SIZE, POOL_FRAME_COUNT);
+
+/*
+ * Public functions
+ */
+
+// Returns NULL if every block is in use
+void *pool_alloc(pool *p) {
+	pool_block *block = NULL;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(!p->registered) {
+		p->registered = 1;
+		p->next = pools;
+		pools = p;
+	}
+	if(p->free != NULL) {
+		block = p->free;
+		p->free = block->next;
+	} else if(p->fresh < p->count) {
+		block = (pool_block *)(p->storage + (uint32_t)p->fresh++ * p->block_size);
+	}
+	if(block != NULL) {
+		p->allocs++;
+		if(++p->used > p->peak) {
+			p->peak = p->used;
+		}
+	} else {
+		p->failures++;
+	}
+	__set_PRIMASK(primask);
+	return block;
+}
+
+// block must come from p, NULL is ignored
+void pool_free(pool *p, void *block) {
+	if(block == NULL) {
+		return;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	((pool_block *)block)->next = p->free;
+	p->free = block;
+	p->used--;
+	__set_PRIMASK(primask);
+}
+
+const pool *pool_first(void) {
+	return pools;
+}
+
+// Clears the statistics, blocks in use stay counted
+void pool_reset(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for(pool *p = pools; p != NULL; p = p->next) {
+		p->peak = p->used;
+		p->allocs = 0;
+		p->failures = 0;
+	}
+	__set_PRIMASK(primask);
+}
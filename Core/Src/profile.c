@@ -0,0 +1,91 @@
+#include <string.h>
+#include "profile.h"
+#include "main.h"
+
+/*
+ * Private variables
+ */
+static profile_scope *profile_scopes = NULL;
+static uint32_t profile_cost = 0;
+
+/*
+ * Public functions
+ */
+void profile_init(void) {
+#if PROFILE_ENABLE
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// cycles between the two counter reads of an empty scope, subtracted from every sample
+	uint32_t start = DWT->CYCCNT;
+	profile_cost = DWT->CYCCNT - start;
+#endif
+}
+
+// Called by PROFILE_END, safe from interrupts
+void profile_record(profile_scope *scope, uint32_t cycles) {
+	cycles = cycles > profile_cost ? cycles - profile_cost : 0;
+
+	uint32_t bucket = cycles >> PROFILE_HIST_SHIFT;
+	if(bucket != 0) {
+		bucket = 32 - __builtin_clz(bucket);
+		if(bucket >= PROFILE_HIST_BUCKETS) {
+			bucket = PROFILE_HIST_BUCKETS - 1;
+		}
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(!scope->registered) {
+		scope->registered = 1;
+		scope->next = profile_scopes;
+		profile_scopes = scope;
+	}
+	scope->count++;
+	scope->total += cycles;
+	if(cycles < scope->min) {
+		scope->min = cycles;
+	}
+	if(cycles > scope->max) {
+		scope->max = cycles;
+	}
+	scope->hist[bucket]++;
+	__set_PRIMASK(primask);
+}
+
+// Clears the statistics, scopes stay registered
+void profile_reset(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for(profile_scope *scope = profile_scopes; scope != NULL; scope = scope->next) {
+		scope->count = 0;
+		scope->total = 0;
+		scope->min = UINT32_MAX;
+		scope->max = 0;
+		memset(scope->hist, 0, sizeof(scope->hist));
+	}
+	__set_PRIMASK(primask);
+}
+
+// Most recently registered first, walk on with scope->next
+const profile_scope *profile_first(void) {
+	return profile_scopes;
+}
+
+const profile_scope *profile_find(const char *name) {
+	for(const profile_scope *scope = profile_scopes; scope != NULL; scope = scope->next) {
+		if(strcmp(scope->name, name) == 0) {
+			return scope;
+		}
+	}
+	return NULL;
+}
+
+uint32_t profile_overhead(void) {
+	return profile_cost;
+}
+
+uint32_t profile_cycles_to_us(uint32_t cycles) {
+	return cycles / (SystemCoreClock / 1000000);
+}
@@ -0,0 +1,321 @@
+#include <string.h>
+#include "sched.h"
+#include "main.h"
+#include "os.h"
+
+#ifdef USE_FREERTOS
+// kernel threads all share one priority, like the round robin without the kernel
+#define SCHED_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+
+/*
+ * Private function prototypes
+ */
+static uint32_t sched_cycles(void);
+static uint8_t sched_ready(const sched_task *task, uint32_t now);
+static void sched_dispatch(sched_task *task, uint32_t now);
+#ifdef USE_FREERTOS
+static void sched_thread(void *arg);
+static void sched_idle_thread(void *arg);
+#else
+static sched_task *sched_next(uint32_t now);
+static uint8_t sched_pending(uint32_t now);
+static void sched_idle(void);
+#endif
+
+/*
+ * Private variables
+ */
+static sched_task sched_tasks[SCHED_MAX_TASKS];
+static sched_idle_hook sched_idle_hooks[SCHED_MAX_IDLE_HOOKS];
+static uint8_t sched_idle_count = 0;
+static sched_stats stats;
+#ifdef USE_FREERTOS
+static uint32_t sched_stats_tick = 0;
+#else
+static uint8_t sched_last = SCHED_MAX_TASKS - 1;
+#endif
+
+/*
+ * Private functions
+ */
+
+/*
+ * Cycle timestamp built from the HAL tick and the SysTick counter. Unlike
+ * DWT->CYCCNT it keeps counting while the core sleeps in WFI.
+ */
+static uint32_t sched_cycles(void) {
+	uint32_t tick, val, pending;
+	do {
+		tick = HAL_GetTick();
+		val = SysTick->VAL;
+		pending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+	} while(tick != HAL_GetTick());
+
+	uint32_t load = SysTick->LOAD;
+	if(pending && val > load / 2) {
+		// the counter wrapped but the interrupt has not run yet
+		tick++;
+	}
+	return tick * (load + 1) + (load - val);
+}
+
+static uint8_t sched_ready(const sched_task *task, uint32_t now) {
+	if(task->handler == NULL) {
+		return 0;
+	}
+	return task->events != 0 || (task->period_ms != 0 && (int32_t)(now - task->next_run) >= 0);
+}
+
+static void sched_dispatch(sched_task *task, uint32_t now) {
+	uint32_t start = sched_cycles();
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t events = task->events;
+	uint32_t posted_at = task->posted_at;
+	task->events = 0;
+	__set_PRIMASK(primask);
+
+	if(events != 0 && start - posted_at > task->max_wait) {
+		task->max_wait = start - posted_at;
+	}
+	if(task->period_ms != 0 && (int32_t)(now - task->next_run) >= 0) {
+		events |= SCHED_EVENT_TIMER;
+		if(now - task->next_run > task->max_late_ms) {
+			task->max_late_ms = now - task->next_run;
+		}
+		// keep the phase, but do not run a backlog of missed periods
+		task->next_run += task->period_ms;
+		if((int32_t)(now - task->next_run) >= 0) {
+			task->next_run = now + task->period_ms;
+		}
+	}
+
+	task->handler(events);
+
+	uint32_t cycles = sched_cycles() - start;
+	task->runs++;
+	task->cycles += cycles;
+	if(cycles > task->max_cycles) {
+		task->max_cycles = cycles;
+	}
+}
+
+#ifdef USE_FREERTOS
+// Kernel thread of one task, sleeps until events are posted or the period elapses
+static void sched_thread(void *arg) {
+	sched_task *task = arg;
+	while(1) {
+		uint32_t now = HAL_GetTick();
+		if(!sched_ready(task, now)) {
+			TickType_t wait = portMAX_DELAY;
+			if(task->period_ms != 0) {
+				wait = pdMS_TO_TICKS(task->next_run - now);
+			}
+			ulTaskNotifyTakeIndexed(OS_NOTIFY_SCHED, pdTRUE, wait);
+			now = HAL_GetTick();
+			if(!sched_ready(task, now)) {
+				continue;
+			}
+		}
+		sched_dispatch(task, now);
+	}
+}
+
+static void sched_idle_thread(void *arg) {
+	while(1) {
+		for(uint8_t i = 0; i < sched_idle_count; i++) {
+			sched_idle_hooks[i]();
+		}
+		vTaskDelay(1);
+	}
+}
+
+// The kernel's idle task, nothing at all is ready
+void vApplicationIdleHook(void) {
+	stats.sleeps++;
+	__WFI();
+}
+#else
+// round robin from the task after the one that ran last
+static sched_task *sched_next(uint32_t now) {
+	for(uint8_t i = 1; i <= SCHED_MAX_TASKS; i++) {
+		uint8_t id = (sched_last + i) % SCHED_MAX_TASKS;
+		if(sched_ready(&sched_tasks[id], now)) {
+			sched_last = id;
+			return &sched_tasks[id];
+		}
+	}
+	return NULL;
+}
+
+static uint8_t sched_pending(uint32_t now) {
+	for(uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+		if(sched_ready(&sched_tasks[id], now)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void sched_idle(void) {
+	uint32_t start = sched_cycles();
+
+	for(uint8_t i = 0; i < sched_idle_count; i++) {
+		sched_idle_hooks[i]();
+	}
+
+	// an interrupt arriving after the check still ends the WFI, it is only taken afterwards
+	__disable_irq();
+	if(!sched_pending(HAL_GetTick())) {
+		__WFI();
+		stats.sleeps++;
+	}
+	__enable_irq();
+
+	stats.idle += sched_cycles() - start;
+}
+#endif
+
+/*
+ * Public functions
+ */
+void sched_init(void) {
+	memset(sched_tasks, 0, sizeof(sched_tasks));
+	sched_idle_count = 0;
+#ifndef USE_FREERTOS
+	sched_last = SCHED_MAX_TASKS - 1;
+#endif
+	memset(&stats, 0, sizeof(stats));
+}
+
+// Timer tasks first run one period after sched_run starts
+void sched_add(uint8_t id, const char *name, sched_handler handler, uint32_t period_ms) {
+	if(id >= SCHED_MAX_TASKS) {
+		Error_Handler();
+	}
+	sched_task *task = &sched_tasks[id];
+	memset(task, 0, sizeof(*task));
+	task->name = name;
+	task->period_ms = period_ms;
+	task->next_run = HAL_GetTick() + period_ms;
+	task->handler = handler;
+}
+
+// Runs every time the scheduler finds nothing to do, must return quickly
+void sched_add_idle(sched_idle_hook hook) {
+	if(sched_idle_count >= SCHED_MAX_IDLE_HOOKS) {
+		Error_Handler();
+	}
+	sched_idle_hooks[sched_idle_count++] = hook;
+}
+
+// Safe from interrupts
+void sched_post(uint8_t id, uint32_t events) {
+	if(id >= SCHED_MAX_TASKS) {
+		return;
+	}
+	sched_task *task = &sched_tasks[id];
+	uint32_t now = sched_cycles();
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(task->events == 0) {
+		task->posted_at = now;
+	}
+	task->events |= events;
+	__set_PRIMASK(primask);
+
+#ifdef USE_FREERTOS
+	TaskHandle_t thread = task->os_task;
+	if(thread == NULL) {
+		// not started yet, the thread finds the events when it does
+		return;
+	}
+	if(os_in_isr()) {
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveIndexedFromISR(thread, OS_NOTIFY_SCHED, &woken);
+		portYIELD_FROM_ISR(woken);
+	} else {
+		xTaskNotifyGiveIndexed(thread, OS_NOTIFY_SCHED);
+	}
+#endif
+}
+
+void sched_run(void) {
+#ifdef USE_FREERTOS
+	for(uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+		sched_task *task = &sched_tasks[id];
+		TaskHandle_t thread;
+		if(task->handler == NULL) {
+			continue;
+		}
+		if(xTaskCreate(sched_thread, task->name, SCHED_STACK_WORDS, task, SCHED_PRIORITY,
+				&thread) != pdPASS) {
+			Error_Handler();
+		}
+		task->os_task = thread;
+	}
+	if(sched_idle_count != 0 && xTaskCreate(sched_idle_thread, "hooks", SCHED_STACK_WORDS, NULL,
+			tskIDLE_PRIORITY, NULL) != pdPASS) {
+		Error_Handler();
+	}
+	sched_stats_tick = HAL_GetTick();
+	vTaskStartScheduler();
+
+	// only returns if the heap is too small for the kernel's own tasks
+	Error_Handler();
+	while(1) {
+	}
+#else
+	uint32_t mark = sched_cycles();
+	while(1) {
+		uint32_t now = HAL_GetTick();
+		sched_task *task = sched_next(now);
+		if(task != NULL) {
+			sched_dispatch(task, now);
+		} else {
+			sched_idle();
+		}
+
+		uint32_t cycles = sched_cycles();
+		stats.elapsed += cycles - mark;
+		mark = cycles;
+	}
+#endif
+}
+
+const sched_task *sched_get_task(uint8_t id) {
+	return id < SCHED_MAX_TASKS && sched_tasks[id].handler != NULL ? &sched_tasks[id] : NULL;
+}
+
+const sched_stats *sched_get_stats(void) {
+#ifdef USE_FREERTOS
+	// the kernel owns the idle time, count it as whatever the tasks did not use
+	uint64_t busy = 0;
+	for(uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+		busy += sched_tasks[id].cycles;
+	}
+	stats.elapsed = (uint64_t)(HAL_GetTick() - sched_stats_tick) * (SysTick->LOAD + 1);
+	stats.idle = stats.elapsed > busy ? stats.elapsed - busy : 0;
+#endif
+	return &stats;
+}
+
+void sched_reset_stats(void) {
+	for(uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+		sched_task *task = &sched_tasks[id];
+		task->runs = 0;
+		task->cycles = 0;
+		task->max_cycles = 0;
+		task->max_wait = 0;
+		task->max_late_ms = 0;
+	}
+	stats.elapsed = 0;
+	stats.idle = 0;
+	stats.sleeps = 0;
+#ifdef USE_FREERTOS
+	sched_stats_tick = HAL_GetTick();
+#endif
+}
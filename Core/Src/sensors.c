@@ -0,0 +1,225 @@
+#include <string.h>
+#include "sensors.h"
+#include "log.h"
+#include "main.h"
+
+/*
+ * Private function prototypes
+ */
+static void sensors_bus_used(onewire_bus *bus);
+static void sensors_start_conversion(sensors_device *dev, uint32_t now);
+static uint8_t sensors_finish_conversion(sensors_device *dev, uint32_t now);
+static uint8_t sensors_apply_resolution(sensors_device *dev);
+static onewire_resolution sensors_resolution_for_period(uint32_t period_ms);
+
+/*
+ * Private variables
+ */
+static sensors_device sensors[SENSORS_MAX_DEVICES];
+static uint8_t sensors_cnt = 0;
+
+/*
+ * Private functions
+ */
+
+// any transaction ends the read slot status of a pending Convert T
+static void sensors_bus_used(onewire_bus *bus) {
+	for(uint8_t i = 0; i < sensors_cnt; i++) {
+		if(sensors[i].bus == bus) {
+			sensors[i].pollable = 0;
+		}
+	}
+}
+
+static void sensors_start_conversion(sensors_device *dev, uint32_t now) {
+	sensors_bus_used(dev->bus);
+	onewire_request_conversion(dev->bus, dev->rom);
+	dev->state = SENSORS_CONVERTING;
+	dev->pollable = 1;
+	dev->conversion_start = now;
+	dev->conversion_deadline = now + onewire_conversion_time_ms(dev->resolution);
+	dev->next_conversion += dev->period_ms;
+	// do not try to catch up after a stall, just keep the period
+	if((int32_t)(dev->next_conversion - now) < 0) {
+		dev->next_conversion = now + dev->period_ms;
+	}
+}
+
+// returns 1 if a valid sample was read
+static uint8_t sensors_finish_conversion(sensors_device *dev, uint32_t now) {
+	uint8_t ok = 0;
+	int16_t temperature;
+
+	sensors_bus_used(dev->bus);
+	if(onewire_read_temperature_checked(dev->bus, dev->rom, &temperature)) {
+		dev->temperature = temperature;
+		dev->timestamp = now;
+		dev->fresh = 1;
+		dev->samples++;
+		ok = 1;
+	} else {
+		dev->errors++;
+		LOG("sensors: read of %08lx%08lx failed, %lu errors\n", (unsigned long)(dev->rom >> 32),
+				(unsigned long)dev->rom, (unsigned long)dev->errors);
+	}
+	dev->conversion_ms = now - dev->conversion_start;
+	dev->state = SENSORS_IDLE;
+
+	if(dev->requested_resolution != dev->resolution) {
+		sensors_apply_resolution(dev);
+	}
+	return ok;
+}
+
+static uint8_t sensors_apply_resolution(sensors_device *dev) {
+	sensors_bus_used(dev->bus);
+	if(!onewire_set_resolution(dev->bus, dev->rom, dev->requested_resolution)) {
+		dev->requested_resolution = dev->resolution;
+		dev->errors++;
+		return 0;
+	}
+	dev->resolution = dev->requested_resolution;
+	return 1;
+}
+
+// highest resolution whose conversion still fits in the sample period
+static onewire_resolution sensors_resolution_for_period(uint32_t period_ms) {
+	const onewire_resolution resolutions[] = {
+		ONEWIRE_RESOLUTION_12BIT,
+		ONEWIRE_RESOLUTION_11BIT,
+		ONEWIRE_RESOLUTION_10BIT,
+	};
+	for(size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++) {
+		if(onewire_conversion_time_ms(resolutions[i]) <= period_ms) {
+			return resolutions[i];
+		}
+	}
+	return ONEWIRE_RESOLUTION_9BIT;
+}
+
+/*
+ * Public functions
+ */
+void sensors_init(void) {
+	memset(sensors, 0, sizeof(sensors));
+	sensors_cnt = 0;
+}
+
+// returns index of the device or -1 if it could not be added
+int sensors_add(onewire_bus *bus, uint64_t rom, uint32_t period_ms) {
+	for(uint8_t i = 0; i < sensors_cnt; i++) {
+		if(sensors[i].bus == bus && sensors[i].rom == rom) {
+			return i;
+		}
+	}
+	if(sensors_cnt >= SENSORS_MAX_DEVICES) {
+		return -1;
+	}
+
+	sensors_device *dev = &sensors[sensors_cnt];
+	memset(dev, 0, sizeof(*dev));
+	dev->bus = bus;
+	dev->rom = rom;
+	sensors_bus_used(bus);
+	if(!onewire_get_resolution(bus, rom, &dev->resolution)) {
+		return -1;
+	}
+	dev->requested_resolution = dev->resolution;
+	dev->period_ms = period_ms;
+	dev->next_conversion = HAL_GetTick();
+	return sensors_cnt++;
+}
+
+// adds every DS18B20 found on the bus, returns the number of new devices
+uint8_t sensors_scan(onewire_bus *bus, uint32_t period_ms) {
+	uint64_t roms[SENSORS_MAX_DEVICES];
+	uint8_t before = sensors_cnt;
+
+	sensors_bus_used(bus);
+	uint8_t found = onewire_search(bus, roms, SENSORS_MAX_DEVICES);
+	for(uint8_t i = 0; i < found; i++) {
+		if((roms[i] & 0xff) == ONEWIRE_FAMILY_DS18B20) {
+			sensors_add(bus, roms[i], period_ms);
+		}
+	}
+	return sensors_cnt - before;
+}
+
+uint8_t sensors_count(void) {
+	return sensors_cnt;
+}
+
+sensors_device *sensors_get(uint8_t index) {
+	return index < sensors_cnt ? &sensors[index] : NULL;
+}
+
+// a running conversion is finished at the old resolution first
+uint8_t sensors_set_resolution(uint8_t index, onewire_resolution resolution) {
+	sensors_device *dev = sensors_get(index);
+	if(dev == NULL) {
+		return 0;
+	}
+
+	dev->requested_resolution = resolution;
+	if(dev->state != SENSORS_IDLE || resolution == dev->resolution) {
+		return 1;
+	}
+	return sensors_apply_resolution(dev);
+}
+
+// Trades precision for rate: picks the best resolution that converts within period_ms
+uint8_t sensors_set_period(uint8_t index, uint32_t period_ms) {
+	sensors_device *dev = sensors_get(index);
+	if(dev == NULL) {
+		return 0;
+	}
+
+	dev->period_ms = period_ms;
+	dev->next_conversion = HAL_GetTick();
+	if(period_ms == 0) {
+		return 1;
+	}
+	return sensors_set_resolution(index, sensors_resolution_for_period(period_ms));
+}
+
+// returns 1 and clears the flag if a sample arrived since the last call
+uint8_t sensors_read(uint8_t index, int16_t *temperature, uint32_t *timestamp) {
+	sensors_device *dev = sensors_get(index);
+	if(dev == NULL || !dev->fresh) {
+		return 0;
+	}
+
+	dev->fresh = 0;
+	if(temperature != NULL)
+		*temperature = dev->temperature;
+	if(timestamp != NULL)
+		*timestamp = dev->timestamp;
+	return 1;
+}
+
+// Non-blocking, call from the main loop. Returns the number of new samples.
+uint8_t sensors_poll(void) {
+	uint32_t now = HAL_GetTick();
+	uint8_t new_samples = 0;
+
+	// finish conversions first so read slot polling is still possible
+	for(uint8_t i = 0; i < sensors_cnt; i++) {
+		sensors_device *dev = &sensors[i];
+		if(dev->state != SENSORS_CONVERTING) {
+			continue;
+		}
+		if((int32_t)(now - dev->conversion_deadline) >= 0
+				|| (dev->pollable && onewire_get_request_status(dev->bus))) {
+			new_samples += sensors_finish_conversion(dev, now);
+		}
+	}
+
+	for(uint8_t i = 0; i < sensors_cnt; i++) {
+		sensors_device *dev = &sensors[i];
+		if(dev->state == SENSORS_IDLE && dev->period_ms != 0
+				&& (int32_t)(now - dev->next_conversion) >= 0) {
+			sensors_start_conversion(dev, now);
+		}
+	}
+	return new_samples;
+}
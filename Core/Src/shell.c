@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "console.h"
+#include "crashdump.h"
+#include "diskio.h"
+#include "ff.h"
+#include "log.h"
+#include "main.h"
+#include "memstat.h"
+#include "pool.h"
+#include "profile.h"
+#include "sched.h"
+#include "sensors.h"
+#include "telemetry.h"
+#include "usb_cdc.h"
+#include "usb_msc.h"
+#include "usb_stream.h"
+
+#define SHELL_PROMPT "> "
+#define HEXDUMP_LINES_PER_POLL 4
+#define BENCH_SECTORS_PER_POLL 8
+#define BENCH_DEFAULT_SECTORS 2048
+
+/*
+ * Private function prototypes
+ */
+static int shell_split(char *line, char **argv);
+static uint8_t shell_mount(void);
+static void shell_fs_error(const char *what, FRESULT res);
+static void shell_start_job(shell_job job);
+
+static void shell_cmd_help(int argc, char **argv);
+static void shell_cmd_ls(int argc, char **argv);
+static void shell_cmd_cat(int argc, char **argv);
+static void shell_cmd_hexdump(int argc, char **argv);
+static void shell_cmd_stat(int argc, char **argv);
+static void shell_cmd_df(int argc, char **argv);
+static void shell_cmd_sensors(int argc, char **argv);
+static void shell_cmd_bench(int argc, char **argv);
+static void shell_cmd_stats(int argc, char **argv);
+static void shell_cmd_baud(int argc, char **argv);
+static void shell_cmd_telemetry(int argc, char **argv);
+static void shell_cmd_msc(int argc, char **argv);
+static void shell_cmd_prof(int argc, char **argv);
+static void shell_cmd_tasks(int argc, char **argv);
+static void shell_cmd_crash(int argc, char **argv);
+
+static uint8_t shell_job_ls(void);
+static uint8_t shell_job_cat(void);
+static uint8_t shell_job_hexdump(void);
+static uint8_t shell_job_df(void);
+static uint8_t shell_job_bench(void);
+
+/*
+ * Private variables
+ */
+static const shell_command shell_commands[] = {
+	{ "help", "", shell_cmd_help },
+	{ "ls", "[path]", shell_cmd_ls },
+	{ "cat", "<file>", shell_cmd_cat },
+	{ "hexdump", "<file> [offset] [length]", shell_cmd_hexdump },
+	{ "stat", "<path>", shell_cmd_stat },
+	{ "df", "", shell_cmd_df },
+	{ "sensors", "scan|read", shell_cmd_sensors },
+	{ "bench", "[sectors]", shell_cmd_bench },
+	{ "stats", "", shell_cmd_stats },
+	{ "baud", "<rate>", shell_cmd_baud },
+	{ "telemetry", "on|off|stats", shell_cmd_telemetry },
+	{ "msc", "[eject|attach]", shell_cmd_msc },
+	{ "prof", "[reset|hist <scope>]", shell_cmd_prof },
+	{ "tasks", "[reset]", shell_cmd_tasks },
+	{ "crash", "[clear]", shell_cmd_crash },
+};
+
+static onewire_bus *shell_bus = NULL;
+static uint32_t shell_sensor_period = 0;
+static shell_job shell_current_job = NULL;
+static char shell_line[CONSOLE_LINE_MAX];
+
+static FATFS shell_fs;
+static uint8_t shell_mounted = 0;
+
+// pool blocks of the running job, shell_end_job returns them
+static FIL *shell_fil = NULL;
+static DIR *shell_dir = NULL;
+static uint8_t *shell_sector = NULL;
+
+// state of the running job, only one job runs at a time
+static union {
+	struct {
+		uint32_t offset;
+		uint32_t remaining;
+	} hexdump;
+	struct {
+		uint32_t sector;
+		uint32_t entry;
+		uint32_t free;
+		uint8_t carry[3];
+		uint8_t ncarry;
+	} df;
+	struct {
+		uint32_t sector;
+		uint32_t remaining;
+		uint32_t count;
+		uint32_t start;
+		uint32_t errors;
+	} bench;
+} job;
+
+/*
+ * Private functions
+ */
+
+// splits on spaces in place, returns argc
+static int shell_split(char *line, char **argv) {
+	int argc = 0;
+	char *p = line;
+	while(*p != '\0' && argc < SHELL_MAX_ARGS) {
+		while(*p == ' ') {
+			*p++ = '\0';
+		}
+		if(*p == '\0') {
+			break;
+		}
+		argv[argc++] = p;
+		while(*p != '\0' && *p != ' ') {
+			p++;
+		}
+	}
+	return argc;
+}
+
+// the volume stays mounted until a command fails, so a swapped card is picked up
+static uint8_t shell_mount(void) {
+	if(usb_msc_attached()) {
+		printf("the card is attached to the USB host, try msc eject\n");
+		return 0;
+	}
+	if(shell_mounted) {
+		return 1;
+	}
+	FRESULT res = f_mount(&shell_fs, "", 1);
+	if(res != FR_OK) {
+		shell_fs_error("mount", res);
+		return 0;
+	}
+	shell_mounted = 1;
+	return 1;
+}
+
+static void shell_fs_error(const char *what, FRESULT res) {
+	printf("%s failed: %d\n", what, res);
+	if(res == FR_DISK_ERR || res == FR_NOT_READY || res == FR_NO_FILESYSTEM) {
+		f_unmount("");
+		shell_mounted = 0;
+	}
+}
+
+static void shell_start_job(shell_job job) {
+	shell_current_job = job;
+}
+
+// FatFs is read only, closing files and directories only releases their blocks
+static void shell_end_job(void) {
+	pool_free(&pool_fil, shell_fil);
+	pool_free(&pool_dir, shell_dir);
+	pool_free(&pool_sector, shell_sector);
+	shell_fil = NULL;
+	shell_dir = NULL;
+	shell_sector = NULL;
+	shell_current_job = NULL;
+}
+
+static void *shell_alloc(pool *p) {
+	void *block = pool_alloc(p);
+	if(block == NULL) {
+		printf("%s exhausted\n", p->name);
+	}
+	return block;
+}
+
+static void shell_cmd_help(int argc, char **argv) {
+	for(size_t i = 0; i < sizeof(shell_commands) / sizeof(shell_commands[0]); i++) {
+		printf("  %s %s\n", shell_commands[i].name, shell_commands[i].usage);
+	}
+}
+
+static void shell_cmd_ls(int argc, char **argv) {
+	if(!shell_mount() || (shell_dir = shell_alloc(&pool_dir)) == NULL) {
+		return;
+	}
+	FRESULT res = f_opendir(shell_dir, argc > 1 ? argv[1] : "/");
+	if(res != FR_OK) {
+		shell_fs_error("opendir", res);
+		shell_end_job();
+		return;
+	}
+	shell_start_job(shell_job_ls);
+}
+
+static uint8_t shell_job_ls(void) {
+	FILINFO finfo;
+	FRESULT res = f_readdir(shell_dir, &finfo);
+	if(res != FR_OK) {
+		shell_fs_error("readdir", res);
+		f_closedir(shell_dir);
+		return 0;
+	}
+	if(finfo.fname[0] == '\0') {
+		f_closedir(shell_dir);
+		return 0;
+	}
+
+	if(telemetry_enabled()) {
+		telemetry_send_dir_entry(&finfo);
+	} else if(finfo.fattrib & AM_DIR) {
+		printf("%-12s      <DIR>\n", finfo.fname);
+	} else {
+		printf("%-12s %10lu\n", finfo.fname, (unsigned long)finfo.fsize);
+	}
+	return 1;
+}
+
+static void shell_cmd_cat(int argc, char **argv) {
+	if(argc < 2) {
+		printf("usage: cat <file>\n");
+		return;
+	}
+	if(!shell_mount() || (shell_fil = shell_alloc(&pool_fil)) == NULL
+			|| (shell_sector = shell_alloc(&pool_sector)) == NULL) {
+		shell_end_job();
+		return;
+	}
+	FRESULT res = f_open(shell_fil, argv[1], FA_READ);
+	if(res != FR_OK) {
+		shell_fs_error("open", res);
+		shell_end_job();
+		return;
+	}
+	shell_start_job(shell_job_cat);
+}
+
+static uint8_t shell_job_cat(void) {
+	UINT br;
+	FRESULT res = f_read(shell_fil, shell_sector, SHELL_TX_RESERVE / 2, &br);
+	if(res != FR_OK) {
+		shell_fs_error("read", res);
+		f_close(shell_fil);
+		return 0;
+	}
+	console_write((const char *)shell_sector, br);
+	if(br == 0) {
+		f_close(shell_fil);
+		printf("\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void shell_cmd_hexdump(int argc, char **argv) {
+	if(argc < 2) {
+		printf("usage: hexdump <file> [offset] [length]\n");
+		return;
+	}
+	if(!shell_mount() || (shell_fil = shell_alloc(&pool_fil)) == NULL) {
+		return;
+	}
+	FRESULT res = f_open(shell_fil, argv[1], FA_READ);
+	if(res != FR_OK) {
+		shell_fs_error("open", res);
+		shell_end_job();
+		return;
+	}
+	job.hexdump.offset = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+	job.hexdump.remaining = argc > 3 ? strtoul(argv[3], NULL, 0) : UINT32_MAX;
+	if((res = f_lseek(shell_fil, job.hexdump.offset)) != FR_OK) {
+		shell_fs_error("seek", res);
+		f_close(shell_fil);
+		shell_end_job();
+		return;
+	}
+	shell_start_job(shell_job_hexdump);
+}
+
+static uint8_t shell_job_hexdump(void) {
+	for(int line = 0; line < HEXDUMP_LINES_PER_POLL; line++) {
+		uint8_t data[16];
+		UINT br;
+		UINT want = job.hexdump.remaining < sizeof(data) ? job.hexdump.remaining : sizeof(data);
+		FRESULT res = f_read(shell_fil, data, want, &br);
+		if(res != FR_OK) {
+			shell_fs_error("read", res);
+			f_close(shell_fil);
+			return 0;
+		}
+		if(br == 0) {
+			f_close(shell_fil);
+			return 0;
+		}
+
+		char text[17];
+		printf("%08lx ", (unsigned long)job.hexdump.offset);
+		for(UINT i = 0; i < sizeof(data); i++) {
+			if(i < br) {
+				printf(" %02x", data[i]);
+				text[i] = (data[i] >= 0x20 && data[i] < 0x7f) ? data[i] : '.';
+			} else {
+				printf("   ");
+				text[i] = ' ';
+			}
+		}
+		text[sizeof(data)] = '\0';
+		printf("  |%s|\n", text);
+
+		job.hexdump.offset += br;
+		job.hexdump.remaining -= br;
+	}
+	return 1;
+}
+
+static void shell_cmd_stat(int argc, char **argv) {
+	FILINFO finfo;
+	if(argc < 2) {
+		printf("usage: stat <path>\n");
+		return;
+	}
+	if(!shell_mount()) {
+		return;
+	}
+	FRESULT res = f_stat(argv[1], &finfo);
+	if(res != FR_OK) {
+		shell_fs_error("stat", res);
+		return;
+	}
+	printf("name:     %s\n", finfo.fname);
+	printf("size:     %lu\n", (unsigned long)finfo.fsize);
+	printf("modified: %04u-%02u-%02u %02u:%02u:%02u\n",
+			1980 + (finfo.fdate >> 9), (finfo.fdate >> 5) & 15, finfo.fdate & 31,
+			finfo.ftime >> 11, (finfo.ftime >> 5) & 63, (finfo.ftime & 31) * 2);
+	printf("attrib:   %c%c%c%c%c\n",
+			(finfo.fattrib & AM_RDO) ? 'R' : '-', (finfo.fattrib & AM_HID) ? 'H' : '-',
+			(finfo.fattrib & AM_SYS) ? 'S' : '-', (finfo.fattrib & AM_DIR) ? 'D' : '-',
+			(finfo.fattrib & AM_ARC) ? 'A' : '-');
+}
+
+/*
+ * The volume is mounted read-only, so FatFs keeps no free cluster count.
+ * df walks the first FAT one sector per poll instead.
+ */
+static void shell_cmd_df(int argc, char **argv) {
+	if(!shell_mount() || (shell_sector = shell_alloc(&pool_sector)) == NULL) {
+		return;
+	}
+	memset(&job.df, 0, sizeof(job.df));
+	shell_start_job(shell_job_df);
+}
+
+static uint8_t shell_job_df(void) {
+	FATFS *fs = &shell_fs;
+
+	if(job.df.entry < fs->n_fatent && job.df.sector < fs->fsize) {
+		if(disk_read(fs->pdrv, shell_sector, fs->fatbase + job.df.sector, 1) != RES_OK) {
+			shell_fs_error("FAT read", FR_DISK_ERR);
+			return 0;
+		}
+		job.df.sector++;
+
+		for(size_t i = 0; i < POOL_SECTOR_SIZE && job.df.entry < fs->n_fatent; ) {
+			uint32_t value;
+			if(fs->fs_type == FS_FAT32) {
+				value = (shell_sector[i] | shell_sector[i + 1] << 8 | shell_sector[i + 2] << 16
+						| (uint32_t)shell_sector[i + 3] << 24) & 0x0fffffff;
+				i += 4;
+			} else if(fs->fs_type == FS_FAT16) {
+				value = shell_sector[i] | shell_sector[i + 1] << 8;
+				i += 2;
+			} else {
+				// FAT12 packs two entries in three bytes, which may span sectors
+				job.df.carry[job.df.ncarry++] = shell_sector[i++];
+				if(job.df.ncarry < 3) {
+					continue;
+				}
+				job.df.ncarry = 0;
+				value = job.df.carry[0] | (job.df.carry[1] & 0x0f) << 8;
+				if(job.df.entry >= 2 && value == 0) {
+					job.df.free++;
+				}
+				if(++job.df.entry >= fs->n_fatent) {
+					break;
+				}
+				value = job.df.carry[1] >> 4 | job.df.carry[2] << 4;
+			}
+			if(job.df.entry >= 2 && value == 0) {
+				job.df.free++;
+			}
+			job.df.entry++;
+		}
+		return 1;
+	}
+
+	static const char *const types[] = { "?", "FAT12", "FAT16", "FAT32", "exFAT" };
+	uint32_t cluster_kib = fs->csize / 2;
+	printf("%s, %lu byte clusters, %lu KiB total, %lu KiB free\n",
+			types[fs->fs_type <= FS_EXFAT ? fs->fs_type : 0], (unsigned long)fs->csize * 512,
+			(unsigned long)(fs->n_fatent - 2) * cluster_kib, (unsigned long)job.df.free * cluster_kib);
+	return 0;
+}
+
+static void shell_cmd_sensors(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "scan") == 0) {
+		uint8_t added = sensors_scan(shell_bus, shell_sensor_period);
+		printf("%d new, %d sensors\n", added, sensors_count());
+		return;
+	}
+	if(argc > 1 && strcmp(argv[1], "read") == 0) {
+		uint32_t now = HAL_GetTick();
+		for(uint8_t i = 0; i < sensors_count(); i++) {
+			sensors_device *dev = sensors_get(i);
+			char temp[ONEWIRE_TEMPERATURE_MAX_LEN];
+			onewire_format_temperature(dev->temperature, temp, sizeof(temp));
+			printf("%2d %08lx%08lx %2d bit %8s C, %lu ms ago, %lu samples, %lu errors\n", i,
+					(unsigned long)(dev->rom >> 32), (unsigned long)dev->rom,
+					9 + (dev->resolution >> 5), dev->samples != 0 ? temp : "-",
+					(unsigned long)(now - dev->timestamp), (unsigned long)dev->samples,
+					(unsigned long)dev->errors);
+		}
+		return;
+	}
+	printf("usage: sensors scan|read\n");
+}
+
+// Sequential single sector reads from the start of the data area
+static void shell_cmd_bench(int argc, char **argv) {
+	if(!shell_mount() || (shell_sector = shell_alloc(&pool_sector)) == NULL) {
+		return;
+	}
+	job.bench.count = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_SECTORS;
+	job.bench.remaining = job.bench.count;
+	job.bench.sector = shell_fs.database;
+	job.bench.errors = 0;
+	job.bench.start = HAL_GetTick();
+	shell_start_job(shell_job_bench);
+}
+
+static uint8_t shell_job_bench(void) {
+	for(int i = 0; i < BENCH_SECTORS_PER_POLL && job.bench.remaining != 0; i++) {
+		if(disk_read(shell_fs.pdrv, shell_sector, job.bench.sector++, 1) != RES_OK) {
+			job.bench.errors++;
+		}
+		job.bench.remaining--;
+	}
+	if(job.bench.remaining != 0) {
+		return 1;
+	}
+
+	uint32_t ms = HAL_GetTick() - job.bench.start;
+	if(ms == 0) {
+		ms = 1;
+	}
+	printf("%lu sectors in %lu ms, %lu KiB/s, %lu errors\n", (unsigned long)job.bench.count,
+			(unsigned long)ms, (unsigned long)(job.bench.count * 500 / ms),
+			(unsigned long)job.bench.errors);
+	return 0;
+}
+
+static void shell_cmd_stats(int argc, char **argv) {
+	const console_stats *cs = console_get_stats();
+	const telemetry_stats *ts = telemetry_get_stats();
+	const log_stats *ls = log_get_stats();
+	const usb_cdc_stats *us = usb_cdc_get_stats();
+	const usb_stream_stats *ss = usb_stream_get_stats();
+	memstat_info ms;
+
+	memstat_get(&ms);
+	printf("uptime    %lu ms\n", (unsigned long)HAL_GetTick());
+	printf("memory    stack peak %lu of %lu%s, heap %lu peak %lu of %lu, refused %lu\n",
+			(unsigned long)ms.stack_peak, (unsigned long)ms.stack_size, ms.guarded ? " guarded" : "",
+			(unsigned long)ms.heap_used, (unsigned long)ms.heap_peak, (unsigned long)ms.heap_size,
+			(unsigned long)ms.heap_failures);
+	printf("console   tx %lu, dropped %lu, overwritten %lu, transfers %lu, peak %lu\n",
+			(unsigned long)cs->written, (unsigned long)cs->dropped, (unsigned long)cs->overwritten,
+			(unsigned long)cs->transfers, (unsigned long)cs->tx_peak);
+	printf("          rx %lu, lost %lu, errors %lu, truncated lines %lu\n",
+			(unsigned long)cs->received, (unsigned long)cs->rx_lost, (unsigned long)cs->rx_errors,
+			(unsigned long)cs->line_truncated);
+	printf("usb cdc   %s, tx %lu, transfers %lu, rx %lu, paused %lu\n",
+			usb_cdc_connected() ? "open" : "closed", (unsigned long)us->written,
+			(unsigned long)us->transfers, (unsigned long)us->received, (unsigned long)us->rx_paused);
+	printf("usb stream %s, records %lu, dropped %lu, bytes %lu, transfers %lu, peak %lu\n",
+			usb_stream_active() ? "running" : "stopped", (unsigned long)ss->records,
+			(unsigned long)ss->dropped, (unsigned long)ss->bytes, (unsigned long)ss->transfers,
+			(unsigned long)ss->peak);
+	printf("telemetry frames %lu, dropped %lu, bytes %lu\n",
+			(unsigned long)ts->sent, (unsigned long)ts->dropped, (unsigned long)ts->bytes);
+	printf("log       records %lu, dropped %lu, peak %lu words\n",
+			(unsigned long)ls->written, (unsigned long)ls->dropped, (unsigned long)ls->peak);
+	for(const pool *p = pool_first(); p != NULL; p = p->next) {
+		printf("%-11s %u of %u in use, peak %u, allocs %lu, exhausted %lu\n", p->name,
+				p->used, p->count, p->peak, (unsigned long)p->allocs, (unsigned long)p->failures);
+	}
+	for(uint8_t i = 0; i < sensors_count(); i++) {
+		sensors_device *dev = sensors_get(i);
+		printf("sensor %2d %lu samples, %lu errors, conversion %lu ms\n", i,
+				(unsigned long)dev->samples, (unsigned long)dev->errors,
+				(unsigned long)dev->conversion_ms);
+	}
+}
+
+static void shell_cmd_baud(int argc, char **argv) {
+	if(argc < 2) {
+		printf("baud: %lu\n", (unsigned long)console_get_baud());
+		return;
+	}
+	if(console_change_baud(strtoul(argv[1], NULL, 10)) != 0) {
+		printf("baud: unsupported rate\n");
+	}
+}
+
+static void shell_cmd_telemetry(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "on") == 0) {
+		telemetry_enable(1);
+		telemetry_send_hello();
+		for(uint8_t i = 0; i < sensors_count(); i++) {
+			telemetry_send_sensor(i, sensors_get(i));
+		}
+	} else if(argc > 1 && strcmp(argv[1], "off") == 0) {
+		telemetry_enable(0);
+	} else if(argc > 1 && strcmp(argv[1], "stats") == 0) {
+		telemetry_send_stats();
+	} else {
+		printf("usage: telemetry on|off|stats\n");
+	}
+}
+
+static void shell_cmd_msc(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "eject") == 0) {
+		if(!usb_msc_eject()) {
+			printf("msc: the host has the card locked, eject it there first\n");
+		}
+		return;
+	}
+	if(argc > 1 && strcmp(argv[1], "attach") == 0) {
+		usb_msc_attach();
+		return;
+	}
+	if(argc > 1) {
+		printf("usage: msc [eject|attach]\n");
+		return;
+	}
+
+	const usb_msc_stats *ms = usb_msc_get_stats();
+	// the host takes the card with its first read, write or removal lock, not when plugged in
+	printf("msc: %s, %lu sectors\n", usb_msc_attached() ? "attached to the host" : "not in use by the host",
+			(unsigned long)usb_msc_sector_count());
+	printf("     commands %lu, failed %lu, resets %lu, read %lu, written %lu sectors\n",
+			(unsigned long)ms->commands, (unsigned long)ms->failed, (unsigned long)ms->resets,
+			(unsigned long)ms->sectors_read, (unsigned long)ms->sectors_written);
+}
+
+/*
+ * Per scope cycle statistics. With telemetry on, one binary frame per scope
+ * is sent instead, including the histogram.
+ */
+static void shell_cmd_prof(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+		profile_reset();
+		return;
+	}
+	if(argc > 2 && strcmp(argv[1], "hist") == 0) {
+		const profile_scope *scope = profile_find(argv[2]);
+		if(scope == NULL) {
+			printf("prof: no scope %s\n", argv[2]);
+			return;
+		}
+		for(int i = 0; i < PROFILE_HIST_BUCKETS; i++) {
+			uint8_t last = i == PROFILE_HIST_BUCKETS - 1;
+			uint32_t bound = (uint32_t)1 << (i + PROFILE_HIST_SHIFT - last);
+			printf("%s %8lu cycles (%6lu us) %lu\n", last ? ">=" : " <", (unsigned long)bound,
+					(unsigned long)profile_cycles_to_us(bound), (unsigned long)scope->hist[i]);
+		}
+		return;
+	}
+	if(argc > 1) {
+		printf("usage: prof [reset|hist <scope>]\n");
+		return;
+	}
+
+	if(!PROFILE_ENABLE) {
+		printf("prof: built with PROFILE_ENABLE=0\n");
+		return;
+	}
+	if(telemetry_enabled()) {
+		for(const profile_scope *scope = profile_first(); scope != NULL; scope = scope->next) {
+			telemetry_send_profile(scope);
+		}
+		return;
+	}
+	printf("scope            count   min cyc   avg cyc   max cyc    max us\n");
+	for(const profile_scope *scope = profile_first(); scope != NULL; scope = scope->next) {
+		uint32_t avg = scope->count != 0 ? scope->total / scope->count : 0;
+		printf("%-12s %9lu %9lu %9lu %9lu %9lu\n", scope->name, (unsigned long)scope->count,
+				(unsigned long)(scope->count != 0 ? scope->min : 0), (unsigned long)avg,
+				(unsigned long)scope->max, (unsigned long)profile_cycles_to_us(scope->max));
+	}
+	printf("%lu cycles overhead per scope subtracted\n", (unsigned long)profile_overhead());
+}
+
+// Scheduler accounting, times in microseconds, load in tenths of a percent
+static void shell_cmd_tasks(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+		sched_reset_stats();
+		return;
+	}
+	if(argc > 1) {
+		printf("usage: tasks [reset]\n");
+		return;
+	}
+
+	const sched_stats *st = sched_get_stats();
+	uint64_t elapsed = st->elapsed != 0 ? st->elapsed : 1;
+	uint32_t cycles_per_us = SystemCoreClock / 1000000;
+
+	printf("task           runs    avg us    max us   wait us   late ms   load\n");
+	for(uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+		const sched_task *task = sched_get_task(id);
+		if(task == NULL) {
+			continue;
+		}
+		uint32_t avg = task->runs != 0 ? task->cycles / task->runs : 0;
+		uint32_t load = task->cycles * 1000 / elapsed;
+		printf("%-10s %8lu %9lu %9lu %9lu %9lu %4lu.%lu%%\n", task->name, (unsigned long)task->runs,
+				(unsigned long)(avg / cycles_per_us), (unsigned long)(task->max_cycles / cycles_per_us),
+				(unsigned long)(task->max_wait / cycles_per_us), (unsigned long)task->max_late_ms,
+				(unsigned long)(load / 10), (unsigned long)(load % 10));
+	}
+	uint32_t idle = st->idle * 1000 / elapsed;
+	printf("idle %lu.%lu%%, %lu sleeps in %lu ms\n", (unsigned long)(idle / 10), (unsigned long)(idle % 10),
+			(unsigned long)st->sleeps, (unsigned long)(st->elapsed / (cycles_per_us * 1000)));
+}
+
+// The dump the last crash left in RAM, until it is cleared or the power goes
+static void shell_cmd_crash(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "clear") == 0) {
+		crashdump_clear();
+		return;
+	}
+	if(argc > 1) {
+		printf("usage: crash [clear]\n");
+		return;
+	}
+
+	const crashdump *dump = crashdump_get();
+	if(dump == NULL) {
+		printf("no crash recorded\n");
+		return;
+	}
+	crashdump_print(dump);
+}
+
+/*
+ * Public functions
+ */
+void shell_init(onewire_bus *bus, uint32_t sensor_period_ms) {
+	shell_bus = bus;
+	shell_sensor_period = sensor_period_ms;
+	shell_current_job = NULL;
+	printf(SHELL_PROMPT);
+}
+
+// Non-blocking, call from the main loop
+void shell_poll(void) {
+	if(shell_mounted && usb_msc_attached()) {
+		// the host may rewrite anything FatFs has cached, drop the volume and whatever used it
+		f_unmount("");
+		shell_mounted = 0;
+		if(shell_current_job != NULL) {
+			shell_end_job();
+			printf("\naborted, the card was attached to the USB host\n" SHELL_PROMPT);
+		}
+	}
+
+	if(shell_current_job != NULL) {
+		if(console_tx_free() < SHELL_TX_RESERVE) {
+			return;
+		}
+		if(shell_current_job()) {
+			return;
+		}
+		shell_end_job();
+		printf(SHELL_PROMPT);
+		return;
+	}
+
+	int len = console_read_line(shell_line, sizeof(shell_line));
+	if(len < 0) {
+		return;
+	}
+	if(!shell_execute(shell_line) || shell_current_job == NULL) {
+		printf(SHELL_PROMPT);
+	}
+}
+
+// Runs a command line, returns 0 if it was empty or unknown
+uint8_t shell_execute(const char *line) {
+	char buffer[CONSOLE_LINE_MAX];
+	char *argv[SHELL_MAX_ARGS];
+
+	if(shell_current_job != NULL) {
+		return 0;
+	}
+	strncpy(buffer, line, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = '\0';
+
+	int argc = shell_split(buffer, argv);
+	if(argc == 0) {
+		return 0;
+	}
+	for(size_t i = 0; i < sizeof(shell_commands) / sizeof(shell_commands[0]); i++) {
+		if(strcmp(argv[0], shell_commands[i].name) == 0) {
+			shell_commands[i].handler(argc, argv);
+			return 1;
+		}
+	}
+	printf("unknown command: %s, try help\n", argv[0]);
+	return 0;
+}
+
+uint8_t shell_busy(void) {
+	return shell_current_job != NULL;
+}
@@ -20,6 +20,9 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+extern DMA_HandleTypeDef hdma_usart3_rx;
+
+extern DMA_HandleTypeDef hdma_usart3_tx;
 
 /* USER CODE BEGIN Includes */
 
@@ -206,6 +209,44 @@ void HAL_UART_MspInit(UART_HandleTypeDef *huart) {
 		GPIO_InitStruct.Alternate = GPIO_AF7_USART3;
 		HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
+		/* USART3 DMA Init */
+		/* USART3_RX Init */
+		hdma_usart3_rx.Instance = DMA1_Stream1;
+		hdma_usart3_rx.Init.Channel = DMA_CHANNEL_4;
+		hdma_usart3_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+		hdma_usart3_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+		hdma_usart3_rx.Init.MemInc = DMA_MINC_ENABLE;
+		hdma_usart3_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+		hdma_usart3_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+		hdma_usart3_rx.Init.Mode = DMA_CIRCULAR;
+		hdma_usart3_rx.Init.Priority = DMA_PRIORITY_HIGH;
+		hdma_usart3_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+		if (HAL_DMA_Init(&hdma_usart3_rx) != HAL_OK) {
+			Error_Handler();
+		}
+
+		__HAL_LINKDMA(huart, hdmarx, hdma_usart3_rx);
+
+		/* USART3_TX Init */
+		hdma_usart3_tx.Instance = DMA1_Stream3;
+		hdma_usart3_tx.Init.Channel = DMA_CHANNEL_4;
+		hdma_usart3_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+		hdma_usart3_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+		hdma_usart3_tx.Init.MemInc = DMA_MINC_ENABLE;
+		hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+		hdma_usart3_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+		hdma_usart3_tx.Init.Mode = DMA_NORMAL;
+		hdma_usart3_tx.Init.Priority = DMA_PRIORITY_LOW;
+		hdma_usart3_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+		if (HAL_DMA_Init(&hdma_usart3_tx) != HAL_OK) {
+			Error_Handler();
+		}
+
+		__HAL_LINKDMA(huart, hdmatx, hdma_usart3_tx);
+
+		/* USART3 interrupt Init */
+		HAL_NVIC_SetPriority(USART3_IRQn, 0, 0);
+		HAL_NVIC_EnableIRQ(USART3_IRQn);
 		/* USER CODE BEGIN USART3_MspInit 1 */
 
 		/* USER CODE END USART3_MspInit 1 */
@@ -233,6 +274,12 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef *huart) {
 		 */
 		HAL_GPIO_DeInit(GPIOD, STLK_RX_Pin | STLK_TX_Pin);
 
+		/* USART3 DMA DeInit */
+		HAL_DMA_DeInit(huart->hdmarx);
+		HAL_DMA_DeInit(huart->hdmatx);
+
+		/* USART3 interrupt DeInit */
+		HAL_NVIC_DisableIRQ(USART3_IRQn);
 		/* USER CODE BEGIN USART3_MspDeInit 1 */
 
 		/* USER CODE END USART3_MspDeInit 1 */
@@ -285,6 +332,9 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef *hpcd) {
 
 		/* Peripheral clock enable */
 		__HAL_RCC_USB_OTG_FS_CLK_ENABLE();
+		/* USB_OTG_FS interrupt Init */
+		HAL_NVIC_SetPriority(OTG_FS_IRQn, 0, 0);
+		HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
 		/* USER CODE BEGIN USB_OTG_FS_MspInit 1 */
 
 		/* USER CODE END USB_OTG_FS_MspInit 1 */
@@ -316,6 +366,8 @@ void HAL_PCD_MspDeInit(PCD_HandleTypeDef *hpcd) {
 		HAL_GPIO_DeInit(GPIOA,
 		USB_SOF_Pin | USB_VBUS_Pin | USB_ID_Pin | USB_DM_Pin | USB_DP_Pin);
 
+		/* USB_OTG_FS interrupt DeInit */
+		HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
 		/* USER CODE BEGIN USB_OTG_FS_MspDeInit 1 */
 
 		/* USER CODE END USB_OTG_FS_MspDeInit 1 */
@@ -22,6 +22,8 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "os.h"
+#include "sched.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -46,6 +48,9 @@
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
+#ifdef USE_FREERTOS
+void xPortSysTickHandler(void);
+#endif
 
 /* USER CODE END PFP */
 
@@ -55,6 +60,10 @@
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
+extern DMA_HandleTypeDef hdma_usart3_rx;
+extern DMA_HandleTypeDef hdma_usart3_tx;
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
+extern UART_HandleTypeDef huart3;
 
 /* USER CODE BEGIN EV */
 
@@ -76,58 +85,7 @@ void NMI_Handler(void) {
 	/* USER CODE END NonMaskableInt_IRQn 1 */
 }
 
-/**
- * @brief This function handles Hard fault interrupt.
- */
-void HardFault_Handler(void) {
-	/* USER CODE BEGIN HardFault_IRQn 0 */
-
-	/* USER CODE END HardFault_IRQn 0 */
-	while (1) {
-		/* USER CODE BEGIN W1_HardFault_IRQn 0 */
-		/* USER CODE END W1_HardFault_IRQn 0 */
-	}
-}
-
-/**
- * @brief This function handles Memory management fault.
- */
-void MemManage_Handler(void) {
-	/* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
-	/* USER CODE END MemoryManagement_IRQn 0 */
-	while (1) {
-		/* USER CODE BEGIN W1_MemoryManagement_IRQn 0 */
-		/* USER CODE END W1_MemoryManagement_IRQn 0 */
-	}
-}
-
-/**
- * @brief This function handles Pre-fetch fault, memory access fault.
- */
-void BusFault_Handler(void) {
-	/* USER CODE BEGIN BusFault_IRQn 0 */
-
-	/* USER CODE END BusFault_IRQn 0 */
-	while (1) {
-		/* USER CODE BEGIN W1_BusFault_IRQn 0 */
-		/* USER CODE END W1_BusFault_IRQn 0 */
-	}
-}
-
-/**
- * @brief This function handles Undefined instruction or illegal state.
- */
-void UsageFault_Handler(void) {
-	/* USER CODE BEGIN UsageFault_IRQn 0 */
-
-	/* USER CODE END UsageFault_IRQn 0 */
-	while (1) {
-		/* USER CODE BEGIN W1_UsageFault_IRQn 0 */
-		/* USER CODE END W1_UsageFault_IRQn 0 */
-	}
-}
-
+#ifndef USE_FREERTOS
 /**
  * @brief This function handles System service call via SWI instruction.
  */
@@ -139,6 +97,7 @@ void SVC_Handler(void) {
 
 	/* USER CODE END SVCall_IRQn 1 */
 }
+#endif
 
 /**
  * @brief This function handles Debug monitor.
@@ -152,6 +111,7 @@ void DebugMon_Handler(void) {
 	/* USER CODE END DebugMonitor_IRQn 1 */
 }
 
+#ifndef USE_FREERTOS
 /**
  * @brief This function handles Pendable request for system service.
  */
@@ -163,6 +123,7 @@ void PendSV_Handler(void) {
 
 	/* USER CODE END PendSV_IRQn 1 */
 }
+#endif
 
 /**
  * @brief This function handles System tick timer.
@@ -173,7 +134,12 @@ void SysTick_Handler(void) {
 	/* USER CODE END SysTick_IRQn 0 */
 	HAL_IncTick();
 	/* USER CODE BEGIN SysTick_IRQn 1 */
-
+#ifdef USE_FREERTOS
+	// SysTick stays the HAL time base and is shared with the kernel
+	if(xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+		xPortSysTickHandler();
+	}
+#endif
 	/* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -184,6 +150,72 @@ void SysTick_Handler(void) {
 /* please refer to the startup file (startup_stm32f4xx.s).                    */
 /******************************************************************************/
 
+/**
+ * @brief This function handles DMA1 stream1 global interrupt.
+ */
+void DMA1_Stream1_IRQHandler(void) {
+	/* USER CODE BEGIN DMA1_Stream1_IRQn 0 */
+
+	/* USER CODE END DMA1_Stream1_IRQn 0 */
+	HAL_DMA_IRQHandler(&hdma_usart3_rx);
+	/* USER CODE BEGIN DMA1_Stream1_IRQn 1 */
+	sched_post(TASK_CONSOLE, TASK_EVENT_IRQ);
+	/* USER CODE END DMA1_Stream1_IRQn 1 */
+}
+
+/**
+ * @brief This function handles DMA1 stream3 global interrupt.
+ */
+void DMA1_Stream3_IRQHandler(void) {
+	/* USER CODE BEGIN DMA1_Stream3_IRQn 0 */
+
+	/* USER CODE END DMA1_Stream3_IRQn 0 */
+	HAL_DMA_IRQHandler(&hdma_usart3_tx);
+	/* USER CODE BEGIN DMA1_Stream3_IRQn 1 */
+
+	/* USER CODE END DMA1_Stream3_IRQn 1 */
+}
+
+/**
+ * @brief This function handles USART3 global interrupt.
+ */
+void USART3_IRQHandler(void) {
+	/* USER CODE BEGIN USART3_IRQn 0 */
+
+	/* USER CODE END USART3_IRQn 0 */
+	HAL_UART_IRQHandler(&huart3);
+	/* USER CODE BEGIN USART3_IRQn 1 */
+	// RX idle line and TX complete, which frees console space for a running shell job
+	sched_post(TASK_CONSOLE, TASK_EVENT_IRQ);
+	/* USER CODE END USART3_IRQn 1 */
+}
+
+/**
+ * @brief This function handles EXTI line[15:10] interrupts.
+ */
+void EXTI15_10_IRQHandler(void) {
+	/* USER CODE BEGIN EXTI15_10_IRQn 0 */
+
+	/* USER CODE END EXTI15_10_IRQn 0 */
+	HAL_GPIO_EXTI_IRQHandler(USER_Btn_Pin);
+	/* USER CODE BEGIN EXTI15_10_IRQn 1 */
+
+	/* USER CODE END EXTI15_10_IRQn 1 */
+}
+
+/**
+ * @brief This function handles USB On The Go FS global interrupt.
+ */
+void OTG_FS_IRQHandler(void) {
+	/* USER CODE BEGIN OTG_FS_IRQn 0 */
+
+	/* USER CODE END OTG_FS_IRQn 0 */
+	HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
+	/* USER CODE BEGIN OTG_FS_IRQn 1 */
+	sched_post(TASK_USB, TASK_EVENT_IRQ);
+	/* USER CODE END OTG_FS_IRQn 1 */
+}
+
 /* USER CODE BEGIN 1 */
 
 /* USER CODE END 1 */
@@ -29,6 +29,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/times.h>
+#include "console.h"
 
 /* Variables */
 extern int __io_putchar(int ch) __attribute__((weak));
@@ -80,14 +81,11 @@ __attribute__((weak)) int _read(int file, char *ptr, int len) {
 	}
 }
 
+/* Output is queued and sent by DMA, see console.c for the overflow policy */
 __attribute__((weak)) int _write(int file, char *ptr, int len) {
 	(void) file;
 
-	int DataIdx;
-
-	for (DataIdx = 0; DataIdx < len; DataIdx++) {
-		__io_putchar(*ptr++);
-	}
+	console_write(ptr, len);
 	return len;
 }
 
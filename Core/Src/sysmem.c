@@ -23,26 +23,32 @@
 /* Includes */
 #include <errno.h>
 #include <stdint.h>
+#include "memstat.h"
 
 /**
  * Pointer to the current high watermark of the heap usage
  */
 static uint8_t *__sbrk_heap_end = NULL;
 
+/* Highest heap end so far and the number of refused requests, for memstat */
+static uint8_t *__sbrk_heap_peak = NULL;
+static uint32_t __sbrk_failures = 0;
+
 /**
  * @brief _sbrk() allocates memory to the newlib heap and is used by malloc
  *        and others from the C library
  *
  * @verbatim
  * ############################################################################
- * #  .data  #  .bss  #       newlib heap       #          MSP stack          #
- * #         #        #                         # Reserved by _Min_Stack_Size #
+ * #  .data  #  .bss  #   newlib heap   # guard #          MSP stack          #
+ * #         #        #                 #       # Reserved by _Min_Stack_Size #
  * ############################################################################
  * ^-- RAM start      ^-- _end                             _estack, RAM end --^
  * @endverbatim
  *
  * This implementation starts allocating at the '_end' linker symbol
  * The '_Min_Stack_Size' linker symbol reserves a memory for the MSP stack
+ * The '_Stack_Guard_Size' bytes below it are the MPU guard of memstat.c
  * The implementation considers '_estack' linker symbol to be RAM end
  * NOTE: If the MSP stack, at any point during execution, grows larger than the
  * reserved size, please increase the '_Min_Stack_Size'.
@@ -54,8 +60,9 @@ void* _sbrk(ptrdiff_t incr) {
 	extern uint8_t _end; /* Symbol defined in the linker script */
 	extern uint8_t _estack; /* Symbol defined in the linker script */
 	extern uint32_t _Min_Stack_Size; /* Symbol defined in the linker script */
+	extern uint32_t _Stack_Guard_Size; /* Symbol defined in the linker script */
 	const uint32_t stack_limit = (uint32_t) &_estack
-			- (uint32_t) &_Min_Stack_Size;
+			- (uint32_t) &_Min_Stack_Size - (uint32_t) &_Stack_Guard_Size;
 	const uint8_t *max_heap = (uint8_t*) stack_limit;
 	uint8_t *prev_heap_end;
 
@@ -66,12 +73,27 @@ void* _sbrk(ptrdiff_t incr) {
 
 	/* Protect heap from growing into the reserved MSP stack */
 	if (__sbrk_heap_end + incr > max_heap) {
+		__sbrk_failures++;
 		errno = ENOMEM;
 		return (void*) -1;
 	}
 
 	prev_heap_end = __sbrk_heap_end;
 	__sbrk_heap_end += incr;
+	if (__sbrk_heap_end > __sbrk_heap_peak) {
+		__sbrk_heap_peak = __sbrk_heap_end;
+	}
 
 	return (void*) prev_heap_end;
 }
+
+/**
+ * @brief Heap use in bytes from '_end', now and at the highest so far
+ */
+void sysmem_heap_stats(uint32_t *used, uint32_t *peak, uint32_t *failures) {
+	extern uint8_t _end; /* Symbol defined in the linker script */
+
+	*used = __sbrk_heap_end != NULL ? (uint32_t) (__sbrk_heap_end - &_end) : 0;
+	*peak = __sbrk_heap_peak != NULL ? (uint32_t) (__sbrk_heap_peak - &_end) : 0;
+	*failures = __sbrk_failures;
+}
@@ -0,0 +1,167 @@
+#include <string.h>
+#include "telemetry.h"
+#include "console.h"
+#include "frame.h"
+#include "main.h"
+#include "pool.h"
+
+_Static_assert(TELEMETRY_PROFILE_BUCKETS == PROFILE_HIST_BUCKETS
+		&& TELEMETRY_PROFILE_SHIFT == PROFILE_HIST_SHIFT, "profile histogram mismatch");
+
+/*
+ * Private variables
+ */
+static uint8_t telemetry_on = 0;
+static uint8_t telemetry_seq = 0;
+static telemetry_stats stats;
+
+/*
+ * Public functions
+ */
+void telemetry_init(void) {
+	telemetry_on = 0;
+	telemetry_seq = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void telemetry_enable(uint8_t enable) {
+	telemetry_on = enable;
+}
+
+uint8_t telemetry_enabled(void) {
+	return telemetry_on;
+}
+
+/*
+ * Frames are never split: one that does not fit in the console TX ring is
+ * dropped whole, so the host never sees half a frame followed by text.
+ * The buffers come from pool_frame, the calling task's stack stays small.
+ * Returns 0 if the frame was queued.
+ */
+int telemetry_send(telemetry_msg_type type, const void *payload, uint16_t len) {
+	if(len > TELEMETRY_MAX_PAYLOAD) {
+		return -1;
+	}
+	uint8_t *raw = pool_alloc(&pool_frame);
+	if(raw == NULL) {
+		stats.dropped++;
+		return -1;
+	}
+	uint8_t *frame = raw + TELEMETRY_RAW_MAX;
+
+	telemetry_header *hdr = (telemetry_header *)raw;
+	hdr->type = type;
+	hdr->seq = telemetry_seq++;
+	memcpy(raw + sizeof(*hdr), payload, len);
+
+	size_t raw_len = sizeof(*hdr) + len;
+	uint16_t crc = frame_crc16(FRAME_CRC16_INIT, raw, raw_len);
+	raw[raw_len++] = crc & 0xff;
+	raw[raw_len++] = crc >> 8;
+
+	size_t frame_len = 0;
+	frame[frame_len++] = 0;
+	frame_len += frame_cobs_encode(raw, raw_len, frame + frame_len);
+	frame[frame_len++] = 0;
+
+	int res = -1;
+	if(console_tx_free() < frame_len) {
+		stats.dropped++;
+	} else {
+		console_write((const char *)frame, frame_len);
+		stats.sent++;
+		stats.bytes += frame_len;
+		res = 0;
+	}
+	pool_free(&pool_frame, raw);
+	return res;
+}
+
+int telemetry_send_hello(void) {
+	telemetry_hello msg = {
+		.version = TELEMETRY_VERSION,
+		.tick = HAL_GetTick(),
+	};
+	return telemetry_send(TELEMETRY_MSG_HELLO, &msg, sizeof(msg));
+}
+
+int telemetry_send_sensor(uint8_t index, const sensors_device *dev) {
+	telemetry_sensor msg = {
+		.index = index,
+		.rom = dev->rom,
+		.resolution = dev->resolution,
+		.period_ms = dev->period_ms,
+	};
+	return telemetry_send(TELEMETRY_MSG_SENSOR, &msg, sizeof(msg));
+}
+
+int telemetry_send_samples(const telemetry_sample *samples, uint8_t count) {
+	telemetry_temperature msg;
+
+	if(count == 0 || count > TELEMETRY_MAX_SAMPLES) {
+		return -1;
+	}
+	msg.count = count;
+	memcpy(msg.samples, samples, count * sizeof(*samples));
+	return telemetry_send(TELEMETRY_MSG_TEMPERATURE, &msg,
+			sizeof(msg.count) + count * sizeof(*samples));
+}
+
+int telemetry_send_dir_entry(const FILINFO *finfo) {
+	telemetry_dir_entry msg = {
+		.size = finfo->fsize,
+		.date = finfo->fdate,
+		.time = finfo->ftime,
+		.attrib = finfo->fattrib,
+	};
+	strncpy(msg.name, finfo->fname, sizeof(msg.name) - 1);
+	return telemetry_send(TELEMETRY_MSG_DIR_ENTRY, &msg, sizeof(msg));
+}
+
+int telemetry_send_stats(void) {
+	const console_stats *cs = console_get_stats();
+	telemetry_stats_msg msg = {
+		.tick = HAL_GetTick(),
+		.console_written = cs->written,
+		.console_dropped = cs->dropped,
+		.console_rx_lost = cs->rx_lost,
+		.console_rx_errors = cs->rx_errors,
+		.frames_sent = stats.sent,
+		.frames_dropped = stats.dropped,
+	};
+	for(uint8_t i = 0; i < sensors_count(); i++) {
+		sensors_device *dev = sensors_get(i);
+		msg.sensor_samples += dev->samples;
+		msg.sensor_errors += dev->errors;
+	}
+	return telemetry_send(TELEMETRY_MSG_STATS, &msg, sizeof(msg));
+}
+
+int telemetry_send_log(const log_record *rec) {
+	telemetry_log msg = {
+		.tick = rec->tick,
+		.fmt = (uint32_t)(uintptr_t)rec->fmt,
+	};
+	for(uint8_t i = 0; i < rec->nargs; i++) {
+		msg.args[i] = rec->args[i];
+	}
+	return telemetry_send(TELEMETRY_MSG_LOG, &msg,
+			sizeof(msg) - sizeof(msg.args) + rec->nargs * sizeof(msg.args[0]));
+}
+
+int telemetry_send_profile(const profile_scope *scope) {
+	telemetry_profile msg = {
+		.clock_hz = SystemCoreClock,
+		.count = scope->count,
+		.min = scope->count != 0 ? scope->min : 0,
+		.max = scope->max,
+		.total = scope->total,
+	};
+	strncpy(msg.name, scope->name, sizeof(msg.name) - 1);
+	memcpy(msg.hist, scope->hist, sizeof(msg.hist));
+	return telemetry_send(TELEMETRY_MSG_PROFILE, &msg, sizeof(msg));
+}
+
+const telemetry_stats *telemetry_get_stats(void) {
+	return &stats;
+}
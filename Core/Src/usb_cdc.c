@@ -0,0 +1,288 @@
+#include <string.h>
+#include "usb_cdc.h"
+#include "usb_desc.h"
+#include "main.h"
+#include "os.h"
+
+#define TX_MASK (USB_CDC_TX_BUFFER_SIZE - 1)
+#define RX_MASK (USB_CDC_RX_BUFFER_SIZE - 1)
+
+#if (USB_CDC_TX_BUFFER_SIZE & TX_MASK) != 0 || (USB_CDC_RX_BUFFER_SIZE & RX_MASK) != 0
+#error "USB CDC buffer sizes must be powers of two"
+#endif
+
+#define CDC_SET_LINE_CODING 0x20
+#define CDC_GET_LINE_CODING 0x21
+#define CDC_SET_CONTROL_LINE_STATE 0x22
+#define CDC_SEND_BREAK 0x23
+
+#define CDC_LINE_STATE_DTR 0x01
+
+/*
+ * Private function prototypes
+ */
+static void usb_cdc_configure(PCD_HandleTypeDef *hpcd);
+static void usb_cdc_reset(void);
+static uint8_t usb_cdc_setup(const usb_setup *req, const uint8_t **data, uint16_t *len);
+static void usb_cdc_ep0_out(const usb_setup *req, const uint8_t *data, uint16_t len);
+static void usb_cdc_data_in(uint8_t ep);
+static void usb_cdc_data_out(uint8_t ep, uint32_t len);
+static void usb_cdc_tx_kick(void);
+static uint8_t usb_cdc_rx_prime(void);
+
+/*
+ * Private variables
+ */
+const usb_class usb_cdc_class = {
+	.first_interface = USB_CDC_COMM_INTERFACE,
+	.num_interfaces = 2,
+	.endpoints = USB_EP_BIT(USB_CDC_DATA_IN_EP) | USB_EP_BIT(USB_CDC_DATA_OUT_EP)
+			| USB_EP_BIT(USB_CDC_NOTIFY_EP),
+	.configure = usb_cdc_configure,
+	.reset = usb_cdc_reset,
+	.setup = usb_cdc_setup,
+	.ep0_out = usb_cdc_ep0_out,
+	.data_in = usb_cdc_data_in,
+	.data_out = usb_cdc_data_out,
+};
+
+static PCD_HandleTypeDef *cdc_pcd = NULL;
+static volatile uint8_t cdc_configured = 0;
+static volatile uint8_t cdc_dtr = 0;
+static usb_cdc_stats stats;
+
+// 115200 8N1, only reported back to the host
+static uint8_t line_coding[7] = { 0x00, 0xc2, 0x01, 0x00, 0, 0, 8 };
+
+// same single producer scheme as the UART console
+static uint8_t tx_buffer[USB_CDC_TX_BUFFER_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile uint32_t tx_in_flight = 0;
+static volatile uint8_t tx_zlp = 0;
+// a writer facing a full ring sleeps on this until an IN transfer completes
+static os_event cdc_tx_done;
+
+/*
+ * OUT packets land in two alternating buffers: the next one is primed
+ * before the finished one is copied, so the host is only NAKed when the
+ * RX ring itself has no room for another packet.
+ */
+static uint8_t rx_packet[2][USB_FS_BULK_SIZE];
+static uint8_t rx_active = 0;
+static volatile uint8_t rx_primed = 0;
+static uint8_t rx_buffer[USB_CDC_RX_BUFFER_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+/*
+ * Private functions
+ */
+static void usb_cdc_configure(PCD_HandleTypeDef *hpcd) {
+	cdc_pcd = hpcd;
+	tx_head = tx_tail = tx_in_flight = 0;
+	tx_zlp = 0;
+	rx_head = rx_tail = 0;
+	rx_active = 0;
+	rx_primed = 0;
+
+	HAL_PCD_EP_Open(hpcd, USB_CDC_DATA_IN_EP, USB_FS_BULK_SIZE, EP_TYPE_BULK);
+	HAL_PCD_EP_Open(hpcd, USB_CDC_DATA_OUT_EP, USB_FS_BULK_SIZE, EP_TYPE_BULK);
+	HAL_PCD_EP_Open(hpcd, USB_CDC_NOTIFY_EP, USB_CDC_NOTIFY_SIZE, EP_TYPE_INTR);
+	cdc_configured = 1;
+	usb_cdc_rx_prime();
+}
+
+static void usb_cdc_reset(void) {
+	cdc_configured = 0;
+	cdc_dtr = 0;
+	tx_in_flight = 0;
+	tx_zlp = 0;
+	os_event_signal(&cdc_tx_done);
+	if(cdc_pcd != NULL) {
+		HAL_PCD_EP_Close(cdc_pcd, USB_CDC_DATA_IN_EP);
+		HAL_PCD_EP_Close(cdc_pcd, USB_CDC_DATA_OUT_EP);
+		HAL_PCD_EP_Close(cdc_pcd, USB_CDC_NOTIFY_EP);
+	}
+}
+
+static uint8_t usb_cdc_setup(const usb_setup *req, const uint8_t **data, uint16_t *len) {
+	if((req->bmRequestType & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_CLASS) {
+		return 0;
+	}
+
+	switch(req->bRequest) {
+	case CDC_SET_LINE_CODING:
+		return req->wLength == sizeof(line_coding);
+	case CDC_GET_LINE_CODING:
+		*data = line_coding;
+		*len = sizeof(line_coding);
+		return 1;
+	case CDC_SET_CONTROL_LINE_STATE: {
+		uint8_t dtr = (req->wValue & CDC_LINE_STATE_DTR) != 0;
+		if(dtr && !cdc_dtr && tx_in_flight == 0 && !tx_zlp) {
+			// a terminal was just opened, it should not get stale output
+			tx_tail = tx_head;
+		}
+		cdc_dtr = dtr;
+		return 1;
+	}
+	case CDC_SEND_BREAK:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void usb_cdc_ep0_out(const usb_setup *req, const uint8_t *data, uint16_t len) {
+	if(req->bRequest == CDC_SET_LINE_CODING && len == sizeof(line_coding)) {
+		memcpy(line_coding, data, sizeof(line_coding));
+	}
+}
+
+// runs with interrupts masked or from the USB interrupt
+static void usb_cdc_tx_kick(void) {
+	if(!cdc_configured || tx_in_flight != 0 || tx_zlp) {
+		return;
+	}
+
+	uint32_t pending = tx_head - tx_tail;
+	if(pending == 0) {
+		return;
+	}
+
+	uint32_t start = tx_tail & TX_MASK;
+	uint32_t chunk = USB_CDC_TX_BUFFER_SIZE - start;
+	if(chunk > pending) {
+		chunk = pending;
+	}
+	if(chunk > USB_CDC_MAX_TRANSFER) {
+		chunk = USB_CDC_MAX_TRANSFER;
+	}
+
+	tx_in_flight = chunk;
+	HAL_PCD_EP_Transmit(cdc_pcd, USB_CDC_DATA_IN_EP, tx_buffer + start, chunk);
+	stats.transfers++;
+}
+
+static void usb_cdc_data_in(uint8_t ep) {
+	uint32_t sent = tx_in_flight;
+	tx_in_flight = 0;
+	if(tx_zlp) {
+		tx_zlp = 0;
+		usb_cdc_tx_kick();
+		return;
+	}
+
+	tx_tail += sent;
+	os_event_signal(&cdc_tx_done);
+	if(tx_head == tx_tail && (sent % USB_FS_BULK_SIZE) == 0) {
+		// the host only completes a read on a short packet
+		tx_zlp = 1;
+		HAL_PCD_EP_Transmit(cdc_pcd, USB_CDC_DATA_IN_EP, NULL, 0);
+		return;
+	}
+	usb_cdc_tx_kick();
+}
+
+// runs with interrupts masked or from the USB interrupt, returns 0 if the ring is too full
+static uint8_t usb_cdc_rx_prime(void) {
+	if(!cdc_configured || rx_primed) {
+		return 1;
+	}
+	// room for the packet in flight and the one about to be primed
+	if(USB_CDC_RX_BUFFER_SIZE - (rx_head - rx_tail) < 2 * USB_FS_BULK_SIZE) {
+		return 0;
+	}
+	rx_primed = 1;
+	HAL_PCD_EP_Receive(cdc_pcd, USB_CDC_DATA_OUT_EP, rx_packet[rx_active], USB_FS_BULK_SIZE);
+	return 1;
+}
+
+static void usb_cdc_data_out(uint8_t ep, uint32_t len) {
+	const uint8_t *done = rx_packet[rx_active];
+	rx_active ^= 1;
+	rx_primed = 0;
+	if(!usb_cdc_rx_prime()) {
+		stats.rx_paused++;
+	}
+
+	for(uint32_t i = 0; i < len; i++) {
+		rx_buffer[rx_head++ & RX_MASK] = done[i];
+	}
+	stats.received += len;
+}
+
+/*
+ * Public functions
+ */
+
+// Configured and a terminal has the port open
+uint8_t usb_cdc_connected(void) {
+	return cdc_configured && cdc_dtr && usb_device_state() == USB_STATE_CONFIGURED;
+}
+
+uint32_t usb_cdc_tx_free(void) {
+	return USB_CDC_TX_BUFFER_SIZE - (tx_head - tx_tail);
+}
+
+// Queues data for the bulk IN endpoint, returns the number of bytes accepted
+int usb_cdc_write(const char *data, int len) {
+	if(!usb_cdc_connected()) {
+		return 0;
+	}
+
+	// masked from reading head to publishing the chunk, writes from interrupts land whole
+	int written = 0;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	while(written < len) {
+		uint32_t free = usb_cdc_tx_free();
+		if(free == 0) {
+			break;
+		}
+		uint32_t start = tx_head & TX_MASK;
+		uint32_t chunk = USB_CDC_TX_BUFFER_SIZE - start;
+		if(chunk > free) {
+			chunk = free;
+		}
+		if(chunk > (uint32_t)(len - written)) {
+			chunk = len - written;
+		}
+		memcpy(tx_buffer + start, data + written, chunk);
+		__DMB();
+		tx_head += chunk;
+		written += chunk;
+	}
+	usb_cdc_tx_kick();
+	__set_PRIMASK(primask);
+
+	stats.written += written;
+	return written;
+}
+
+// Sleeps until an IN transfer frees room in the ring or timeout_ms passes
+void usb_cdc_wait_tx(uint32_t timeout_ms) {
+	os_event_wait(&cdc_tx_done, timeout_ms);
+}
+
+// Returns the next received byte, or -1 if there is none
+int usb_cdc_getchar(void) {
+	if(rx_head == rx_tail) {
+		return -1;
+	}
+	int ch = rx_buffer[rx_tail & RX_MASK];
+	rx_tail++;
+
+	if(!rx_primed) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		usb_cdc_rx_prime();
+		__set_PRIMASK(primask);
+	}
+	return ch;
+}
+
+const usb_cdc_stats *usb_cdc_get_stats(void) {
+	return &stats;
+}
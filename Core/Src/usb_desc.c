@@ -0,0 +1,153 @@
+#include <stddef.h>
+#include "usb_desc.h"
+#include "usb_cdc.h"
+#include "usb_msc.h"
+#include "usb_stream.h"
+
+#define LO(x) ((x) & 0xff)
+#define HI(x) (((x) >> 8) & 0xff)
+
+#define CDC_DESC_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+#define MSC_DESC_LEN (9 + 7 + 7)
+#define STREAM_DESC_LEN (9 + 7)
+
+#define CONFIG_INTERFACES (2 * USB_WITH_CDC + USB_WITH_MSC + USB_WITH_STREAM)
+#define CONFIG_TOTAL_LEN (9 + USB_WITH_CDC * CDC_DESC_LEN + USB_WITH_MSC * MSC_DESC_LEN \
+		+ USB_WITH_STREAM * STREAM_DESC_LEN)
+
+#if USB_CONFIG == USB_CONFIG_MSC
+#define DEVICE_CLASS 0x00, 0x00, 0x00
+#define PRODUCT_ID USB_PID_MSC
+#define PRODUCT_NAME "onewire SD card"
+#else
+// miscellaneous device class, the CDC function is grouped by an IAD
+#define DEVICE_CLASS 0xef, 0x02, 0x01
+#if USB_CONFIG == USB_CONFIG_COMPOSITE
+#define PRODUCT_ID USB_PID_COMPOSITE
+#define PRODUCT_NAME "onewire"
+#else
+#define PRODUCT_ID USB_PID_CDC
+#define PRODUCT_NAME "onewire console"
+#endif
+#endif
+
+/*
+ * Public variables
+ */
+const uint8_t usb_device_descriptor[] = {
+	18,					// bLength
+	USB_DESC_DEVICE,
+	0x00, 0x02,			// bcdUSB 2.00
+	DEVICE_CLASS,
+	USB_EP0_SIZE,
+	LO(USB_VID), HI(USB_VID),
+	LO(PRODUCT_ID), HI(PRODUCT_ID),
+	0x00, 0x01,			// bcdDevice 1.00
+	USB_STRING_MANUFACTURER,
+	USB_STRING_PRODUCT,
+	USB_STRING_SERIAL,
+	1,					// bNumConfigurations
+};
+
+const uint8_t usb_config_descriptor[] = {
+	9, USB_DESC_CONFIGURATION,
+	LO(CONFIG_TOTAL_LEN), HI(CONFIG_TOTAL_LEN),
+	CONFIG_INTERFACES,
+	1,					// bConfigurationValue
+	0,
+	0x80,				// bus powered
+	250,				// 500 mA
+
+#if USB_WITH_CDC
+	8, USB_DESC_IAD, USB_CDC_COMM_INTERFACE, 2, 0x02, 0x02, 0x01, 0,
+
+	// CDC communication interface
+	9, USB_DESC_INTERFACE, USB_CDC_COMM_INTERFACE, 0, 1, 0x02, 0x02, 0x01, 0,
+	5, USB_DESC_CS_INTERFACE, 0x00, 0x10, 0x01,		// header, CDC 1.10
+	5, USB_DESC_CS_INTERFACE, 0x01, 0x00, USB_CDC_DATA_INTERFACE,	// call management
+	4, USB_DESC_CS_INTERFACE, 0x02, 0x02,			// ACM, line coding and state
+	5, USB_DESC_CS_INTERFACE, 0x06, USB_CDC_COMM_INTERFACE, USB_CDC_DATA_INTERFACE,	// union
+	7, USB_DESC_ENDPOINT, USB_CDC_NOTIFY_EP, 0x03, LO(USB_CDC_NOTIFY_SIZE), HI(USB_CDC_NOTIFY_SIZE), 16,
+
+	// CDC data interface
+	9, USB_DESC_INTERFACE, USB_CDC_DATA_INTERFACE, 0, 2, 0x0a, 0x00, 0x00, 0,
+	7, USB_DESC_ENDPOINT, USB_CDC_DATA_OUT_EP, 0x02, LO(USB_FS_BULK_SIZE), HI(USB_FS_BULK_SIZE), 0,
+	7, USB_DESC_ENDPOINT, USB_CDC_DATA_IN_EP, 0x02, LO(USB_FS_BULK_SIZE), HI(USB_FS_BULK_SIZE), 0,
+#endif
+
+#if USB_WITH_MSC
+	// mass storage, SCSI transparent command set, bulk-only transport
+	9, USB_DESC_INTERFACE, USB_MSC_INTERFACE, 0, 2, 0x08, 0x06, 0x50, 0,
+	7, USB_DESC_ENDPOINT, USB_MSC_IN_EP, 0x02, LO(USB_FS_BULK_SIZE), HI(USB_FS_BULK_SIZE), 0,
+	7, USB_DESC_ENDPOINT, USB_MSC_OUT_EP, 0x02, LO(USB_FS_BULK_SIZE), HI(USB_FS_BULK_SIZE), 0,
+#endif
+
+#if USB_WITH_STREAM
+	// vendor specific sample stream, see stream_proto.h
+	9, USB_DESC_INTERFACE, USB_STREAM_INTERFACE, 0, 1, 0xff, 0x00, 0x00, 0,
+	7, USB_DESC_ENDPOINT, USB_STREAM_IN_EP, 0x02, LO(USB_FS_BULK_SIZE), HI(USB_FS_BULK_SIZE), 0,
+#endif
+};
+
+_Static_assert(sizeof(usb_config_descriptor) == CONFIG_TOTAL_LEN, "wTotalLength mismatch");
+
+// index 0 (languages) and the serial number are generated by the core
+const char *const usb_strings[] = {
+	NULL,
+	"onewire",
+	PRODUCT_NAME,
+	NULL,
+};
+const uint8_t usb_string_count = sizeof(usb_strings) / sizeof(usb_strings[0]);
+
+const usb_class *const usb_classes[] = {
+#if USB_WITH_CDC
+	&usb_cdc_class,
+#endif
+#if USB_WITH_MSC
+	&usb_msc_class,
+#endif
+#if USB_WITH_STREAM
+	&usb_stream_class,
+#endif
+};
+const uint8_t usb_class_count = sizeof(usb_classes) / sizeof(usb_classes[0]);
+
+/*
+ * TX FIFO per IN endpoint. A FIFO holding several packets lets the core
+ * send the next one while the interrupt handler loads more, so the bulk
+ * endpoints get what is left after EP0 and the notification endpoint,
+ * which never carry more than one packet. 16 words is the minimum depth.
+ */
+#if USB_CONFIG == USB_CONFIG_COMPOSITE
+/*
+ * 80 words of RX FIFO hold four OUT packets plus the SETUP and status
+ * entries, enough to keep MSC writes and console input flowing. The IN
+ * side favours mass storage reads: 80 + 16 + 48 + 16 + 112 + 48 = 320.
+ */
+const uint16_t usb_tx_fifo_words[USB_TX_FIFO_COUNT] = {
+	16,		// EP0
+	48,		// CDC data, 3 packets
+	16,		// CDC notification
+	112,	// mass storage data, 7 packets
+	48,		// sample stream, 3 packets
+};
+#elif USB_CONFIG == USB_CONFIG_CDC
+// 128 + 16 + 64 + 16 + 96 of the 320 words
+const uint16_t usb_tx_fifo_words[USB_TX_FIFO_COUNT] = {
+	16,		// EP0
+	64,		// CDC data, 4 packets
+	16,		// CDC notification
+	0,
+	96,		// sample stream, 6 packets
+};
+#else
+// 128 + 16 + 176 of the 320 words
+const uint16_t usb_tx_fifo_words[USB_TX_FIFO_COUNT] = {
+	16,		// EP0
+	0,
+	0,
+	176,	// mass storage data, 11 packets
+	0,
+};
+#endif
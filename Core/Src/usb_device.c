@@ -0,0 +1,401 @@
+#include <string.h>
+#include "usb_device.h"
+#include "usb_desc.h"
+#include "main.h"
+
+#define REQ_GET_STATUS 0x00
+#define REQ_CLEAR_FEATURE 0x01
+#define REQ_SET_FEATURE 0x03
+#define REQ_SET_ADDRESS 0x05
+#define REQ_GET_DESCRIPTOR 0x06
+#define REQ_GET_CONFIGURATION 0x08
+#define REQ_SET_CONFIGURATION 0x09
+#define REQ_GET_INTERFACE 0x0a
+#define REQ_SET_INTERFACE 0x0b
+
+#define FEATURE_ENDPOINT_HALT 0
+
+// the serial number is the 96-bit unique ID in hex
+#define SERIAL_LEN 24
+
+/*
+ * Private function prototypes
+ */
+static void usb_ep0_send(const uint8_t *data, uint16_t len, uint16_t requested);
+static void usb_ep0_status(void);
+static void usb_ep0_stall(void);
+static uint8_t usb_get_descriptor(const usb_setup *req);
+static void usb_standard_request(const usb_setup *req);
+static void usb_set_configuration(uint8_t config);
+static const usb_class *usb_class_for_interface(uint8_t interface);
+static const usb_class *usb_class_for_endpoint(uint8_t ep);
+
+/*
+ * Private variables
+ */
+static PCD_HandleTypeDef *usb_pcd = NULL;
+static volatile usb_state usb_dev_state = USB_STATE_DEFAULT;
+static usb_state usb_state_before_suspend = USB_STATE_DEFAULT;
+static uint8_t usb_config = 0;
+
+// control transfer in progress, EP0 moves at most one packet per transfer
+static struct {
+	usb_setup req;
+	const uint8_t *data;
+	uint16_t remaining;
+	uint16_t chunk;
+	uint8_t zlp;
+	uint8_t in_data;
+	uint8_t out_data;
+	const usb_class *out_class;
+	uint8_t buffer[USB_EP0_SIZE];
+	uint8_t string[2 + 2 * 64];
+	uint8_t status[2];
+} ep0;
+
+/*
+ * Private functions
+ */
+
+// An IN data stage shorter than requested ends with a short or zero length packet
+static void usb_ep0_send(const uint8_t *data, uint16_t len, uint16_t requested) {
+	if(len > requested) {
+		len = requested;
+	}
+	ep0.data = data;
+	ep0.remaining = len;
+	ep0.zlp = len < requested && (len % USB_EP0_SIZE) == 0 && len != 0;
+	ep0.chunk = len < USB_EP0_SIZE ? len : USB_EP0_SIZE;
+	ep0.in_data = 1;
+	HAL_PCD_EP_Transmit(usb_pcd, USB_EP_IN(0), (uint8_t *)data, ep0.chunk);
+}
+
+static void usb_ep0_status(void) {
+	HAL_PCD_EP_Transmit(usb_pcd, USB_EP_IN(0), NULL, 0);
+}
+
+static void usb_ep0_stall(void) {
+	HAL_PCD_EP_SetStall(usb_pcd, USB_EP_IN(0));
+	HAL_PCD_EP_SetStall(usb_pcd, USB_EP_OUT(0));
+}
+
+static uint8_t usb_get_descriptor(const usb_setup *req) {
+	uint8_t type = req->wValue >> 8;
+	uint8_t index = req->wValue & 0xff;
+
+	switch(type) {
+	case USB_DESC_DEVICE:
+		usb_ep0_send(usb_device_descriptor, usb_device_descriptor[0], req->wLength);
+		return 1;
+	case USB_DESC_CONFIGURATION:
+		usb_ep0_send(usb_config_descriptor,
+				usb_config_descriptor[2] | usb_config_descriptor[3] << 8, req->wLength);
+		return 1;
+	case USB_DESC_STRING:
+		break;
+	default:
+		// full speed only, so no device qualifier either
+		return 0;
+	}
+
+	uint8_t len = 2;
+	if(index == 0) {
+		// language ID, US English
+		ep0.string[len++] = 0x09;
+		ep0.string[len++] = 0x04;
+	} else if(index == USB_STRING_SERIAL) {
+		static const char hex[] = "0123456789ABCDEF";
+		const uint8_t *uid = (const uint8_t *)UID_BASE;
+		for(int i = 0; i < SERIAL_LEN; i++) {
+			ep0.string[len++] = hex[(uid[i / 2] >> ((i & 1) ? 0 : 4)) & 0x0f];
+			ep0.string[len++] = 0;
+		}
+	} else if(index < usb_string_count && usb_strings[index] != NULL) {
+		for(const char *s = usb_strings[index]; *s != '\0' && len < sizeof(ep0.string); s++) {
+			ep0.string[len++] = *s;
+			ep0.string[len++] = 0;
+		}
+	} else {
+		return 0;
+	}
+	ep0.string[0] = len;
+	ep0.string[1] = USB_DESC_STRING;
+	usb_ep0_send(ep0.string, len, req->wLength);
+	return 1;
+}
+
+static void usb_set_configuration(uint8_t config) {
+	if(usb_config == config) {
+		return;
+	}
+	if(usb_config != 0) {
+		for(uint8_t i = 0; i < usb_class_count; i++) {
+			usb_classes[i]->reset();
+		}
+	}
+	usb_config = config;
+	if(config != 0) {
+		for(uint8_t i = 0; i < usb_class_count; i++) {
+			usb_classes[i]->configure(usb_pcd);
+		}
+		usb_dev_state = USB_STATE_CONFIGURED;
+	} else {
+		usb_dev_state = USB_STATE_ADDRESSED;
+	}
+}
+
+static void usb_standard_request(const usb_setup *req) {
+	uint8_t recipient = req->bmRequestType & USB_REQ_RECIPIENT_MASK;
+
+	switch(req->bRequest) {
+	case REQ_GET_DESCRIPTOR:
+		if(!usb_get_descriptor(req)) {
+			usb_ep0_stall();
+		}
+		return;
+	case REQ_SET_ADDRESS:
+		// the OTG core applies the address after the status stage by itself
+		HAL_PCD_SetAddress(usb_pcd, req->wValue & 0x7f);
+		usb_dev_state = (req->wValue & 0x7f) != 0 ? USB_STATE_ADDRESSED : USB_STATE_DEFAULT;
+		usb_ep0_status();
+		return;
+	case REQ_SET_CONFIGURATION:
+		if(req->wValue > 1 || usb_dev_state == USB_STATE_DEFAULT) {
+			break;
+		}
+		usb_set_configuration(req->wValue);
+		usb_ep0_status();
+		return;
+	case REQ_GET_CONFIGURATION:
+		ep0.status[0] = usb_config;
+		usb_ep0_send(ep0.status, 1, req->wLength);
+		return;
+	case REQ_GET_STATUS:
+		ep0.status[0] = 0;
+		ep0.status[1] = 0;
+		if(recipient == USB_REQ_RECIPIENT_ENDPOINT) {
+			uint8_t ep = req->wIndex & 0xff;
+			PCD_EPTypeDef *pep = (ep & 0x80) ? &usb_pcd->IN_ep[ep & 0x0f] : &usb_pcd->OUT_ep[ep & 0x0f];
+			ep0.status[0] = pep->is_stall ? 1 : 0;
+		}
+		usb_ep0_send(ep0.status, 2, req->wLength);
+		return;
+	case REQ_CLEAR_FEATURE:
+	case REQ_SET_FEATURE:
+		if(recipient == USB_REQ_RECIPIENT_ENDPOINT && req->wValue == FEATURE_ENDPOINT_HALT) {
+			uint8_t ep = req->wIndex & 0xff;
+			if((ep & 0x0f) != 0) {
+				if(req->bRequest == REQ_SET_FEATURE) {
+					HAL_PCD_EP_SetStall(usb_pcd, ep);
+				} else {
+					const usb_class *cls = usb_class_for_endpoint(ep);
+					HAL_PCD_EP_ClrStall(usb_pcd, ep);
+					if(cls != NULL && cls->clear_halt != NULL) {
+						cls->clear_halt(ep);
+					}
+				}
+			}
+			usb_ep0_status();
+			return;
+		}
+		if(recipient == USB_REQ_RECIPIENT_DEVICE) {
+			// remote wakeup is not supported, accept and ignore
+			usb_ep0_status();
+			return;
+		}
+		break;
+	case REQ_GET_INTERFACE:
+		if(usb_dev_state != USB_STATE_CONFIGURED) {
+			break;
+		}
+		ep0.status[0] = 0;
+		usb_ep0_send(ep0.status, 1, req->wLength);
+		return;
+	case REQ_SET_INTERFACE:
+		// only alternate setting 0 exists
+		if(usb_dev_state == USB_STATE_CONFIGURED && req->wValue == 0) {
+			usb_ep0_status();
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+	usb_ep0_stall();
+}
+
+static const usb_class *usb_class_for_interface(uint8_t interface) {
+	for(uint8_t i = 0; i < usb_class_count; i++) {
+		const usb_class *cls = usb_classes[i];
+		if(interface >= cls->first_interface && interface < cls->first_interface + cls->num_interfaces) {
+			return cls;
+		}
+	}
+	return NULL;
+}
+
+static const usb_class *usb_class_for_endpoint(uint8_t ep) {
+	for(uint8_t i = 0; i < usb_class_count; i++) {
+		if(usb_classes[i]->endpoints & USB_EP_BIT(ep)) {
+			return usb_classes[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Public functions
+ */
+
+// Sizes the FIFOs and connects to the bus, hpcd must be initialized already
+void usb_device_init(PCD_HandleTypeDef *hpcd) {
+	usb_pcd = hpcd;
+	usb_dev_state = USB_STATE_DEFAULT;
+	usb_config = 0;
+	memset(&ep0, 0, sizeof(ep0));
+
+	HAL_PCDEx_SetRxFiFo(hpcd, USB_RX_FIFO_WORDS);
+	for(uint8_t i = 0; i < USB_TX_FIFO_COUNT; i++) {
+		HAL_PCDEx_SetTxFiFo(hpcd, i, usb_tx_fifo_words[i]);
+	}
+	HAL_PCD_Start(hpcd);
+}
+
+usb_state usb_device_state(void) {
+	return usb_dev_state;
+}
+
+PCD_HandleTypeDef *usb_device_pcd(void) {
+	return usb_pcd;
+}
+
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd) {
+	usb_setup *req = &ep0.req;
+	memcpy(req, hpcd->Setup, sizeof(*req));
+	ep0.in_data = 0;
+	ep0.out_data = 0;
+
+	if((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_STANDARD
+			&& (req->bmRequestType & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE) {
+		usb_standard_request(req);
+		return;
+	}
+
+	const usb_class *cls = NULL;
+	switch(req->bmRequestType & USB_REQ_RECIPIENT_MASK) {
+	case USB_REQ_RECIPIENT_INTERFACE:
+		cls = usb_class_for_interface(req->wIndex & 0xff);
+		break;
+	case USB_REQ_RECIPIENT_ENDPOINT:
+		cls = usb_class_for_endpoint(req->wIndex & 0xff);
+		break;
+	default:
+		break;
+	}
+	if((req->bmRequestType & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_STANDARD) {
+		// GET/SET_INTERFACE and friends for an interface
+		if(cls != NULL) {
+			usb_standard_request(req);
+		} else {
+			usb_ep0_stall();
+		}
+		return;
+	}
+
+	const uint8_t *data = NULL;
+	uint16_t len = 0;
+	if(cls == NULL || cls->setup == NULL || !cls->setup(req, &data, &len)) {
+		usb_ep0_stall();
+		return;
+	}
+
+	if(req->bmRequestType & USB_REQ_DIR_IN) {
+		usb_ep0_send(data, len, req->wLength);
+	} else if(req->wLength != 0 && req->wLength <= sizeof(ep0.buffer)) {
+		ep0.out_data = 1;
+		ep0.out_class = cls;
+		HAL_PCD_EP_Receive(hpcd, USB_EP_OUT(0), ep0.buffer, req->wLength);
+	} else if(req->wLength == 0) {
+		usb_ep0_status();
+	} else {
+		usb_ep0_stall();
+	}
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+	if(epnum == 0) {
+		if(ep0.out_data) {
+			ep0.out_data = 0;
+			if(ep0.out_class->ep0_out != NULL) {
+				ep0.out_class->ep0_out(&ep0.req, ep0.buffer, HAL_PCD_EP_GetRxCount(hpcd, 0));
+			}
+			usb_ep0_status();
+		}
+		return;
+	}
+
+	const usb_class *cls = usb_class_for_endpoint(USB_EP_OUT(epnum));
+	if(cls != NULL && cls->data_out != NULL) {
+		cls->data_out(USB_EP_OUT(epnum), HAL_PCD_EP_GetRxCount(hpcd, epnum));
+	}
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+	if(epnum == 0) {
+		if(!ep0.in_data) {
+			return;
+		}
+		ep0.data += ep0.chunk;
+		ep0.remaining -= ep0.chunk;
+		if(ep0.remaining != 0) {
+			ep0.chunk = ep0.remaining < USB_EP0_SIZE ? ep0.remaining : USB_EP0_SIZE;
+			HAL_PCD_EP_Transmit(hpcd, USB_EP_IN(0), (uint8_t *)ep0.data, ep0.chunk);
+		} else if(ep0.zlp) {
+			ep0.zlp = 0;
+			ep0.chunk = 0;
+			HAL_PCD_EP_Transmit(hpcd, USB_EP_IN(0), NULL, 0);
+		} else {
+			// data stage done, the host answers with a zero length OUT
+			ep0.in_data = 0;
+			HAL_PCD_EP_Receive(hpcd, USB_EP_OUT(0), NULL, 0);
+		}
+		return;
+	}
+
+	const usb_class *cls = usb_class_for_endpoint(USB_EP_IN(epnum));
+	if(cls != NULL && cls->data_in != NULL) {
+		cls->data_in(USB_EP_IN(epnum));
+	}
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd) {
+	if(usb_config != 0) {
+		for(uint8_t i = 0; i < usb_class_count; i++) {
+			usb_classes[i]->reset();
+		}
+	}
+	usb_config = 0;
+	usb_dev_state = USB_STATE_DEFAULT;
+	ep0.in_data = 0;
+	ep0.out_data = 0;
+	HAL_PCD_EP_Open(hpcd, USB_EP_OUT(0), USB_EP0_SIZE, EP_TYPE_CTRL);
+	HAL_PCD_EP_Open(hpcd, USB_EP_IN(0), USB_EP0_SIZE, EP_TYPE_CTRL);
+}
+
+void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd) {
+	if(usb_dev_state != USB_STATE_SUSPENDED) {
+		usb_state_before_suspend = usb_dev_state;
+	}
+	usb_dev_state = USB_STATE_SUSPENDED;
+}
+
+void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd) {
+	if(usb_dev_state == USB_STATE_SUSPENDED) {
+		usb_dev_state = usb_state_before_suspend;
+	}
+}
+
+void HAL_PCD_DisconnectCallback(PCD_HandleTypeDef *hpcd) {
+	usb_set_configuration(0);
+	usb_dev_state = USB_STATE_DEFAULT;
+}
@@ -0,0 +1,725 @@
+#include <string.h>
+#include "usb_msc.h"
+#include "usb_desc.h"
+#include "diskio.h"
+#include "main.h"
+
+#define SECTOR_SIZE 512
+
+// Bulk-Only Transport, USB Mass Storage Class BOT 1.0
+#define MSC_REQ_RESET 0xff
+#define MSC_REQ_GET_MAX_LUN 0xfe
+
+#define CBW_SIGNATURE 0x43425355
+#define CSW_SIGNATURE 0x53425355
+#define CBW_LENGTH 31
+#define CSW_LENGTH 13
+#define CBW_FLAG_IN 0x80
+
+#define CSW_PASSED 0
+#define CSW_FAILED 1
+#define CSW_PHASE_ERROR 2
+
+// SCSI commands, SPC-2 and SBC-2
+#define SCSI_TEST_UNIT_READY 0x00
+#define SCSI_REQUEST_SENSE 0x03
+#define SCSI_INQUIRY 0x12
+#define SCSI_MODE_SENSE6 0x1a
+#define SCSI_START_STOP_UNIT 0x1b
+#define SCSI_PREVENT_ALLOW 0x1e
+#define SCSI_READ_FORMAT_CAPACITIES 0x23
+#define SCSI_READ_CAPACITY10 0x25
+#define SCSI_READ10 0x28
+#define SCSI_WRITE10 0x2a
+#define SCSI_VERIFY10 0x2f
+#define SCSI_SYNCHRONIZE_CACHE10 0x35
+#define SCSI_MODE_SENSE10 0x5a
+
+// sense key, additional sense code
+#define SENSE_NONE 0x00, 0x00
+#define SENSE_NOT_PRESENT 0x02, 0x3a
+#define SENSE_READ_ERROR 0x03, 0x11
+#define SENSE_WRITE_ERROR 0x03, 0x0c
+#define SENSE_INVALID_OPCODE 0x05, 0x20
+#define SENSE_OUT_OF_RANGE 0x05, 0x21
+#define SENSE_INVALID_FIELD 0x05, 0x24
+#define SENSE_MEDIUM_CHANGED 0x06, 0x28
+
+// how often a missing card is looked for again
+#define MSC_INIT_RETRY_MS 1000
+
+typedef struct __attribute__((packed)) {
+	uint32_t signature;
+	uint32_t tag;
+	uint32_t length;
+	uint8_t flags;
+	uint8_t lun;
+	uint8_t cb_length;
+	uint8_t cb[16];
+} msc_cbw;
+
+typedef struct __attribute__((packed)) {
+	uint32_t signature;
+	uint32_t tag;
+	uint32_t residue;
+	uint8_t status;
+} msc_csw;
+
+typedef enum {
+	MSC_IDLE = 0,		// waiting for a CBW
+	MSC_COMMAND,		// CBW received, usb_msc_poll runs it
+	MSC_DATA_IN,
+	MSC_DATA_OUT,
+	MSC_STATUS,			// CSW on its way
+	MSC_STALLED,		// data stage cut short, CSW follows once the host clears the halt
+	MSC_RESET_RECOVERY,	// invalid CBW, endpoints stay halted until a mass storage reset
+} msc_phase;
+
+/*
+ * Private function prototypes
+ */
+static void usb_msc_configure(PCD_HandleTypeDef *hpcd);
+static void usb_msc_reset(void);
+static uint8_t usb_msc_setup(const usb_setup *req, const uint8_t **data, uint16_t *len);
+static void usb_msc_data_in(uint8_t ep);
+static void usb_msc_data_out(uint8_t ep, uint32_t len);
+static void usb_msc_clear_halt(uint8_t ep);
+static void msc_receive_cbw(void);
+static void msc_send_csw(void);
+static void msc_finish(uint8_t status);
+static void msc_fail(uint8_t key, uint8_t asc);
+static void msc_reply(const uint8_t *data, uint32_t len);
+static uint8_t msc_medium_ready(void);
+static void msc_execute(void);
+static void msc_start_io(uint8_t write);
+static void msc_read_kick(void);
+static void msc_write_kick(void);
+static void msc_read_poll(void);
+static void msc_write_poll(void);
+
+/*
+ * Private variables
+ */
+const usb_class usb_msc_class = {
+	.first_interface = USB_MSC_INTERFACE,
+	.num_interfaces = 1,
+	.endpoints = USB_EP_BIT(USB_MSC_IN_EP) | USB_EP_BIT(USB_MSC_OUT_EP),
+	.configure = usb_msc_configure,
+	.reset = usb_msc_reset,
+	.setup = usb_msc_setup,
+	.data_in = usb_msc_data_in,
+	.data_out = usb_msc_data_out,
+	.clear_halt = usb_msc_clear_halt,
+};
+
+static PCD_HandleTypeDef *msc_pcd = NULL;
+static volatile uint8_t msc_configured = 0;
+static volatile msc_phase phase = MSC_IDLE;
+static usb_msc_stats stats;
+
+static uint8_t cbw_packet[USB_FS_BULK_SIZE] __attribute__((aligned(4)));
+static msc_cbw cbw;
+static msc_csw csw;
+static uint32_t residue;
+static uint8_t csw_status;
+static uint8_t max_lun = 0;
+
+/*
+ * The card belongs to the host from its first READ(10), WRITE(10) or
+ * PREVENT MEDIUM REMOVAL on, a host that only enumerates leaves it to
+ * FatFs. Ejecting, from either side, hands it back, and the next attach
+ * reports a medium change.
+ */
+static volatile uint8_t msc_claimed = 0;
+static volatile uint8_t msc_ejected = 0;
+static volatile uint8_t msc_unit_attention = 0;
+static volatile uint8_t msc_prevent_removal = 0;
+static uint32_t msc_sectors = 0;
+static uint32_t msc_init_tick = 0;
+static uint8_t msc_init_tried = 0;
+static uint8_t sense_key = 0;
+static uint8_t sense_asc = 0;
+
+// READ(10) / WRITE(10) pipeline over the two halves of msc_buffer
+static uint8_t msc_buffer[2][USB_MSC_BUFFER_SECTORS * SECTOR_SIZE] __attribute__((aligned(4)));
+static struct {
+	uint32_t lba;			// next sector on the card side
+	uint32_t disk_left;		// sectors the card still has to move
+	uint32_t usb_left;		// sectors USB still has to move
+	uint32_t blocks;
+	uint8_t disk_half;
+	uint8_t usb_half;
+	uint8_t count[2];
+	volatile uint8_t full[2];	// read: loaded from the card, write: received from the host
+	volatile uint8_t usb_busy;
+	volatile uint8_t error;
+	volatile uint8_t short_out;	// the host ended WRITE(10) data early
+	uint8_t active;
+} io;
+
+/*
+ * Private functions
+ */
+static void usb_msc_configure(PCD_HandleTypeDef *hpcd) {
+	msc_pcd = hpcd;
+	memset(&io, 0, sizeof(io));
+	phase = MSC_IDLE;
+	msc_claimed = 0;
+	msc_ejected = 0;
+	msc_prevent_removal = 0;
+	msc_sectors = 0;
+	msc_init_tried = 0;
+
+	HAL_PCD_EP_Open(hpcd, USB_MSC_IN_EP, USB_FS_BULK_SIZE, EP_TYPE_BULK);
+	HAL_PCD_EP_Open(hpcd, USB_MSC_OUT_EP, USB_FS_BULK_SIZE, EP_TYPE_BULK);
+	msc_configured = 1;
+	msc_receive_cbw();
+}
+
+static void usb_msc_reset(void) {
+	msc_configured = 0;
+	msc_claimed = 0;
+	phase = MSC_IDLE;
+	io.active = 0;
+	io.usb_busy = 0;
+	if(msc_pcd != NULL) {
+		HAL_PCD_EP_Close(msc_pcd, USB_MSC_IN_EP);
+		HAL_PCD_EP_Close(msc_pcd, USB_MSC_OUT_EP);
+	}
+}
+
+static uint8_t usb_msc_setup(const usb_setup *req, const uint8_t **data, uint16_t *len) {
+	if((req->bmRequestType & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_CLASS) {
+		return 0;
+	}
+
+	switch(req->bRequest) {
+	case MSC_REQ_RESET:
+		if(req->wLength != 0 || req->wValue != 0) {
+			return 0;
+		}
+		// the halts stay until the host clears them, the next CBW is primed then
+		HAL_PCD_EP_Abort(msc_pcd, USB_MSC_IN_EP);
+		HAL_PCD_EP_Abort(msc_pcd, USB_MSC_OUT_EP);
+		io.active = 0;
+		io.usb_busy = 0;
+		phase = MSC_IDLE;
+		stats.resets++;
+		if(!msc_pcd->OUT_ep[USB_MSC_OUT_EP & 0x0f].is_stall) {
+			msc_receive_cbw();
+		}
+		return 1;
+	case MSC_REQ_GET_MAX_LUN:
+		*data = &max_lun;
+		*len = 1;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void usb_msc_clear_halt(uint8_t ep) {
+	switch(phase) {
+	case MSC_RESET_RECOVERY:
+		// only a mass storage reset ends this, BOT 6.6.1
+		HAL_PCD_EP_SetStall(msc_pcd, ep);
+		break;
+	case MSC_STALLED:
+		if(ep == USB_MSC_IN_EP) {
+			msc_send_csw();
+		}
+		break;
+	case MSC_IDLE:
+		if(ep == USB_MSC_OUT_EP) {
+			msc_receive_cbw();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void msc_receive_cbw(void) {
+	HAL_PCD_EP_Receive(msc_pcd, USB_MSC_OUT_EP, cbw_packet, sizeof(cbw_packet));
+}
+
+static void msc_send_csw(void) {
+	csw.signature = CSW_SIGNATURE;
+	csw.tag = cbw.tag;
+	csw.residue = residue;
+	csw.status = csw_status;
+	phase = MSC_STATUS;
+	HAL_PCD_EP_Transmit(msc_pcd, USB_MSC_IN_EP, (uint8_t *)&csw, CSW_LENGTH);
+}
+
+/*
+ * Ends the data stage. Data the host still expects to receive is refused
+ * by halting IN, the CSW then waits for the halt to be cleared. Data it
+ * still wants to send is refused by halting OUT, BOT 6.7.
+ */
+static void msc_finish(uint8_t status) {
+	csw_status = status;
+	if(residue != 0 && (cbw.flags & CBW_FLAG_IN)) {
+		phase = MSC_STALLED;
+		HAL_PCD_EP_SetStall(msc_pcd, USB_MSC_IN_EP);
+		return;
+	}
+	if(residue != 0) {
+		HAL_PCD_EP_SetStall(msc_pcd, USB_MSC_OUT_EP);
+	}
+	msc_send_csw();
+}
+
+static void msc_fail(uint8_t key, uint8_t asc) {
+	sense_key = key;
+	sense_asc = asc;
+	stats.failed++;
+	msc_finish(CSW_FAILED);
+}
+
+// Data IN stage for short replies, cut to what the host asked for
+static void msc_reply(const uint8_t *data, uint32_t len) {
+	if(!(cbw.flags & CBW_FLAG_IN) && residue != 0) {
+		msc_finish(CSW_PHASE_ERROR);
+		return;
+	}
+	if(len > residue) {
+		len = residue;
+	}
+	if(len == 0) {
+		msc_finish(CSW_PASSED);
+		return;
+	}
+	residue -= len;
+	phase = MSC_DATA_IN;
+	HAL_PCD_EP_Transmit(msc_pcd, USB_MSC_IN_EP, (uint8_t *)data, len);
+}
+
+// The card is attached, initialized and its size known
+static uint8_t msc_medium_ready(void) {
+	if(msc_ejected) {
+		return 0;
+	}
+	if(disk_status(0) & STA_NOINIT) {
+		msc_sectors = 0;
+		if(msc_init_tried && HAL_GetTick() - msc_init_tick < MSC_INIT_RETRY_MS) {
+			return 0;
+		}
+		msc_init_tried = 1;
+		msc_init_tick = HAL_GetTick();
+		if(disk_initialize(0) & STA_NOINIT) {
+			return 0;
+		}
+	}
+	if(msc_sectors == 0) {
+		LBA_t count = 0;
+		if(disk_ioctl(0, GET_SECTOR_COUNT, &count) != RES_OK || count == 0) {
+			return 0;
+		}
+		msc_sectors = count;
+	}
+	return 1;
+}
+
+static void put_be32(uint8_t *p, uint32_t value) {
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static void msc_execute(void) {
+	uint8_t *reply = msc_buffer[0];
+	const uint8_t *cb = cbw.cb;
+
+	stats.commands++;
+	residue = cbw.length;
+
+	if(msc_unit_attention && cb[0] != SCSI_INQUIRY && cb[0] != SCSI_REQUEST_SENSE) {
+		msc_unit_attention = 0;
+		msc_fail(SENSE_MEDIUM_CHANGED);
+		return;
+	}
+
+	switch(cb[0]) {
+	case SCSI_TEST_UNIT_READY:
+		if(!msc_medium_ready()) {
+			msc_fail(SENSE_NOT_PRESENT);
+			return;
+		}
+		msc_finish(CSW_PASSED);
+		return;
+
+	case SCSI_REQUEST_SENSE:
+		memset(reply, 0, 18);
+		reply[0] = 0x70;	// current error, fixed format
+		reply[2] = sense_key;
+		reply[7] = 10;
+		reply[12] = sense_asc;
+		sense_key = sense_asc = 0;
+		msc_reply(reply, 18);
+		return;
+
+	case SCSI_INQUIRY:
+		if(cb[1] & 0x01) {
+			// no vital product data pages
+			msc_fail(SENSE_INVALID_FIELD);
+			return;
+		}
+		memset(reply, 0, 36);
+		reply[1] = 0x80;	// removable
+		reply[2] = 0x02;
+		reply[3] = 0x02;
+		reply[4] = 36 - 5;
+		memcpy(reply + 8, "onewire ", 8);
+		memcpy(reply + 16, "SD card         ", 16);
+		memcpy(reply + 32, "1.00", 4);
+		msc_reply(reply, 36);
+		return;
+
+	case SCSI_MODE_SENSE6:
+		// header only, no pages and not write protected
+		memset(reply, 0, 4);
+		reply[0] = 3;
+		msc_reply(reply, 4);
+		return;
+
+	case SCSI_MODE_SENSE10:
+		memset(reply, 0, 8);
+		reply[1] = 6;
+		msc_reply(reply, 8);
+		return;
+
+	case SCSI_PREVENT_ALLOW:
+		msc_prevent_removal = cb[4] & 0x01;
+		if(msc_prevent_removal && !msc_ejected) {
+			msc_claimed = 1;
+		}
+		msc_finish(CSW_PASSED);
+		return;
+
+	case SCSI_START_STOP_UNIT:
+		if((cb[4] & 0x03) == 0x02) {
+			// LoEj without Start: the host is done with the card
+			msc_ejected = 1;
+			msc_claimed = 0;
+			msc_prevent_removal = 0;
+		} else if((cb[4] & 0x03) == 0x03) {
+			msc_ejected = 0;
+		}
+		msc_finish(CSW_PASSED);
+		return;
+
+	case SCSI_READ_FORMAT_CAPACITIES:
+		if(!msc_medium_ready()) {
+			msc_fail(SENSE_NOT_PRESENT);
+			return;
+		}
+		memset(reply, 0, 12);
+		reply[3] = 8;
+		put_be32(reply + 4, msc_sectors);
+		reply[8] = 0x02;	// formatted media
+		reply[10] = SECTOR_SIZE >> 8;
+		reply[11] = SECTOR_SIZE & 0xff;
+		msc_reply(reply, 12);
+		return;
+
+	case SCSI_READ_CAPACITY10:
+		if(!msc_medium_ready()) {
+			msc_fail(SENSE_NOT_PRESENT);
+			return;
+		}
+		put_be32(reply, msc_sectors - 1);
+		put_be32(reply + 4, SECTOR_SIZE);
+		msc_reply(reply, 8);
+		return;
+
+	case SCSI_READ10:
+	case SCSI_WRITE10:
+		if(!msc_medium_ready()) {
+			msc_fail(SENSE_NOT_PRESENT);
+			return;
+		}
+		msc_claimed = 1;
+		msc_start_io(cb[0] == SCSI_WRITE10);
+		return;
+
+	case SCSI_VERIFY10:
+		// BYTCHK is not supported, the medium is always "verified"
+		msc_finish(CSW_PASSED);
+		return;
+
+	case SCSI_SYNCHRONIZE_CACHE10:
+		if(!msc_medium_ready() || disk_ioctl(0, CTRL_SYNC, NULL) != RES_OK) {
+			msc_fail(SENSE_NOT_PRESENT);
+			return;
+		}
+		msc_finish(CSW_PASSED);
+		return;
+
+	default:
+		msc_fail(SENSE_INVALID_OPCODE);
+		return;
+	}
+}
+
+static void msc_start_io(uint8_t write) {
+	const uint8_t *cb = cbw.cb;
+	uint32_t lba = (uint32_t)cb[2] << 24 | cb[3] << 16 | cb[4] << 8 | cb[5];
+	uint32_t blocks = cb[7] << 8 | cb[8];
+
+	// the host must expect exactly the direction and at least the amount
+	uint8_t dir_in = (cbw.flags & CBW_FLAG_IN) != 0;
+	if((blocks != 0 && dir_in == write) || cbw.length < blocks * SECTOR_SIZE) {
+		msc_finish(CSW_PHASE_ERROR);
+		return;
+	}
+	if(lba >= msc_sectors || blocks > msc_sectors - lba) {
+		msc_fail(SENSE_OUT_OF_RANGE);
+		return;
+	}
+	if(blocks == 0) {
+		msc_finish(CSW_PASSED);
+		return;
+	}
+
+	memset(&io, 0, sizeof(io));
+	io.lba = lba;
+	io.disk_left = io.usb_left = io.blocks = blocks;
+	io.active = 1;
+
+	if(write) {
+		phase = MSC_DATA_OUT;
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		msc_write_kick();
+		__set_PRIMASK(primask);
+	} else {
+		phase = MSC_DATA_IN;
+	}
+}
+
+// runs with interrupts masked or from the USB interrupt
+static void msc_read_kick(void) {
+	uint8_t h = io.usb_half;
+	if(io.usb_busy || !io.full[h]) {
+		return;
+	}
+	io.usb_busy = 1;
+	HAL_PCD_EP_Transmit(msc_pcd, USB_MSC_IN_EP, msc_buffer[h], io.count[h] * SECTOR_SIZE);
+}
+
+// runs with interrupts masked or from the USB interrupt
+static void msc_write_kick(void) {
+	uint8_t h = io.usb_half;
+	if(io.usb_busy || io.usb_left == 0 || io.full[h] || io.error) {
+		return;
+	}
+	io.count[h] = io.usb_left < USB_MSC_BUFFER_SECTORS ? io.usb_left : USB_MSC_BUFFER_SECTORS;
+	io.usb_busy = 1;
+	HAL_PCD_EP_Receive(msc_pcd, USB_MSC_OUT_EP, msc_buffer[h], io.count[h] * SECTOR_SIZE);
+}
+
+// Loads the next free half from the card while USB sends the other one
+static void msc_read_poll(void) {
+	uint8_t h = io.disk_half;
+	if(io.error) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		if(!io.usb_busy && io.active) {
+			io.active = 0;
+			if(disk_status(0) & STA_NOINIT) {
+				// the card stopped answering, diskio.c dropped it
+				msc_fail(SENSE_NOT_PRESENT);
+			} else {
+				msc_fail(SENSE_READ_ERROR);
+			}
+		}
+		__set_PRIMASK(primask);
+		return;
+	}
+	if(io.disk_left == 0 || io.full[h]) {
+		return;
+	}
+
+	uint8_t n = io.disk_left < USB_MSC_BUFFER_SECTORS ? io.disk_left : USB_MSC_BUFFER_SECTORS;
+	if(disk_read(0, msc_buffer[h], io.lba, n) != RES_OK) {
+		io.error = 1;
+		return;
+	}
+	io.count[h] = n;
+	io.lba += n;
+	io.disk_left -= n;
+	io.disk_half ^= 1;
+	stats.sectors_read += n;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	io.full[h] = 1;
+	msc_read_kick();
+	__set_PRIMASK(primask);
+}
+
+// Writes out a half received from the host while USB fills the other one
+static void msc_write_poll(void) {
+	uint8_t h = io.disk_half;
+	if(!io.full[h] || io.error) {
+		return;
+	}
+
+	uint8_t n = io.count[h];
+	if(n != 0 && disk_write(0, msc_buffer[h], io.lba, n) != RES_OK) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		io.error = 1;
+		io.active = 0;
+		// only what reached the card counts, the rest is refused by the OUT halt
+		residue = cbw.length - (io.blocks - io.disk_left) * SECTOR_SIZE;
+		if(disk_status(0) & STA_NOINIT) {
+			msc_fail(SENSE_NOT_PRESENT);
+		} else {
+			msc_fail(SENSE_WRITE_ERROR);
+		}
+		__set_PRIMASK(primask);
+		return;
+	}
+	io.lba += n;
+	io.disk_left -= n;
+	io.disk_half ^= 1;
+	stats.sectors_written += n;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	io.full[h] = 0;
+	// after a short packet nothing follows the half that held it
+	if(io.disk_left == 0 || (io.short_out && !io.full[h ^ 1])) {
+		io.active = 0;
+		msc_finish(io.short_out ? CSW_PHASE_ERROR : CSW_PASSED);
+	} else {
+		msc_write_kick();
+	}
+	__set_PRIMASK(primask);
+}
+
+static void usb_msc_data_in(uint8_t ep) {
+	switch(phase) {
+	case MSC_DATA_IN:
+		if(!io.active) {
+			// short reply done
+			msc_finish(CSW_PASSED);
+			return;
+		}
+		io.usb_busy = 0;
+		io.full[io.usb_half] = 0;
+		io.usb_left -= io.count[io.usb_half];
+		residue -= io.count[io.usb_half] * SECTOR_SIZE;
+		io.usb_half ^= 1;
+		if(io.usb_left == 0) {
+			io.active = 0;
+			msc_finish(CSW_PASSED);
+		} else {
+			msc_read_kick();
+		}
+		return;
+	case MSC_STATUS:
+		phase = MSC_IDLE;
+		msc_receive_cbw();
+		return;
+	default:
+		return;
+	}
+}
+
+static void usb_msc_data_out(uint8_t ep, uint32_t len) {
+	switch(phase) {
+	case MSC_IDLE:
+		memcpy(&cbw, cbw_packet, sizeof(cbw));
+		if(len != CBW_LENGTH || cbw.signature != CBW_SIGNATURE || cbw.lun > max_lun
+				|| cbw.cb_length < 1 || cbw.cb_length > 16) {
+			phase = MSC_RESET_RECOVERY;
+			HAL_PCD_EP_SetStall(msc_pcd, USB_MSC_IN_EP);
+			HAL_PCD_EP_SetStall(msc_pcd, USB_MSC_OUT_EP);
+			return;
+		}
+		phase = MSC_COMMAND;
+		return;
+	case MSC_DATA_OUT: {
+		if(!io.active) {
+			return;
+		}
+		uint8_t h = io.usb_half;
+		io.usb_busy = 0;
+		io.usb_left -= io.count[h];
+		residue -= len;
+		if(len < io.count[h] * SECTOR_SIZE) {
+			// a short packet ends the data stage, only the whole sectors in it reach the card
+			io.count[h] = len / SECTOR_SIZE;
+			io.usb_left = 0;
+			io.short_out = 1;
+		}
+		io.full[h] = 1;
+		io.usb_half ^= 1;
+		msc_write_kick();
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+/*
+ * Public functions
+ */
+
+// Runs SCSI commands and moves sectors between the card and the USB buffers
+void usb_msc_poll(void) {
+	switch(phase) {
+	case MSC_COMMAND:
+		msc_execute();
+		break;
+	case MSC_DATA_IN:
+		if(io.active) {
+			msc_read_poll();
+		}
+		break;
+	case MSC_DATA_OUT:
+		if(io.active) {
+			msc_write_poll();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// The host owns the card, FatFs must stay away from it
+uint8_t usb_msc_attached(void) {
+	return msc_configured && msc_claimed && !msc_ejected;
+}
+
+// Takes the card back from the host, fails while the host has locked it
+uint8_t usb_msc_eject(void) {
+	if(msc_prevent_removal) {
+		return 0;
+	}
+	msc_ejected = 1;
+	msc_claimed = 0;
+	return 1;
+}
+
+// Gives the card to the host again, it sees a medium change
+void usb_msc_attach(void) {
+	if(msc_ejected) {
+		msc_ejected = 0;
+		msc_sectors = 0;
+		msc_unit_attention = 1;
+	}
+}
+
+uint32_t usb_msc_sector_count(void) {
+	return msc_sectors;
+}
+
+const usb_msc_stats *usb_msc_get_stats(void) {
+	return &stats;
+}
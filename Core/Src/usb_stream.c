@@ -0,0 +1,220 @@
+#include <string.h>
+#include "usb_stream.h"
+#include "usb_desc.h"
+#include "stream_proto.h"
+#include "main.h"
+
+#define MASK (USB_STREAM_BUFFER_SIZE - 1)
+
+#if (USB_STREAM_BUFFER_SIZE & MASK) != 0
+#error "USB stream buffer size must be a power of two"
+#endif
+
+/*
+ * Private function prototypes
+ */
+static void usb_stream_configure(PCD_HandleTypeDef *hpcd);
+static void usb_stream_reset(void);
+static uint8_t usb_stream_setup(const usb_setup *req, const uint8_t **data, uint16_t *len);
+static void usb_stream_data_in(uint8_t ep);
+static void usb_stream_clear_halt(uint8_t ep);
+static void usb_stream_kick(void);
+static void usb_stream_copy(uint32_t pos, const void *data, uint32_t len);
+
+/*
+ * Private variables
+ */
+const usb_class usb_stream_class = {
+	.first_interface = USB_STREAM_INTERFACE,
+	.num_interfaces = 1,
+	.endpoints = USB_EP_BIT(USB_STREAM_IN_EP),
+	.configure = usb_stream_configure,
+	.reset = usb_stream_reset,
+	.setup = usb_stream_setup,
+	.data_in = usb_stream_data_in,
+	.clear_halt = usb_stream_clear_halt,
+};
+
+static PCD_HandleTypeDef *stream_pcd = NULL;
+static volatile uint8_t stream_configured = 0;
+static volatile uint8_t stream_started = 0;
+static uint16_t stream_seq = 0;
+static usb_stream_stats stats;
+static stream_stats_msg stats_msg;
+
+// records are queued whole by the main loop and sent in as few transfers as possible
+static uint8_t buffer[USB_STREAM_BUFFER_SIZE] __attribute__((aligned(4)));
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t in_flight = 0;
+static volatile uint8_t zlp = 0;
+
+/*
+ * Private functions
+ */
+static void usb_stream_configure(PCD_HandleTypeDef *hpcd) {
+	stream_pcd = hpcd;
+	head = tail = in_flight = 0;
+	zlp = 0;
+	stream_started = 0;
+	HAL_PCD_EP_Open(hpcd, USB_STREAM_IN_EP, USB_FS_BULK_SIZE, EP_TYPE_BULK);
+	stream_configured = 1;
+}
+
+static void usb_stream_reset(void) {
+	stream_configured = 0;
+	stream_started = 0;
+	in_flight = 0;
+	zlp = 0;
+	if(stream_pcd != NULL) {
+		HAL_PCD_EP_Close(stream_pcd, USB_STREAM_IN_EP);
+	}
+}
+
+static uint8_t usb_stream_setup(const usb_setup *req, const uint8_t **data, uint16_t *len) {
+	if((req->bmRequestType & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_VENDOR) {
+		return 0;
+	}
+
+	switch(req->bRequest) {
+	case STREAM_REQ_START:
+		if(!stream_started) {
+			// a new reader starts with an empty ring and a fresh sequence
+			if(in_flight == 0 && !zlp) {
+				tail = head;
+			}
+			stream_seq = 0;
+			stream_started = 1;
+		}
+		return 1;
+	case STREAM_REQ_STOP:
+		stream_started = 0;
+		return 1;
+	case STREAM_REQ_STATS:
+		stats_msg.records = stats.records;
+		stats_msg.dropped = stats.dropped;
+		stats_msg.bytes = stats.bytes;
+		stats_msg.peak = stats.peak;
+		*data = (const uint8_t *)&stats_msg;
+		*len = sizeof(stats_msg);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// runs with interrupts masked or from the USB interrupt
+static void usb_stream_kick(void) {
+	if(!stream_configured || in_flight != 0 || zlp) {
+		return;
+	}
+
+	uint32_t pending = head - tail;
+	if(pending == 0) {
+		return;
+	}
+
+	uint32_t start = tail & MASK;
+	uint32_t chunk = USB_STREAM_BUFFER_SIZE - start;
+	if(chunk > pending) {
+		chunk = pending;
+	}
+	if(chunk > USB_STREAM_MAX_TRANSFER) {
+		chunk = USB_STREAM_MAX_TRANSFER;
+	}
+
+	in_flight = chunk;
+	HAL_PCD_EP_Transmit(stream_pcd, USB_STREAM_IN_EP, buffer + start, chunk);
+	stats.transfers++;
+}
+
+static void usb_stream_data_in(uint8_t ep) {
+	uint32_t sent = in_flight;
+	in_flight = 0;
+	if(zlp) {
+		zlp = 0;
+		usb_stream_kick();
+		return;
+	}
+
+	tail += sent;
+	if(head == tail && (sent % USB_FS_BULK_SIZE) == 0) {
+		// ends the host's read without waiting for more data
+		zlp = 1;
+		HAL_PCD_EP_Transmit(stream_pcd, USB_STREAM_IN_EP, NULL, 0);
+		return;
+	}
+	usb_stream_kick();
+}
+
+static void usb_stream_clear_halt(uint8_t ep) {
+	// whatever was in flight is gone, carry on with the next transfer
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	tail += in_flight;
+	in_flight = 0;
+	zlp = 0;
+	usb_stream_kick();
+	__set_PRIMASK(primask);
+}
+
+static void usb_stream_copy(uint32_t pos, const void *data, uint32_t len) {
+	uint32_t start = pos & MASK;
+	uint32_t first = USB_STREAM_BUFFER_SIZE - start;
+	if(first > len) {
+		first = len;
+	}
+	memcpy(buffer + start, data, first);
+	memcpy(buffer, (const uint8_t *)data + first, len - first);
+}
+
+/*
+ * Public functions
+ */
+
+// A reader has started the stream, records are worth producing
+uint8_t usb_stream_active(void) {
+	return stream_configured && stream_started && usb_device_state() == USB_STATE_CONFIGURED;
+}
+
+// Queues one record, whole or not at all, returns 0 if it was dropped
+uint8_t usb_stream_write(uint8_t type, const void *payload, uint16_t len) {
+	if(!usb_stream_active()) {
+		return 0;
+	}
+
+	stream_header hdr = {
+		.magic = STREAM_MAGIC,
+		.type = type,
+		.version = STREAM_VERSION,
+		.length = len,
+		.seq = stream_seq++,
+	};
+	uint32_t size = sizeof(hdr) + len;
+	if(len > STREAM_MAX_PAYLOAD || USB_STREAM_BUFFER_SIZE - (head - tail) < size) {
+		stats.dropped++;
+		return 0;
+	}
+
+	uint32_t pos = head;
+	usb_stream_copy(pos, &hdr, sizeof(hdr));
+	usb_stream_copy(pos + sizeof(hdr), payload, len);
+	__DMB();
+	head = pos + size;
+
+	stats.records++;
+	stats.bytes += size;
+	if(head - tail > stats.peak) {
+		stats.peak = head - tail;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	usb_stream_kick();
+	__set_PRIMASK(primask);
+	return 1;
+}
+
+const usb_stream_stats *usb_stream_get_stats(void) {
+	return &stats;
+}
@@ -0,0 +1,44 @@
+/*
+ * Builds FAT12, FAT16 and FAT32 volumes in host memory, for the card model
+ * to serve. The firmware's FatFs is read only and has no f_mkfs.
+ *
+ * Files are stored in contiguous clusters and directories grow by a cluster
+ * at a time. Names are 8.3 and converted to upper case, timestamps are
+ * fixed so that images are identical from run to run.
+ */
+#ifndef HOST_FAT_IMAGE_H_
+#define HOST_FAT_IMAGE_H_
+
+#include <stdint.h>
+
+#define FAT_IMAGE_ROOT 0	// parent directory argument for the root
+
+typedef struct {
+	uint8_t *data;
+	uint32_t sectors;
+	uint8_t fat_type;			// 12, 16 or 32
+	uint32_t volume_start;		// boot sector, 0 without a partition table
+	uint8_t sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint32_t fat_sectors;
+	uint32_t root_entries;		// fixed root directory of FAT12 and FAT16
+	uint32_t root_start;
+	uint32_t data_start;
+	uint32_t clusters;
+	uint32_t next_cluster;		// first cluster never allocated
+} fat_image;
+
+/*
+ * Formats data (sectors of 512 bytes) with the given FAT type, behind an
+ * MBR with one partition if partitioned is set. Picks the smallest cluster
+ * size that gives a valid cluster count, returns 0 or -1 if there is none.
+ */
+int fat_image_format(fat_image *img, uint8_t *data, uint32_t sectors, uint8_t fat_type,
+		uint8_t partitioned);
+
+// Returns the first cluster of the new directory, 0 on failure
+uint32_t fat_image_mkdir(fat_image *img, uint32_t parent, const char *name);
+int fat_image_add_file(fat_image *img, uint32_t parent, const char *name, const void *data,
+		uint32_t size);
+
+#endif /* HOST_FAT_IMAGE_H_ */
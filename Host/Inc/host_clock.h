@@ -0,0 +1,45 @@
+/*
+ * Virtual time seen by the firmware on the host, in nanoseconds.
+ *
+ * Time only moves when the code under test pays for something: a HAL call,
+ * a timer poll, bytes on a bus, or a sleep. Peripheral models schedule
+ * events (a DMA transfer finishing, a byte arriving) that run as
+ * interrupts once the clock reaches them, in time order and, at equal
+ * times, in the order they were scheduled. Nothing depends on the speed
+ * of the host, so every run of a program gives the same numbers.
+ *
+ * Events wait while interrupts are masked through the PRIMASK functions of
+ * the HAL shim and do not nest. Time spent in an event handler is added to
+ * whatever the interrupted code was doing, like on the core.
+ */
+#ifndef HOST_CLOCK_H_
+#define HOST_CLOCK_H_
+
+#include <stdint.h>
+
+#define HOST_CLOCK_NEVER UINT64_MAX
+
+typedef void (*host_event_handler)(void *arg);
+
+// Owned by the model that schedules it, at most once in the queue
+typedef struct host_event {
+	struct host_event *next;
+	uint64_t at;
+	uint64_t seq;
+	host_event_handler handler;
+	void *arg;
+	uint8_t pending;
+} host_event;
+
+uint64_t host_clock_now(void);
+void host_clock_advance(uint64_t ns);
+void host_clock_reset(void);
+
+void host_clock_schedule(host_event *event, uint64_t at, host_event_handler handler, void *arg);
+void host_clock_cancel(host_event *event);
+uint64_t host_clock_next_event(void);
+void host_clock_sleep_until(uint64_t deadline);
+void host_clock_run_pending(void);
+uint8_t host_clock_in_event(void);
+
+#endif /* HOST_CLOCK_H_ */
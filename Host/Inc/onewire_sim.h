@@ -0,0 +1,93 @@
+/*
+ * Simulated open drain 1-Wire buses with virtual DS18B20 devices.
+ *
+ * Force included into onewire.c on the host, replacing the GPIO and timer
+ * access macros. Time only moves when the driver polls the timer or calls
+ * HAL_GetTick, so results do not depend on the speed of the host.
+ */
+#ifndef HOST_ONEWIRE_SIM_H_
+#define HOST_ONEWIRE_SIM_H_
+
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+
+#define ONEWIRE_SIM_MAX_BUSES 16
+#define ONEWIRE_SIM_MAX_DEVICES 32
+
+#define ONEWIRE_LOW(bus) onewire_sim_pin_write((bus)->out_port, (bus)->out_pin, 0)
+#define ONEWIRE_RELEASE(bus) onewire_sim_pin_write((bus)->out_port, (bus)->out_pin, 1)
+#define ONEWIRE_READ(bus) onewire_sim_pin_read((bus)->in_port, (bus)->in_pin)
+#define ONEWIRE_PORT_WRITE(port, bsrr) onewire_sim_port_write((port), (bsrr))
+#define ONEWIRE_PORT_READ(port) onewire_sim_port_read(port)
+#define ONEWIRE_TIMER_COUNT(htim) onewire_sim_timer_count()
+
+typedef enum {
+	ONEWIRE_SIM_IDLE = 0,
+	ONEWIRE_SIM_ROM_CMD,
+	ONEWIRE_SIM_MATCH,
+	ONEWIRE_SIM_SEARCH,
+	ONEWIRE_SIM_FUNC_CMD,
+	ONEWIRE_SIM_CONVERTING,
+	ONEWIRE_SIM_WRITE_SCRATCHPAD,
+	ONEWIRE_SIM_TX,
+} onewire_sim_state;
+
+typedef struct {
+	uint64_t rom;
+	uint8_t overdrive_capable;
+	int16_t temperature;		// loaded into the scratchpad by Convert T, 1/16 C
+	double conversion_scale;	// fraction of the datasheet worst case Tconv
+	double crc_error_rate;		// probability that a scratchpad read is corrupted
+
+	uint8_t scratchpad[9];
+	uint8_t overdrive;
+	onewire_sim_state state;
+	uint8_t rx_byte;
+	uint8_t rx_bits;
+	uint8_t rx_count;
+	uint8_t tx[9];
+	uint8_t tx_len;
+	uint16_t tx_bit;
+	uint8_t search_phase;
+	uint8_t search_bit;
+	uint64_t conversion_end;
+	uint8_t conversion_pending;
+	uint64_t hold_from;
+	uint64_t hold_until;
+
+	uint32_t conversions;
+	uint32_t scratchpad_reads;
+	uint32_t corrupted_reads;
+} onewire_sim_device;
+
+typedef struct {
+	GPIO_TypeDef *out_port;
+	GPIO_TypeDef *in_port;
+	uint16_t out_pin;
+	uint16_t in_pin;
+	uint8_t master_low;
+	uint64_t fall_time;
+	double noise_rate;		// probability that a sampled level is flipped
+	onewire_sim_device *devices[ONEWIRE_SIM_MAX_DEVICES];
+	uint8_t device_count;
+
+	uint32_t resets;
+	uint32_t slots;
+	uint32_t flipped_samples;
+	uint64_t busy_ns;
+} onewire_sim_bus;
+
+void onewire_sim_reset(void);
+void onewire_sim_seed(uint32_t seed);
+uint64_t onewire_sim_make_rom(uint8_t family, uint64_t serial);
+onewire_sim_bus *onewire_sim_bus_create(GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin);
+onewire_sim_device *onewire_sim_add_ds18b20(onewire_sim_bus *bus, uint64_t serial);
+
+void onewire_sim_pin_write(GPIO_TypeDef *port, uint16_t pin, uint8_t level);
+uint8_t onewire_sim_pin_read(GPIO_TypeDef *port, uint16_t pin);
+void onewire_sim_port_write(GPIO_TypeDef *port, uint32_t bsrr);
+uint16_t onewire_sim_port_read(GPIO_TypeDef *port);
+uint16_t onewire_sim_timer_count(void);
+
+#endif /* HOST_ONEWIRE_SIM_H_ */
@@ -0,0 +1,42 @@
+/*
+ * SD card in SPI mode on SPI1, selected by SPI1_CS from main.h.
+ *
+ * The card answers the commands diskio.c sends, with the data of a sector
+ * image in host memory. Access and programming times are virtual, the card
+ * sends 0xff before a data token and holds DO low while busy until the
+ * host clock passed them.
+ */
+#ifndef HOST_SD_SIM_H_
+#define HOST_SD_SIM_H_
+
+#include <stdint.h>
+
+#define SD_SIM_SECTOR_SIZE 512
+
+typedef struct {
+	uint8_t *image;
+	uint32_t sectors;
+	uint8_t high_capacity;		// SDHC: block addresses and a version 2.0 CSD
+
+	uint64_t init_ns;			// ACMD41 reports busy this long after CMD0
+	uint64_t read_latency_ns;	// command or previous block to the data token
+	uint64_t write_busy_ns;		// programming time of one block
+	double crc_error_rate;		// probability that a block is sent with a bad CRC
+
+	uint32_t commands;
+	uint32_t blocks_read;
+	uint32_t blocks_written;
+	uint32_t crc_errors;		// commands and data blocks rejected for their CRC
+	uint32_t illegal_commands;
+	uint64_t busy_ns;
+} sd_sim_card;
+
+/*
+ * Attaches a card backed by image, sectors must be a multiple of 1024 for
+ * SDHC and of 512 for SDSC cards. Writes go straight to the image.
+ */
+sd_sim_card *sd_sim_insert(uint8_t *image, uint32_t sectors, uint8_t high_capacity);
+void sd_sim_remove(void);
+void sd_sim_seed(uint32_t seed);
+
+#endif /* HOST_SD_SIM_H_ */
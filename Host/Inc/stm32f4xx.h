@@ -0,0 +1,10 @@
+/*
+ * Host replacement for the CMSIS device header, the register definitions
+ * the application uses live in the HAL shim.
+ */
+#ifndef HOST_STM32F4XX_H_
+#define HOST_STM32F4XX_H_
+
+#include "stm32f4xx_hal.h"
+
+#endif /* HOST_STM32F4XX_H_ */
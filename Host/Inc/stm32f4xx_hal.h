@@ -0,0 +1,239 @@
+/*
+ * Host replacement for the STM32 HAL.
+ *
+ * Only the types and calls used by the application sources are provided,
+ * peripherals are backed by the simulators in Host/Src.
+ */
+#ifndef HOST_STM32F4XX_HAL_H_
+#define HOST_STM32F4XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef enum {
+	RESET = 0,
+	SET = !RESET
+} FlagStatus;
+
+/*
+ * Output levels set through HAL_GPIO_WritePin are kept in ODR for the
+ * simulators that sample them (SD card chip select). The 1-Wire pins are
+ * driven through onewire_sim.h and never show up here.
+ */
+typedef struct {
+	const char *name;
+	uint16_t ODR;
+} GPIO_TypeDef;
+
+typedef struct {
+	volatile uint32_t CNT;
+} TIM_TypeDef;
+
+typedef struct {
+	TIM_TypeDef *Instance;
+} TIM_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t CR1;
+} SPI_TypeDef;
+
+typedef struct {
+	uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct {
+	SPI_TypeDef *Instance;
+	SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t SR;
+} USART_TypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+	uint32_t OverSampling;
+} UART_InitTypeDef;
+
+typedef struct {
+	volatile uint32_t NDTR;
+} DMA_Stream_TypeDef;
+
+typedef struct {
+	DMA_Stream_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+typedef enum {
+	HAL_UART_STATE_RESET = 0x00U,
+	HAL_UART_STATE_READY = 0x20U,
+	HAL_UART_STATE_BUSY_TX = 0x21U,
+	HAL_UART_STATE_BUSY_RX = 0x22U
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	uint8_t *pRxBuffPtr;
+	uint16_t RxXferSize;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	volatile HAL_UART_StateTypeDef gState;
+	volatile HAL_UART_StateTypeDef RxState;
+} UART_HandleTypeDef;
+
+/* The USB core only passes the handle around on the host */
+typedef struct {
+	void *pData;
+} PCD_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t ICSR;
+} SCB_Type;
+
+typedef struct {
+	volatile uint32_t LOAD;
+	volatile uint32_t VAL;
+} SysTick_Type;
+
+extern uint32_t SystemCoreClock;
+extern GPIO_TypeDef host_gpioa, host_gpiob, host_gpioc, host_gpiod,
+		host_gpioe, host_gpiof, host_gpiog, host_gpioh;
+extern TIM_TypeDef host_tim6;
+extern SPI_TypeDef host_spi1;
+extern USART_TypeDef host_usart3;
+extern SCB_Type host_scb;
+
+#define GPIOA (&host_gpioa)
+#define GPIOB (&host_gpiob)
+#define GPIOC (&host_gpioc)
+#define GPIOD (&host_gpiod)
+#define GPIOE (&host_gpioe)
+#define GPIOF (&host_gpiof)
+#define GPIOG (&host_gpiog)
+#define GPIOH (&host_gpioh)
+#define TIM6 (&host_tim6)
+#define SPI1 (&host_spi1)
+#define USART3 (&host_usart3)
+#define SCB (&host_scb)
+// reading the registers brings VAL up to the virtual time
+#define SysTick (host_systick())
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define SPI_CR1_SPE 0x0040U
+#define SPI_CR1_BR 0x0038U
+#define SPI_BAUDRATEPRESCALER_2 0x0000U
+#define SPI_BAUDRATEPRESCALER_4 0x0008U
+#define SPI_BAUDRATEPRESCALER_8 0x0010U
+#define SPI_BAUDRATEPRESCALER_16 0x0018U
+#define SPI_BAUDRATEPRESCALER_32 0x0020U
+#define SPI_BAUDRATEPRESCALER_64 0x0028U
+#define SPI_BAUDRATEPRESCALER_128 0x0030U
+#define SPI_BAUDRATEPRESCALER_256 0x0038U
+
+#define UART_FLAG_TC 0x0040U
+#define UART_OVERSAMPLING_16 0x0000U
+#define UART_OVERSAMPLING_8 0x8000U
+
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
+#define SCB_ICSR_VECTACTIVE_Msk 0x1FFUL
+
+#define MODIFY_REG(reg, clear, set) ((reg) = (((reg) & ~(clear)) | (set)))
+#define __HAL_SPI_DISABLE(handle) ((handle)->Instance->CR1 &= ~SPI_CR1_SPE)
+#define __HAL_UART_GET_FLAG(handle, flag) (((handle)->Instance->SR & (flag)) == (flag))
+#define __HAL_DMA_GET_COUNTER(handle) ((handle)->Instance->NDTR)
+
+// USARTDIV with 8x oversampling, as the F4 HAL computes it
+#define UART_DIV_SAMPLING8(pclk, baud) ((((uint64_t)(pclk)) * 25U) / (2U * ((uint64_t)(baud))))
+#define UART_DIVMANT_SAMPLING8(pclk, baud) (UART_DIV_SAMPLING8((pclk), (baud)) / 100U)
+#define UART_DIVFRAQ_SAMPLING8(pclk, baud) ((((UART_DIV_SAMPLING8((pclk), (baud)) \
+		- (UART_DIVMANT_SAMPLING8((pclk), (baud)) * 100U)) * 8U) + 50U) / 100U)
+#define UART_BRR_SAMPLING8(pclk, baud) ((UART_DIVMANT_SAMPLING8((pclk), (baud)) << 4U) \
+		+ ((UART_DIVFRAQ_SAMPLING8((pclk), (baud)) & 0xF8U) << 1U) \
+		+ (UART_DIVFRAQ_SAMPLING8((pclk), (baud)) & 0x07U))
+
+// and with 16x
+#define UART_DIV_SAMPLING16(pclk, baud) ((((uint64_t)(pclk)) * 25U) / (4U * ((uint64_t)(baud))))
+#define UART_DIVMANT_SAMPLING16(pclk, baud) (UART_DIV_SAMPLING16((pclk), (baud)) / 100U)
+#define UART_DIVFRAQ_SAMPLING16(pclk, baud) ((((UART_DIV_SAMPLING16((pclk), (baud)) \
+		- (UART_DIVMANT_SAMPLING16((pclk), (baud)) * 100U)) * 16U) + 50U) / 100U)
+#define UART_BRR_SAMPLING16(pclk, baud) ((UART_DIVMANT_SAMPLING16((pclk), (baud)) << 4U) \
+		+ (UART_DIVFRAQ_SAMPLING16((pclk), (baud)) & 0xF0U) \
+		+ (UART_DIVFRAQ_SAMPLING16((pclk), (baud)) & 0x0FU))
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+/* Interrupts are the events of host_clock.h, masking defers the ones that come due */
+extern uint32_t host_primask;
+void host_clock_run_pending(void);
+
+static inline uint32_t __get_PRIMASK(void) { return host_primask; }
+static inline void __set_PRIMASK(uint32_t primask) {
+	host_primask = primask;
+	if(primask == 0)
+		host_clock_run_pending();
+}
+static inline void __disable_irq(void) { host_primask = 1; }
+static inline void __enable_irq(void) { __set_PRIMASK(0); }
+static inline void __DMB(void) { }
+void __WFI(void);
+
+SysTick_Type *host_systick(void);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx,
+		uint16_t size, uint32_t timeout);
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+/*
+ * Host only: the device answering on a SPI bus, called once per byte with
+ * the byte sent and returning the byte received. Unattached buses read 0xff.
+ */
+typedef uint8_t (*host_spi_device)(uint8_t mosi);
+void host_spi_attach(SPI_TypeDef *spi, host_spi_device device);
+
+#endif /* HOST_STM32F4XX_HAL_H_ */
@@ -0,0 +1,31 @@
+/*
+ * UART with circular RX DMA and TX DMA, as console.c drives USART3.
+ *
+ * Transmitted bytes go to a stdio stream, received bytes are fed in by the
+ * test program. Both take their time on the line: the callbacks run as
+ * host_clock events when a transfer is done, a byte has arrived or the
+ * line went idle, followed by the hook that stands in for the code of the
+ * interrupt handlers in stm32f4xx_it.c.
+ */
+#ifndef HOST_UART_SIM_H_
+#define HOST_UART_SIM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+
+typedef struct {
+	uint32_t tx_bytes;
+	uint32_t tx_transfers;
+	uint32_t rx_bytes;
+	uint32_t rx_dropped;	// arrived with no reception running, or FIFO full
+	uint64_t wire_ns;		// time the transmitted bytes take on the line
+} uart_sim_stats;
+
+void uart_sim_set_output(FILE *out);
+void uart_sim_set_irq_hook(void (*hook)(void));
+void uart_sim_receive(UART_HandleTypeDef *huart, const uint8_t *data, uint32_t len);
+uint32_t uart_sim_rx_pending(void);
+const uart_sim_stats *uart_sim_get_stats(void);
+
+#endif /* HOST_UART_SIM_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Regression run of the console TX ring on the UART model: a telemetry
+ * frame that wraps around the end of the ring reaches the line in one
+ * piece when an interrupt handler writes to the console while telemetry
+ * hands the frame over, for every point the wrap can split it at.
+ *
+ * console_write is wrapped at link time, the wrapper makes the interrupt
+ * come due before the real one runs, so it fires at the first point
+ * console_write lets interrupts in.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "console.h"
+#include "frame.h"
+#include "host_clock.h"
+#include "telemetry.h"
+#include "uart_sim.h"
+
+#define TX_MASK (CONSOLE_TX_BUFFER_SIZE - 1)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+		if(!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while(0)
+
+UART_HandleTypeDef huart3 = { USART3, { CONSOLE_DEFAULT_BAUD, UART_OVERSAMPLING_16 } };
+static DMA_Stream_TypeDef usart3_rx_stream;
+static DMA_HandleTypeDef hdma_usart3_rx = { &usart3_rx_stream };
+
+static const char isr_text[] = "irq\n";
+static host_event isr_event;
+static uint8_t isr_armed = 0;
+static uint8_t isr_ran = 0;
+
+int __real_console_write(const char *data, int len);
+
+static void isr_write(void *arg) {
+	(void)arg;
+	console_write(isr_text, sizeof(isr_text) - 1);
+	isr_ran = 1;
+}
+
+int __wrap_console_write(const char *data, int len) {
+	if(isr_armed) {
+		isr_armed = 0;
+		host_clock_schedule(&isr_event, host_clock_now(), isr_write, NULL);
+	}
+	return __real_console_write(data, len);
+}
+
+// Moves the head of the ring to ring_pos with text, then waits until it is on the line
+static void pad_to(uint32_t ring_pos) {
+	static char pad[CONSOLE_TX_BUFFER_SIZE];
+	uint32_t len = (ring_pos - console_get_stats()->written) & TX_MASK;
+
+	memset(pad, '.', len);
+	console_write(pad, len);
+	console_flush();
+}
+
+// The frame must come whole, with the interrupt's text after it
+static void check_frame(const uint8_t *out, size_t out_len, uint32_t room) {
+	uint8_t raw[TELEMETRY_RAW_MAX];
+	size_t end = 1;
+
+	while(end < out_len && out[end] != 0) {
+		end++;
+	}
+	CHECK(out_len != 0 && out[0] == 0 && end < out_len, "room %u: no frame on the line", room);
+	if(end >= out_len) {
+		return;
+	}
+
+	int n = frame_cobs_decode(out + 1, end - 1, raw, sizeof(raw));
+	CHECK(n >= (int)sizeof(telemetry_header) + 2, "room %u: frame does not decode", room);
+	if(n < (int)sizeof(telemetry_header) + 2) {
+		return;
+	}
+	uint16_t crc = raw[n - 2] | (raw[n - 1] << 8);
+	CHECK(frame_crc16(FRAME_CRC16_INIT, raw, n - 2) == crc, "room %u: bad crc", room);
+	CHECK(((telemetry_header *)raw)->type == TELEMETRY_MSG_HELLO, "room %u: type %u", room,
+			((telemetry_header *)raw)->type);
+	CHECK(end + 1 > room, "room %u: frame of %u bytes did not wrap", room, (unsigned)(end + 1));
+	CHECK(out_len - end - 1 == sizeof(isr_text) - 1 && memcmp(out + end + 1, isr_text, sizeof(isr_text) - 1) == 0,
+			"room %u: %u bytes after the frame", room, (unsigned)(out_len - end - 1));
+}
+
+int main(void) {
+	char *out = NULL;
+	size_t out_len = 0;
+	FILE *line = open_memstream(&out, &out_len);
+	if(line == NULL) {
+		return 1;
+	}
+
+	host_clock_reset();
+	uart_sim_set_output(line);
+	huart3.hdmarx = &hdma_usart3_rx;
+	HAL_UART_Init(&huart3);
+	console_init(&huart3);
+	telemetry_init();
+
+	// a hello frame is the same size every time, measure it first
+	telemetry_send_hello();
+	console_flush();
+	fflush(line);
+	uint32_t frame_len = out_len;
+
+	for(uint32_t room = 1; room < frame_len; room++) {
+		pad_to(CONSOLE_TX_BUFFER_SIZE - room);
+		fflush(line);
+		size_t mark = out_len;
+
+		isr_ran = 0;
+		isr_armed = 1;
+		CHECK(telemetry_send_hello() == 0, "room %u: frame dropped", room);
+		console_flush();
+		fflush(line);
+		CHECK(isr_ran, "room %u: the interrupt did not run", room);
+		check_frame((const uint8_t *)out + mark, out_len - mark, room);
+	}
+	printf("%u byte frame wrapped at %u points, interrupt write during each\n",
+			frame_len, frame_len - 1);
+
+	fclose(line);
+	free(out);
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * crashdump.h on the host, where a crash ends the process and the sanitizers
+ * or a core file tell the story: no dump is ever recorded.
+ */
+#include <stddef.h>
+#include "crashdump.h"
+
+void crashdump_init(void) {
+}
+
+void crashdump_report(void) {
+}
+
+const crashdump *crashdump_get(void) {
+	return NULL;
+}
+
+void crashdump_print(const crashdump *dump) {
+}
+
+void crashdump_clear(void) {
+}
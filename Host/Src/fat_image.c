@@ -0,0 +1,334 @@
+/*
+ * FAT volume builder, field layout of the Microsoft FAT specification.
+ */
+#include <string.h>
+#include <ctype.h>
+#include "fat_image.h"
+
+#define SECTOR_SIZE 512
+#define DIR_ENTRY_SIZE 32
+#define NUM_FATS 2
+
+/* Cluster count limits, kept clear of the values FatFs and Windows disagree on */
+#define FAT12_MAX_CLUSTERS 4084
+#define FAT16_MIN_CLUSTERS 4086
+#define FAT16_MAX_CLUSTERS 65524
+#define FAT32_MIN_CLUSTERS 65526
+#define FAT32_MAX_CLUSTERS 0x0ffffff5
+
+#define PARTITION_START 2048
+
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE 0x20
+
+/* 2024-01-01 12:00:00 */
+#define FIXED_DATE (((2024 - 1980) << 9) | (1 << 5) | 1)
+#define FIXED_TIME (12 << 11)
+
+/*
+ * Private functions
+ */
+static void put16(uint8_t *p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+static uint8_t *sector_ptr(fat_image *img, uint32_t sector) {
+	return img->data + (size_t)sector * SECTOR_SIZE;
+}
+
+static uint32_t cluster_sector(fat_image *img, uint32_t cluster) {
+	return img->data_start + (cluster - 2) * img->sectors_per_cluster;
+}
+
+static uint32_t fat_eoc(fat_image *img) {
+	return img->fat_type == 12 ? 0xfff : img->fat_type == 16 ? 0xffff : 0x0fffffff;
+}
+
+static void fat_set(fat_image *img, uint32_t cluster, uint32_t value) {
+	for(uint32_t n = 0; n < NUM_FATS; n++) {
+		uint8_t *fat = sector_ptr(img, img->volume_start + img->reserved_sectors + n * img->fat_sectors);
+		if(img->fat_type == 12) {
+			uint8_t *p = fat + cluster + cluster / 2;
+			uint16_t word = p[0] | p[1] << 8;
+			if(cluster & 1)
+				word = (word & 0x000f) | (value << 4);
+			else
+				word = (word & 0xf000) | (value & 0x0fff);
+			put16(p, word);
+		} else if(img->fat_type == 16) {
+			put16(fat + cluster * 2, value);
+		} else {
+			put32(fat + cluster * 4, value & 0x0fffffff);
+		}
+	}
+}
+
+static uint32_t fat_get(fat_image *img, uint32_t cluster) {
+	const uint8_t *fat = sector_ptr(img, img->volume_start + img->reserved_sectors);
+	if(img->fat_type == 12) {
+		const uint8_t *p = fat + cluster + cluster / 2;
+		uint16_t word = p[0] | p[1] << 8;
+		return cluster & 1 ? word >> 4 : word & 0x0fff;
+	}
+	if(img->fat_type == 16)
+		return fat[cluster * 2] | fat[cluster * 2 + 1] << 8;
+	const uint8_t *p = fat + cluster * 4;
+	return ((uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24) & 0x0fffffff;
+}
+
+// Allocates count contiguous clusters as one chain and zeroes them, returns the first or 0
+static uint32_t alloc_chain(fat_image *img, uint32_t count) {
+	if(count == 0 || img->next_cluster + count > img->clusters + 2)
+		return 0;
+	uint32_t first = img->next_cluster;
+	for(uint32_t i = 0; i < count; i++)
+		fat_set(img, first + i, i == count - 1 ? fat_eoc(img) : first + i + 1);
+	memset(sector_ptr(img, cluster_sector(img, first)), 0,
+			(size_t)count * img->sectors_per_cluster * SECTOR_SIZE);
+	img->next_cluster += count;
+	return first;
+}
+
+static int make_short_name(const char *name, uint8_t *out) {
+	memset(out, ' ', 11);
+	uint8_t i = 0, limit = 8, pos = 0;
+	for(const char *p = name; *p != '\0'; p++) {
+		if(*p == '.' && pos == 0) {
+			pos = 8;
+			i = 0;
+			limit = 3;
+			continue;
+		}
+		if(i >= limit || *p == '.' || *p == ' ')
+			return -1;
+		out[pos + i++] = toupper((unsigned char)*p);
+	}
+	return out[0] == ' ' ? -1 : 0;
+}
+
+// A free entry in the directory, grows subdirectories and the FAT32 root by a cluster
+static uint8_t *dir_free_entry(fat_image *img, uint32_t dir) {
+	uint32_t per_sector = SECTOR_SIZE / DIR_ENTRY_SIZE;
+
+	if(dir == FAT_IMAGE_ROOT && img->fat_type != 32) {
+		for(uint32_t i = 0; i < img->root_entries; i++) {
+			uint8_t *e = sector_ptr(img, img->root_start + i / per_sector) + (i % per_sector) * DIR_ENTRY_SIZE;
+			if(e[0] == 0x00 || e[0] == 0xe5)
+				return e;
+		}
+		return NULL;
+	}
+
+	uint32_t cluster = dir == FAT_IMAGE_ROOT ? 2 : dir;
+	uint32_t entries = img->sectors_per_cluster * per_sector;
+	while(1) {
+		uint8_t *base = sector_ptr(img, cluster_sector(img, cluster));
+		for(uint32_t i = 0; i < entries; i++) {
+			uint8_t *e = base + i * DIR_ENTRY_SIZE;
+			if(e[0] == 0x00 || e[0] == 0xe5)
+				return e;
+		}
+		uint32_t next = fat_get(img, cluster);
+		if(next >= 2 && next < img->clusters + 2) {
+			cluster = next;
+			continue;
+		}
+		next = alloc_chain(img, 1);
+		if(next == 0)
+			return NULL;
+		fat_set(img, cluster, next);
+		cluster = next;
+	}
+}
+
+static void fill_entry(uint8_t *e, const uint8_t *name, uint8_t attr, uint32_t cluster, uint32_t size) {
+	memset(e, 0, DIR_ENTRY_SIZE);
+	memcpy(e, name, 11);
+	e[11] = attr;
+	put16(e + 14, FIXED_TIME);
+	put16(e + 16, FIXED_DATE);
+	put16(e + 18, FIXED_DATE);
+	put16(e + 20, cluster >> 16);
+	put16(e + 22, FIXED_TIME);
+	put16(e + 24, FIXED_DATE);
+	put16(e + 26, cluster);
+	put32(e + 28, size);
+}
+
+static int add_entry(fat_image *img, uint32_t parent, const char *name, uint8_t attr,
+		uint32_t cluster, uint32_t size) {
+	uint8_t short_name[11];
+	if(make_short_name(name, short_name) != 0)
+		return -1;
+	uint8_t *e = dir_free_entry(img, parent);
+	if(e == NULL)
+		return -1;
+	fill_entry(e, short_name, attr, cluster, size);
+	return 0;
+}
+
+// Cluster size and FAT size for the requested type, the FAT size is iterated to a fixed point
+static int choose_geometry(fat_image *img, uint32_t volume_sectors) {
+	uint32_t bits = img->fat_type;
+	img->reserved_sectors = img->fat_type == 32 ? 32 : 1;
+	img->root_entries = img->fat_type == 32 ? 0 : 512;
+	uint32_t root_sectors = img->root_entries * DIR_ENTRY_SIZE / SECTOR_SIZE;
+
+	for(uint32_t spc = 1; spc <= 128; spc <<= 1) {
+		uint32_t fat_sectors = 1;
+		uint32_t clusters = 0;
+		while(1) {
+			uint32_t meta = img->reserved_sectors + NUM_FATS * fat_sectors + root_sectors;
+			if(meta >= volume_sectors) {
+				clusters = 0;
+				break;
+			}
+			clusters = (volume_sectors - meta) / spc;
+			uint32_t needed = (uint32_t)(((uint64_t)(clusters + 2) * bits / 8 + SECTOR_SIZE) / SECTOR_SIZE);
+			if(needed <= fat_sectors)
+				break;
+			fat_sectors = needed;
+		}
+
+		uint8_t valid = (img->fat_type == 12 && clusters >= 1 && clusters <= FAT12_MAX_CLUSTERS)
+				|| (img->fat_type == 16 && clusters >= FAT16_MIN_CLUSTERS && clusters <= FAT16_MAX_CLUSTERS)
+				|| (img->fat_type == 32 && clusters >= FAT32_MIN_CLUSTERS && clusters <= FAT32_MAX_CLUSTERS);
+		if(valid) {
+			img->sectors_per_cluster = spc;
+			img->fat_sectors = fat_sectors;
+			img->clusters = clusters;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void write_boot_sector(fat_image *img, uint8_t *bs, uint32_t volume_sectors) {
+	static const uint8_t jump16[3] = { 0xeb, 0x3c, 0x90 };
+	static const uint8_t jump32[3] = { 0xeb, 0x58, 0x90 };
+
+	memcpy(bs, img->fat_type == 32 ? jump32 : jump16, 3);
+	memcpy(bs + 3, "ONEWIRE ", 8);
+	put16(bs + 11, SECTOR_SIZE);
+	bs[13] = img->sectors_per_cluster;
+	put16(bs + 14, img->reserved_sectors);
+	bs[16] = NUM_FATS;
+	put16(bs + 17, img->root_entries);
+	if(img->fat_type != 32 && volume_sectors < 0x10000)
+		put16(bs + 19, volume_sectors);
+	else
+		put32(bs + 32, volume_sectors);
+	bs[21] = 0xf8;
+	put16(bs + 24, 63);
+	put16(bs + 26, 255);
+	put32(bs + 28, img->volume_start);
+
+	uint8_t *ext = bs + 36;
+	if(img->fat_type == 32) {
+		put32(bs + 36, img->fat_sectors);
+		put32(bs + 44, 2);		// root directory cluster
+		put16(bs + 48, 1);		// FSInfo sector
+		put16(bs + 50, 6);		// backup boot sector
+		ext = bs + 64;
+	} else {
+		put16(bs + 22, img->fat_sectors);
+	}
+	ext[0] = 0x80;				// drive number
+	ext[2] = 0x29;				// extended boot signature
+	put32(ext + 3, 0x12345678);
+	memcpy(ext + 7, "NO NAME    ", 11);
+	memcpy(ext + 18, img->fat_type == 12 ? "FAT12   " : img->fat_type == 16 ? "FAT16   " : "FAT32   ", 8);
+	put16(bs + 510, 0xaa55);
+}
+
+static void write_fsinfo(uint8_t *fsi) {
+	put32(fsi, 0x41615252);
+	put32(fsi + 484, 0x61417272);
+	put32(fsi + 488, 0xffffffff);	// free count unknown
+	put32(fsi + 492, 0xffffffff);
+	put32(fsi + 508, 0xaa550000);
+}
+
+/*
+ * Public functions
+ */
+int fat_image_format(fat_image *img, uint8_t *data, uint32_t sectors, uint8_t fat_type,
+		uint8_t partitioned) {
+	memset(img, 0, sizeof(*img));
+	if(fat_type != 12 && fat_type != 16 && fat_type != 32)
+		return -1;
+	img->data = data;
+	img->sectors = sectors;
+	img->fat_type = fat_type;
+	img->volume_start = partitioned ? PARTITION_START : 0;
+	if(img->volume_start >= sectors)
+		return -1;
+
+	uint32_t volume_sectors = sectors - img->volume_start;
+	if(choose_geometry(img, volume_sectors) != 0)
+		return -1;
+	memset(data, 0, (size_t)sectors * SECTOR_SIZE);
+
+	if(partitioned) {
+		static const uint8_t types[3] = { 0x01, 0x06, 0x0c };
+		uint8_t *entry = data + 446;
+		entry[4] = types[fat_type == 12 ? 0 : fat_type == 16 ? 1 : 2];
+		put32(entry + 8, img->volume_start);
+		put32(entry + 12, volume_sectors);
+		put16(data + 510, 0xaa55);
+	}
+
+	uint8_t *bs = sector_ptr(img, img->volume_start);
+	write_boot_sector(img, bs, volume_sectors);
+
+	uint32_t fat_start = img->volume_start + img->reserved_sectors;
+	img->root_start = fat_start + NUM_FATS * img->fat_sectors;
+	img->data_start = img->root_start + img->root_entries * DIR_ENTRY_SIZE / SECTOR_SIZE;
+	img->next_cluster = 2;
+
+	fat_set(img, 0, 0x0fffff00 | 0xf8);
+	fat_set(img, 1, fat_eoc(img));
+	if(fat_type == 32) {
+		write_fsinfo(sector_ptr(img, img->volume_start + 1));
+		memcpy(sector_ptr(img, img->volume_start + 6), bs, SECTOR_SIZE);
+		write_fsinfo(sector_ptr(img, img->volume_start + 7));
+		alloc_chain(img, 1);
+	}
+	return 0;
+}
+
+uint32_t fat_image_mkdir(fat_image *img, uint32_t parent, const char *name) {
+	uint32_t cluster = alloc_chain(img, 1);
+	if(cluster == 0)
+		return 0;
+	uint8_t *base = sector_ptr(img, cluster_sector(img, cluster));
+	uint8_t dot[11], dotdot[11];
+	memset(dot, ' ', sizeof(dot));
+	memset(dotdot, ' ', sizeof(dotdot));
+	dot[0] = dotdot[0] = dotdot[1] = '.';
+	fill_entry(base, dot, ATTR_DIRECTORY, cluster, 0);
+	fill_entry(base + DIR_ENTRY_SIZE, dotdot, ATTR_DIRECTORY, parent, 0);
+
+	if(add_entry(img, parent, name, ATTR_DIRECTORY, cluster, 0) != 0)
+		return 0;
+	return cluster;
+}
+
+int fat_image_add_file(fat_image *img, uint32_t parent, const char *name, const void *data,
+		uint32_t size) {
+	uint32_t cluster_size = img->sectors_per_cluster * SECTOR_SIZE;
+	uint32_t cluster = 0;
+	if(size != 0) {
+		cluster = alloc_chain(img, (size + cluster_size - 1) / cluster_size);
+		if(cluster == 0)
+			return -1;
+		memcpy(sector_ptr(img, cluster_sector(img, cluster)), data, size);
+	}
+	return add_entry(img, parent, name, ATTR_ARCHIVE, cluster, size);
+}
@@ -0,0 +1,157 @@
+/*
+ * libFuzzer harness for the parts of FatFs that parse what is on the card:
+ * the partition table and boot sector (find_volume, mount_volume), FAT
+ * chains, directory entries (dir_read, dir_find, get_fileinfo) and file
+ * data. The input is the start of a 64 MiB SDHC card, the rest reads as
+ * zeros, and every access goes through diskio.c and the card model like on
+ * the target.
+ *
+ * Besides the sanitizers, the harness fails an input that makes one
+ * operation read more blocks than it can legitimately need, so a crafted
+ * chain or directory cannot stall the logger in a scan.
+ *
+ *   make fuzz               clang, libFuzzer, ASan and UBSan
+ *   make fuzz-replay        gcc, ASan and UBSan, runs the seed corpus
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "sd_sim.h"
+#include "host_clock.h"
+
+#define FUZZ_CARD_SECTORS 131072
+#define FUZZ_MAX_DEPTH 3
+#define FUZZ_MAX_SUBDIRS 4		// directories entered per directory
+#define FUZZ_MAX_FILES 8		// files opened per directory
+#define FUZZ_READ_SIZE 4096		// bytes read from each file
+
+/*
+ * Block budgets of one operation. A directory holds at most 2 MiB of
+ * entries and each of its sectors can start a cluster, whose FAT12 entry
+ * may straddle two sectors. A path lookup walks up to FUZZ_MAX_DEPTH + 1
+ * directories. Mounting reads the MBR, the boot sector and FSINFO.
+ */
+#define FUZZ_DIR_BLOCKS (3 * (0x200000 / SD_SIM_SECTOR_SIZE) + 16)
+#define FUZZ_PATH_BLOCKS ((FUZZ_MAX_DEPTH + 1) * FUZZ_DIR_BLOCKS)
+#define FUZZ_MOUNT_BLOCKS 16
+#define FUZZ_READ_BLOCKS (3 * (FUZZ_READ_SIZE / SD_SIM_SECTOR_SIZE) + 16)
+
+static uint8_t *image;
+static size_t image_used = 0;
+static sd_sim_card *card;
+
+static FATFS fs;
+static uint8_t file_buffer[FUZZ_READ_SIZE];
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/*
+ * Private functions
+ */
+static void fuzz_budget(const char *op, const char *path, uint32_t start, uint32_t limit) {
+	uint32_t blocks = card->blocks_read - start;
+	if(blocks > limit) {
+		fprintf(stderr, "%s %s read %lu blocks, more than %lu\n", op, path, (unsigned long)blocks,
+				(unsigned long)limit);
+		abort();
+	}
+}
+
+static void fuzz_file(const char *path) {
+	static FIL fil;
+	FILINFO finfo;
+	UINT br;
+
+	uint32_t start = card->blocks_read;
+	FRESULT res = f_stat(path, &finfo);
+	fuzz_budget("stat", path, start, FUZZ_PATH_BLOCKS);
+	if(res != FR_OK) {
+		return;
+	}
+
+	start = card->blocks_read;
+	res = f_open(&fil, path, FA_READ);
+	fuzz_budget("open", path, start, FUZZ_PATH_BLOCKS);
+	if(res != FR_OK) {
+		return;
+	}
+
+	start = card->blocks_read;
+	if(f_read(&fil, file_buffer, sizeof(file_buffer), &br) == FR_OK && br > sizeof(file_buffer)) {
+		abort();
+	}
+	fuzz_budget("read", path, start, FUZZ_READ_BLOCKS);
+	f_close(&fil);
+}
+
+static void fuzz_dir(const char *path, int depth) {
+	DIR dir;
+	FILINFO finfo;
+	char child[64];
+	int subdirs = 0, files = 0;
+
+	uint32_t start = card->blocks_read;
+	FRESULT res = f_opendir(&dir, path);
+	if(res != FR_OK) {
+		fuzz_budget("opendir", path, start, FUZZ_PATH_BLOCKS);
+		return;
+	}
+	// the whole listing counts as one scan, it ends at FatFs's 2 MiB limit at the latest
+	while(f_readdir(&dir, &finfo) == FR_OK && finfo.fname[0] != '\0') {
+		if(strlen(finfo.fname) > 12) {
+			abort();
+		}
+		snprintf(child, sizeof(child), "%s/%s", depth == 0 ? "" : path, finfo.fname);
+		if(finfo.fattrib & AM_DIR) {
+			if(depth < FUZZ_MAX_DEPTH && subdirs++ < FUZZ_MAX_SUBDIRS) {
+				uint32_t before = card->blocks_read;
+				fuzz_dir(child, depth + 1);
+				start += card->blocks_read - before;
+			}
+		} else if(files++ < FUZZ_MAX_FILES) {
+			uint32_t before = card->blocks_read;
+			fuzz_file(child);
+			start += card->blocks_read - before;
+		}
+	}
+	f_closedir(&dir);
+	fuzz_budget("readdir", path, start, FUZZ_PATH_BLOCKS + FUZZ_DIR_BLOCKS);
+}
+
+/*
+ * Public functions
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if(image == NULL) {
+		image = calloc(FUZZ_CARD_SECTORS, SD_SIM_SECTOR_SIZE);
+		if(image == NULL) {
+			abort();
+		}
+	}
+	if(size > (size_t)FUZZ_CARD_SECTORS * SD_SIM_SECTOR_SIZE) {
+		size = (size_t)FUZZ_CARD_SECTORS * SD_SIM_SECTOR_SIZE;
+	}
+	memset(image, 0, image_used);
+	memcpy(image, data, size);
+	image_used = size;
+
+	host_clock_reset();
+	sd_sim_seed(1);
+	card = sd_sim_insert(image, FUZZ_CARD_SECTORS, 1);
+	card->init_ns = 0;
+
+	uint32_t start = card->blocks_read;
+	FRESULT res = f_mount(&fs, "", 1);
+	fuzz_budget("mount", "", start, FUZZ_MOUNT_BLOCKS);
+	if(res == FR_OK) {
+		fuzz_dir("/", 0);
+		f_unmount("");
+	}
+	// FatFs is built read only
+	if(card->blocks_written != 0) {
+		abort();
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Writes the seed corpus of fatfs_fuzz: FAT12, FAT16 and FAT32 volumes with
+ * and without a partition table, holding nested directories and files that
+ * span several clusters. Trailing zero sectors are left out, the harness
+ * reads them as zeros anyway.
+ *
+ *   ./build/fatfs_seeds build/corpus
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "fat_image.h"
+
+#define SECTOR_SIZE 512
+#define SEED_MAX_SECTORS 131072
+
+typedef struct {
+	const char *name;
+	uint32_t sectors;
+	uint8_t fat_type;
+	uint8_t partitioned;
+} seed;
+
+static const seed seeds[] = {
+	{ "fat12", 2048, 12, 0 },
+	{ "fat12_mbr", 8192, 12, 1 },
+	{ "fat16", 16384, 16, 0 },
+	{ "fat16_mbr", 131072, 16, 1 },
+	{ "fat32", 131072, 32, 0 },
+	{ "fat32_mbr", 131072, 32, 1 },
+};
+
+static uint8_t *image;
+
+/*
+ * Private functions
+ */
+static void fill_volume(fat_image *img) {
+	static uint8_t data[6000];
+	char name[13], text[32];
+
+	for(size_t i = 0; i < sizeof(data); i++) {
+		data[i] = i * 7;
+	}
+	fat_image_add_file(img, FAT_IMAGE_ROOT, "README.TXT", "seed volume\r\n", 13);
+	fat_image_add_file(img, FAT_IMAGE_ROOT, "DATA.BIN", data, sizeof(data));
+	fat_image_add_file(img, FAT_IMAGE_ROOT, "EMPTY.TXT", "", 0);
+
+	uint32_t logs = fat_image_mkdir(img, FAT_IMAGE_ROOT, "LOGS");
+	for(int i = 0; i < 20; i++) {
+		snprintf(name, sizeof(name), "LOG%05d.TXT", i);
+		int len = snprintf(text, sizeof(text), "%d,21.5000\r\n", i * 1000);
+		fat_image_add_file(img, logs, name, text, len);
+	}
+	uint32_t a = fat_image_mkdir(img, FAT_IMAGE_ROOT, "A");
+	uint32_t b = fat_image_mkdir(img, a, "B");
+	uint32_t c = fat_image_mkdir(img, b, "C");
+	fat_image_add_file(img, c, "DEEP.TXT", "deep\r\n", 6);
+}
+
+static int write_seed(const char *dir, const seed *s) {
+	fat_image img;
+	char path[256];
+
+	memset(image, 0, (size_t)s->sectors * SECTOR_SIZE);
+	if(fat_image_format(&img, image, s->sectors, s->fat_type, s->partitioned) != 0) {
+		fprintf(stderr, "%s: cannot format\n", s->name);
+		return -1;
+	}
+	fill_volume(&img);
+
+	uint32_t used = s->sectors;
+	while(used > 1) {
+		const uint8_t *sector = image + (size_t)(used - 1) * SECTOR_SIZE;
+		uint32_t i = 0;
+		while(i < SECTOR_SIZE && sector[i] == 0) {
+			i++;
+		}
+		if(i < SECTOR_SIZE) {
+			break;
+		}
+		used--;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s.img", dir, s->name);
+	FILE *f = fopen(path, "wb");
+	if(f == NULL || fwrite(image, SECTOR_SIZE, used, f) != used) {
+		perror(path);
+		if(f != NULL) {
+			fclose(f);
+		}
+		return -1;
+	}
+	fclose(f);
+	printf("%s: FAT%d, %lu of %lu sectors\n", path, s->fat_type, (unsigned long)used,
+			(unsigned long)s->sectors);
+	return 0;
+}
+
+/*
+ * Public functions
+ */
+int main(int argc, char **argv) {
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s <corpus directory>\n", argv[0]);
+		return 2;
+	}
+	mkdir(argv[1], 0777);
+	image = malloc((size_t)SEED_MAX_SECTORS * SECTOR_SIZE);
+	if(image == NULL) {
+		return 1;
+	}
+
+	int failed = 0;
+	for(size_t i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+		failed |= write_seed(argv[1], &seeds[i]) != 0;
+	}
+	free(image);
+	return failed;
+}
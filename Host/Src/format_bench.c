@@ -0,0 +1,96 @@
+/*
+ * Compares onewire_format_temperature against the previous snprintf based
+ * implementation: identical output for every raw value, and the time it
+ * takes to format a line of 40 probes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "onewire.h"
+
+#define PROBES 40
+#define LINES 200000
+
+// the formatter as it was before it became integer only
+static void legacy_format_temperature(int16_t temp, char *dest, size_t len) {
+	int16_t temp_whole = temp / 16;
+	int16_t temp_frac = temp & 0xf;
+
+	const uint16_t fractions[] = {10000 / 16, 10000 / 8, 10000 / 4, 10000 / 2};
+	uint16_t fractional_sum = 0;
+	for(int i = 0; i < 4; i++) {
+		fractional_sum += fractions[i] * ((temp_frac >> i) & 1);
+	}
+
+	if(temp < 0) {
+		if(fractional_sum)
+			fractional_sum = 10000 - fractional_sum;
+
+		snprintf(dest, len, "-%d.%04d", -temp_whole, fractional_sum);
+	} else {
+		snprintf(dest, len, "%d.%04d", temp_whole, fractional_sum);
+	}
+
+	for(size_t i = strlen(dest) - 1; i > 0; i--) {
+		if(dest[i] == '0' && dest[i - 1] != '.') {
+			dest[i] = '\0';
+		} else {
+			break;
+		}
+	}
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+	char expected[32], actual[32];
+	int mismatches = 0;
+
+	for(int32_t raw = INT16_MIN; raw <= INT16_MAX; raw++) {
+		legacy_format_temperature(raw, expected, sizeof(expected));
+		size_t n = onewire_format_temperature(raw, actual, sizeof(actual));
+		if(strcmp(expected, actual) != 0 || n != strlen(expected)) {
+			if(mismatches++ < 10)
+				printf("mismatch for %d: \"%s\" != \"%s\"\n", raw, expected, actual);
+		}
+	}
+
+	int16_t temps[PROBES];
+	for(int i = 0; i < PROBES; i++)
+		temps[i] = (i * 37 - 400) * (i % 3 ? 1 : -1);
+
+	char line[PROBES * (ONEWIRE_TEMPERATURE_MAX_LEN + 1) + 1];
+	volatile size_t sink = 0;
+
+	double start = now_ns();
+	for(int l = 0; l < LINES; l++) {
+		size_t n = 0;
+		for(int i = 0; i < PROBES; i++) {
+			legacy_format_temperature(temps[i], line + n, sizeof(line) - n);
+			n += strlen(line + n);
+			line[n++] = ',';
+		}
+		sink += n;
+	}
+	double legacy = (now_ns() - start) / LINES;
+
+	start = now_ns();
+	for(int l = 0; l < LINES; l++) {
+		sink += onewire_format_temperatures(temps, PROBES, ',', line, sizeof(line));
+	}
+	double batch = (now_ns() - start) / LINES;
+
+	printf("%d probes per line: snprintf %.0f ns, integer batch %.0f ns (%.1fx)\n",
+			PROBES, legacy, batch, legacy / batch);
+
+	if(mismatches) {
+		printf("%d values formatted differently\n", mismatches);
+		return 1;
+	}
+	printf("all %d raw values match\n", UINT16_MAX + 1);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Runs a libFuzzer harness on given files and on every file in given
+ * directories, without libFuzzer: for compilers that lack it, for the
+ * corpus as a regression test and for replaying a crash under gdb.
+ *
+ *   ./build/asan/fatfs_replay build/corpus crash-0123abcd
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+static int replayed = 0;
+
+/*
+ * Private functions
+ */
+static int replay_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	// an empty input is valid, malloc(0) may not be
+	unsigned char *data = malloc(size + 1);
+	if(data == NULL || fread(data, 1, size, f) != (size_t)size) {
+		perror(path);
+		free(data);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	printf("%s: %ld bytes\n", path, size);
+	fflush(stdout);
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+	replayed++;
+	return 0;
+}
+
+static int replay_dir(const char *path) {
+	struct dirent **entries;
+	char child[1024];
+	int failed = 0;
+
+	// sorted, so that runs are repeatable
+	int n = scandir(path, &entries, NULL, alphasort);
+	if(n < 0) {
+		perror(path);
+		return -1;
+	}
+	for(int i = 0; i < n; i++) {
+		if(entries[i]->d_name[0] != '.') {
+			snprintf(child, sizeof(child), "%s/%s", path, entries[i]->d_name);
+			failed |= replay_file(child) != 0;
+		}
+		free(entries[i]);
+	}
+	free(entries);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Public functions
+ */
+int main(int argc, char **argv) {
+	struct stat st;
+	int failed = 0;
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s <file or directory>...\n", argv[0]);
+		return 2;
+	}
+	for(int i = 1; i < argc; i++) {
+		if(stat(argv[i], &st) != 0) {
+			perror(argv[i]);
+			failed = 1;
+		} else if(S_ISDIR(st.st_mode)) {
+			failed |= replay_dir(argv[i]) != 0;
+		} else {
+			failed |= replay_file(argv[i]) != 0;
+		}
+	}
+	printf("%d inputs replayed\n", replayed);
+	return failed;
+}
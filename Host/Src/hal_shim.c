@@ -0,0 +1,135 @@
+/*
+ * Host implementation of the HAL calls used by the application.
+ */
+#include "stm32f4xx_hal.h"
+#include "host_clock.h"
+
+/* Cost of one main loop HAL_GetTick call, keeps idle loops moving in time */
+#define HOST_GETTICK_NS 1000
+
+/* Clock tree of SystemClock_Config: 168 MHz core, APB1 at 42 MHz, APB2 at 84 MHz */
+#define HOST_HCLK_HZ 168000000U
+#define HOST_PCLK1_HZ 42000000U
+#define HOST_PCLK2_HZ 84000000U
+
+/* Setup and flag polling of one polled HAL_SPI call, about 170 cycles */
+#define HOST_SPI_CALL_NS 1000
+
+uint32_t SystemCoreClock = HOST_HCLK_HZ;
+GPIO_TypeDef host_gpioa = { "GPIOA" }, host_gpiob = { "GPIOB" },
+		host_gpioc = { "GPIOC" }, host_gpiod = { "GPIOD" },
+		host_gpioe = { "GPIOE" }, host_gpiof = { "GPIOF" },
+		host_gpiog = { "GPIOG" }, host_gpioh = { "GPIOH" };
+TIM_TypeDef host_tim6;
+SPI_TypeDef host_spi1 = { SPI_BAUDRATEPRESCALER_256 };
+USART_TypeDef host_usart3;
+SCB_Type host_scb;
+
+// the handle main.c sets up on the target, diskio.c drives the card through it
+SPI_HandleTypeDef hspi1 = { SPI1, { SPI_BAUDRATEPRESCALER_256 } };
+
+static SysTick_Type host_systick_regs = { HOST_HCLK_HZ / 1000 - 1, 0 };
+static host_spi_device host_spi1_device = NULL;
+
+/*
+ * Private function prototypes
+ */
+static HAL_StatusTypeDef host_spi_transfer(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx,
+		uint16_t size);
+
+/*
+ * Private functions
+ */
+
+// Full duplex transfer, the bus clock is PCLK2 divided by the BR field of CR1
+static HAL_StatusTypeDef host_spi_transfer(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx,
+		uint16_t size) {
+	uint32_t divider = 2U << ((hspi->Instance->CR1 & SPI_CR1_BR) >> 3);
+	uint64_t byte_ns = 8ULL * divider * 1000000000ULL / HOST_PCLK2_HZ;
+	host_spi_device device = hspi->Instance == SPI1 ? host_spi1_device : NULL;
+
+	hspi->Instance->CR1 |= SPI_CR1_SPE;
+	host_clock_advance(HOST_SPI_CALL_NS);
+	for(uint16_t i = 0; i < size; i++) {
+		uint8_t mosi = tx != NULL ? tx[i] : 0xff;
+		host_clock_advance(byte_ns);
+		uint8_t miso = device != NULL ? device(mosi) : 0xff;
+		if(rx != NULL)
+			rx[i] = miso;
+	}
+	return HAL_OK;
+}
+
+/*
+ * Public functions
+ */
+// SysTick counts down from LOAD once per millisecond
+SysTick_Type *host_systick(void) {
+	uint64_t ns = host_clock_now() % 1000000;
+	host_systick_regs.VAL = host_systick_regs.LOAD - (uint32_t)(ns * (HOST_HCLK_HZ / 1000000) / 1000);
+	return &host_systick_regs;
+}
+
+// Sleeps until the next SysTick or model interrupt
+void __WFI(void) {
+	host_clock_sleep_until((host_clock_now() / 1000000 + 1) * 1000000);
+}
+
+uint32_t HAL_GetTick(void) {
+	host_clock_advance(HOST_GETTICK_NS);
+	return (uint32_t)(host_clock_now() / 1000000);
+}
+
+void HAL_Delay(uint32_t delay) {
+	host_clock_advance((uint64_t)delay * 1000000);
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return HOST_PCLK1_HZ;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+	return HOST_PCLK2_HZ;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	(void)htim;
+	return HAL_OK;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+	if(state == GPIO_PIN_RESET)
+		port->ODR &= ~pin;
+	else
+		port->ODR |= pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin) {
+	return (port->ODR & pin) != 0 ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void host_spi_attach(SPI_TypeDef *spi, host_spi_device device) {
+	if(spi == SPI1)
+		host_spi1_device = device;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+	(void)timeout;
+	return host_spi_transfer(hspi, data, NULL, size);
+}
+
+// The F4 HAL clocks out the old buffer contents, the host sends 0xff so stray data never looks like a command
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size, uint32_t timeout) {
+	(void)timeout;
+	return host_spi_transfer(hspi, NULL, data, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx,
+		uint16_t size, uint32_t timeout) {
+	(void)timeout;
+	return host_spi_transfer(hspi, tx, rx, size);
+}
+
+void Error_Handler(void) {
+	__builtin_trap();
+}
@@ -0,0 +1,129 @@
+/*
+ * Discrete event virtual clock, see host_clock.h.
+ */
+#include "host_clock.h"
+#include "stm32f4xx_hal.h"
+
+/* TIM6 counts at 84 MHz / (20 + 1), as MX_TIM6_Init sets it up */
+#define HOST_TIM6_TICK_NS 250
+
+/* VECTACTIVE while an event runs, anything but 0 tells handler from thread mode */
+#define HOST_EVENT_VECTOR 16
+
+uint32_t host_primask = 0;
+
+static uint64_t clock_now = 0;
+static uint64_t clock_seq = 0;
+static host_event *clock_queue = NULL;
+static uint8_t clock_in_event = 0;
+
+/*
+ * Private functions
+ */
+static void clock_set(uint64_t now) {
+	clock_now = now;
+	TIM6->CNT = (uint16_t)(now / HOST_TIM6_TICK_NS);
+}
+
+static uint8_t clock_can_dispatch(uint64_t deadline) {
+	return clock_queue != NULL && clock_queue->at <= deadline && !host_primask && !clock_in_event;
+}
+
+static void clock_dispatch(void) {
+	host_event *event = clock_queue;
+	clock_queue = event->next;
+	event->pending = 0;
+
+	clock_in_event = 1;
+	SCB->ICSR = (SCB->ICSR & ~SCB_ICSR_VECTACTIVE_Msk) | HOST_EVENT_VECTOR;
+	event->handler(event->arg);
+	SCB->ICSR &= ~SCB_ICSR_VECTACTIVE_Msk;
+	clock_in_event = 0;
+}
+
+/*
+ * Public functions
+ */
+uint64_t host_clock_now(void) {
+	return clock_now;
+}
+
+/*
+ * Spends ns of the running code's time. Events that come due run at their
+ * own time and push the end of the interval out by however long they take.
+ */
+void host_clock_advance(uint64_t ns) {
+	uint64_t remaining = ns;
+	while(clock_can_dispatch(clock_now + remaining)) {
+		if(clock_queue->at > clock_now) {
+			remaining -= clock_queue->at - clock_now;
+			clock_set(clock_queue->at);
+		}
+		clock_dispatch();
+	}
+	clock_set(clock_now + remaining);
+}
+
+void host_clock_reset(void) {
+	while(clock_queue != NULL) {
+		clock_queue->pending = 0;
+		clock_queue = clock_queue->next;
+	}
+	clock_seq = 0;
+	clock_in_event = 0;
+	host_primask = 0;
+	SCB->ICSR = 0;
+	clock_set(0);
+}
+
+// Moves an event that is already queued, times in the past run as soon as possible
+void host_clock_schedule(host_event *event, uint64_t at, host_event_handler handler, void *arg) {
+	host_clock_cancel(event);
+	event->at = at > clock_now ? at : clock_now;
+	event->seq = clock_seq++;
+	event->handler = handler;
+	event->arg = arg;
+	event->pending = 1;
+
+	host_event **link = &clock_queue;
+	while(*link != NULL && (*link)->at <= event->at)
+		link = &(*link)->next;
+	event->next = *link;
+	*link = event;
+}
+
+void host_clock_cancel(host_event *event) {
+	if(!event->pending)
+		return;
+	for(host_event **link = &clock_queue; *link != NULL; link = &(*link)->next) {
+		if(*link == event) {
+			*link = event->next;
+			break;
+		}
+	}
+	event->pending = 0;
+}
+
+uint64_t host_clock_next_event(void) {
+	return clock_queue != NULL ? clock_queue->at : HOST_CLOCK_NEVER;
+}
+
+/*
+ * WFI: idles until the next event or the deadline. An event that is due
+ * but masked ends the sleep at once and runs when the mask is lifted.
+ */
+void host_clock_sleep_until(uint64_t deadline) {
+	uint64_t wake = host_clock_next_event();
+	if(wake > deadline)
+		wake = deadline;
+	host_clock_advance(wake > clock_now ? wake - clock_now : 0);
+}
+
+// Runs whatever came due while interrupts were masked
+void host_clock_run_pending(void) {
+	host_clock_advance(0);
+}
+
+uint8_t host_clock_in_event(void) {
+	return clock_in_event;
+}
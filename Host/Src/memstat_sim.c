@@ -0,0 +1,13 @@
+/*
+ * memstat.h on the host, where the firmware runs on the process stack and
+ * the C library's heap: nothing to measure, every figure reads 0.
+ */
+#include <string.h>
+#include "memstat.h"
+
+void memstat_init(void) {
+}
+
+void memstat_get(memstat_info *info) {
+	memset(info, 0, sizeof(*info));
+}
@@ -0,0 +1,241 @@
+/*
+ * Host benchmark and regression run of the 1-Wire driver and the sensor
+ * manager on simulated buses. All times are virtual bus times.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "onewire_sim.h"
+#include "onewire.h"
+#include "sensors.h"
+#include "host_clock.h"
+
+static TIM_HandleTypeDef htim6 = { TIM6 };
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+		if(!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while(0)
+
+static void setup(void) {
+	host_clock_reset();
+	onewire_sim_reset();
+	onewire_sim_seed(12345);
+	sensors_init();
+}
+
+static double elapsed_us(uint64_t start) {
+	return (host_clock_now() - start) / 1000.0;
+}
+
+static void bench_search(void) {
+	onewire_bus bus;
+	uint64_t roms[16];
+
+	setup();
+	onewire_sim_bus *sim = onewire_sim_bus_create(GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	for(int i = 0; i < 12; i++)
+		onewire_sim_add_ds18b20(sim, 0x1000 + i * 0x1111);
+	onewire_bus_init(&bus, GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+
+	uint64_t start = host_clock_now();
+	uint8_t found = onewire_search(&bus, roms, 16);
+	printf("search: %d devices in %.1f ms\n", found, elapsed_us(start) / 1000);
+	CHECK(found == 12, "found %d devices", found);
+	for(int i = 0; i < sim->device_count; i++) {
+		int seen = 0;
+		for(int j = 0; j < found; j++)
+			seen |= roms[j] == sim->devices[i]->rom;
+		CHECK(seen, "device %016" PRIx64 " not found", sim->devices[i]->rom);
+	}
+	CHECK(onewire_get_single_address(&bus) == 0, "single address with 12 devices");
+
+	setup();
+	sim = onewire_sim_bus_create(GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	onewire_sim_device *dev = onewire_sim_add_ds18b20(sim, 0xabcdef);
+	uint64_t rom = onewire_get_single_address(&bus);
+	CHECK(rom == dev->rom, "single address %016" PRIx64, rom);
+}
+
+static void bench_overdrive(void) {
+	onewire_bus bus;
+	int16_t temp;
+	const int reads = 100;
+
+	setup();
+	onewire_sim_bus *sim = onewire_sim_bus_create(GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	onewire_sim_device *fast = onewire_sim_add_ds18b20(sim, 1);
+	onewire_sim_device *slow = onewire_sim_add_ds18b20(sim, 2);
+	fast->overdrive_capable = 1;
+	fast->temperature = slow->temperature = -10 * 16 - 3;
+	onewire_bus_init(&bus, GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+
+	uint64_t start = host_clock_now();
+	for(int i = 0; i < reads; i++)
+		CHECK(onewire_read_temperature_checked(&bus, fast->rom, &temp), "standard read");
+	double standard = elapsed_us(start) / reads;
+
+	CHECK(onewire_set_speed(&bus, fast->rom, ONEWIRE_SPEED_OVERDRIVE) == ONEWIRE_SPEED_OVERDRIVE,
+			"enter overdrive");
+	CHECK(onewire_set_speed(&bus, slow->rom, ONEWIRE_SPEED_OVERDRIVE) == ONEWIRE_SPEED_STANDARD,
+			"standard only part must fall back");
+
+	start = host_clock_now();
+	for(int i = 0; i < reads; i++)
+		CHECK(onewire_read_temperature_checked(&bus, fast->rom, &temp), "overdrive read");
+	double overdrive = elapsed_us(start) / reads;
+	printf("scratchpad read: standard %.0f us, overdrive %.0f us (%.1fx)\n",
+			standard, overdrive, standard / overdrive);
+	CHECK(overdrive * 4 < standard, "overdrive not faster");
+
+	// mixed traffic keeps working in both directions
+	CHECK(onewire_read_temperature_checked(&bus, slow->rom, &temp), "standard after overdrive");
+	CHECK(onewire_read_temperature_checked(&bus, fast->rom, &temp), "overdrive after standard");
+	CHECK(onewire_get_speed(&bus, fast->rom) == ONEWIRE_SPEED_OVERDRIVE, "speed lost");
+
+	// a marginal line drops the device back to standard speed
+	fast->crc_error_rate = 1.0;
+	onewire_read_temperature_checked(&bus, fast->rom, &temp);
+	CHECK(onewire_get_speed(&bus, fast->rom) == ONEWIRE_SPEED_STANDARD, "no fallback on CRC errors");
+
+	// OVERDRIVE SKIP ROM reaches devices that were never switched one by one
+	fast->crc_error_rate = 0;
+	CHECK(onewire_overdrive_skip_rom(&bus), "overdrive skip rom");
+	start = host_clock_now();
+	CHECK(onewire_read_temperature_checked(&bus, fast->rom, &temp), "read after skip rom");
+	CHECK(elapsed_us(start) * 4 < standard, "skip rom left the device at standard speed");
+	CHECK(onewire_read_temperature_checked(&bus, slow->rom, &temp), "standard only part after skip rom");
+}
+
+static void bench_errors(void) {
+	onewire_bus bus;
+	int16_t temp;
+	int failed = 0;
+	const int reads = 1000;
+
+	setup();
+	onewire_sim_bus *sim = onewire_sim_bus_create(GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	onewire_sim_device *dev = onewire_sim_add_ds18b20(sim, 7);
+	dev->crc_error_rate = 0.1;
+	onewire_bus_init(&bus, GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+
+	for(int i = 0; i < reads; i++)
+		failed += !onewire_read_temperature_checked(&bus, dev->rom, &temp);
+	printf("crc errors: %d of %d reads rejected, %" PRIu32 " corrupted\n",
+			failed, reads, dev->corrupted_reads);
+	CHECK((uint32_t)failed == dev->corrupted_reads, "corrupted scratchpad accepted");
+
+	dev->crc_error_rate = 0;
+	sim->noise_rate = 0.0005;
+	failed = 0;
+	for(int i = 0; i < reads; i++)
+		failed += !onewire_read_temperature_checked(&bus, dev->rom, &temp)
+				|| temp != 0x0550;
+	printf("bus noise: %d of %d reads failed, %" PRIu32 " samples flipped\n",
+			failed, reads, sim->flipped_samples);
+}
+
+static void bench_sensors(void) {
+	onewire_bus bus1, bus2;
+
+	setup();
+	onewire_sim_bus *sim1 = onewire_sim_bus_create(GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	onewire_sim_bus *sim2 = onewire_sim_bus_create(GPIOC, GPIO_PIN_8, GPIOC, GPIO_PIN_9);
+	for(int i = 0; i < 2; i++) {
+		onewire_sim_add_ds18b20(sim1, 0x100 + i)->conversion_scale = 0.6;
+		onewire_sim_add_ds18b20(sim2, 0x200 + i)->conversion_scale = 0.6;
+	}
+	onewire_bus_init(&bus1, GPIOC, GPIO_PIN_10, GPIOC, GPIO_PIN_11);
+	onewire_bus_init(&bus2, GPIOC, GPIO_PIN_8, GPIOC, GPIO_PIN_9);
+
+	CHECK(sensors_scan(&bus1, 1000) == 2, "scan bus 1");
+	CHECK(sensors_scan(&bus2, 1000) == 2, "scan bus 2");
+	// a 10 Hz control loop probe on each bus
+	CHECK(sensors_set_period(0, 100), "set period");
+	CHECK(sensors_set_period(2, 100), "set period");
+
+	uint32_t end = HAL_GetTick() + 10000;
+	while((int32_t)(HAL_GetTick() - end) < 0)
+		sensors_poll();
+
+	for(uint8_t i = 0; i < sensors_count(); i++) {
+		sensors_device *dev = sensors_get(i);
+		printf("sensor %d: %2d bit, period %4" PRIu32 " ms, %3" PRIu32 " samples, "
+				"%" PRIu32 " errors, last conversion %" PRIu32 " ms\n",
+				i, 9 + ((dev->resolution >> 5) & 3), dev->period_ms, dev->samples,
+				dev->errors, dev->conversion_ms);
+		CHECK(dev->errors == 0, "sensor %d errors", i);
+		CHECK(dev->samples >= 10000 / dev->period_ms - 1, "sensor %d too few samples", i);
+	}
+	CHECK(sensors_get(0)->resolution == ONEWIRE_RESOLUTION_9BIT, "10 Hz probe not at 9 bit");
+	CHECK(sensors_get(1)->resolution == ONEWIRE_RESOLUTION_12BIT, "1 Hz probe not at 12 bit");
+}
+
+static void bench_parallel(void) {
+	const uint8_t count = 8;
+	onewire_bus buses[8];
+	onewire_parallel group;
+	uint16_t out_pins[8], in_pins[8];
+	uint64_t roms[8];
+	int16_t temps[8];
+
+	setup();
+	for(uint8_t i = 0; i < count; i++) {
+		// same pin for output and input, open drain
+		out_pins[i] = in_pins[i] = 1 << i;
+		onewire_sim_bus *sim = onewire_sim_bus_create(GPIOE, out_pins[i], GPIOE, in_pins[i]);
+		onewire_sim_device *dev = onewire_sim_add_ds18b20(sim, 0x300 + i);
+		dev->temperature = i * 16 + i;
+		roms[i] = dev->rom;
+		onewire_bus_init(&buses[i], GPIOE, out_pins[i], GPIOE, in_pins[i]);
+	}
+	CHECK(onewire_parallel_init(&group, GPIOE, out_pins, GPIOE, in_pins, count), "parallel init");
+
+	uint64_t start = host_clock_now();
+	for(uint8_t i = 0; i < count; i++) {
+		onewire_request_conversion(&buses[i], roms[i]);
+	}
+	HAL_Delay(750);
+	for(uint8_t i = 0; i < count; i++) {
+		CHECK(onewire_read_temperature_checked(&buses[i], roms[i], &temps[i]), "sequential read");
+	}
+	double sequential = elapsed_us(start) / 1000 - 750;
+
+	start = host_clock_now();
+	uint16_t presence = onewire_parallel_request_conversion(&group, roms);
+	HAL_Delay(750);
+	uint16_t valid = onewire_parallel_read_temperature(&group, roms, temps);
+	double parallel = elapsed_us(start) / 1000 - 750;
+
+	printf("%d buses: sequential %.2f ms, parallel %.2f ms of bus time\n",
+			count, sequential, parallel);
+	CHECK(presence == 0xff, "presence %04x", presence);
+	CHECK(valid == 0xff, "valid %04x", valid);
+	for(uint8_t i = 0; i < count; i++)
+		CHECK(temps[i] == i * 16 + i, "bus %d read %d", i, temps[i]);
+
+	valid = onewire_parallel_read_temperature(&group, NULL, temps);
+	CHECK(valid == 0xff, "skip rom valid %04x", valid);
+}
+
+int main(void) {
+	onewire_init(&htim6);
+
+	bench_search();
+	bench_overdrive();
+	bench_errors();
+	bench_sensors();
+	bench_parallel();
+
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
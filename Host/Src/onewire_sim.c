@@ -0,0 +1,400 @@
+/*
+ * Open drain 1-Wire bus model with virtual DS18B20 devices.
+ *
+ * Devices react to the edges driven by the master: the length of each low
+ * pulse tells a reset from a write 1 or write 0 slot, and a device that is
+ * sending a 0 holds the line low for a while after the falling edge.
+ * Timing follows the DS18B20 and DS2431 datasheets.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include "onewire_sim.h"
+#include "onewire.h"
+#include "host_clock.h"
+
+#define NS(us) ((uint64_t)((us) * 1000))
+
+/* Cost of one timer poll in the delay loop (about 10 cycles at 168 MHz) */
+#define SIM_POLL_NS 60
+
+typedef struct {
+	uint64_t reset_min;		// shortest low pulse taken as a reset
+	uint64_t sample;		// slave samples the line this long after the fall
+	uint64_t hold;			// slave holds a 0 this long after the fall
+	uint64_t presence_wait;
+	uint64_t presence_len;
+} sim_timing;
+
+static const sim_timing sim_timings[] = {
+	{ NS(400), NS(15), NS(30), NS(30), NS(120) },
+	{ NS(48), NS(2), NS(3), NS(2.5), NS(10) },
+};
+
+static onewire_sim_bus sim_buses[ONEWIRE_SIM_MAX_BUSES];
+static uint8_t sim_bus_count = 0;
+static onewire_sim_device sim_devices[ONEWIRE_SIM_MAX_BUSES * 4];
+static uint8_t sim_device_count = 0;
+static uint32_t sim_random_state = 1;
+
+/*
+ * Private functions
+ */
+static uint32_t sim_random(void) {
+	// xorshift32, deterministic across hosts
+	uint32_t x = sim_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim_random_state = x;
+	return x;
+}
+
+static uint8_t sim_chance(double probability) {
+	return probability > 0 && sim_random() < probability * 4294967296.0;
+}
+
+static uint8_t sim_crc(const uint8_t *data, size_t len) {
+	uint8_t crc = 0;
+	for(size_t i = 0; i < len; i++) {
+		uint8_t byte = data[i];
+		for(int j = 0; j < 8; j++) {
+			uint8_t mix = (crc ^ byte) & 1;
+			crc >>= 1;
+			if(mix)
+				crc ^= 0x8c;
+			byte >>= 1;
+		}
+	}
+	return crc;
+}
+
+static const sim_timing *sim_device_timing(onewire_sim_device *dev) {
+	return &sim_timings[dev->overdrive];
+}
+
+static void sim_finish_conversion(onewire_sim_device *dev, uint64_t now) {
+	if(!dev->conversion_pending || now < dev->conversion_end)
+		return;
+
+	// unused low bits are undefined at lower resolutions, the part clears them
+	uint8_t resolution_bits = 9 + ((dev->scratchpad[4] >> 5) & 3);
+	int16_t temp = dev->temperature & ~((1 << (12 - resolution_bits)) - 1);
+	dev->scratchpad[0] = temp & 0xff;
+	dev->scratchpad[1] = (uint16_t)temp >> 8;
+	dev->conversion_pending = 0;
+}
+
+static void sim_transmit(onewire_sim_device *dev, const uint8_t *data, uint8_t len) {
+	memcpy(dev->tx, data, len);
+	dev->tx_len = len;
+	dev->tx_bit = 0;
+	dev->state = ONEWIRE_SIM_TX;
+}
+
+static void sim_function_command(onewire_sim_device *dev, uint8_t cmd, uint64_t now) {
+	switch(cmd) {
+	case 0x44: {
+		const uint16_t tconv[] = {94, 188, 375, 750};
+		uint16_t ms = tconv[(dev->scratchpad[4] >> 5) & 3];
+		dev->conversion_end = now + (uint64_t)(ms * dev->conversion_scale * 1000000);
+		dev->conversion_pending = 1;
+		dev->conversions++;
+		dev->state = ONEWIRE_SIM_CONVERTING;
+		break;
+	}
+	case 0xbe: {
+		uint8_t data[9];
+		sim_finish_conversion(dev, now);
+		dev->scratchpad[8] = sim_crc(dev->scratchpad, 8);
+		memcpy(data, dev->scratchpad, 9);
+		dev->scratchpad_reads++;
+		if(sim_chance(dev->crc_error_rate)) {
+			data[sim_random() % 9] ^= 1 << (sim_random() % 8);
+			dev->corrupted_reads++;
+		}
+		sim_transmit(dev, data, 9);
+		break;
+	}
+	case 0x4e:
+		dev->rx_count = 0;
+		dev->state = ONEWIRE_SIM_WRITE_SCRATCHPAD;
+		break;
+	default:
+		dev->state = ONEWIRE_SIM_IDLE;
+		break;
+	}
+}
+
+static void sim_rom_command(onewire_sim_device *dev, uint8_t cmd) {
+	switch(cmd) {
+	case 0x33:
+		sim_transmit(dev, (const uint8_t*)&dev->rom, 8);
+		break;
+	case 0x69:
+		if(!dev->overdrive_capable) {
+			dev->state = ONEWIRE_SIM_IDLE;
+			break;
+		}
+		dev->overdrive = 1;
+		/* fall through */
+	case 0x55:
+		dev->search_bit = 0;
+		dev->state = ONEWIRE_SIM_MATCH;
+		break;
+	case 0x3c:
+		if(!dev->overdrive_capable) {
+			dev->state = ONEWIRE_SIM_IDLE;
+			break;
+		}
+		dev->overdrive = 1;
+		/* fall through */
+	case 0xcc:
+		dev->state = ONEWIRE_SIM_FUNC_CMD;
+		break;
+	case 0xf0:
+		dev->search_bit = 0;
+		dev->search_phase = 0;
+		dev->state = ONEWIRE_SIM_SEARCH;
+		break;
+	default:
+		dev->state = ONEWIRE_SIM_IDLE;
+		break;
+	}
+}
+
+// returns 1 when a whole byte has been collected in dev->rx_byte
+static uint8_t sim_receive_bit(onewire_sim_device *dev, uint8_t bit) {
+	dev->rx_byte = (dev->rx_byte >> 1) | (bit << 7);
+	if(++dev->rx_bits < 8)
+		return 0;
+	dev->rx_bits = 0;
+	return 1;
+}
+
+static uint8_t sim_rom_bit(onewire_sim_device *dev, uint8_t index) {
+	return (dev->rom >> index) & 1;
+}
+
+static void sim_device_fall(onewire_sim_device *dev, uint64_t now) {
+	const sim_timing *t = sim_device_timing(dev);
+	uint8_t send_zero = 0;
+
+	switch(dev->state) {
+	case ONEWIRE_SIM_TX:
+		send_zero = !((dev->tx[dev->tx_bit / 8] >> (dev->tx_bit % 8)) & 1);
+		break;
+	case ONEWIRE_SIM_SEARCH:
+		if(dev->search_phase == 0)
+			send_zero = !sim_rom_bit(dev, dev->search_bit);
+		else if(dev->search_phase == 1)
+			send_zero = sim_rom_bit(dev, dev->search_bit);
+		break;
+	case ONEWIRE_SIM_CONVERTING:
+		send_zero = now < dev->conversion_end;
+		break;
+	default:
+		break;
+	}
+
+	if(send_zero) {
+		dev->hold_from = now;
+		dev->hold_until = now + t->hold;
+	}
+}
+
+static void sim_device_rise(onewire_sim_device *dev, uint64_t now, uint64_t low) {
+	const sim_timing *t = sim_device_timing(dev);
+
+	if(low >= sim_timings[0].reset_min || (dev->overdrive && low >= t->reset_min)) {
+		if(low >= sim_timings[0].reset_min)
+			dev->overdrive = 0;
+		t = sim_device_timing(dev);
+		dev->hold_from = now + t->presence_wait;
+		dev->hold_until = dev->hold_from + t->presence_len;
+		dev->rx_bits = 0;
+		dev->state = ONEWIRE_SIM_ROM_CMD;
+		return;
+	}
+
+	uint8_t bit = low < t->sample;
+	switch(dev->state) {
+	case ONEWIRE_SIM_ROM_CMD:
+		if(sim_receive_bit(dev, bit))
+			sim_rom_command(dev, dev->rx_byte);
+		break;
+	case ONEWIRE_SIM_MATCH:
+		if(bit != sim_rom_bit(dev, dev->search_bit)) {
+			dev->overdrive = 0;
+			dev->state = ONEWIRE_SIM_IDLE;
+		} else if(++dev->search_bit == 64) {
+			dev->state = ONEWIRE_SIM_FUNC_CMD;
+		}
+		break;
+	case ONEWIRE_SIM_SEARCH:
+		if(dev->search_phase < 2) {
+			dev->search_phase++;
+		} else if(bit != sim_rom_bit(dev, dev->search_bit)) {
+			dev->state = ONEWIRE_SIM_IDLE;
+		} else {
+			dev->search_phase = 0;
+			if(++dev->search_bit == 64)
+				dev->state = ONEWIRE_SIM_FUNC_CMD;
+		}
+		break;
+	case ONEWIRE_SIM_FUNC_CMD:
+		if(sim_receive_bit(dev, bit))
+			sim_function_command(dev, dev->rx_byte, now);
+		break;
+	case ONEWIRE_SIM_WRITE_SCRATCHPAD:
+		if(sim_receive_bit(dev, bit)) {
+			// TH, TL, configuration; only R1 R0 of the configuration are writable
+			uint8_t byte = dev->rx_byte;
+			if(dev->rx_count == 2)
+				byte = (byte & 0x60) | 0x1f;
+			dev->scratchpad[2 + dev->rx_count] = byte;
+			if(++dev->rx_count == 3)
+				dev->state = ONEWIRE_SIM_IDLE;
+		}
+		break;
+	case ONEWIRE_SIM_TX:
+		if(++dev->tx_bit == dev->tx_len * 8)
+			dev->state = ONEWIRE_SIM_FUNC_CMD;
+		break;
+	default:
+		break;
+	}
+}
+
+static onewire_sim_bus *sim_find_out(GPIO_TypeDef *port, uint16_t pin) {
+	for(uint8_t i = 0; i < sim_bus_count; i++) {
+		if(sim_buses[i].out_port == port && sim_buses[i].out_pin == pin)
+			return &sim_buses[i];
+	}
+	return NULL;
+}
+
+static uint8_t sim_bus_level(onewire_sim_bus *bus, uint64_t now) {
+	uint8_t level = !bus->master_low;
+	for(uint8_t i = 0; i < bus->device_count && level; i++) {
+		onewire_sim_device *dev = bus->devices[i];
+		if(now >= dev->hold_from && now < dev->hold_until)
+			level = 0;
+	}
+	if(sim_chance(bus->noise_rate)) {
+		bus->flipped_samples++;
+		level = !level;
+	}
+	return level;
+}
+
+static void sim_bus_drive(onewire_sim_bus *bus, uint8_t level) {
+	uint64_t now = host_clock_now();
+
+	if(!level && !bus->master_low) {
+		bus->master_low = 1;
+		bus->fall_time = now;
+		bus->slots++;
+		for(uint8_t i = 0; i < bus->device_count; i++)
+			sim_device_fall(bus->devices[i], now);
+	} else if(level && bus->master_low) {
+		uint64_t low = now - bus->fall_time;
+		bus->master_low = 0;
+		bus->busy_ns += low;
+		// longer than any standard slot, shorter than an overdrive reset
+		if(low >= NS(65)) {
+			bus->resets++;
+		}
+		for(uint8_t i = 0; i < bus->device_count; i++)
+			sim_device_rise(bus->devices[i], now, low);
+	}
+}
+
+/*
+ * Public functions
+ */
+void onewire_sim_reset(void) {
+	memset(sim_buses, 0, sizeof(sim_buses));
+	memset(sim_devices, 0, sizeof(sim_devices));
+	sim_bus_count = 0;
+	sim_device_count = 0;
+}
+
+void onewire_sim_seed(uint32_t seed) {
+	sim_random_state = seed ? seed : 1;
+}
+
+uint64_t onewire_sim_make_rom(uint8_t family, uint64_t serial) {
+	uint8_t bytes[8];
+	uint64_t rom = family | ((serial & 0xffffffffffffULL) << 8);
+	memcpy(bytes, &rom, 8);
+	rom |= (uint64_t)sim_crc(bytes, 7) << 56;
+	return rom;
+}
+
+onewire_sim_bus *onewire_sim_bus_create(GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin) {
+	if(sim_bus_count >= ONEWIRE_SIM_MAX_BUSES)
+		return NULL;
+
+	onewire_sim_bus *bus = &sim_buses[sim_bus_count++];
+	bus->out_port = out_port;
+	bus->out_pin = out_pin;
+	bus->in_port = in_port;
+	bus->in_pin = in_pin;
+	return bus;
+}
+
+onewire_sim_device *onewire_sim_add_ds18b20(onewire_sim_bus *bus, uint64_t serial) {
+	if(bus->device_count >= ONEWIRE_SIM_MAX_DEVICES
+			|| sim_device_count >= sizeof(sim_devices) / sizeof(sim_devices[0]))
+		return NULL;
+
+	onewire_sim_device *dev = &sim_devices[sim_device_count++];
+	dev->rom = onewire_sim_make_rom(ONEWIRE_FAMILY_DS18B20, serial);
+	dev->temperature = 25 * 16;
+	dev->conversion_scale = 1.0;
+	// power-on scratchpad: 85 C, TH 75, TL 70, 12 bit
+	const uint8_t power_on[] = {0x50, 0x05, 0x4b, 0x46, 0x7f, 0xff, 0x0c, 0x10};
+	memcpy(dev->scratchpad, power_on, sizeof(power_on));
+	bus->devices[bus->device_count++] = dev;
+	return dev;
+}
+
+void onewire_sim_pin_write(GPIO_TypeDef *port, uint16_t pin, uint8_t level) {
+	onewire_sim_bus *bus = sim_find_out(port, pin);
+	if(bus != NULL)
+		sim_bus_drive(bus, level);
+}
+
+uint8_t onewire_sim_pin_read(GPIO_TypeDef *port, uint16_t pin) {
+	return (onewire_sim_port_read(port) & pin) != 0;
+}
+
+void onewire_sim_port_write(GPIO_TypeDef *port, uint32_t bsrr) {
+	for(uint8_t i = 0; i < sim_bus_count; i++) {
+		onewire_sim_bus *bus = &sim_buses[i];
+		if(bus->out_port != port)
+			continue;
+		// set has priority over reset, like on the real port
+		if(bsrr & bus->out_pin)
+			sim_bus_drive(bus, 1);
+		else if((bsrr >> 16) & bus->out_pin)
+			sim_bus_drive(bus, 0);
+	}
+}
+
+uint16_t onewire_sim_port_read(GPIO_TypeDef *port) {
+	uint64_t now = host_clock_now();
+	uint16_t idr = 0;
+	for(uint8_t i = 0; i < sim_bus_count; i++) {
+		onewire_sim_bus *bus = &sim_buses[i];
+		if(bus->in_port == port && sim_bus_level(bus, now))
+			idr |= bus->in_pin;
+	}
+	return idr;
+}
+
+uint16_t onewire_sim_timer_count(void) {
+	host_clock_advance(SIM_POLL_NS);
+	return TIM6->CNT;
+}
@@ -0,0 +1,37 @@
+/*
+ * os.h without a kernel, on virtual time. There is one thread of control,
+ * so locks do nothing, but a wait idles the core until the next interrupt
+ * or the timeout instead of returning at once: the caller's polling loop
+ * then moves the clock along like it would on the target.
+ */
+#include "os.h"
+#include "stm32f4xx_hal.h"
+#include "host_clock.h"
+
+uint8_t os_running(void) {
+	return 0;
+}
+
+uint8_t os_in_isr(void) {
+	return (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
+}
+
+void os_mutex_lock(os_mutex *mutex) {
+	(void)mutex;
+}
+
+void os_mutex_unlock(os_mutex *mutex) {
+	(void)mutex;
+}
+
+void os_event_wait(os_event *event, uint32_t timeout_ms) {
+	(void)event;
+	if(os_in_isr())
+		return;
+	host_clock_sleep_until(host_clock_now() + (uint64_t)timeout_ms * 1000000);
+}
+
+// the wait ends with any interrupt, there is no waiter to wake
+void os_event_signal(os_event *event) {
+	(void)event;
+}
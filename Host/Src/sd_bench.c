@@ -0,0 +1,246 @@
+/*
+ * Host benchmark and regression run of diskio.c and FatFs against the SD
+ * card model. All times are virtual: SPI clocks, HAL call overhead and the
+ * card's access and programming times.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "sd_sim.h"
+#include "fat_image.h"
+#include "host_clock.h"
+
+#define SECTOR_SIZE SD_SIM_SECTOR_SIZE
+#define CARD_SECTORS 131072		// 64 MiB
+#define DATA_SIZE (256 * 1024)
+#define LOG_FILES 200
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+		if(!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while(0)
+
+static uint8_t *image;
+static uint8_t *data_file;
+
+static double elapsed_ms(uint64_t start) {
+	return (host_clock_now() - start) / 1e6;
+}
+
+static double kib_per_s(uint64_t bytes, uint64_t start) {
+	return bytes / 1024.0 / ((host_clock_now() - start) / 1e9);
+}
+
+static void fill_pattern(uint8_t *dest, uint32_t len, uint32_t seed) {
+	uint32_t x = seed | 1;
+	for(uint32_t i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		dest[i] = x;
+	}
+}
+
+static sd_sim_card *insert(uint32_t sectors, uint8_t high_capacity) {
+	host_clock_reset();
+	sd_sim_seed(1);
+	return sd_sim_insert(image, sectors, high_capacity);
+}
+
+static void bench_init(void) {
+	memset(image, 0, (size_t)CARD_SECTORS * SECTOR_SIZE);
+	insert(CARD_SECTORS, 1);
+
+	uint64_t start = host_clock_now();
+	DSTATUS status = disk_initialize(0);
+	printf("init: %.2f ms\n", elapsed_ms(start));
+	CHECK(status == 0, "status %02x", status);
+
+	LBA_t count = 0;
+	CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &count) == RES_OK && count == CARD_SECTORS,
+			"SDHC sector count %lu", (unsigned long)count);
+
+	insert(CARD_SECTORS, 0);
+	status = disk_initialize(0);
+	count = 0;
+	CHECK(status == 0, "SDSC status %02x", status);
+	CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &count) == RES_OK && count == CARD_SECTORS,
+			"SDSC sector count %lu", (unsigned long)count);
+}
+
+static void bench_raw(uint8_t high_capacity) {
+	const uint32_t sectors = 2048;
+	const char *name = high_capacity ? "SDHC" : "SDSC";
+	static uint8_t buffer[8 * SECTOR_SIZE];
+
+	fill_pattern(image, sectors * SECTOR_SIZE, 7);
+	insert(CARD_SECTORS, high_capacity);
+	CHECK(disk_initialize(0) == 0, "%s init", name);
+
+	uint64_t start = host_clock_now();
+	int errors = 0;
+	for(uint32_t s = 0; s < sectors; s++) {
+		if(disk_read(0, buffer, s, 1) != RES_OK || memcmp(buffer, image + s * SECTOR_SIZE, SECTOR_SIZE) != 0)
+			errors++;
+	}
+	printf("%s read, 1 sector: %.0f KiB/s\n", name, kib_per_s(sectors * SECTOR_SIZE, start));
+	CHECK(errors == 0, "%d single sector reads failed", errors);
+
+	start = host_clock_now();
+	errors = 0;
+	for(uint32_t s = 0; s < sectors; s += 8) {
+		if(disk_read(0, buffer, s, 8) != RES_OK || memcmp(buffer, image + s * SECTOR_SIZE, sizeof(buffer)) != 0)
+			errors++;
+	}
+	printf("%s read, 8 sectors: %.0f KiB/s\n", name, kib_per_s(sectors * SECTOR_SIZE, start));
+	CHECK(errors == 0, "%d multiple sector reads failed", errors);
+
+	const uint32_t written = 256;
+	start = host_clock_now();
+	errors = 0;
+	for(uint32_t s = 0; s < written; s++) {
+		fill_pattern(buffer, SECTOR_SIZE, s + 100);
+		if(disk_write(0, buffer, 4096 + s, 1) != RES_OK
+				|| memcmp(buffer, image + (4096 + s) * SECTOR_SIZE, SECTOR_SIZE) != 0)
+			errors++;
+	}
+	printf("%s write, 1 sector: %.0f KiB/s\n", name, kib_per_s(written * SECTOR_SIZE, start));
+	CHECK(errors == 0, "%d single sector writes failed", errors);
+
+	start = host_clock_now();
+	errors = 0;
+	for(uint32_t s = 0; s < written; s += 8) {
+		fill_pattern(buffer, sizeof(buffer), s + 200);
+		if(disk_write(0, buffer, 8192 + s, 8) != RES_OK
+				|| memcmp(buffer, image + (8192 + s) * SECTOR_SIZE, sizeof(buffer)) != 0)
+			errors++;
+	}
+	printf("%s write, 8 sectors: %.0f KiB/s\n", name, kib_per_s(written * SECTOR_SIZE, start));
+	CHECK(errors == 0, "%d multiple sector writes failed", errors);
+	CHECK(disk_ioctl(0, CTRL_SYNC, NULL) == RES_OK, "%s sync", name);
+}
+
+static void bench_errors(void) {
+	uint8_t buffer[SECTOR_SIZE];
+
+	sd_sim_card *card = insert(CARD_SECTORS, 1);
+	CHECK(disk_initialize(0) == 0, "init");
+
+	card->crc_error_rate = 1;
+	CHECK(disk_read(0, buffer, 0, 1) == RES_ERROR, "bad CRC not detected");
+	card->crc_error_rate = 0;
+	CHECK(disk_read(0, buffer, 0, 1) == RES_OK, "read after a CRC error");
+
+	CHECK(disk_read(0, buffer, CARD_SECTORS, 1) == RES_ERROR, "read past the end");
+	CHECK(disk_read(0, buffer, 1, 1) == RES_OK, "read after an address error");
+	CHECK(card->illegal_commands == 0, "%lu illegal commands", (unsigned long)card->illegal_commands);
+}
+
+static void make_volume(fat_image *img, uint32_t sectors, uint8_t fat_type, uint8_t partitioned) {
+	char name[13], text[64];
+
+	CHECK(fat_image_format(img, image, sectors, fat_type, partitioned) == 0, "FAT%d format", fat_type);
+	static const char readme[] = "simulated card\r\n";
+	fat_image_add_file(img, FAT_IMAGE_ROOT, "README.TXT", readme, sizeof(readme) - 1);
+	CHECK(fat_image_add_file(img, FAT_IMAGE_ROOT, "DATA.BIN", data_file, DATA_SIZE) == 0, "add DATA.BIN");
+
+	uint32_t logs = fat_image_mkdir(img, FAT_IMAGE_ROOT, "LOGS");
+	CHECK(logs != 0, "mkdir LOGS");
+	for(int i = 0; i < LOG_FILES; i++) {
+		snprintf(name, sizeof(name), "LOG%05d.TXT", i);
+		int len = snprintf(text, sizeof(text), "log %d\r\n", i);
+		CHECK(fat_image_add_file(img, logs, name, text, len) == 0, "add %s", name);
+	}
+}
+
+static void bench_fatfs(uint8_t fat_type, uint8_t partitioned, uint8_t high_capacity) {
+	static FATFS fs;
+	static FIL fil;
+	static DIR dir;
+	static uint8_t buffer[4096];
+	FILINFO finfo;
+	fat_image img;
+	UINT br;
+
+	uint32_t sectors = fat_type == 12 ? 8192 : CARD_SECTORS;
+	make_volume(&img, sectors, fat_type, partitioned);
+	insert(sectors, high_capacity);
+	printf("FAT%d, %s%u sectors per cluster, %s:\n", fat_type, partitioned ? "partitioned, " : "",
+			img.sectors_per_cluster, high_capacity ? "SDHC" : "SDSC");
+
+	uint64_t start = host_clock_now();
+	FRESULT res = f_mount(&fs, "", 1);
+	printf("  mount: %.2f ms\n", elapsed_ms(start));
+	CHECK(res == FR_OK, "FAT%d mount: %d", fat_type, res);
+	if(res != FR_OK)
+		return;
+	CHECK(fs.fs_type == (fat_type == 12 ? FS_FAT12 : fat_type == 16 ? FS_FAT16 : FS_FAT32),
+			"mounted as type %d", fs.fs_type);
+
+	for(UINT chunk = 512; chunk <= sizeof(buffer); chunk *= 8) {
+		res = f_open(&fil, "/DATA.BIN", FA_READ);
+		CHECK(res == FR_OK, "open DATA.BIN: %d", res);
+		if(res != FR_OK)
+			break;
+		uint32_t offset = 0;
+		int mismatches = 0;
+		start = host_clock_now();
+		while(f_read(&fil, buffer, chunk, &br) == FR_OK && br != 0) {
+			mismatches += memcmp(buffer, data_file + offset, br) != 0;
+			offset += br;
+		}
+		printf("  read %u byte chunks: %.0f KiB/s\n", chunk, kib_per_s(offset, start));
+		CHECK(offset == DATA_SIZE, "read %lu bytes", (unsigned long)offset);
+		CHECK(mismatches == 0, "%d chunks differ", mismatches);
+		f_close(&fil);
+	}
+
+	start = host_clock_now();
+	int entries = 0;
+	res = f_opendir(&dir, "/LOGS");
+	CHECK(res == FR_OK, "opendir LOGS: %d", res);
+	while(res == FR_OK && f_readdir(&dir, &finfo) == FR_OK && finfo.fname[0] != '\0')
+		entries++;
+	f_closedir(&dir);
+	printf("  list %d entries: %.2f ms\n", entries, elapsed_ms(start));
+	CHECK(entries == LOG_FILES, "listed %d entries", entries);
+
+	res = f_stat("/LOGS/LOG00123.TXT", &finfo);
+	CHECK(res == FR_OK && finfo.fsize == 9, "stat LOG00123.TXT: %d, %lu bytes", res,
+			(unsigned long)finfo.fsize);
+	f_unmount("");
+}
+
+int main(void) {
+	image = malloc((size_t)CARD_SECTORS * SECTOR_SIZE);
+	data_file = malloc(DATA_SIZE);
+	if(image == NULL || data_file == NULL)
+		return 1;
+	fill_pattern(data_file, DATA_SIZE, 42);
+
+	bench_init();
+	bench_raw(1);
+	bench_raw(0);
+	bench_errors();
+	bench_fatfs(12, 1, 1);
+	bench_fatfs(16, 0, 1);
+	bench_fatfs(16, 0, 0);
+	bench_fatfs(32, 1, 1);
+
+	free(data_file);
+	free(image);
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,446 @@
+/*
+ * SD card model, SPI mode of the Physical Layer Simplified Specification.
+ *
+ * Every byte on the bus is full duplex: the card shifts out the byte it has
+ * ready before it looks at the byte it received. Responses come one byte
+ * after the command (NCR = 1), data blocks once the access time passed.
+ * A transfer survives CS going high in between, as diskio.c releases the
+ * card between a command and its data.
+ */
+#include <string.h>
+#include "sd_sim.h"
+#include "main.h"
+#include "host_clock.h"
+
+#define NS(us) ((uint64_t)((us) * 1000))
+
+/* R1 bits */
+#define R1_IDLE 0x01
+#define R1_ILLEGAL 0x04
+#define R1_CRC_ERROR 0x08
+#define R1_ADDRESS_ERROR 0x20
+#define R1_PARAMETER_ERROR 0x40
+
+#define TOKEN_START_BLOCK 0xfe
+#define TOKEN_START_MULTI_WRITE 0xfc
+#define TOKEN_STOP_MULTI_WRITE 0xfd
+#define DATA_ACCEPTED 0x05
+#define DATA_CRC_ERROR 0x0b
+
+/* OCR: 2.7 - 3.6 V, power up done, card capacity status */
+#define OCR_VOLTAGES 0x00ff8000
+#define OCR_READY 0x80000000
+#define OCR_CCS 0x40000000
+
+/* The longest response: data token, a block and its CRC */
+#define SIM_OUT_MAX (1 + SD_SIM_SECTOR_SIZE + 2)
+
+typedef enum {
+	SIM_NONE = 0,
+	SIM_READ_SINGLE,
+	SIM_READ_MULTI,
+	SIM_READ_CSD,
+	SIM_WRITE_SINGLE,
+	SIM_WRITE_MULTI,
+} sim_transfer;
+
+static sd_sim_card sim_card;
+static uint8_t sim_inserted = 0;
+static uint32_t sim_random_state = 1;
+
+static uint8_t sim_csd[16];
+static uint8_t sim_idle = 1;
+static uint8_t sim_app_cmd = 0;
+static uint8_t sim_crc_on = 0;
+static uint64_t sim_reset_time = 0;
+
+static uint8_t sim_cmd[6];
+static uint8_t sim_cmd_len = 0;
+
+static uint8_t sim_out[SIM_OUT_MAX];
+static uint32_t sim_out_len = 0;
+static uint32_t sim_out_pos = 0;
+
+static sim_transfer sim_mode = SIM_NONE;
+static uint32_t sim_block = 0;
+static uint64_t sim_data_ready = 0;
+static uint64_t sim_busy_until = 0;
+
+// write block being received: token seen, then data and CRC
+static uint8_t sim_in[SD_SIM_SECTOR_SIZE + 2];
+static uint32_t sim_in_len = 0;
+static uint8_t sim_in_active = 0;
+
+/*
+ * Private functions
+ */
+static uint32_t sim_random(void) {
+	// xorshift32, reproducible across hosts
+	sim_random_state ^= sim_random_state << 13;
+	sim_random_state ^= sim_random_state >> 17;
+	sim_random_state ^= sim_random_state << 5;
+	return sim_random_state;
+}
+
+static uint8_t sim_chance(double probability) {
+	return probability > 0 && sim_random() < probability * 4294967296.0;
+}
+
+static uint8_t sim_crc7(const uint8_t *data, uint32_t len) {
+	uint8_t crc = 0;
+	for(uint32_t i = 0; i < len; i++) {
+		for(int bit = 7; bit >= 0; bit--) {
+			uint8_t in = ((data[i] >> bit) & 1) ^ ((crc >> 6) & 1);
+			crc = (crc << 1) & 0x7f;
+			if(in)
+				crc ^= 0x09;
+		}
+	}
+	return crc;
+}
+
+static uint16_t sim_crc16(const uint8_t *data, uint32_t len) {
+	uint16_t crc = 0;
+	for(uint32_t i = 0; i < len; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for(int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static void sim_build_csd(void) {
+	memset(sim_csd, 0, sizeof(sim_csd));
+	if(sim_card.high_capacity) {
+		// CSD 2.0, capacity (C_SIZE + 1) * 512 KiB
+		uint32_t c_size = sim_card.sectors / 1024 - 1;
+		sim_csd[0] = 0x40;
+		sim_csd[5] = 0x59;
+		sim_csd[7] = (c_size >> 16) & 0x3f;
+		sim_csd[8] = c_size >> 8;
+		sim_csd[9] = c_size;
+	} else {
+		// CSD 1.0 with 512 byte blocks and C_SIZE_MULT 7
+		uint32_t c_size = sim_card.sectors / 512 - 1;
+		sim_csd[0] = 0x00;
+		sim_csd[5] = 0x59;
+		sim_csd[6] = (c_size >> 10) & 0x03;
+		sim_csd[7] = c_size >> 2;
+		sim_csd[8] = (c_size & 0x03) << 6;
+		sim_csd[9] = 0x03;
+		sim_csd[10] = 0x80;
+	}
+	sim_csd[15] = (sim_crc7(sim_csd, 15) << 1) | 1;
+}
+
+static void sim_respond(const uint8_t *data, uint32_t len) {
+	// NCR: one byte of 0xff before the response
+	sim_out[0] = 0xff;
+	memcpy(sim_out + 1, data, len);
+	sim_out_len = len + 1;
+	sim_out_pos = 0;
+}
+
+static void sim_respond_r1(uint8_t r1) {
+	sim_respond(&r1, 1);
+}
+
+// Queues the data token, the block and its CRC
+static void sim_send_block(const uint8_t *data, uint32_t len) {
+	sim_out[0] = TOKEN_START_BLOCK;
+	memcpy(sim_out + 1, data, len);
+	uint16_t crc = sim_crc16(data, len);
+	if(sim_chance(sim_card.crc_error_rate))
+		crc ^= 0x0001;
+	sim_out[len + 1] = crc >> 8;
+	sim_out[len + 2] = crc & 0xff;
+	sim_out_len = len + 3;
+	sim_out_pos = 0;
+}
+
+static uint8_t sim_busy(uint64_t now) {
+	return now < sim_busy_until;
+}
+
+static void sim_set_busy(uint64_t now, uint64_t ns) {
+	sim_busy_until = now + ns;
+	sim_card.busy_ns += ns;
+}
+
+// Block number of a read or write argument, or UINT32_MAX when out of range
+static uint32_t sim_address(uint32_t arg) {
+	uint32_t block = arg;
+	if(!sim_card.high_capacity) {
+		if(arg % SD_SIM_SECTOR_SIZE != 0)
+			return UINT32_MAX;
+		block = arg / SD_SIM_SECTOR_SIZE;
+	}
+	return block < sim_card.sectors ? block : UINT32_MAX;
+}
+
+static void sim_command(uint64_t now) {
+	uint8_t index = sim_cmd[0] & 0x3f;
+	uint32_t arg = (uint32_t)sim_cmd[1] << 24 | sim_cmd[2] << 16 | sim_cmd[3] << 8 | sim_cmd[4];
+	uint8_t app = sim_app_cmd;
+	sim_app_cmd = 0;
+	sim_card.commands++;
+
+	// CMD0 and CMD8 always carry a valid CRC, the others once CMD59 turned checking on
+	if((sim_crc_on || index == 0 || index == 8) && (sim_cmd[5] >> 1) != sim_crc7(sim_cmd, 5)) {
+		sim_card.crc_errors++;
+		sim_respond_r1(R1_CRC_ERROR | (sim_idle ? R1_IDLE : 0));
+		return;
+	}
+
+	uint8_t r1 = sim_idle ? R1_IDLE : 0;
+	uint32_t block;
+	uint8_t r[5];
+
+	if(index == 12) {
+		// CMD12 answers after a stuff byte, then the card is busy for a moment
+		uint8_t stop[2] = { 0xff, r1 };
+		sim_mode = SIM_NONE;
+		sim_respond(stop, 2);
+		sim_set_busy(now, NS(2));
+		return;
+	}
+	if(app && index == 41) {
+		if(now - sim_reset_time >= sim_card.init_ns)
+			sim_idle = 0;
+		sim_respond_r1(sim_idle ? R1_IDLE : 0);
+		return;
+	}
+	if(app && index == 23) {
+		sim_respond_r1(r1);
+		return;
+	}
+
+	switch(index) {
+	case 0:
+		sim_idle = 1;
+		sim_crc_on = 0;
+		sim_mode = SIM_NONE;
+		sim_reset_time = now;
+		sim_respond_r1(R1_IDLE);
+		return;
+	case 8:
+		r[0] = r1;
+		r[1] = 0;
+		r[2] = 0;
+		r[3] = (arg >> 8) & 0x0f;
+		r[4] = arg & 0xff;
+		sim_respond(r, 5);
+		return;
+	case 55:
+		sim_app_cmd = 1;
+		sim_respond_r1(r1);
+		return;
+	case 58: {
+		uint32_t ocr = OCR_VOLTAGES;
+		if(!sim_idle)
+			ocr |= OCR_READY | (sim_card.high_capacity ? OCR_CCS : 0);
+		r[0] = r1;
+		r[1] = ocr >> 24;
+		r[2] = ocr >> 16;
+		r[3] = ocr >> 8;
+		r[4] = ocr;
+		sim_respond(r, 5);
+		return;
+	}
+	case 59:
+		sim_crc_on = arg & 1;
+		sim_respond_r1(r1);
+		return;
+	}
+
+	// the rest needs an initialized card
+	if(sim_idle) {
+		sim_card.illegal_commands++;
+		sim_respond_r1(R1_ILLEGAL | R1_IDLE);
+		return;
+	}
+
+	switch(index) {
+	case 9:
+		sim_mode = SIM_READ_CSD;
+		sim_data_ready = now + sim_card.read_latency_ns;
+		sim_respond_r1(r1);
+		return;
+	case 16:
+		sim_respond_r1(arg == SD_SIM_SECTOR_SIZE ? r1 : r1 | R1_PARAMETER_ERROR);
+		return;
+	case 17:
+	case 18:
+	case 24:
+	case 25:
+		block = sim_address(arg);
+		if(block == UINT32_MAX) {
+			sim_respond_r1(r1 | R1_ADDRESS_ERROR);
+			return;
+		}
+		sim_block = block;
+		if(index == 17 || index == 18) {
+			sim_mode = index == 17 ? SIM_READ_SINGLE : SIM_READ_MULTI;
+			sim_data_ready = now + sim_card.read_latency_ns;
+		} else {
+			sim_mode = index == 24 ? SIM_WRITE_SINGLE : SIM_WRITE_MULTI;
+			sim_in_active = 0;
+		}
+		sim_respond_r1(r1);
+		return;
+	default:
+		sim_card.illegal_commands++;
+		sim_respond_r1(r1 | R1_ILLEGAL);
+		return;
+	}
+}
+
+static void sim_write_byte(uint8_t mosi, uint64_t now) {
+	if(!sim_in_active) {
+		if(mosi == TOKEN_STOP_MULTI_WRITE && sim_mode == SIM_WRITE_MULTI) {
+			sim_mode = SIM_NONE;
+			sim_set_busy(now, NS(2));
+		} else if(mosi == (sim_mode == SIM_WRITE_SINGLE ? TOKEN_START_BLOCK : TOKEN_START_MULTI_WRITE)) {
+			sim_in_active = 1;
+			sim_in_len = 0;
+		}
+		return;
+	}
+
+	sim_in[sim_in_len++] = mosi;
+	if(sim_in_len < sizeof(sim_in))
+		return;
+
+	sim_in_active = 0;
+	uint16_t crc = sim_in[SD_SIM_SECTOR_SIZE] << 8 | sim_in[SD_SIM_SECTOR_SIZE + 1];
+	if(sim_crc_on && crc != sim_crc16(sim_in, SD_SIM_SECTOR_SIZE)) {
+		sim_card.crc_errors++;
+		sim_out[0] = DATA_CRC_ERROR;
+		sim_out_len = 1;
+		sim_out_pos = 0;
+		sim_mode = SIM_NONE;
+		return;
+	}
+	if(sim_block >= sim_card.sectors) {
+		// ran off the end of a multiple block write
+		sim_mode = SIM_NONE;
+		return;
+	}
+
+	memcpy(sim_card.image + (size_t)sim_block * SD_SIM_SECTOR_SIZE, sim_in, SD_SIM_SECTOR_SIZE);
+	sim_card.blocks_written++;
+	sim_block++;
+	sim_out[0] = DATA_ACCEPTED;
+	sim_out_len = 1;
+	sim_out_pos = 0;
+	sim_set_busy(now, sim_card.write_busy_ns);
+	if(sim_mode == SIM_WRITE_SINGLE)
+		sim_mode = SIM_NONE;
+}
+
+// The byte the card drives on DO during this transfer
+static uint8_t sim_output(uint64_t now) {
+	if(sim_out_pos < sim_out_len)
+		return sim_out[sim_out_pos++];
+	if(sim_busy(now))
+		return 0x00;
+
+	if(sim_mode == SIM_READ_MULTI && sim_data_ready == UINT64_MAX) {
+		// the access time of the next block starts once the previous one is out
+		sim_data_ready = now + sim_card.read_latency_ns;
+	}
+
+	switch(sim_mode) {
+	case SIM_READ_SINGLE:
+	case SIM_READ_MULTI:
+		if(now < sim_data_ready)
+			return 0xff;
+		if(sim_block >= sim_card.sectors) {
+			// error token: out of range
+			sim_mode = SIM_NONE;
+			return 0x08;
+		}
+		sim_send_block(sim_card.image + (size_t)sim_block * SD_SIM_SECTOR_SIZE, SD_SIM_SECTOR_SIZE);
+		sim_card.blocks_read++;
+		sim_block++;
+		if(sim_mode == SIM_READ_SINGLE)
+			sim_mode = SIM_NONE;
+		else
+			sim_data_ready = UINT64_MAX;
+		return sim_out[sim_out_pos++];
+	case SIM_READ_CSD:
+		if(now < sim_data_ready)
+			return 0xff;
+		sim_send_block(sim_csd, sizeof(sim_csd));
+		sim_mode = SIM_NONE;
+		return sim_out[sim_out_pos++];
+	default:
+		return 0xff;
+	}
+}
+
+static void sim_input(uint8_t mosi, uint64_t now) {
+	if(sim_cmd_len != 0 || (sim_mode != SIM_WRITE_SINGLE && sim_mode != SIM_WRITE_MULTI
+			&& (mosi & 0xc0) == 0x40)) {
+		sim_cmd[sim_cmd_len++] = mosi;
+		if(sim_cmd_len == sizeof(sim_cmd)) {
+			sim_cmd_len = 0;
+			sim_command(now);
+		}
+		return;
+	}
+	if(sim_mode == SIM_WRITE_SINGLE || sim_mode == SIM_WRITE_MULTI)
+		sim_write_byte(mosi, now);
+}
+
+static uint8_t sim_exchange(uint8_t mosi) {
+	if(!sim_inserted)
+		return 0xff;
+	if(HAL_GPIO_ReadPin(SPI1_CS_GPIO_Port, SPI1_CS_Pin) == GPIO_PIN_SET) {
+		// a deselected card ignores the bus and forgets a partial command
+		sim_cmd_len = 0;
+		return 0xff;
+	}
+
+	uint64_t now = host_clock_now();
+	uint8_t miso = sim_output(now);
+	sim_input(mosi, now);
+	return miso;
+}
+
+/*
+ * Public functions
+ */
+sd_sim_card *sd_sim_insert(uint8_t *image, uint32_t sectors, uint8_t high_capacity) {
+	memset(&sim_card, 0, sizeof(sim_card));
+	sim_card.image = image;
+	sim_card.sectors = sectors;
+	sim_card.high_capacity = high_capacity;
+	sim_card.init_ns = NS(20000);
+	sim_card.read_latency_ns = NS(250);
+	sim_card.write_busy_ns = NS(400);
+
+	sim_idle = 1;
+	sim_app_cmd = 0;
+	sim_crc_on = 0;
+	sim_reset_time = host_clock_now();
+	sim_cmd_len = 0;
+	sim_out_len = sim_out_pos = 0;
+	sim_mode = SIM_NONE;
+	sim_busy_until = 0;
+	sim_in_active = 0;
+	sim_build_csd();
+
+	HAL_GPIO_WritePin(SPI1_CS_GPIO_Port, SPI1_CS_Pin, GPIO_PIN_SET);
+	host_spi_attach(SPI1, sim_exchange);
+	sim_inserted = 1;
+	return &sim_card;
+}
+
+void sd_sim_remove(void) {
+	sim_inserted = 0;
+}
+
+void sd_sim_seed(uint32_t seed) {
+	sim_random_state = seed != 0 ? seed : 1;
+}
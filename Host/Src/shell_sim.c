@@ -0,0 +1,209 @@
+/*
+ * Runs the firmware's tasks and shell on the host: commands are read from
+ * stdin and arrive through the simulated USART3, printf goes through the
+ * console like __io_putchar does on the target and the UART's output ends
+ * up on stdout. All of it runs on the virtual clock, so the timing shown
+ * by stats and tasks is the same on every run.
+ * The card holds a small demo volume, or the raw image given as argument,
+ * and three DS18B20s sit on the 1-Wire bus.
+ *
+ *   echo "ls" | ./build/shell_sim
+ *   ./build/shell_sim card.img
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "onewire_sim.h"
+#include "main.h"
+#include "console.h"
+#include "fat_image.h"
+#include "log.h"
+#include "onewire.h"
+#include "sched.h"
+#include "sd_sim.h"
+#include "sensors.h"
+#include "shell.h"
+#include "telemetry.h"
+#include "uart_sim.h"
+
+#define SENSORS_DEFAULT_PERIOD_MS 1000
+#define LOG_TX_RESERVE 128
+#define LOG_IDLE_RECORDS 4
+
+#define TASK_PERIOD_CONSOLE_MS 5
+#define TASK_PERIOD_SENSORS_MS 10
+
+#define DEMO_SECTORS 131072
+
+UART_HandleTypeDef huart3 = { USART3, { CONSOLE_DEFAULT_BAUD, UART_OVERSAMPLING_16 } };
+static DMA_Stream_TypeDef usart3_rx_stream;
+static DMA_HandleTypeDef hdma_usart3_rx = { &usart3_rx_stream };
+static TIM_HandleTypeDef htim6 = { TIM6 };
+static onewire_bus onewire_bus1;
+static FILE *uart_out;
+
+/*
+ * Private functions
+ */
+
+// the console and sensor tasks of main.c, without the USB functions
+static void task_console(uint32_t events) {
+	console_poll();
+	shell_poll();
+	if(shell_busy() && console_tx_free() >= SHELL_TX_RESERVE) {
+		sched_post(TASK_CONSOLE, TASK_EVENT_AGAIN);
+	}
+}
+
+static void task_sensors(uint32_t events) {
+	telemetry_sample samples[TELEMETRY_MAX_SAMPLES];
+
+	if(!sensors_poll() || !telemetry_enabled()) {
+		return;
+	}
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < sensors_count() && count < TELEMETRY_MAX_SAMPLES; i++) {
+		int16_t temperature;
+		uint32_t timestamp;
+		if(sensors_read(i, &temperature, &timestamp)) {
+			samples[count].index = i;
+			samples[count].temperature = temperature;
+			samples[count++].timestamp = timestamp;
+		}
+	}
+	if(count != 0) {
+		telemetry_send_samples(samples, count);
+	}
+}
+
+static void idle_log(void) {
+	log_record rec;
+	for(uint32_t n = 0; n < LOG_IDLE_RECORDS && console_tx_free() >= LOG_TX_RESERVE
+			&& log_peek(&rec); n++) {
+		if(telemetry_enabled()) {
+			telemetry_send_log(&rec);
+		} else {
+			log_print(&rec);
+		}
+		log_discard();
+	}
+}
+
+// Types the next line once the previous command is done, leaves at the end of the input
+static void idle_stdin(void) {
+	char line[CONSOLE_LINE_MAX];
+
+	if(shell_busy() || uart_sim_rx_pending() != 0 || console_rx_available() != 0) {
+		return;
+	}
+	if(fgets(line, sizeof(line), stdin) == NULL) {
+		fflush(stdout);
+		console_flush();
+		fflush(uart_out);
+		exit(0);
+	}
+	uart_sim_receive(&huart3, (const uint8_t *)line, strlen(line));
+}
+
+// what the USART3 and DMA interrupt handlers add to the HAL's
+static void uart_irq(void) {
+	sched_post(TASK_CONSOLE, TASK_EVENT_IRQ);
+}
+
+static ssize_t console_stdout(void *cookie, const char *data, size_t len) {
+	(void)cookie;
+	console_write(data, len);
+	return len;
+}
+
+static uint8_t *load_image(const char *path, uint32_t *sectors) {
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	// SDHC capacity comes in 512 KiB units
+	*sectors = ((size + SD_SIM_SECTOR_SIZE - 1) / SD_SIM_SECTOR_SIZE + 1023) / 1024 * 1024;
+	uint8_t *image = calloc(*sectors, SD_SIM_SECTOR_SIZE);
+	if(image != NULL && fread(image, 1, size, f) != (size_t)size) {
+		perror(path);
+		free(image);
+		image = NULL;
+	}
+	fclose(f);
+	return image;
+}
+
+static uint8_t *demo_image(uint32_t *sectors) {
+	static const char readme[] = "Host simulation of the onewire logger\r\n";
+	fat_image img;
+	char name[13], text[64];
+
+	*sectors = DEMO_SECTORS;
+	uint8_t *image = malloc((size_t)DEMO_SECTORS * SD_SIM_SECTOR_SIZE);
+	if(image == NULL || fat_image_format(&img, image, DEMO_SECTORS, 16, 0) != 0) {
+		free(image);
+		return NULL;
+	}
+	fat_image_add_file(&img, FAT_IMAGE_ROOT, "README.TXT", readme, sizeof(readme) - 1);
+	uint32_t logs = fat_image_mkdir(&img, FAT_IMAGE_ROOT, "LOGS");
+	for(int i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "LOG%05d.TXT", i);
+		int len = snprintf(text, sizeof(text), "%d,21.5000\r\n", i * 1000);
+		fat_image_add_file(&img, logs, name, text, len);
+	}
+	return image;
+}
+
+/*
+ * Public functions
+ */
+int main(int argc, char **argv) {
+	uint32_t sectors;
+	uint8_t *image = argc > 1 ? load_image(argv[1], &sectors) : demo_image(&sectors);
+	if(image == NULL) {
+		return 1;
+	}
+	sd_sim_insert(image, sectors, 1);
+
+	onewire_sim_seed(1);
+	onewire_sim_bus *bus = onewire_sim_bus_create(ONEWIRE_OUT_GPIO_Port, ONEWIRE_OUT_Pin,
+			ONEWIRE_IN_GPIO_Port, ONEWIRE_IN_Pin);
+	for(int i = 0; i < 3; i++) {
+		onewire_sim_device *dev = onewire_sim_add_ds18b20(bus, 0x100 + i);
+		dev->temperature = 16 * 21 + i * 8;
+	}
+
+	uart_out = fdopen(dup(STDOUT_FILENO), "w");
+	stdout = fopencookie(NULL, "w", (cookie_io_functions_t){ .write = console_stdout });
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	uart_sim_set_output(uart_out);
+	uart_sim_set_irq_hook(uart_irq);
+	huart3.hdmarx = &hdma_usart3_rx;
+	HAL_UART_Init(&huart3);
+
+	console_init(&huart3);
+	// piped input is shown by the echo, a terminal echoes by itself
+	console_set_echo(!isatty(STDIN_FILENO));
+	log_init();
+	onewire_init(&htim6);
+	onewire_bus_init(&onewire_bus1, ONEWIRE_OUT_GPIO_Port, ONEWIRE_OUT_Pin,
+			ONEWIRE_IN_GPIO_Port, ONEWIRE_IN_Pin);
+	sensors_init();
+	printf("Found %d sensors\n", sensors_scan(&onewire_bus1, SENSORS_DEFAULT_PERIOD_MS));
+	telemetry_init();
+	shell_init(&onewire_bus1, SENSORS_DEFAULT_PERIOD_MS);
+
+	sched_init();
+	sched_add(TASK_CONSOLE, "console", task_console, TASK_PERIOD_CONSOLE_MS);
+	sched_add(TASK_SENSORS, "sensors", task_sensors, TASK_PERIOD_SENSORS_MS);
+	sched_add_idle(idle_log);
+	sched_add_idle(idle_stdin);
+	sched_run();
+}
@@ -0,0 +1,405 @@
+/*
+ * Reads the vendor bulk sample stream straight from usbdevfs, no libusb
+ * needed, and prints the samples. A capture written with -w can be
+ * replayed later by passing the file instead of a device.
+ *
+ * Usage: stream_read [-q] [-w capture] [/dev/bus/usb/BBB/DDD|capture]
+ *   -q    only print the summary
+ *   -w    append the raw stream to a capture file
+ * Without a path the first device of the firmware is used. The streaming
+ * interface and its endpoint are looked up in sysfs, so any of the
+ * firmware's USB function sets works.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/usbdevice_fs.h>
+#include "stream_proto.h"
+
+// must match usb_desc.h
+#define STREAM_VID 0x0483
+#define STREAM_MANUFACTURER "onewire"
+#define SYSFS_USB "/sys/bus/usb/devices"
+
+#define URB_COUNT 4
+#define URB_SIZE 16384
+#define CONTROL_TIMEOUT_MS 1000
+
+static volatile sig_atomic_t stop = 0;
+static int quiet = 0;
+static FILE *capture = NULL;
+
+static uint8_t pending[2 * URB_SIZE + sizeof(stream_header) + STREAM_MAX_PAYLOAD];
+static size_t pending_len = 0;
+static int have_seq = 0;
+static uint16_t last_seq = 0;
+static unsigned long records = 0, samples = 0, lost = 0, skipped = 0;
+static unsigned long long total_bytes = 0;
+static unsigned stream_interface = 0;
+static unsigned stream_endpoint = 0;
+
+static void on_signal(int sig) {
+	stop = 1;
+}
+
+static void print_temperature(int16_t t) {
+	printf("%s%d.%04d", t < 0 ? "-" : "", abs(t) / 16, (abs(t) % 16) * 625);
+}
+
+static void print_record(const stream_header *hdr, const uint8_t *payload) {
+	if(have_seq && (uint16_t)(last_seq + 1) != hdr->seq) {
+		uint16_t gap = hdr->seq - last_seq - 1;
+		lost += gap;
+		if(!quiet) {
+			printf("[lost %u records]\n", gap);
+		}
+	}
+	have_seq = 1;
+	last_seq = hdr->seq;
+	records++;
+
+	if(hdr->type != STREAM_RECORD_SAMPLES) {
+		if(!quiet) {
+			printf("[type 0x%02x] %u bytes\n", hdr->type, hdr->length);
+		}
+		return;
+	}
+	for(size_t off = 0; off + sizeof(telemetry_sample) <= hdr->length; off += sizeof(telemetry_sample)) {
+		telemetry_sample s;
+		memcpy(&s, payload + off, sizeof(s));
+		samples++;
+		if(!quiet) {
+			int16_t temperature = s.temperature;
+			printf("%10" PRIu32 " %2u ", s.timestamp, s.index);
+			print_temperature(temperature);
+			printf(" C\n");
+		}
+	}
+}
+
+// Splits the byte stream into records, skipping anything that does not look like one
+static void parse(const uint8_t *data, size_t len) {
+	if(len > sizeof(pending) - pending_len) {
+		// cannot happen with well formed input, drop the backlog to stay bounded
+		skipped += pending_len;
+		pending_len = 0;
+	}
+	memcpy(pending + pending_len, data, len);
+	pending_len += len;
+
+	size_t pos = 0;
+	while(pending_len - pos >= sizeof(stream_header)) {
+		stream_header hdr;
+		memcpy(&hdr, pending + pos, sizeof(hdr));
+		if(hdr.magic != STREAM_MAGIC || hdr.version != STREAM_VERSION || hdr.length > STREAM_MAX_PAYLOAD) {
+			pos++;
+			skipped++;
+			continue;
+		}
+		if(pending_len - pos < sizeof(hdr) + hdr.length) {
+			break;
+		}
+		print_record(&hdr, pending + pos + sizeof(hdr));
+		pos += sizeof(hdr) + hdr.length;
+	}
+	memmove(pending, pending + pos, pending_len - pos);
+	pending_len -= pos;
+}
+
+static void consume(const uint8_t *data, size_t len) {
+	total_bytes += len;
+	if(capture != NULL && fwrite(data, 1, len, capture) != len) {
+		perror("capture");
+		stop = 1;
+	}
+	parse(data, len);
+}
+
+static int read_sysfs(const char *dir, const char *name, char *value, size_t size) {
+	char path[512];
+	snprintf(path, sizeof(path), SYSFS_USB "/%s/%s", dir, name);
+	FILE *f = fopen(path, "r");
+	if(f == NULL) {
+		return -1;
+	}
+	int ok = fgets(value, size, f) != NULL;
+	fclose(f);
+	value[strcspn(value, "\n")] = '\0';
+	return ok ? 0 : -1;
+}
+
+static int read_sysfs_uint(const char *dir, const char *name, int base, unsigned *value) {
+	char text[32];
+	if(read_sysfs(dir, name, text, sizeof(text)) != 0) {
+		return -1;
+	}
+	*value = strtoul(text, NULL, base);
+	return 0;
+}
+
+// Finds the vendor interface of device dev and its bulk IN endpoint
+static int find_interface(const char *dev) {
+	DIR *dir = opendir(SYSFS_USB);
+	struct dirent *de;
+	size_t len = strlen(dev);
+	int found = -1;
+
+	while(found != 0 && dir != NULL && (de = readdir(dir)) != NULL) {
+		unsigned cls, number;
+		if(strncmp(de->d_name, dev, len) != 0 || de->d_name[len] != ':'
+				|| read_sysfs_uint(de->d_name, "bInterfaceClass", 16, &cls) != 0 || cls != 0xff
+				|| read_sysfs_uint(de->d_name, "bInterfaceNumber", 16, &number) != 0) {
+			continue;
+		}
+
+		char ifpath[512];
+		snprintf(ifpath, sizeof(ifpath), SYSFS_USB "/%s", de->d_name);
+		DIR *ifdir = opendir(ifpath);
+		struct dirent *ep;
+		while(found != 0 && ifdir != NULL && (ep = readdir(ifdir)) != NULL) {
+			char epdir[2 * sizeof(ep->d_name)], text[16];
+			unsigned address;
+			if(strncmp(ep->d_name, "ep_", 3) != 0) {
+				continue;
+			}
+			snprintf(epdir, sizeof(epdir), "%s/%s", de->d_name, ep->d_name);
+			if(read_sysfs(epdir, "type", text, sizeof(text)) != 0 || strcmp(text, "Bulk") != 0
+					|| read_sysfs_uint(epdir, "bEndpointAddress", 16, &address) != 0 || !(address & 0x80)) {
+				continue;
+			}
+			stream_interface = number;
+			stream_endpoint = address;
+			found = 0;
+		}
+		if(ifdir != NULL) {
+			closedir(ifdir);
+		}
+	}
+	if(dir != NULL) {
+		closedir(dir);
+	}
+	return found;
+}
+
+/*
+ * Looks up the firmware's device, the given usbdevfs node or else the first
+ * one, and fills in its node and streaming endpoint.
+ */
+static int find_device(const char *node, char *path, size_t size) {
+	unsigned want_bus = 0, want_dev = 0;
+	if(node != NULL && sscanf(node, "/dev/bus/usb/%u/%u", &want_bus, &want_dev) != 2) {
+		fprintf(stderr, "%s: not a usbdevfs node\n", node);
+		return -1;
+	}
+
+	DIR *dir = opendir(SYSFS_USB);
+	struct dirent *de;
+	int found = -1;
+
+	if(dir == NULL) {
+		perror(SYSFS_USB);
+		return -1;
+	}
+	while(found != 0 && (de = readdir(dir)) != NULL) {
+		unsigned vid, bus, dev;
+		char manufacturer[64];
+		if(de->d_name[0] == '.' || strchr(de->d_name, ':') != NULL
+				|| read_sysfs_uint(de->d_name, "idVendor", 16, &vid) != 0 || vid != STREAM_VID
+				|| read_sysfs(de->d_name, "manufacturer", manufacturer, sizeof(manufacturer)) != 0
+				|| strcmp(manufacturer, STREAM_MANUFACTURER) != 0
+				|| read_sysfs_uint(de->d_name, "busnum", 10, &bus) != 0
+				|| read_sysfs_uint(de->d_name, "devnum", 10, &dev) != 0) {
+			continue;
+		}
+		if(node != NULL && (bus != want_bus || dev != want_dev)) {
+			continue;
+		}
+		if(find_interface(de->d_name) != 0) {
+			fprintf(stderr, "%s: no streaming interface, wrong USB_CONFIG?\n", de->d_name);
+			continue;
+		}
+		snprintf(path, size, "/dev/bus/usb/%03u/%03u", bus, dev);
+		found = 0;
+	}
+	closedir(dir);
+	if(found != 0) {
+		fprintf(stderr, "no %s device with a streaming interface found\n", STREAM_MANUFACTURER);
+	}
+	return found;
+}
+
+static int vendor_request(int fd, uint8_t request, int in, void *data, uint16_t len) {
+	struct usbdevfs_ctrltransfer ctrl = {
+		.bRequestType = (in ? 0x80 : 0x00) | 0x40 | 0x01,	// vendor, interface
+		.bRequest = request,
+		.wValue = 0,
+		.wIndex = stream_interface,
+		.wLength = len,
+		.timeout = CONTROL_TIMEOUT_MS,
+		.data = data,
+	};
+	return ioctl(fd, USBDEVFS_CONTROL, &ctrl);
+}
+
+static int read_file(const char *path) {
+	FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+	uint8_t buf[URB_SIZE];
+	size_t n;
+
+	if(f == NULL) {
+		perror(path);
+		return 1;
+	}
+	while(!stop && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		consume(buf, n);
+	}
+	if(f != stdin) {
+		fclose(f);
+	}
+	return 0;
+}
+
+/*
+ * Keeps URB_COUNT bulk reads queued so the endpoint is never left without
+ * a pending request while the previous buffer is being parsed.
+ */
+static int read_device(const char *path) {
+	static uint8_t buffers[URB_COUNT][URB_SIZE];
+	struct usbdevfs_urb urbs[URB_COUNT];
+	unsigned int interface = stream_interface;
+	int ret = 1;
+
+	int fd = open(path, O_RDWR);
+	if(fd < 0) {
+		perror(path);
+		return 1;
+	}
+	if(ioctl(fd, USBDEVFS_CLAIMINTERFACE, &interface) != 0) {
+		perror("claim interface");
+		close(fd);
+		return 1;
+	}
+	if(vendor_request(fd, STREAM_REQ_START, 0, NULL, 0) < 0) {
+		perror("start");
+		goto release;
+	}
+
+	memset(urbs, 0, sizeof(urbs));
+	for(int i = 0; i < URB_COUNT; i++) {
+		urbs[i].type = USBDEVFS_URB_TYPE_BULK;
+		urbs[i].endpoint = stream_endpoint;
+		urbs[i].buffer = buffers[i];
+		urbs[i].buffer_length = URB_SIZE;
+		if(ioctl(fd, USBDEVFS_SUBMITURB, &urbs[i]) != 0) {
+			perror("submit");
+			goto discard;
+		}
+	}
+
+	while(!stop) {
+		struct usbdevfs_urb *urb = NULL;
+		if(ioctl(fd, USBDEVFS_REAPURB, &urb) != 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("reap");
+			goto discard;
+		}
+		if(urb->status != 0 && urb->status != -EREMOTEIO) {
+			fprintf(stderr, "transfer failed: %s\n", strerror(-urb->status));
+			goto discard;
+		}
+		consume(urb->buffer, urb->actual_length);
+		if(ioctl(fd, USBDEVFS_SUBMITURB, urb) != 0) {
+			perror("submit");
+			goto discard;
+		}
+	}
+	ret = 0;
+
+discard:
+	for(int i = 0; i < URB_COUNT; i++) {
+		ioctl(fd, USBDEVFS_DISCARDURB, &urbs[i]);
+	}
+	for(int i = 0; i < URB_COUNT; i++) {
+		struct usbdevfs_urb *urb;
+		if(ioctl(fd, USBDEVFS_REAPURBNDELAY, &urb) != 0) {
+			break;
+		}
+	}
+	vendor_request(fd, STREAM_REQ_STOP, 0, NULL, 0);
+
+	stream_stats_msg st;
+	if(vendor_request(fd, STREAM_REQ_STATS, 1, &st, sizeof(st)) == sizeof(st)) {
+		fprintf(stderr, "device: %" PRIu32 " records, %" PRIu32 " dropped, %" PRIu32
+				" bytes, ring peak %" PRIu32 "\n", st.records, st.dropped, st.bytes, st.peak);
+	}
+release:
+	ioctl(fd, USBDEVFS_RELEASEINTERFACE, &interface);
+	close(fd);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	int argi = 1;
+	for(; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; argi++) {
+		if(strcmp(argv[argi], "-q") == 0) {
+			quiet = 1;
+		} else if(strcmp(argv[argi], "-w") == 0 && argi + 1 < argc) {
+			capture = fopen(argv[++argi], "ab");
+			if(capture == NULL) {
+				perror(argv[argi]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-q] [-w capture] [/dev/bus/usb/BBB/DDD|capture]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	char path[256];
+	if(argi < argc) {
+		snprintf(path, sizeof(path), "%s", argv[argi]);
+	} else if(find_device(NULL, path, sizeof(path)) != 0) {
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	struct stat st;
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	int ret;
+	if(strcmp(path, "-") != 0 && stat(path, &st) == 0 && S_ISCHR(st.st_mode)) {
+		if(stream_endpoint == 0 && find_device(path, path, sizeof(path)) != 0) {
+			return 1;
+		}
+		ret = read_device(path);
+	} else {
+		ret = read_file(path);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if(capture != NULL) {
+		fclose(capture);
+	}
+	double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	fprintf(stderr, "%lu records, %lu samples, %lu lost, %lu bytes skipped, %llu bytes in %.1f s (%.0f B/s)\n",
+			records, samples, lost, skipped, total_bytes, seconds,
+			seconds > 0 ? total_bytes / seconds : 0.0);
+	return ret;
+}
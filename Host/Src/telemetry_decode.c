@@ -0,0 +1,385 @@
+/*
+ * Splits the USART3 stream into console text and telemetry frames and
+ * prints the frames in readable form.
+ *
+ * Usage: telemetry_decode [-q] [-e firmware.elf] [device|file|-] [baud]
+ *   -q    suppress console text, only print frames
+ *   -e    resolve deferred log format strings from the firmware image
+ * Devices are put in raw mode at the given baud rate (default 115200).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include "frame.h"
+#include "telemetry_proto.h"
+
+#define FRAME_BUFFER_SIZE (FRAME_COBS_MAX(sizeof(telemetry_header) + TELEMETRY_MAX_PAYLOAD + 2) + 16)
+
+static int quiet = 0;
+static int have_seq = 0;
+static uint8_t last_seq = 0;
+static unsigned long frames = 0, bad_frames = 0, lost_frames = 0;
+
+static uint8_t *elf_image = NULL;
+static size_t elf_size = 0;
+
+static int elf_load(const char *path) {
+	FILE *f = fopen(path, "rb");
+	struct stat st;
+	if(f == NULL || fstat(fileno(f), &st) != 0) {
+		perror(path);
+		return -1;
+	}
+	elf_size = st.st_size;
+	elf_image = malloc(elf_size);
+	if(elf_image == NULL || fread(elf_image, 1, elf_size, f) != elf_size) {
+		fprintf(stderr, "%s: read failed\n", path);
+		return -1;
+	}
+	fclose(f);
+
+	const Elf32_Ehdr *eh = (const Elf32_Ehdr *)elf_image;
+	if(elf_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0
+			|| eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB
+			|| eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf32_Shdr) > elf_size) {
+		fprintf(stderr, "%s: not a 32-bit little endian ELF file\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+// Finds the zero terminated string at a target address in the loaded sections
+static const char *elf_string(uint32_t addr) {
+	if(elf_image == NULL) {
+		return NULL;
+	}
+	const Elf32_Ehdr *eh = (const Elf32_Ehdr *)elf_image;
+	const Elf32_Shdr *sh = (const Elf32_Shdr *)(elf_image + eh->e_shoff);
+
+	for(int i = 0; i < eh->e_shnum; i++) {
+		if(sh[i].sh_type != SHT_PROGBITS || !(sh[i].sh_flags & SHF_ALLOC)
+				|| addr < sh[i].sh_addr || addr >= sh[i].sh_addr + sh[i].sh_size
+				|| sh[i].sh_offset + sh[i].sh_size > elf_size) {
+			continue;
+		}
+		const char *s = (const char *)elf_image + sh[i].sh_offset + (addr - sh[i].sh_addr);
+		size_t max = sh[i].sh_addr + sh[i].sh_size - addr;
+		return memchr(s, 0, max) != NULL ? s : NULL;
+	}
+	return NULL;
+}
+
+/*
+ * printf for the target's 32-bit argument words: length modifiers are
+ * dropped, every conversion takes one word and %s is read from the ELF.
+ */
+static void print_log(uint32_t fmt_addr, const uint32_t *args, size_t nargs) {
+	const char *fmt = elf_string(fmt_addr);
+	size_t argi = 0;
+
+	if(fmt == NULL) {
+		printf("[log 0x%08" PRIx32 "]", fmt_addr);
+		for(size_t i = 0; i < nargs; i++) {
+			printf(" 0x%08" PRIx32, args[i]);
+		}
+		printf("\n");
+		return;
+	}
+
+	while(*fmt) {
+		if(*fmt != '%') {
+			putchar(*fmt++);
+			continue;
+		}
+		if(fmt[1] == '%') {
+			putchar('%');
+			fmt += 2;
+			continue;
+		}
+
+		char spec[32];
+		size_t len = 0;
+		spec[len++] = *fmt++;
+		while(*fmt && strchr("-+ #0123456789.*", *fmt) && len < sizeof(spec) - 2) {
+			if(*fmt == '*') {
+				len += snprintf(spec + len, sizeof(spec) - len - 2, "%d",
+						argi < nargs ? (int32_t)args[argi++] : 0);
+				fmt++;
+				continue;
+			}
+			spec[len++] = *fmt++;
+		}
+		while(*fmt && strchr("hlzjt", *fmt)) {
+			fmt++;
+		}
+		if(*fmt == '\0') {
+			break;
+		}
+		char conv = *fmt++;
+		uint32_t arg = argi < nargs ? args[argi++] : 0;
+		spec[len++] = conv == 'p' ? 'x' : conv;
+		spec[len] = '\0';
+
+		switch(conv) {
+		case 'd':
+		case 'i':
+			printf(spec, (int32_t)arg);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			printf(spec, arg);
+			break;
+		case 'p':
+			printf("0x");
+			printf(spec, arg);
+			break;
+		case 'c':
+			printf(spec, (int)arg);
+			break;
+		case 's': {
+			const char *s = elf_string(arg);
+			if(s != NULL) {
+				printf(spec, s);
+			} else {
+				printf("<0x%08" PRIx32 ">", arg);
+			}
+			break;
+		}
+		default:
+			printf("%s", spec);
+			break;
+		}
+	}
+}
+
+static void print_temperature(int16_t t) {
+	printf("%s%d.%04d", t < 0 ? "-" : "", abs(t) / 16, (abs(t) % 16) * 625);
+}
+
+static void print_frame(const uint8_t *raw, size_t len) {
+	const telemetry_header *hdr = (const telemetry_header *)raw;
+	const uint8_t *p = raw + sizeof(*hdr);
+	size_t plen = len - sizeof(*hdr);
+
+	if(have_seq && (uint8_t)(last_seq + 1) != hdr->seq) {
+		lost_frames += (uint8_t)(hdr->seq - last_seq - 1);
+		printf("[lost %u frames]\n", (uint8_t)(hdr->seq - last_seq - 1));
+	}
+	have_seq = 1;
+	last_seq = hdr->seq;
+
+	switch(hdr->type) {
+	case TELEMETRY_MSG_HELLO: {
+		telemetry_hello m;
+		if(plen < sizeof(m))
+			break;
+		memcpy(&m, p, sizeof(m));
+		printf("[hello] version=%u tick=%" PRIu32 "\n", m.version, m.tick);
+		return;
+	}
+	case TELEMETRY_MSG_SENSOR: {
+		telemetry_sensor m;
+		if(plen < sizeof(m))
+			break;
+		memcpy(&m, p, sizeof(m));
+		printf("[sensor %u] rom=%016" PRIx64 " resolution=%d bits period=%" PRIu32 " ms\n",
+				m.index, m.rom, 9 + (m.resolution >> 5), m.period_ms);
+		return;
+	}
+	case TELEMETRY_MSG_TEMPERATURE: {
+		telemetry_temperature m;
+		if(plen < 1 || p[0] > TELEMETRY_MAX_SAMPLES || plen < 1 + p[0] * sizeof(telemetry_sample))
+			break;
+		memcpy(&m, p, plen);
+		for(uint8_t i = 0; i < m.count; i++) {
+			printf("[temp %u] ", m.samples[i].index);
+			print_temperature(m.samples[i].temperature);
+			printf(" C at %" PRIu32 " ms\n", m.samples[i].timestamp);
+		}
+		return;
+	}
+	case TELEMETRY_MSG_DIR_ENTRY: {
+		telemetry_dir_entry m;
+		if(plen < sizeof(m))
+			break;
+		memcpy(&m, p, sizeof(m));
+		m.name[sizeof(m.name) - 1] = '\0';
+		printf("[dir] %-12s %s %10" PRIu32 " %04u-%02u-%02u %02u:%02u\n", m.name,
+				(m.attrib & 0x10) ? "<DIR>" : "     ", m.size,
+				1980 + (m.date >> 9), (m.date >> 5) & 15, m.date & 31,
+				m.time >> 11, (m.time >> 5) & 63);
+		return;
+	}
+	case TELEMETRY_MSG_STATS: {
+		telemetry_stats_msg m;
+		if(plen < sizeof(m))
+			break;
+		memcpy(&m, p, sizeof(m));
+		printf("[stats] tick=%" PRIu32 " console written=%" PRIu32 " dropped=%" PRIu32
+				" rx_lost=%" PRIu32 " rx_errors=%" PRIu32 " frames sent=%" PRIu32
+				" dropped=%" PRIu32 " samples=%" PRIu32 " sensor_errors=%" PRIu32 "\n",
+				m.tick, m.console_written, m.console_dropped, m.console_rx_lost,
+				m.console_rx_errors, m.frames_sent, m.frames_dropped,
+				m.sensor_samples, m.sensor_errors);
+		return;
+	}
+	case TELEMETRY_MSG_LOG: {
+		telemetry_log m = { 0 };
+		size_t head = sizeof(m) - sizeof(m.args);
+		if(plen < head || plen > sizeof(m))
+			break;
+		uint32_t args[7];
+		memcpy(&m, p, plen);
+		memcpy(args, m.args, sizeof(args));
+		printf("[%8" PRIu32 "] ", m.tick);
+		print_log(m.fmt, args, (plen - head) / sizeof(args[0]));
+		return;
+	}
+	case TELEMETRY_MSG_PROFILE: {
+		telemetry_profile m;
+		if(plen < sizeof(m))
+			break;
+		memcpy(&m, p, sizeof(m));
+		m.name[sizeof(m.name) - 1] = '\0';
+		double mhz = m.clock_hz / 1e6;
+		printf("[profile] %-12s count=%" PRIu32 " min=%.2f avg=%.2f max=%.2f us\n", m.name,
+				m.count, m.min / mhz, m.count != 0 ? (double)m.total / m.count / mhz : 0.0, m.max / mhz);
+		for(int i = 0; i < TELEMETRY_PROFILE_BUCKETS; i++) {
+			int last = i == TELEMETRY_PROFILE_BUCKETS - 1;
+			if(m.hist[i] != 0) {
+				printf("[profile] %-12s %s %8" PRIu32 " cycles: %" PRIu32 "\n", m.name, last ? ">=" : "<",
+						(uint32_t)1 << (i + TELEMETRY_PROFILE_SHIFT - last), m.hist[i]);
+			}
+		}
+		return;
+	}
+	default:
+		printf("[type 0x%02x] %zu bytes\n", hdr->type, plen);
+		return;
+	}
+	printf("[type 0x%02x] short payload, %zu bytes\n", hdr->type, plen);
+}
+
+static void decode_frame(const uint8_t *enc, size_t len) {
+	uint8_t raw[FRAME_BUFFER_SIZE];
+	int n = frame_cobs_decode(enc, len, raw, sizeof(raw));
+
+	if(n < (int)sizeof(telemetry_header) + 2) {
+		bad_frames++;
+		return;
+	}
+	uint16_t crc = raw[n - 2] | (raw[n - 1] << 8);
+	if(frame_crc16(FRAME_CRC16_INIT, raw, n - 2) != crc) {
+		bad_frames++;
+		printf("[bad crc]\n");
+		return;
+	}
+	frames++;
+	print_frame(raw, n - 2);
+}
+
+static speed_t baud_to_speed(long baud) {
+	switch(baud) {
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	case 1000000: return B1000000;
+	case 1500000: return B1500000;
+	case 2000000: return B2000000;
+	case 3000000: return B3000000;
+	default: return 0;
+	}
+}
+
+int main(int argc, char **argv) {
+	int argi = 1;
+	for(; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; argi++) {
+		if(strcmp(argv[argi], "-q") == 0) {
+			quiet = 1;
+		} else if(strcmp(argv[argi], "-e") == 0 && argi + 1 < argc) {
+			if(elf_load(argv[++argi]) != 0) {
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-q] [-e firmware.elf] [device|file|-] [baud]\n", argv[0]);
+			return 1;
+		}
+	}
+	const char *path = argi < argc ? argv[argi++] : "-";
+	long baud = argi < argc ? strtol(argv[argi++], NULL, 10) : 115200;
+
+	int fd = 0;
+	if(strcmp(path, "-") != 0) {
+		fd = open(path, O_RDONLY | O_NOCTTY);
+		if(fd < 0) {
+			perror(path);
+			return 1;
+		}
+	}
+	if(isatty(fd)) {
+		struct termios tio;
+		speed_t speed = baud_to_speed(baud);
+		if(speed == 0) {
+			fprintf(stderr, "unsupported baud rate %ld\n", baud);
+			return 1;
+		}
+		tcgetattr(fd, &tio);
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	uint8_t buf[4096];
+	uint8_t frame[FRAME_BUFFER_SIZE];
+	size_t frame_len = 0;
+	int in_frame = 0, overflow = 0;
+	ssize_t n;
+
+	while((n = read(fd, buf, sizeof(buf))) > 0) {
+		for(ssize_t i = 0; i < n; i++) {
+			uint8_t c = buf[i];
+			if(!in_frame) {
+				if(c == 0) {
+					in_frame = 1;
+					frame_len = 0;
+					overflow = 0;
+				} else if(!quiet) {
+					putchar(c);
+				}
+				continue;
+			}
+			if(c == 0) {
+				// an empty frame is the opening delimiter of the next one
+				if(frame_len == 0) {
+					continue;
+				}
+				if(overflow) {
+					bad_frames++;
+				} else {
+					decode_frame(frame, frame_len);
+				}
+				in_frame = 0;
+				continue;
+			}
+			if(frame_len < sizeof(frame)) {
+				frame[frame_len++] = c;
+			} else {
+				overflow = 1;
+			}
+		}
+	}
+
+	fprintf(stderr, "%lu frames, %lu bad, %lu lost\n", frames, bad_frames, lost_frames);
+	return 0;
+}
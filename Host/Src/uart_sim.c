@@ -0,0 +1,170 @@
+/*
+ * UART and DMA model for the console. Frames are 10 bits: start, 8 data
+ * bits and stop, at the baud rate in the handle.
+ */
+#include "uart_sim.h"
+#include "host_clock.h"
+
+#define UART_FRAME_BITS 10
+#define UART_SIM_RX_FIFO 4096
+
+static FILE *sim_out = NULL;
+static uart_sim_stats sim_stats;
+static void (*sim_irq_hook)(void) = NULL;
+
+static host_event sim_tx_done;
+static const uint8_t *sim_tx_data;
+static uint16_t sim_tx_size;
+
+static host_event sim_rx_byte, sim_rx_idle;
+static uint8_t sim_rx_fifo[UART_SIM_RX_FIFO];
+static uint32_t sim_rx_head = 0, sim_rx_tail = 0;
+static uint32_t sim_rx_pos = 0;
+static uint8_t sim_rx_reported = 1;
+
+/*
+ * Private functions
+ */
+static uint64_t sim_frame_ns(UART_HandleTypeDef *huart) {
+	return UART_FRAME_BITS * 1000000000ULL / huart->Init.BaudRate;
+}
+
+static void sim_tx_complete(void *arg) {
+	UART_HandleTypeDef *huart = arg;
+
+	if(sim_out != NULL)
+		fwrite(sim_tx_data, 1, sim_tx_size, sim_out);
+	huart->gState = HAL_UART_STATE_READY;
+	huart->Instance->SR |= UART_FLAG_TC;
+	HAL_UART_TxCpltCallback(huart);
+	if(sim_irq_hook != NULL)
+		sim_irq_hook();
+}
+
+static void sim_rx_event(UART_HandleTypeDef *huart, uint16_t pos) {
+	if(huart->hdmarx != NULL)
+		huart->hdmarx->Instance->NDTR = huart->RxXferSize - pos;
+	HAL_UARTEx_RxEventCallback(huart, pos);
+	sim_rx_reported = 1;
+	if(sim_irq_hook != NULL)
+		sim_irq_hook();
+}
+
+// The line stayed high for a frame after the last byte
+static void sim_rx_idle_line(void *arg) {
+	UART_HandleTypeDef *huart = arg;
+
+	if(!sim_rx_reported && huart->RxState == HAL_UART_STATE_BUSY_RX)
+		sim_rx_event(huart, sim_rx_pos);
+}
+
+// Stop bit of the next byte, the DMA stores it right away
+static void sim_rx_deliver(void *arg) {
+	UART_HandleTypeDef *huart = arg;
+	uint8_t byte = sim_rx_fifo[sim_rx_tail++ % UART_SIM_RX_FIFO];
+
+	if(huart->RxState != HAL_UART_STATE_BUSY_RX) {
+		sim_stats.rx_dropped++;
+	} else {
+		huart->pRxBuffPtr[sim_rx_pos++] = byte;
+		sim_stats.rx_bytes++;
+		sim_rx_reported = 0;
+		// half and full transfer interrupts of the circular DMA
+		if(sim_rx_pos == huart->RxXferSize / 2) {
+			sim_rx_event(huart, sim_rx_pos);
+		} else if(sim_rx_pos == huart->RxXferSize) {
+			sim_rx_pos = 0;
+			sim_rx_event(huart, huart->RxXferSize);
+		}
+	}
+
+	uint64_t next = host_clock_now() + sim_frame_ns(huart);
+	if(sim_rx_head != sim_rx_tail)
+		host_clock_schedule(&sim_rx_byte, next, sim_rx_deliver, huart);
+	else
+		host_clock_schedule(&sim_rx_idle, next, sim_rx_idle_line, huart);
+}
+
+/*
+ * Public functions
+ */
+void uart_sim_set_output(FILE *out) {
+	sim_out = out;
+}
+
+void uart_sim_set_irq_hook(void (*hook)(void)) {
+	sim_irq_hook = hook;
+}
+
+// Queues bytes for the RX line, they follow whatever is still arriving back to back
+void uart_sim_receive(UART_HandleTypeDef *huart, const uint8_t *data, uint32_t len) {
+	for(uint32_t i = 0; i < len; i++) {
+		if(sim_rx_head - sim_rx_tail == UART_SIM_RX_FIFO) {
+			sim_stats.rx_dropped += len - i;
+			break;
+		}
+		sim_rx_fifo[sim_rx_head++ % UART_SIM_RX_FIFO] = data[i];
+	}
+	if(sim_rx_head != sim_rx_tail && !sim_rx_byte.pending) {
+		host_clock_cancel(&sim_rx_idle);
+		host_clock_schedule(&sim_rx_byte, host_clock_now() + sim_frame_ns(huart), sim_rx_deliver, huart);
+	}
+}
+
+// Bytes still on the way, or the idle line after them not seen yet
+uint32_t uart_sim_rx_pending(void) {
+	return sim_rx_head - sim_rx_tail + (sim_rx_byte.pending || sim_rx_idle.pending);
+}
+
+const uart_sim_stats *uart_sim_get_stats(void) {
+	return &sim_stats;
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart) {
+	if(huart->Init.BaudRate == 0)
+		return HAL_ERROR;
+	huart->Instance->SR |= UART_FLAG_TC;
+	huart->gState = HAL_UART_STATE_READY;
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
+
+// The completion interrupt comes when the last stop bit is out
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+	if(huart->gState != HAL_UART_STATE_READY)
+		return HAL_BUSY;
+	if(data == NULL || size == 0)
+		return HAL_ERROR;
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	huart->Instance->SR &= ~UART_FLAG_TC;
+	sim_tx_data = data;
+	sim_tx_size = size;
+	uint64_t wire_ns = size * sim_frame_ns(huart);
+	sim_stats.tx_bytes += size;
+	sim_stats.tx_transfers++;
+	sim_stats.wire_ns += wire_ns;
+	host_clock_schedule(&sim_tx_done, host_clock_now() + wire_ns, sim_tx_complete, huart);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size) {
+	if(huart->RxState != HAL_UART_STATE_READY)
+		return HAL_BUSY;
+	if(data == NULL || size == 0)
+		return HAL_ERROR;
+
+	huart->pRxBuffPtr = data;
+	huart->RxXferSize = size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	if(huart->hdmarx != NULL)
+		huart->hdmarx->Instance->NDTR = size;
+	sim_rx_pos = 0;
+	sim_rx_reported = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart) {
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
@@ -0,0 +1,68 @@
+/*
+ * The USB functions as seen with no host attached: the CDC terminal is
+ * closed, the card is not exported and nobody streams.
+ */
+#include "usb_cdc.h"
+#include "usb_msc.h"
+#include "usb_stream.h"
+
+static usb_cdc_stats cdc_stats;
+static usb_msc_stats msc_stats;
+static usb_stream_stats stream_stats;
+
+uint8_t usb_cdc_connected(void) {
+	return 0;
+}
+
+uint32_t usb_cdc_tx_free(void) {
+	return 0;
+}
+
+int usb_cdc_write(const char *data, int len) {
+	return 0;
+}
+
+void usb_cdc_wait_tx(uint32_t timeout_ms) {
+}
+
+int usb_cdc_getchar(void) {
+	return -1;
+}
+
+const usb_cdc_stats *usb_cdc_get_stats(void) {
+	return &cdc_stats;
+}
+
+void usb_msc_poll(void) {
+}
+
+uint8_t usb_msc_attached(void) {
+	return 0;
+}
+
+uint8_t usb_msc_eject(void) {
+	return 1;
+}
+
+void usb_msc_attach(void) {
+}
+
+uint32_t usb_msc_sector_count(void) {
+	return 0;
+}
+
+const usb_msc_stats *usb_msc_get_stats(void) {
+	return &msc_stats;
+}
+
+uint8_t usb_stream_active(void) {
+	return 0;
+}
+
+uint8_t usb_stream_write(uint8_t type, const void *payload, uint16_t len) {
+	return 0;
+}
+
+const usb_stream_stats *usb_stream_get_stats(void) {
+	return &stream_stats;
+}